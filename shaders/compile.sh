@@ -1,3 +0,0 @@
-#!/bin/sh
-glslc triangle.vert -o triangle.vert.spv
-glslc triangle.frag -o triangle.frag.spv
@@ -0,0 +1,25 @@
+#version 450
+
+// Quads of src/sprite_batch.h, one instance each. The four corners of a
+// triangle strip come from gl_VertexIndex, so the only vertex data is the
+// instance stream.
+
+layout(location = 0) in vec4 rect;
+layout(location = 1) in vec4 uv_rect;
+layout(location = 2) in vec4 color;
+
+// Maps output pixels, y down, to clip space.
+layout(push_constant) uniform SpritePushConstants {
+    vec2 pixel_to_clip;
+} push;
+
+layout(location = 0) out vec2 frag_uv;
+layout(location = 1) out vec4 frag_color;
+
+void main() {
+    vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+    vec2 position = rect.xy + corner * rect.zw;
+    gl_Position = vec4(position * push.pixel_to_clip - 1.0, 0.0, 1.0);
+    frag_uv = mix(uv_rect.xy, uv_rect.zw, corner);
+    frag_color = color;
+}
@@ -1,5 +1,15 @@
 #version 450
 
+// Built twice, see shaders/meson.build. The default variant draws the
+// culled instance list with the renderer's transform; with MULTIVIEW it
+// draws every live instance once per layer of a multiview target.
+#ifdef MULTIVIEW
+#extension GL_EXT_multiview : require
+
+#define MAX_VIEWS 6
+#define INSTANCE_FLAG_VISIBLE 1u
+#endif
+
 vec2 positions[3] = vec2[](
         vec2(0.0, -0.5),
         vec2(0.5, 0.5),
@@ -12,9 +22,56 @@ vec3 colors[3] = vec3[](
     vec3(0.0, 0.0, 1.0)
 );
 
+#ifdef MULTIVIEW
+// One camera per layer of the multiview target.
+layout(set = 0, binding = 0) uniform Views {
+    mat4 view_projections[MAX_VIEWS];
+} views;
+#else
+layout(set = 0, binding = 0) uniform DrawUniforms {
+    mat4 transform;
+    vec4 color;
+} draw;
+#endif
+
+struct Instance {
+    mat4 world;
+    vec4 bounds;
+    uint mesh_id;
+    uint material_id;
+    uint flags;
+    uint generation;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Instances {
+    Instance instances[];
+};
+
+#ifndef MULTIVIEW
+// Compacted by shaders/cull.comp, one list per culling phase.
+layout(std430, set = 0, binding = 2) readonly buffer VisibleIndices {
+    uint visible_indices[];
+};
+#endif
+
 layout(location = 0) out vec3 frag_color;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
+#ifdef MULTIVIEW
+    Instance instance = instances[gl_InstanceIndex];
+    if ((instance.flags & INSTANCE_FLAG_VISIBLE) == 0u) {
+        // Collapses the triangle so it produces no fragments.
+        gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+        frag_color = vec3(0.0);
+        return;
+    }
+    gl_Position = views.view_projections[gl_ViewIndex] * instance.world *
+                  vec4(positions[gl_VertexIndex], 0.0, 1.0);
     frag_color = colors[gl_VertexIndex];
+#else
+    Instance instance = instances[visible_indices[gl_InstanceIndex]];
+    gl_Position = draw.transform * instance.world *
+                  vec4(positions[gl_VertexIndex], 0.0, 1.0);
+    frag_color = colors[gl_VertexIndex] * draw.color.rgb;
+#endif
 }
@@ -0,0 +1,191 @@
+#include "command_stream.h"
+
+#include "log.h"
+#include <assert.h>
+#include <string.h>
+
+static const char command_stream_magic[8] = "VKGSTRM";
+
+struct command_stream_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct command_stream_record_header {
+  uint32_t type;
+  uint32_t size;
+};
+
+static void writer_put(struct command_stream_writer *writer, const void *data,
+                       size_t size) {
+  if (writer->ok && size > 0) {
+    writer->ok = fwrite(data, size, 1, writer->file) == 1;
+  }
+}
+
+bool command_stream_writer_open(struct command_stream_writer *writer,
+                                const char *path,
+                                const struct command_stream_config *config) {
+  *writer = (struct command_stream_writer){0};
+  writer->file = fopen(path, "wb");
+  if (writer->file == NULL) {
+    LOG("Couldn't open %s for writing", path);
+    return false;
+  }
+  writer->ok = true;
+
+  struct command_stream_header header = {.version = COMMAND_STREAM_VERSION};
+  memcpy(header.magic, command_stream_magic, sizeof(header.magic));
+  writer_put(writer, &header, sizeof(header));
+  command_stream_write(writer, COMMAND_STREAM_RECORD_CONFIG, config,
+                       sizeof(*config), NULL, 0);
+  if (!writer->ok) {
+    command_stream_writer_close(writer);
+    return false;
+  }
+  return true;
+}
+
+void command_stream_write(struct command_stream_writer *writer,
+                          enum command_stream_record_type type,
+                          const void *header, uint32_t header_size,
+                          const void *data, uint32_t data_size) {
+  assert(writer->file != NULL);
+  writer_put(writer,
+             &(const struct command_stream_record_header){
+                 .type = type, .size = header_size + data_size},
+             sizeof(struct command_stream_record_header));
+  writer_put(writer, header, header_size);
+  writer_put(writer, data, data_size);
+}
+
+bool command_stream_writer_close(struct command_stream_writer *writer) {
+  bool ok = writer->ok;
+  if (fclose(writer->file) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    LOG("Couldn't write the command stream");
+  }
+  *writer = (struct command_stream_writer){0};
+  return ok;
+}
+
+bool command_stream_reader_open(struct command_stream_reader *reader,
+                                struct host_allocator *allocator,
+                                const char *path,
+                                uint32_t expected_instance_size) {
+  *reader = (struct command_stream_reader){
+      .allocator = allocator,
+      .max_record_size = sizeof(struct command_stream_config)};
+  reader->file = fopen(path, "rb");
+  if (reader->file == NULL) {
+    LOG("Couldn't open %s", path);
+    goto err;
+  }
+
+  struct command_stream_header header;
+  if (fread(&header, sizeof(header), 1, reader->file) != 1 ||
+      memcmp(header.magic, command_stream_magic, sizeof(header.magic)) != 0) {
+    LOG("%s isn't a command stream", path);
+    goto close_file;
+  }
+  if (header.version != COMMAND_STREAM_VERSION) {
+    LOG("%s is command stream version %u, expected %u", path, header.version,
+        COMMAND_STREAM_VERSION);
+    goto close_file;
+  }
+
+  enum command_stream_record_type type;
+  uint32_t size;
+  if (command_stream_read(reader, &type, &size) !=
+          COMMAND_STREAM_READ_RECORD ||
+      type != COMMAND_STREAM_RECORD_CONFIG ||
+      size != sizeof(struct command_stream_config)) {
+    LOG("%s doesn't start with a config record", path);
+    goto free_payload;
+  }
+  memcpy(&reader->config, reader->payload, sizeof(reader->config));
+  if (reader->config.instance_size != expected_instance_size) {
+    LOG("%s was recorded with %u byte instances, this build uses %u", path,
+        reader->config.instance_size, expected_instance_size);
+    goto free_payload;
+  }
+  uint64_t max_upload_size =
+      sizeof(struct command_stream_instance_upload) +
+      (uint64_t)reader->config.scene_capacity * reader->config.instance_size;
+  if (max_upload_size > UINT32_MAX) {
+    LOG("%s has a scene capacity of %u, too big to replay", path,
+        reader->config.scene_capacity);
+    goto free_payload;
+  }
+  reader->max_record_size =
+      max_upload_size > COMMAND_STREAM_MAX_FIXED_RECORD_SIZE
+          ? (uint32_t)max_upload_size
+          : COMMAND_STREAM_MAX_FIXED_RECORD_SIZE;
+
+  return true;
+free_payload:
+  host_allocator_free(allocator, reader->payload);
+close_file:
+  fclose(reader->file);
+err:
+  *reader = (struct command_stream_reader){0};
+  return false;
+}
+
+enum command_stream_read_result
+command_stream_read(struct command_stream_reader *reader,
+                    enum command_stream_record_type *out_type,
+                    uint32_t *out_size) {
+  struct command_stream_record_header header;
+  size_t header_read = fread(&header, 1, sizeof(header), reader->file);
+  if (header_read != sizeof(header)) {
+    // Only a file that ends between records ends cleanly.
+    if (header_read == 0 && feof(reader->file)) {
+      return COMMAND_STREAM_READ_END;
+    }
+    LOG("Truncated command stream record");
+    return COMMAND_STREAM_READ_ERROR;
+  }
+  if (header.size > reader->max_record_size) {
+    LOG("Command stream record of %u bytes, at most %u expected",
+        header.size, reader->max_record_size);
+    return COMMAND_STREAM_READ_ERROR;
+  }
+
+  if (header.size > reader->payload_capacity) {
+    // Grows in powers of two so a stream of growing uploads reallocates
+    // only a handful of times.
+    uint32_t capacity = reader->payload_capacity ? reader->payload_capacity
+                                                 : 256;
+    while (capacity < header.size) {
+      capacity = capacity > UINT32_MAX / 2 ? header.size : capacity * 2;
+    }
+    void *payload = host_allocator_alloc(reader->allocator, capacity,
+                                         VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (payload == NULL) {
+      LOG("Couldn't allocate a %u byte record", header.size);
+      return COMMAND_STREAM_READ_ERROR;
+    }
+    host_allocator_free(reader->allocator, reader->payload);
+    reader->payload = payload;
+    reader->payload_capacity = capacity;
+  }
+  if (header.size > 0 &&
+      fread(reader->payload, header.size, 1, reader->file) != 1) {
+    LOG("Truncated command stream record");
+    return COMMAND_STREAM_READ_ERROR;
+  }
+
+  *out_type = header.type;
+  *out_size = header.size;
+  return COMMAND_STREAM_READ_RECORD;
+}
+
+void command_stream_reader_close(struct command_stream_reader *reader) {
+  host_allocator_free(reader->allocator, reader->payload);
+  fclose(reader->file);
+  *reader = (struct command_stream_reader){0};
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "host_allocator.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define COMMAND_STREAM_VERSION 1
+// Upper bound on the payload of every record type except instance uploads,
+// whose bound follows from the config.
+#define COMMAND_STREAM_MAX_FIXED_RECORD_SIZE 4096
+
+// A recording of what the renderer did, one level above Vulkan: the targets
+// it rendered to, the instance data it uploaded and the passes it recorded,
+// frame by frame. Replaying it drives the same renderer code without the
+// window, input or scene logic that produced it, so a slow frame can be
+// re-run against any build.
+//
+// A file is a header followed by records, each a type and a payload size
+// followed by the payload. Everything is in host byte order and native
+// struct layout; the header keeps enough to reject files from a build whose
+// instance layout differs.
+enum command_stream_record_type {
+  // struct command_stream_config, exactly once, first.
+  COMMAND_STREAM_RECORD_CONFIG = 1,
+  // struct command_stream_frame, starts a frame.
+  COMMAND_STREAM_RECORD_FRAME_BEGIN,
+  // struct command_stream_instance_upload followed by `count` instances.
+  COMMAND_STREAM_RECORD_INSTANCE_UPLOAD,
+  // The renderer's per-draw uniforms.
+  COMMAND_STREAM_RECORD_DRAW_UNIFORMS,
+  // One view projection per thumbnail view.
+  COMMAND_STREAM_RECORD_THUMBNAILS,
+  // The view projection culled against.
+  COMMAND_STREAM_RECORD_CULL_EARLY,
+  // A uint32_t enum occlusion_phase.
+  COMMAND_STREAM_RECORD_DRAW_PHASE,
+  COMMAND_STREAM_RECORD_CULL_LATE,
+  // No payload, ends a frame.
+  COMMAND_STREAM_RECORD_FRAME_END,
+};
+
+// The resources the renderer creates from this: the color and depth targets
+// at width x height, and instance storage for scene_capacity instances.
+struct command_stream_config {
+  uint32_t width;
+  uint32_t height;
+  uint32_t color_format;
+  uint32_t scene_capacity;
+  uint32_t instance_size;
+};
+
+struct command_stream_frame {
+  uint64_t frame_number;
+  uint32_t render_width;
+  uint32_t render_height;
+  // Instances [0, instance_count) are culled and drawn.
+  uint32_t instance_count;
+};
+
+// Instances [first, first + count) of the frame's instance region.
+struct command_stream_instance_upload {
+  uint32_t first;
+  uint32_t count;
+  // Keeps the instances that follow as aligned as struct scene_instance.
+  uint32_t padding[2];
+};
+
+struct command_stream_writer {
+  FILE *file;
+  bool ok;
+};
+
+bool command_stream_writer_open(struct command_stream_writer *writer,
+                                const char *path,
+                                const struct command_stream_config *config);
+// Writes a record whose payload is header followed by data; either may be
+// empty. Failures are sticky and reported by close.
+void command_stream_write(struct command_stream_writer *writer,
+                          enum command_stream_record_type type,
+                          const void *header, uint32_t header_size,
+                          const void *data, uint32_t data_size);
+bool command_stream_writer_close(struct command_stream_writer *writer);
+
+struct command_stream_reader {
+  FILE *file;
+  struct host_allocator *allocator;
+  struct command_stream_config config;
+  // Holds the payload of the last record read, 16 byte aligned.
+  void *payload;
+  uint32_t payload_capacity;
+  // Bigger records are rejected as corrupt instead of being allocated.
+  uint32_t max_record_size;
+};
+
+enum command_stream_read_result {
+  COMMAND_STREAM_READ_RECORD,
+  COMMAND_STREAM_READ_END,
+  COMMAND_STREAM_READ_ERROR,
+};
+
+// Reads the header and config record. expected_instance_size guards
+// against replaying a file recorded with another instance layout.
+bool command_stream_reader_open(struct command_stream_reader *reader,
+                                struct host_allocator *allocator,
+                                const char *path,
+                                uint32_t expected_instance_size);
+enum command_stream_read_result
+command_stream_read(struct command_stream_reader *reader,
+                    enum command_stream_record_type *out_type,
+                    uint32_t *out_size);
+void command_stream_reader_close(struct command_stream_reader *reader);
@@ -0,0 +1,433 @@
+#include "cull.h"
+
+#include "simd.h"
+#include <math.h>
+#include <stdatomic.h>
+
+struct frustum frustum_from_matrix(const struct mat4 *view_projection) {
+  const float *m = view_projection->m;
+  // Row i of a column-major matrix is (m[i], m[4 + i], m[8 + i], m[12 + i]).
+  struct vec4 row0 = {m[0], m[4], m[8], m[12]};
+  struct vec4 row1 = {m[1], m[5], m[9], m[13]};
+  struct vec4 row2 = {m[2], m[6], m[10], m[14]};
+  struct vec4 row3 = {m[3], m[7], m[11], m[15]};
+
+  struct frustum frustum = {
+      .planes = {
+          {row3.x + row0.x, row3.y + row0.y, row3.z + row0.z, row3.w + row0.w},
+          {row3.x - row0.x, row3.y - row0.y, row3.z - row0.z, row3.w - row0.w},
+          {row3.x + row1.x, row3.y + row1.y, row3.z + row1.z, row3.w + row1.w},
+          {row3.x - row1.x, row3.y - row1.y, row3.z - row1.z, row3.w - row1.w},
+          {row2.x, row2.y, row2.z, row2.w},
+          {row3.x - row2.x, row3.y - row2.y, row3.z - row2.z, row3.w - row2.w},
+      }};
+
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    struct vec4 *plane = &frustum.planes[plane_index];
+    float length =
+        sqrtf(plane->x * plane->x + plane->y * plane->y + plane->z * plane->z);
+    if (length > 0.0f) {
+      float inverse_length = 1.0f / length;
+      plane->x *= inverse_length;
+      plane->y *= inverse_length;
+      plane->z *= inverse_length;
+      plane->w *= inverse_length;
+    }
+  }
+  return frustum;
+}
+
+// Appends base_index + lane for every set bit of visible_mask without a
+// branch per object. It stores one slot past the end on invisible lanes,
+// which is why the output array has to hold `count` entries.
+static inline uint32_t append_visible(uint32_t visible_mask,
+                                      uint32_t lane_count, uint32_t base_index,
+                                      uint32_t *out_visible_indices,
+                                      uint32_t visible_count) {
+  for (uint32_t lane = 0; lane < lane_count; lane++) {
+    out_visible_indices[visible_count] = base_index + lane;
+    visible_count += (visible_mask >> lane) & 1u;
+  }
+  return visible_count;
+}
+
+static void transform_sphere_scalar(const struct mat4 *transform,
+                                    const struct sphere_soa *local,
+                                    const struct sphere_soa *world,
+                                    uint32_t index) {
+  const float *m = transform->m;
+  float x = local->center_x[index];
+  float y = local->center_y[index];
+  float z = local->center_z[index];
+  world->center_x[index] = m[0] * x + m[4] * y + m[8] * z + m[12];
+  world->center_y[index] = m[1] * x + m[5] * y + m[9] * z + m[13];
+  world->center_z[index] = m[2] * x + m[6] * y + m[10] * z + m[14];
+
+  float scale0 = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+  float scale1 = m[4] * m[4] + m[5] * m[5] + m[6] * m[6];
+  float scale2 = m[8] * m[8] + m[9] * m[9] + m[10] * m[10];
+  float max_scale = fmaxf(scale0, fmaxf(scale1, scale2));
+  world->radius[index] = local->radius[index] * sqrtf(max_scale);
+}
+
+static void transform_aabb_scalar(const struct mat4 *transform,
+                                  const struct aabb_soa *local,
+                                  const struct aabb_soa *world,
+                                  uint32_t index) {
+  const float *m = transform->m;
+  float x = local->center_x[index];
+  float y = local->center_y[index];
+  float z = local->center_z[index];
+  float ex = local->extent_x[index];
+  float ey = local->extent_y[index];
+  float ez = local->extent_z[index];
+  world->center_x[index] = m[0] * x + m[4] * y + m[8] * z + m[12];
+  world->center_y[index] = m[1] * x + m[5] * y + m[9] * z + m[13];
+  world->center_z[index] = m[2] * x + m[6] * y + m[10] * z + m[14];
+  world->extent_x[index] =
+      fabsf(m[0]) * ex + fabsf(m[4]) * ey + fabsf(m[8]) * ez;
+  world->extent_y[index] =
+      fabsf(m[1]) * ex + fabsf(m[5]) * ey + fabsf(m[9]) * ez;
+  world->extent_z[index] =
+      fabsf(m[2]) * ex + fabsf(m[6]) * ey + fabsf(m[10]) * ez;
+}
+
+static bool sphere_visible_scalar(const struct frustum *frustum,
+                                  const struct sphere_soa *spheres,
+                                  uint32_t index) {
+  bool visible = true;
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    const struct vec4 *plane = &frustum->planes[plane_index];
+    float distance = plane->x * spheres->center_x[index] +
+                     plane->y * spheres->center_y[index] +
+                     plane->z * spheres->center_z[index] + plane->w;
+    visible &= distance + spheres->radius[index] >= 0.0f;
+  }
+  return visible;
+}
+
+static bool aabb_visible_scalar(const struct frustum *frustum,
+                                const struct aabb_soa *aabbs, uint32_t index) {
+  bool visible = true;
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    const struct vec4 *plane = &frustum->planes[plane_index];
+    float distance = plane->x * aabbs->center_x[index] +
+                     plane->y * aabbs->center_y[index] +
+                     plane->z * aabbs->center_z[index] + plane->w;
+    float radius = fabsf(plane->x) * aabbs->extent_x[index] +
+                   fabsf(plane->y) * aabbs->extent_y[index] +
+                   fabsf(plane->z) * aabbs->extent_z[index];
+    visible &= distance + radius >= 0.0f;
+  }
+  return visible;
+}
+
+// Loads one column of four consecutive matrices and transposes it, giving
+// the x, y, z and w components of that column for all four objects.
+static inline void load_columns_x4(const struct mat4 *transforms,
+                                   uint32_t index, int column,
+                                   f32x4 out_components[4]) {
+  out_components[0] = f32x4_load(transforms[index + 0].m + column * 4);
+  out_components[1] = f32x4_load(transforms[index + 1].m + column * 4);
+  out_components[2] = f32x4_load(transforms[index + 2].m + column * 4);
+  out_components[3] = f32x4_load(transforms[index + 3].m + column * 4);
+  f32x4_transpose(&out_components[0], &out_components[1], &out_components[2],
+                  &out_components[3]);
+}
+
+void cull_transform_spheres(const struct mat4 *transforms,
+                            const struct sphere_soa *local,
+                            const struct sphere_soa *world, uint32_t count) {
+  uint32_t index = 0;
+  for (; index + 4 <= count; index += 4) {
+    f32x4 c0[4], c1[4], c2[4], c3[4];
+    load_columns_x4(transforms, index, 0, c0);
+    load_columns_x4(transforms, index, 1, c1);
+    load_columns_x4(transforms, index, 2, c2);
+    load_columns_x4(transforms, index, 3, c3);
+
+    f32x4 x = f32x4_load(local->center_x + index);
+    f32x4 y = f32x4_load(local->center_y + index);
+    f32x4 z = f32x4_load(local->center_z + index);
+    for (int axis = 0; axis < 3; axis++) {
+      f32x4 center = f32x4_madd(c2[axis], z, c3[axis]);
+      center = f32x4_madd(c1[axis], y, center);
+      center = f32x4_madd(c0[axis], x, center);
+      float *out = axis == 0   ? world->center_x
+                   : axis == 1 ? world->center_y
+                               : world->center_z;
+      f32x4_store(out + index, center);
+    }
+
+    f32x4 scale0 = f32x4_madd(
+        c0[0], c0[0], f32x4_madd(c0[1], c0[1], f32x4_mul(c0[2], c0[2])));
+    f32x4 scale1 = f32x4_madd(
+        c1[0], c1[0], f32x4_madd(c1[1], c1[1], f32x4_mul(c1[2], c1[2])));
+    f32x4 scale2 = f32x4_madd(
+        c2[0], c2[0], f32x4_madd(c2[1], c2[1], f32x4_mul(c2[2], c2[2])));
+    f32x4 max_scale = f32x4_sqrt(f32x4_max(scale0, f32x4_max(scale1, scale2)));
+    f32x4_store(world->radius + index,
+                f32x4_mul(f32x4_load(local->radius + index), max_scale));
+  }
+
+  for (; index < count; index++) {
+    transform_sphere_scalar(&transforms[index], local, world, index);
+  }
+}
+
+void cull_transform_aabbs(const struct mat4 *transforms,
+                          const struct aabb_soa *local,
+                          const struct aabb_soa *world, uint32_t count) {
+  uint32_t index = 0;
+  for (; index + 4 <= count; index += 4) {
+    f32x4 c0[4], c1[4], c2[4], c3[4];
+    load_columns_x4(transforms, index, 0, c0);
+    load_columns_x4(transforms, index, 1, c1);
+    load_columns_x4(transforms, index, 2, c2);
+    load_columns_x4(transforms, index, 3, c3);
+
+    f32x4 x = f32x4_load(local->center_x + index);
+    f32x4 y = f32x4_load(local->center_y + index);
+    f32x4 z = f32x4_load(local->center_z + index);
+    f32x4 ex = f32x4_load(local->extent_x + index);
+    f32x4 ey = f32x4_load(local->extent_y + index);
+    f32x4 ez = f32x4_load(local->extent_z + index);
+    float *out_centers[3] = {world->center_x, world->center_y,
+                             world->center_z};
+    float *out_extents[3] = {world->extent_x, world->extent_y,
+                             world->extent_z};
+    for (int axis = 0; axis < 3; axis++) {
+      f32x4 center = f32x4_madd(c2[axis], z, c3[axis]);
+      center = f32x4_madd(c1[axis], y, center);
+      center = f32x4_madd(c0[axis], x, center);
+      f32x4 extent = f32x4_mul(f32x4_abs(c2[axis]), ez);
+      extent = f32x4_madd(f32x4_abs(c1[axis]), ey, extent);
+      extent = f32x4_madd(f32x4_abs(c0[axis]), ex, extent);
+      f32x4_store(out_centers[axis] + index, center);
+      f32x4_store(out_extents[axis] + index, extent);
+    }
+  }
+
+  for (; index < count; index++) {
+    transform_aabb_scalar(&transforms[index], local, world, index);
+  }
+}
+
+static uint32_t cull_spheres_x4(const struct frustum *frustum,
+                                const struct sphere_soa *spheres,
+                                uint32_t count,
+                                uint32_t *out_visible_indices) {
+  f32x4 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    plane_x[plane_index] = f32x4_splat(frustum->planes[plane_index].x);
+    plane_y[plane_index] = f32x4_splat(frustum->planes[plane_index].y);
+    plane_z[plane_index] = f32x4_splat(frustum->planes[plane_index].z);
+    plane_w[plane_index] = f32x4_splat(frustum->planes[plane_index].w);
+  }
+  f32x4 zero = f32x4_splat(0.0f);
+
+  uint32_t visible_count = 0;
+  uint32_t index = 0;
+  for (; index + 4 <= count; index += 4) {
+    f32x4 x = f32x4_load(spheres->center_x + index);
+    f32x4 y = f32x4_load(spheres->center_y + index);
+    f32x4 z = f32x4_load(spheres->center_z + index);
+    f32x4 radius = f32x4_load(spheres->radius + index);
+    m32x4 inside = m32x4_all();
+    for (int plane_index = 0; plane_index < 6; plane_index++) {
+      f32x4 distance = plane_w[plane_index];
+      distance = f32x4_madd(plane_z[plane_index], z, distance);
+      distance = f32x4_madd(plane_y[plane_index], y, distance);
+      distance = f32x4_madd(plane_x[plane_index], x, distance);
+      inside =
+          m32x4_and(inside, f32x4_cmpge(f32x4_add(distance, radius), zero));
+    }
+    visible_count = append_visible(m32x4_bits(inside), 4, index,
+                                   out_visible_indices, visible_count);
+  }
+
+  for (; index < count; index++) {
+    out_visible_indices[visible_count] = index;
+    visible_count += sphere_visible_scalar(frustum, spheres, index);
+  }
+  return visible_count;
+}
+
+static uint32_t cull_aabbs_x4(const struct frustum *frustum,
+                              const struct aabb_soa *aabbs, uint32_t count,
+                              uint32_t *out_visible_indices) {
+  f32x4 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+  f32x4 abs_x[6], abs_y[6], abs_z[6];
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    plane_x[plane_index] = f32x4_splat(frustum->planes[plane_index].x);
+    plane_y[plane_index] = f32x4_splat(frustum->planes[plane_index].y);
+    plane_z[plane_index] = f32x4_splat(frustum->planes[plane_index].z);
+    plane_w[plane_index] = f32x4_splat(frustum->planes[plane_index].w);
+    abs_x[plane_index] = f32x4_abs(plane_x[plane_index]);
+    abs_y[plane_index] = f32x4_abs(plane_y[plane_index]);
+    abs_z[plane_index] = f32x4_abs(plane_z[plane_index]);
+  }
+  f32x4 zero = f32x4_splat(0.0f);
+
+  uint32_t visible_count = 0;
+  uint32_t index = 0;
+  for (; index + 4 <= count; index += 4) {
+    f32x4 x = f32x4_load(aabbs->center_x + index);
+    f32x4 y = f32x4_load(aabbs->center_y + index);
+    f32x4 z = f32x4_load(aabbs->center_z + index);
+    f32x4 ex = f32x4_load(aabbs->extent_x + index);
+    f32x4 ey = f32x4_load(aabbs->extent_y + index);
+    f32x4 ez = f32x4_load(aabbs->extent_z + index);
+    m32x4 inside = m32x4_all();
+    for (int plane_index = 0; plane_index < 6; plane_index++) {
+      f32x4 distance = plane_w[plane_index];
+      distance = f32x4_madd(plane_z[plane_index], z, distance);
+      distance = f32x4_madd(plane_y[plane_index], y, distance);
+      distance = f32x4_madd(plane_x[plane_index], x, distance);
+      f32x4 radius = f32x4_mul(abs_z[plane_index], ez);
+      radius = f32x4_madd(abs_y[plane_index], ey, radius);
+      radius = f32x4_madd(abs_x[plane_index], ex, radius);
+      inside =
+          m32x4_and(inside, f32x4_cmpge(f32x4_add(distance, radius), zero));
+    }
+    visible_count = append_visible(m32x4_bits(inside), 4, index,
+                                   out_visible_indices, visible_count);
+  }
+
+  for (; index < count; index++) {
+    out_visible_indices[visible_count] = index;
+    visible_count += aabb_visible_scalar(frustum, aabbs, index);
+  }
+  return visible_count;
+}
+
+#if defined(SIMD_AVX2_DISPATCH)
+// Both the main and the render thread cull, so the cached answer is atomic.
+// Racing first calls just detect the same thing twice.
+static bool cpu_supports_avx2(void) {
+  static _Atomic int supported = -1;
+  int cached = atomic_load_explicit(&supported, memory_order_relaxed);
+  if (cached < 0) {
+    __builtin_cpu_init();
+    cached = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    atomic_store_explicit(&supported, cached, memory_order_relaxed);
+  }
+  return cached;
+}
+
+__attribute__((target("avx2,fma"))) static uint32_t
+cull_spheres_avx2(const struct frustum *frustum,
+                  const struct sphere_soa *spheres, uint32_t count,
+                  uint32_t *out_visible_indices) {
+  __m256 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    plane_x[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].x);
+    plane_y[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].y);
+    plane_z[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].z);
+    plane_w[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].w);
+  }
+  __m256 zero = _mm256_setzero_ps();
+
+  uint32_t visible_count = 0;
+  uint32_t index = 0;
+  for (; index + 8 <= count; index += 8) {
+    __m256 x = _mm256_loadu_ps(spheres->center_x + index);
+    __m256 y = _mm256_loadu_ps(spheres->center_y + index);
+    __m256 z = _mm256_loadu_ps(spheres->center_z + index);
+    __m256 radius = _mm256_loadu_ps(spheres->radius + index);
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int plane_index = 0; plane_index < 6; plane_index++) {
+      __m256 distance = _mm256_fmadd_ps(
+          plane_x[plane_index], x,
+          _mm256_fmadd_ps(plane_y[plane_index], y,
+                          _mm256_fmadd_ps(plane_z[plane_index], z,
+                                          _mm256_add_ps(plane_w[plane_index],
+                                                        radius))));
+      inside = _mm256_and_ps(inside,
+                             _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+    }
+    visible_count =
+        append_visible((uint32_t)_mm256_movemask_ps(inside), 8, index,
+                       out_visible_indices, visible_count);
+  }
+
+  for (; index < count; index++) {
+    out_visible_indices[visible_count] = index;
+    visible_count += sphere_visible_scalar(frustum, spheres, index);
+  }
+  return visible_count;
+}
+
+__attribute__((target("avx2,fma"))) static uint32_t
+cull_aabbs_avx2(const struct frustum *frustum, const struct aabb_soa *aabbs,
+                uint32_t count, uint32_t *out_visible_indices) {
+  __m256 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+  __m256 abs_x[6], abs_y[6], abs_z[6];
+  __m256 sign_mask = _mm256_set1_ps(-0.0f);
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    plane_x[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].x);
+    plane_y[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].y);
+    plane_z[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].z);
+    plane_w[plane_index] = _mm256_set1_ps(frustum->planes[plane_index].w);
+    abs_x[plane_index] = _mm256_andnot_ps(sign_mask, plane_x[plane_index]);
+    abs_y[plane_index] = _mm256_andnot_ps(sign_mask, plane_y[plane_index]);
+    abs_z[plane_index] = _mm256_andnot_ps(sign_mask, plane_z[plane_index]);
+  }
+  __m256 zero = _mm256_setzero_ps();
+
+  uint32_t visible_count = 0;
+  uint32_t index = 0;
+  for (; index + 8 <= count; index += 8) {
+    __m256 x = _mm256_loadu_ps(aabbs->center_x + index);
+    __m256 y = _mm256_loadu_ps(aabbs->center_y + index);
+    __m256 z = _mm256_loadu_ps(aabbs->center_z + index);
+    __m256 ex = _mm256_loadu_ps(aabbs->extent_x + index);
+    __m256 ey = _mm256_loadu_ps(aabbs->extent_y + index);
+    __m256 ez = _mm256_loadu_ps(aabbs->extent_z + index);
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int plane_index = 0; plane_index < 6; plane_index++) {
+      __m256 distance = _mm256_fmadd_ps(
+          plane_x[plane_index], x,
+          _mm256_fmadd_ps(plane_y[plane_index], y,
+                          _mm256_fmadd_ps(plane_z[plane_index], z,
+                                          plane_w[plane_index])));
+      distance = _mm256_fmadd_ps(
+          abs_x[plane_index], ex,
+          _mm256_fmadd_ps(abs_y[plane_index], ey,
+                          _mm256_fmadd_ps(abs_z[plane_index], ez, distance)));
+      inside = _mm256_and_ps(inside,
+                             _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+    }
+    visible_count =
+        append_visible((uint32_t)_mm256_movemask_ps(inside), 8, index,
+                       out_visible_indices, visible_count);
+  }
+
+  for (; index < count; index++) {
+    out_visible_indices[visible_count] = index;
+    visible_count += aabb_visible_scalar(frustum, aabbs, index);
+  }
+  return visible_count;
+}
+#endif
+
+uint32_t cull_spheres(const struct frustum *frustum,
+                      const struct sphere_soa *spheres, uint32_t count,
+                      uint32_t *out_visible_indices) {
+#if defined(SIMD_AVX2_DISPATCH)
+  if (cpu_supports_avx2()) {
+    return cull_spheres_avx2(frustum, spheres, count, out_visible_indices);
+  }
+#endif
+  return cull_spheres_x4(frustum, spheres, count, out_visible_indices);
+}
+
+uint32_t cull_aabbs(const struct frustum *frustum, const struct aabb_soa *aabbs,
+                    uint32_t count, uint32_t *out_visible_indices) {
+#if defined(SIMD_AVX2_DISPATCH)
+  if (cpu_supports_avx2()) {
+    return cull_aabbs_avx2(frustum, aabbs, count, out_visible_indices);
+  }
+#endif
+  return cull_aabbs_x4(frustum, aabbs, count, out_visible_indices);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "math3d.h"
+#include <stdint.h>
+
+// Batched CPU culling over structure-of-arrays bounds. Every routine walks
+// the arrays 8 (AVX2) or 4 (SSE/NEON/scalar) objects at a time; arrays don't
+// need any padding or alignment.
+
+// Planes point inwards and are normalized: a point p is inside a plane when
+// dot(plane.xyz, p) + plane.w >= 0.
+struct frustum {
+  struct vec4 planes[6];
+};
+
+struct sphere_soa {
+  float *center_x;
+  float *center_y;
+  float *center_z;
+  float *radius;
+};
+
+// Axis aligned boxes stored as center and half extents, which makes both the
+// transform and the plane test a handful of multiply-adds.
+struct aabb_soa {
+  float *center_x;
+  float *center_y;
+  float *center_z;
+  float *extent_x;
+  float *extent_y;
+  float *extent_z;
+};
+
+// Extracts the planes from a view-projection matrix built for Vulkan clip
+// space (depth [0, 1]).
+struct frustum frustum_from_matrix(const struct mat4 *view_projection);
+
+// world[i] = transforms[i] applied to local[i]. Sphere radii are scaled by the
+// largest axis scale so non-uniform scales stay conservative.
+void cull_transform_spheres(const struct mat4 *transforms,
+                            const struct sphere_soa *local,
+                            const struct sphere_soa *world, uint32_t count);
+void cull_transform_aabbs(const struct mat4 *transforms,
+                          const struct aabb_soa *local,
+                          const struct aabb_soa *world, uint32_t count);
+
+// Writes the indices of the objects that intersect the frustum and returns
+// how many there are. out_visible_indices must have room for count entries.
+uint32_t cull_spheres(const struct frustum *frustum,
+                      const struct sphere_soa *spheres, uint32_t count,
+                      uint32_t *out_visible_indices);
+uint32_t cull_aabbs(const struct frustum *frustum, const struct aabb_soa *aabbs,
+                    uint32_t count, uint32_t *out_visible_indices);
@@ -0,0 +1,128 @@
+#include "device_features.h"
+
+#include "log.h"
+
+static uint32_t strip_patch_version(uint32_t version) {
+  return VK_MAKE_API_VERSION(0, VK_API_VERSION_MAJOR(version),
+                             VK_API_VERSION_MINOR(version), 0);
+}
+
+uint32_t device_features_instance_version(void) {
+  // Only exported by 1.1+ loaders; a 1.0 loader returns NULL.
+  PFN_vkEnumerateInstanceVersion enumerate_instance_version =
+      (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(
+          VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+  uint32_t version = VK_API_VERSION_1_0;
+  if (enumerate_instance_version &&
+      enumerate_instance_version(&version) != VK_SUCCESS) {
+    version = VK_API_VERSION_1_0;
+  }
+  version = strip_patch_version(version);
+  return version < DEVICE_FEATURES_MAX_API_VERSION
+             ? version
+             : DEVICE_FEATURES_MAX_API_VERSION;
+}
+
+void device_features_query(VkPhysicalDevice physical_device,
+                           uint32_t instance_version,
+                           struct device_features *out_features) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  uint32_t device_version = strip_patch_version(properties.apiVersion);
+  VkPhysicalDeviceFeatures core_features;
+  vkGetPhysicalDeviceFeatures(physical_device, &core_features);
+  *out_features = (struct device_features){
+      .api_version = device_version < instance_version ? device_version
+                                                       : instance_version,
+      .storage_image_write_without_format =
+          core_features.shaderStorageImageWriteWithoutFormat};
+  if (out_features->api_version < VK_API_VERSION_1_1) {
+    return;
+  }
+
+  VkPhysicalDeviceSubgroupProperties subgroup = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES};
+  vkGetPhysicalDeviceProperties2(
+      physical_device,
+      &(VkPhysicalDeviceProperties2){
+          .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+          .pNext = &subgroup});
+  VkSubgroupFeatureFlags subgroup_operations =
+      VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+  out_features->subgroup_arithmetic =
+      (subgroup.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+      (subgroup.supportedOperations & subgroup_operations) ==
+          subgroup_operations;
+
+  VkPhysicalDeviceVulkan13Features vulkan13 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES};
+  VkPhysicalDeviceVulkan12Features vulkan12 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+      .pNext = out_features->api_version >= VK_API_VERSION_1_3 ? &vulkan13
+                                                               : NULL};
+  VkPhysicalDeviceVulkan11Features vulkan11 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES,
+      .pNext = &vulkan12};
+  // The per-version structs only exist from 1.2 on.
+  VkPhysicalDeviceMultiviewFeatures multiview = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES};
+  bool has_version_structs = out_features->api_version >= VK_API_VERSION_1_2;
+  VkPhysicalDeviceFeatures2 features = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = has_version_structs ? (void *)&vulkan11 : (void *)&multiview};
+  vkGetPhysicalDeviceFeatures2(physical_device, &features);
+
+  if (!has_version_structs) {
+    out_features->multiview = multiview.multiview;
+    return;
+  }
+  out_features->multiview = vulkan11.multiview;
+  out_features->timeline_semaphore = vulkan12.timelineSemaphore;
+  out_features->buffer_device_address = vulkan12.bufferDeviceAddress;
+  if (out_features->api_version >= VK_API_VERSION_1_3) {
+    out_features->synchronization2 = vulkan13.synchronization2;
+    out_features->maintenance4 = vulkan13.maintenance4;
+  }
+}
+
+const void *device_features_chain(const struct device_features *features,
+                                  struct device_feature_chain *chain) {
+  *chain = (struct device_feature_chain){
+      .vulkan11 = {.sType =
+                       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES,
+                   .pNext = &chain->vulkan12,
+                   .multiview = features->multiview},
+      .vulkan12 = {.sType =
+                       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+                   .timelineSemaphore = features->timeline_semaphore,
+                   .bufferDeviceAddress = features->buffer_device_address},
+      .vulkan13 = {.sType =
+                       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+                   .synchronization2 = features->synchronization2,
+                   .maintenance4 = features->maintenance4},
+      .multiview = {.sType =
+                        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES,
+                    .multiview = features->multiview}};
+
+  if (features->api_version >= VK_API_VERSION_1_2) {
+    if (features->api_version >= VK_API_VERSION_1_3) {
+      chain->vulkan12.pNext = &chain->vulkan13;
+    }
+    return &chain->vulkan11;
+  }
+  // Core in 1.1, VK_KHR_multiview on 1.0; same struct either way.
+  return features->multiview ? &chain->multiview : NULL;
+}
+
+void device_features_log(const struct device_features *features) {
+  (void)features;
+  LOG("Vulkan %u.%u: multiview=%d timeline_semaphore=%d synchronization2=%d "
+      "buffer_device_address=%d maintenance4=%d memory_budget=%d "
+      "subgroup_arithmetic=%d storage_image_write_without_format=%d",
+      VK_API_VERSION_MAJOR(features->api_version),
+      VK_API_VERSION_MINOR(features->api_version), features->multiview,
+      features->timeline_semaphore, features->synchronization2,
+      features->buffer_device_address, features->maintenance4,
+      features->memory_budget, features->subgroup_arithmetic,
+      features->storage_image_write_without_format);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// The newest core version the renderer knows how to use.
+#define DEVICE_FEATURES_MAX_API_VERSION VK_API_VERSION_1_3
+
+// What was negotiated with the loader and the physical device, and enabled
+// on the logical device. On a Vulkan 1.0 device every flag is false except
+// the 1.0 features and, possibly, multiview through VK_KHR_multiview, and the
+// renderer falls back to its 1.0 paths.
+struct device_features {
+  // Without the patch version; the lower of the instance and device ones.
+  uint32_t api_version;
+  bool multiview;
+  bool timeline_semaphore;
+  bool synchronization2;
+  bool buffer_device_address;
+  bool maintenance4;
+  // Compute shaders can use subgroup arithmetic (subgroupAdd and friends).
+  // Not a feature but a property, so it needs no enabling.
+  bool subgroup_arithmetic;
+  // A core 1.0 feature: storage images written without a format qualifier,
+  // as needed to write straight into swapchain images.
+  bool storage_image_write_without_format;
+  // VK_EXT_memory_budget; decided and enabled by the renderer along with
+  // its other extensions.
+  bool memory_budget;
+};
+
+// Feature structs for VkDeviceCreateInfo::pNext. Must outlive vkCreateDevice.
+struct device_feature_chain {
+  VkPhysicalDeviceVulkan11Features vulkan11;
+  VkPhysicalDeviceVulkan12Features vulkan12;
+  VkPhysicalDeviceVulkan13Features vulkan13;
+  VkPhysicalDeviceMultiviewFeatures multiview;
+};
+
+// The version to create the instance with: what the loader supports, capped
+// at DEVICE_FEATURES_MAX_API_VERSION.
+uint32_t device_features_instance_version(void);
+
+// Fills out_features with everything the device supports through core
+// vkGetPhysicalDeviceFeatures2. Requires an instance_version of at least 1.1
+// to report anything beyond api_version and the 1.0 features.
+void device_features_query(VkPhysicalDevice physical_device,
+                           uint32_t instance_version,
+                           struct device_features *out_features);
+
+// Fills chain to enable exactly features and returns the head of the pNext
+// chain, or NULL when there is nothing to enable.
+const void *device_features_chain(const struct device_features *features,
+                                  struct device_feature_chain *chain);
+
+void device_features_log(const struct device_features *features);
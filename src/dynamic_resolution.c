@@ -0,0 +1,150 @@
+#include "dynamic_resolution.h"
+
+#include "log.h"
+#include <assert.h>
+#include <math.h>
+
+#define MAX_QUEUE_FAMILY_COUNT 64
+#define TIMESTAMPS_PER_FRAME 2
+
+// Weight of the newest measurement in the moving average.
+#define FRAME_TIME_SMOOTHING 0.1f
+// No change while the smoothed time is within this fraction of the target,
+// so the scale doesn't hunt around a frame time it can't hit exactly.
+#define FRAME_TIME_DEADBAND 0.05f
+// Largest change of the scale per frame, in either direction.
+#define MAX_SCALE_STEP 0.05f
+
+static VkExtent2D scaled_extent(VkExtent2D extent, float scale) {
+  VkExtent2D scaled = {(uint32_t)((float)extent.width * scale + 0.5f),
+                       (uint32_t)((float)extent.height * scale + 0.5f)};
+  scaled.width = scaled.width < 1 ? 1 : scaled.width;
+  scaled.height = scaled.height < 1 ? 1 : scaled.height;
+  return scaled;
+}
+
+bool dynamic_resolution_init(struct dynamic_resolution *resolution,
+                             VkPhysicalDevice physical_device, VkDevice device,
+                             const VkAllocationCallbacks *allocation_callbacks,
+                             uint32_t queue_family_index, uint32_t frame_count,
+                             VkExtent2D max_extent, float min_scale,
+                             float target_frame_ms) {
+  assert(frame_count <= DYNAMIC_RESOLUTION_MAX_FRAMES);
+  assert(min_scale > 0.0f && min_scale <= 1.0f);
+  *resolution = (struct dynamic_resolution){
+      .frame_count = frame_count,
+      .max_extent = max_extent,
+      .min_scale = min_scale,
+      .target_frame_ms = target_frame_ms,
+      .scale = 1.0f,
+      .extent = max_extent};
+
+  uint32_t queue_family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
+                                           &queue_family_count, NULL);
+  assert(queue_family_count < MAX_QUEUE_FAMILY_COUNT);
+  VkQueueFamilyProperties queue_families[MAX_QUEUE_FAMILY_COUNT];
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
+                                           &queue_family_count, queue_families);
+  assert(queue_family_index < queue_family_count);
+  uint32_t valid_bits = queue_families[queue_family_index].timestampValidBits;
+  if (valid_bits == 0) {
+    LOG("No timestamps on the graphics queue, dynamic resolution is off");
+    return true;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  resolution->timestamp_period = properties.limits.timestampPeriod;
+  resolution->timestamp_mask =
+      valid_bits >= 64 ? UINT64_MAX : (UINT64_C(1) << valid_bits) - 1;
+
+  if (vkCreateQueryPool(device,
+                        &(const VkQueryPoolCreateInfo){
+                            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                            .queryCount = frame_count * TIMESTAMPS_PER_FRAME},
+                        allocation_callbacks,
+                        &resolution->query_pool) != VK_SUCCESS) {
+    return false;
+  }
+  resolution->timestamps_supported = true;
+  return true;
+}
+
+void dynamic_resolution_deinit(
+    struct dynamic_resolution *resolution, VkDevice device,
+    const VkAllocationCallbacks *allocation_callbacks) {
+  vkDestroyQueryPool(device, resolution->query_pool, allocation_callbacks);
+}
+
+bool dynamic_resolution_update(struct dynamic_resolution *resolution,
+                               VkDevice device, uint32_t frame_index) {
+  assert(frame_index < resolution->frame_count);
+  if (!resolution->timestamps_supported ||
+      !resolution->queries_written[frame_index]) {
+    return false;
+  }
+  // Read once, or a frame that is skipped before the slot records again
+  // would count the same sample twice.
+  resolution->queries_written[frame_index] = false;
+
+  uint64_t timestamps[TIMESTAMPS_PER_FRAME];
+  // The frame has completed, so anything but VK_SUCCESS means the device
+  // dropped the results; skip the sample rather than stall on it.
+  if (vkGetQueryPoolResults(device, resolution->query_pool,
+                            frame_index * TIMESTAMPS_PER_FRAME,
+                            TIMESTAMPS_PER_FRAME, sizeof(timestamps),
+                            timestamps, sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+    return false;
+  }
+  uint64_t ticks = (timestamps[1] - timestamps[0]) & resolution->timestamp_mask;
+  float frame_ms = (float)ticks * resolution->timestamp_period * 1e-6f;
+  resolution->last_frame_ms = frame_ms;
+  if (resolution->smoothed_frame_ms == 0.0f) {
+    resolution->smoothed_frame_ms = frame_ms;
+  } else {
+    resolution->smoothed_frame_ms +=
+        FRAME_TIME_SMOOTHING * (frame_ms - resolution->smoothed_frame_ms);
+  }
+  if (resolution->smoothed_frame_ms <= 0.0f) {
+    return true;
+  }
+
+  float ratio = resolution->target_frame_ms / resolution->smoothed_frame_ms;
+  if (fabsf(ratio - 1.0f) < FRAME_TIME_DEADBAND) {
+    return true;
+  }
+  float step = resolution->scale * sqrtf(ratio) - resolution->scale;
+  step = fminf(fmaxf(step, -MAX_SCALE_STEP), MAX_SCALE_STEP);
+  resolution->scale =
+      fminf(fmaxf(resolution->scale + step, resolution->min_scale), 1.0f);
+  resolution->extent = scaled_extent(resolution->max_extent, resolution->scale);
+  return true;
+}
+
+void dynamic_resolution_cmd_begin(struct dynamic_resolution *resolution,
+                                  VkCommandBuffer command_buffer,
+                                  uint32_t frame_index) {
+  if (!resolution->timestamps_supported) {
+    return;
+  }
+  uint32_t first_query = frame_index * TIMESTAMPS_PER_FRAME;
+  vkCmdResetQueryPool(command_buffer, resolution->query_pool, first_query,
+                      TIMESTAMPS_PER_FRAME);
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      resolution->query_pool, first_query);
+}
+
+void dynamic_resolution_cmd_end(struct dynamic_resolution *resolution,
+                                VkCommandBuffer command_buffer,
+                                uint32_t frame_index) {
+  if (!resolution->timestamps_supported) {
+    return;
+  }
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      resolution->query_pool,
+                      frame_index * TIMESTAMPS_PER_FRAME + 1);
+  resolution->queries_written[frame_index] = true;
+}
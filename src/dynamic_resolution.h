@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#define DYNAMIC_RESOLUTION_MAX_FRAMES 4
+
+// Picks the size the scene is rendered at each frame so the GPU time of a
+// frame stays around target_frame_ms. Every frame in flight brackets its
+// command buffer with two timestamps; once that frame has completed its
+// duration feeds a smoothed estimate, and the render scale is moved towards
+// the one that estimate predicts would hit the target. GPU cost is taken to
+// scale with the pixel count, so with the area, i.e. the square of the scale.
+//
+// Render targets are meant to be allocated at max_extent once; only the
+// area rendered to changes. Without timestamp support on the queue the
+// scale stays at 1.
+struct dynamic_resolution {
+  VkQueryPool query_pool;
+  bool timestamps_supported;
+  // Nanoseconds per timestamp tick.
+  float timestamp_period;
+  uint64_t timestamp_mask;
+  uint32_t frame_count;
+  // Set when a frame slot's queries are written, cleared when they are read.
+  bool queries_written[DYNAMIC_RESOLUTION_MAX_FRAMES];
+
+  VkExtent2D max_extent;
+  float min_scale;
+  float target_frame_ms;
+  float scale;
+  float last_frame_ms;
+  // Exponential moving average of the GPU frame time, 0 until measured.
+  float smoothed_frame_ms;
+  VkExtent2D extent;
+};
+
+bool dynamic_resolution_init(struct dynamic_resolution *resolution,
+                             VkPhysicalDevice physical_device, VkDevice device,
+                             const VkAllocationCallbacks *allocation_callbacks,
+                             uint32_t queue_family_index, uint32_t frame_count,
+                             VkExtent2D max_extent, float min_scale,
+                             float target_frame_ms);
+void dynamic_resolution_deinit(
+    struct dynamic_resolution *resolution, VkDevice device,
+    const VkAllocationCallbacks *allocation_callbacks);
+
+// Reads the timings the frame slot recorded last time round and updates the
+// render extent. Call once the frame that last used the slot has completed.
+// Returns whether a new measurement was taken, into last_frame_ms.
+bool dynamic_resolution_update(struct dynamic_resolution *resolution,
+                               VkDevice device, uint32_t frame_index);
+
+// Bracket everything the frame's GPU time should include, which must be
+// submitted in a batch that doesn't wait on the swapchain image: under FIFO
+// that wait alone lasts up to a refresh interval. Both must be recorded
+// outside of a render pass.
+void dynamic_resolution_cmd_begin(struct dynamic_resolution *resolution,
+                                  VkCommandBuffer command_buffer,
+                                  uint32_t frame_index);
+void dynamic_resolution_cmd_end(struct dynamic_resolution *resolution,
+                                VkCommandBuffer command_buffer,
+                                uint32_t frame_index);
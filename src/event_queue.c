@@ -0,0 +1,72 @@
+#include "event_queue.h"
+
+#include "log.h"
+#include <assert.h>
+
+static_assert((EVENT_QUEUE_CAPACITY & (EVENT_QUEUE_CAPACITY - 1)) == 0,
+              "EVENT_QUEUE_CAPACITY must be a power of two");
+
+bool event_queue_init(struct event_queue *queue) {
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+  atomic_init(&queue->closed, false);
+  queue->dropped_count = 0;
+  queue->wake = SDL_CreateSemaphore(0);
+  if (!queue->wake) {
+    LOG("Couldn't create event queue semaphore: %s", SDL_GetError());
+    return false;
+  }
+  return true;
+}
+
+void event_queue_deinit(struct event_queue *queue) {
+  SDL_DestroySemaphore(queue->wake);
+}
+
+bool event_queue_push(struct event_queue *queue,
+                      const struct render_event *event) {
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  // Acquire pairs with the consumer's release, so the slot it just popped is
+  // no longer being read when it is overwritten.
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  if (tail - head == EVENT_QUEUE_CAPACITY) {
+    queue->dropped_count++;
+    return false;
+  }
+  queue->events[tail & (EVENT_QUEUE_CAPACITY - 1)] = *event;
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+  SDL_SignalSemaphore(queue->wake);
+  return true;
+}
+
+void event_queue_close(struct event_queue *queue) {
+  atomic_store_explicit(&queue->closed, true, memory_order_release);
+  SDL_SignalSemaphore(queue->wake);
+}
+
+bool event_queue_pop(struct event_queue *queue, struct render_event *event) {
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  if (head == tail) {
+    return false;
+  }
+  *event = queue->events[head & (EVENT_QUEUE_CAPACITY - 1)];
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+  return true;
+}
+
+bool event_queue_is_closed(struct event_queue *queue) {
+  return atomic_load_explicit(&queue->closed, memory_order_acquire);
+}
+
+void event_queue_wait(struct event_queue *queue, uint64_t timeout_ns) {
+  if (timeout_ns == UINT64_MAX) {
+    SDL_WaitSemaphore(queue->wake);
+    return;
+  }
+  // Rounded up, so a deadline isn't woken up for just before it is due.
+  uint64_t timeout_ms = (timeout_ns + SDL_NS_PER_MS - 1) / SDL_NS_PER_MS;
+  SDL_WaitSemaphoreTimeout(queue->wake,
+                           timeout_ms > INT32_MAX ? INT32_MAX
+                                                  : (Sint32)timeout_ms);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "frame_capture.h"
+#include <SDL3/SDL.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Must be a power of two.
+#define EVENT_QUEUE_CAPACITY 256
+
+enum render_event_type {
+  RENDER_EVENT_CAPTURE,
+  RENDER_EVENT_TOGGLE_ANIMATION,
+  // The window contents need to be drawn again.
+  RENDER_EVENT_WINDOW_EXPOSED,
+  // Minimized or hidden: nothing is drawn until it is shown again.
+  RENDER_EVENT_WINDOW_HIDDEN,
+  RENDER_EVENT_WINDOW_SHOWN,
+};
+
+struct render_event {
+  enum render_event_type type;
+  enum frame_capture_encoding capture_encoding;
+};
+
+// Hands input and window events from the thread that owns the window to the
+// render thread. Single producer, single consumer: each side only stores its
+// own index, so pushing and popping never take a lock. The semaphore is only
+// there to let an idle consumer sleep until something is pushed.
+struct event_queue {
+  struct render_event events[EVENT_QUEUE_CAPACITY];
+  // Both only ever increase; the slot is the index modulo the capacity.
+  _Atomic uint32_t head;
+  _Atomic uint32_t tail;
+  atomic_bool closed;
+  SDL_Semaphore *wake;
+  // Producer-only, events lost to a full queue.
+  uint64_t dropped_count;
+};
+
+bool event_queue_init(struct event_queue *queue);
+void event_queue_deinit(struct event_queue *queue);
+
+// Producer side. Returns false, dropping the event, when the queue is full.
+bool event_queue_push(struct event_queue *queue,
+                      const struct render_event *event);
+// Asks the consumer to stop once it has drained the queue.
+void event_queue_close(struct event_queue *queue);
+
+// Consumer side.
+bool event_queue_pop(struct event_queue *queue, struct render_event *event);
+bool event_queue_is_closed(struct event_queue *queue);
+// Sleeps until something is pushed, the queue is closed or timeout_ns have
+// passed, UINT64_MAX waiting for as long as it takes. May return early.
+void event_queue_wait(struct event_queue *queue, uint64_t timeout_ns);
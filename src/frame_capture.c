@@ -0,0 +1,510 @@
+#include "frame_capture.h"
+
+#include "log.h"
+#include "vulkan_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BYTES_PER_PIXEL 4
+// Payload of one stored deflate block, at most 65535 bytes.
+#define PNG_BLOCK_SIZE 32768
+#define ADLER_MODULUS 65521
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static VkDeviceSize align_down(VkDeviceSize value, VkDeviceSize alignment) {
+  return value & ~(alignment - 1);
+}
+
+static void put_u32_be(uint8_t *out, uint32_t value) {
+  out[0] = (uint8_t)(value >> 24);
+  out[1] = (uint8_t)(value >> 16);
+  out[2] = (uint8_t)(value >> 8);
+  out[3] = (uint8_t)value;
+}
+
+static uint32_t crc_update(const uint32_t *table, uint32_t crc,
+                           const uint8_t *data, size_t size) {
+  for (size_t byte_index = 0; byte_index < size; byte_index++) {
+    crc = table[(crc ^ data[byte_index]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+// PNG writer with an uncompressed zlib stream: every stored deflate block
+// becomes one IDAT chunk. Valid for any decoder, and cheap enough that the
+// worker keeps up without a compression library.
+struct png_stream {
+  FILE *file;
+  const uint32_t *crc_table;
+  uint8_t *block;
+  uint32_t block_size;
+  uint32_t adler_a;
+  uint32_t adler_b;
+  bool first_block;
+  bool ok;
+};
+
+static void png_write_bytes(struct png_stream *stream, const void *data,
+                            size_t size) {
+  if (stream->ok && size > 0) {
+    stream->ok = fwrite(data, size, 1, stream->file) == 1;
+  }
+}
+
+static void png_write_chunk(struct png_stream *stream, const char *type,
+                            const uint8_t *prefix, size_t prefix_size,
+                            const uint8_t *data, size_t data_size,
+                            const uint8_t *suffix, size_t suffix_size) {
+  uint8_t length[4];
+  put_u32_be(length, (uint32_t)(prefix_size + data_size + suffix_size));
+  uint32_t crc = 0xffffffffu;
+  crc = crc_update(stream->crc_table, crc, (const uint8_t *)type, 4);
+  crc = crc_update(stream->crc_table, crc, prefix, prefix_size);
+  crc = crc_update(stream->crc_table, crc, data, data_size);
+  crc = crc_update(stream->crc_table, crc, suffix, suffix_size);
+  uint8_t crc_bytes[4];
+  put_u32_be(crc_bytes, crc ^ 0xffffffffu);
+
+  png_write_bytes(stream, length, 4);
+  png_write_bytes(stream, type, 4);
+  png_write_bytes(stream, prefix, prefix_size);
+  png_write_bytes(stream, data, data_size);
+  png_write_bytes(stream, suffix, suffix_size);
+  png_write_bytes(stream, crc_bytes, 4);
+}
+
+static void png_flush_block(struct png_stream *stream, bool final) {
+  // Optional zlib header (deflate, 32 KiB window, no dictionary), then the
+  // stored block header: BFINAL/BTYPE, LEN and NLEN, little endian.
+  uint8_t prefix[7];
+  size_t prefix_size = 0;
+  if (stream->first_block) {
+    prefix[prefix_size++] = 0x78;
+    prefix[prefix_size++] = 0x01;
+    stream->first_block = false;
+  }
+  uint16_t size = (uint16_t)stream->block_size;
+  prefix[prefix_size++] = final ? 1 : 0;
+  prefix[prefix_size++] = (uint8_t)size;
+  prefix[prefix_size++] = (uint8_t)(size >> 8);
+  prefix[prefix_size++] = (uint8_t)~size;
+  prefix[prefix_size++] = (uint8_t)(~size >> 8);
+
+  uint8_t adler[4];
+  put_u32_be(adler, (stream->adler_b << 16) | stream->adler_a);
+  png_write_chunk(stream, "IDAT", prefix, prefix_size, stream->block,
+                  stream->block_size, adler, final ? 4 : 0);
+  stream->block_size = 0;
+}
+
+static void png_write_data(struct png_stream *stream, const uint8_t *data,
+                           size_t size) {
+  for (size_t byte_index = 0; byte_index < size; byte_index++) {
+    stream->adler_a = (stream->adler_a + data[byte_index]) % ADLER_MODULUS;
+    stream->adler_b = (stream->adler_b + stream->adler_a) % ADLER_MODULUS;
+  }
+  while (size > 0) {
+    size_t copy_size = PNG_BLOCK_SIZE - stream->block_size;
+    if (copy_size > size) {
+      copy_size = size;
+    }
+    memcpy(stream->block + stream->block_size, data, copy_size);
+    stream->block_size += (uint32_t)copy_size;
+    data += copy_size;
+    size -= copy_size;
+    if (stream->block_size == PNG_BLOCK_SIZE) {
+      png_flush_block(stream, false);
+    }
+  }
+}
+
+// Converts one row to RGBA8, after a leading PNG filter type byte.
+static void convert_row(uint8_t *out_row, const uint8_t *pixels,
+                        uint32_t width, bool bgra) {
+  out_row[0] = 0;
+  memcpy(out_row + 1, pixels, (size_t)width * BYTES_PER_PIXEL);
+  if (!bgra) {
+    return;
+  }
+  for (uint32_t x = 0; x < width; x++) {
+    uint8_t *pixel = out_row + 1 + x * BYTES_PER_PIXEL;
+    uint8_t blue = pixel[0];
+    pixel[0] = pixel[2];
+    pixel[2] = blue;
+  }
+}
+
+static bool write_slot(struct frame_capture *capture, uint32_t slot_index) {
+  const struct frame_capture_slot *slot = &capture->slots[slot_index];
+  const uint8_t *pixels =
+      (const uint8_t *)capture->mapped + slot_index * capture->region_size;
+  uint32_t width = slot->extent.width;
+  size_t row_size = (size_t)width * BYTES_PER_PIXEL;
+  uint8_t *row = capture->scratch;
+
+  FILE *file = fopen(slot->path, "wb");
+  if (!file) {
+    LOG("Couldn't open capture file %s", slot->path);
+    goto err;
+  }
+
+  bool ok = true;
+  if (slot->encoding == FRAME_CAPTURE_ENCODING_RAW) {
+    for (uint32_t y = 0; ok && y < slot->extent.height; y++) {
+      convert_row(row, pixels + y * row_size, width, slot->bgra);
+      ok = fwrite(row + 1, 1, row_size, file) == row_size;
+    }
+  } else {
+    static const uint8_t signature[] = {0x89, 'P',  'N',  'G',
+                                        '\r', '\n', 0x1a, '\n'};
+    struct png_stream stream = {.file = file,
+                                .crc_table = capture->crc_table,
+                                .block = row + row_size + 1,
+                                .adler_a = 1,
+                                .first_block = true,
+                                .ok = fwrite(signature, sizeof(signature), 1,
+                                             file) == 1};
+    // Width, height, 8 bit depth, RGBA, default compression, filter and no
+    // interlacing.
+    uint8_t header[13] = {[8] = 8, [9] = 6};
+    put_u32_be(header, width);
+    put_u32_be(header + 4, slot->extent.height);
+    png_write_chunk(&stream, "IHDR", NULL, 0, header, sizeof(header), NULL,
+                    0);
+    for (uint32_t y = 0; stream.ok && y < slot->extent.height; y++) {
+      convert_row(row, pixels + y * row_size, width, slot->bgra);
+      png_write_data(&stream, row, row_size + 1);
+    }
+    png_flush_block(&stream, true);
+    png_write_chunk(&stream, "IEND", NULL, 0, NULL, 0, NULL, 0);
+    ok = stream.ok;
+  }
+
+  if (fclose(file) != 0 || !ok) {
+    LOG("Couldn't write capture file %s", slot->path);
+    goto err;
+  }
+
+  LOG("Captured frame %llu to %s", (unsigned long long)slot->frame_serial,
+      slot->path);
+  return true;
+err:
+  return false;
+}
+
+static int frame_capture_worker(void *data) {
+  struct frame_capture *capture = data;
+  SDL_LockMutex(capture->mutex);
+  while (true) {
+    while (capture->queue_count == 0 && !capture->quit) {
+      SDL_WaitCondition(capture->condition, capture->mutex);
+    }
+    // Drain the queue before honoring quit, so no capture is lost.
+    if (capture->queue_count == 0) {
+      break;
+    }
+    uint32_t slot_index = capture->queue[capture->queue_head];
+    capture->queue_head = (capture->queue_head + 1) % FRAME_CAPTURE_SLOT_COUNT;
+    capture->queue_count--;
+    SDL_UnlockMutex(capture->mutex);
+
+    write_slot(capture, slot_index);
+
+    SDL_LockMutex(capture->mutex);
+    capture->slots[slot_index].state = FRAME_CAPTURE_SLOT_FREE;
+  }
+  SDL_UnlockMutex(capture->mutex);
+  return 0;
+}
+
+bool frame_capture_supports_format(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool frame_capture_init(struct frame_capture *capture,
+                        VkPhysicalDevice physical_device, VkDevice device,
+                        const VkAllocationCallbacks *allocation_callbacks,
+                        struct host_allocator *host_allocator,
+                        VkExtent2D max_extent) {
+  assert(max_extent.width > 0 && max_extent.height > 0);
+  *capture = (struct frame_capture){.host_allocator = host_allocator,
+                                    .max_extent = max_extent};
+
+  for (uint32_t byte = 0; byte < 256; byte++) {
+    uint32_t crc = byte;
+    for (uint32_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+    }
+    capture->crc_table[byte] = crc;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  capture->non_coherent_atom_size = properties.limits.nonCoherentAtomSize;
+  // Copy destinations must be aligned to the texel size too.
+  VkDeviceSize alignment = capture->non_coherent_atom_size;
+  if (alignment < BYTES_PER_PIXEL) {
+    alignment = BYTES_PER_PIXEL;
+  }
+  capture->region_size =
+      align_up((VkDeviceSize)max_extent.width * max_extent.height *
+                   BYTES_PER_PIXEL,
+               alignment);
+
+  // Cached memory makes the CPU reads fast; coherency is optional since the
+  // ranges are invalidated explicitly.
+  static const VkMemoryPropertyFlags property_preferences[] = {
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+  VkMemoryPropertyFlags memory_properties;
+  if (!create_buffer(physical_device, device, allocation_callbacks,
+                     capture->region_size * FRAME_CAPTURE_SLOT_COUNT,
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT, property_preferences,
+                     sizeof(property_preferences) /
+                         sizeof(VkMemoryPropertyFlags),
+                     0, &capture->buffer, &capture->memory,
+                     &memory_properties)) {
+    goto err;
+  }
+  capture->coherent = memory_properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  void *mapped;
+  if (vkMapMemory(device, capture->memory, 0, VK_WHOLE_SIZE, 0, &mapped) !=
+      VK_SUCCESS) {
+    LOG("Couldn't map capture buffer memory");
+    goto destroy_buffer;
+  }
+  capture->mapped = mapped;
+
+  capture->scratch = host_allocator_alloc(
+      host_allocator,
+      (size_t)max_extent.width * BYTES_PER_PIXEL + 1 + PNG_BLOCK_SIZE,
+      VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+  if (!capture->scratch) {
+    goto unmap_memory;
+  }
+
+  capture->mutex = SDL_CreateMutex();
+  if (!capture->mutex) {
+    LOG("Couldn't create capture mutex: %s", SDL_GetError());
+    goto free_scratch;
+  }
+  capture->condition = SDL_CreateCondition();
+  if (!capture->condition) {
+    LOG("Couldn't create capture condition: %s", SDL_GetError());
+    goto destroy_mutex;
+  }
+  capture->worker =
+      SDL_CreateThread(frame_capture_worker, "frame_capture", capture);
+  if (!capture->worker) {
+    LOG("Couldn't create capture thread: %s", SDL_GetError());
+    goto destroy_condition;
+  }
+
+  return true;
+destroy_condition:
+  SDL_DestroyCondition(capture->condition);
+destroy_mutex:
+  SDL_DestroyMutex(capture->mutex);
+free_scratch:
+  host_allocator_free(host_allocator, capture->scratch);
+unmap_memory:
+  vkUnmapMemory(device, capture->memory);
+destroy_buffer:
+  vkDestroyBuffer(device, capture->buffer, allocation_callbacks);
+  vkFreeMemory(device, capture->memory, allocation_callbacks);
+err:
+  return false;
+}
+
+void frame_capture_deinit(struct frame_capture *capture, VkDevice device,
+                          const VkAllocationCallbacks *allocation_callbacks) {
+  frame_capture_collect(capture, device, UINT64_MAX);
+  SDL_LockMutex(capture->mutex);
+  capture->quit = true;
+  SDL_SignalCondition(capture->condition);
+  SDL_UnlockMutex(capture->mutex);
+  SDL_WaitThread(capture->worker, NULL);
+
+  if (capture->dropped_count > 0) {
+    LOG("Dropped %llu frame captures, all slots were busy",
+        (unsigned long long)capture->dropped_count);
+  }
+  SDL_DestroyCondition(capture->condition);
+  SDL_DestroyMutex(capture->mutex);
+  host_allocator_free(capture->host_allocator, capture->scratch);
+  vkUnmapMemory(device, capture->memory);
+  vkDestroyBuffer(device, capture->buffer, allocation_callbacks);
+  vkFreeMemory(device, capture->memory, allocation_callbacks);
+  *capture = (struct frame_capture){0};
+}
+
+bool frame_capture_cmd_copy(struct frame_capture *capture,
+                            VkCommandBuffer command_buffer,
+                            const struct frame_capture_source *source,
+                            uint64_t frame_serial, const char *path,
+                            enum frame_capture_encoding encoding) {
+  if (!frame_capture_supports_format(source->format)) {
+    LOG("Can't capture images of format %d", source->format);
+    return false;
+  }
+  if (source->extent.width > capture->max_extent.width ||
+      source->extent.height > capture->max_extent.height) {
+    LOG("Can't capture %ux%u image, the limit is %ux%u", source->extent.width,
+        source->extent.height, capture->max_extent.width,
+        capture->max_extent.height);
+    return false;
+  }
+  if (strlen(path) >= FRAME_CAPTURE_MAX_PATH) {
+    LOG("Capture path %s is too long", path);
+    return false;
+  }
+
+  SDL_LockMutex(capture->mutex);
+  uint32_t slot_index = 0;
+  for (; slot_index < FRAME_CAPTURE_SLOT_COUNT; slot_index++) {
+    if (capture->slots[slot_index].state == FRAME_CAPTURE_SLOT_FREE) {
+      break;
+    }
+  }
+  SDL_UnlockMutex(capture->mutex);
+  if (slot_index == FRAME_CAPTURE_SLOT_COUNT) {
+    capture->dropped_count++;
+    return false;
+  }
+
+  struct frame_capture_slot *slot = &capture->slots[slot_index];
+  slot->frame_serial = frame_serial;
+  slot->extent = source->extent;
+  slot->bgra = source->format == VK_FORMAT_B8G8R8A8_UNORM ||
+               source->format == VK_FORMAT_B8G8R8A8_SRGB;
+  slot->encoding = encoding;
+  strcpy(slot->path, path);
+
+  VkImageSubresourceRange color_range = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .levelCount = 1,
+      .baseArrayLayer = source->array_layer,
+      .layerCount = 1};
+  vkCmdPipelineBarrier(
+      command_buffer, source->src_stage_mask, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0, 0, NULL, 0, NULL, 1,
+      &(const VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = source->src_access_mask,
+          .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+          .oldLayout = source->layout,
+          .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = source->image,
+          .subresourceRange = color_range});
+
+  vkCmdCopyImageToBuffer(
+      command_buffer, source->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      capture->buffer, 1,
+      &(const VkBufferImageCopy){
+          .bufferOffset = slot_index * capture->region_size,
+          .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                               .baseArrayLayer = source->array_layer,
+                               .layerCount = 1},
+          .imageExtent = {source->extent.width, source->extent.height, 1}});
+
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, source->dst_stage_mask,
+      0, 0, NULL, 0, NULL, 1,
+      &(const VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .dstAccessMask = source->dst_access_mask,
+          .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          .newLayout = source->layout,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = source->image,
+          .subresourceRange = color_range});
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1,
+      &(const VkBufferMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .buffer = capture->buffer,
+          .offset = slot_index * capture->region_size,
+          .size = capture->region_size},
+      0, NULL);
+
+  // Only this thread moves a slot out of FREE, so the slot can't have been
+  // taken since the search.
+  SDL_LockMutex(capture->mutex);
+  slot->state = FRAME_CAPTURE_SLOT_IN_FLIGHT;
+  SDL_UnlockMutex(capture->mutex);
+  return true;
+}
+
+bool frame_capture_collect(struct frame_capture *capture, VkDevice device,
+                           uint64_t completed_serial) {
+  bool ok = true;
+  // Hand slots over oldest first, so files are written in frame order.
+  while (true) {
+    // The encoder thread frees slots while this scans.
+    SDL_LockMutex(capture->mutex);
+    uint32_t oldest_index = FRAME_CAPTURE_SLOT_COUNT;
+    for (uint32_t slot_index = 0; slot_index < FRAME_CAPTURE_SLOT_COUNT;
+         slot_index++) {
+      const struct frame_capture_slot *slot = &capture->slots[slot_index];
+      if (slot->state == FRAME_CAPTURE_SLOT_IN_FLIGHT &&
+          slot->frame_serial <= completed_serial &&
+          (oldest_index == FRAME_CAPTURE_SLOT_COUNT ||
+           slot->frame_serial < capture->slots[oldest_index].frame_serial)) {
+        oldest_index = slot_index;
+      }
+    }
+    SDL_UnlockMutex(capture->mutex);
+    if (oldest_index == FRAME_CAPTURE_SLOT_COUNT) {
+      break;
+    }
+
+    const struct frame_capture_slot *slot = &capture->slots[oldest_index];
+    if (!capture->coherent) {
+      VkDeviceSize start = oldest_index * capture->region_size;
+      VkDeviceSize size =
+          (VkDeviceSize)slot->extent.width * slot->extent.height *
+          BYTES_PER_PIXEL;
+      ok = vkInvalidateMappedMemoryRanges(
+               device, 1,
+               &(const VkMappedMemoryRange){
+                   .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                   .memory = capture->memory,
+                   .offset = align_down(start, capture->non_coherent_atom_size),
+                   .size = align_up(size, capture->non_coherent_atom_size)}) ==
+               VK_SUCCESS &&
+           ok;
+    }
+
+    SDL_LockMutex(capture->mutex);
+    capture->slots[oldest_index].state = FRAME_CAPTURE_SLOT_ENCODING;
+    capture->queue[(capture->queue_head + capture->queue_count) %
+                   FRAME_CAPTURE_SLOT_COUNT] = oldest_index;
+    capture->queue_count++;
+    SDL_SignalCondition(capture->condition);
+    SDL_UnlockMutex(capture->mutex);
+  }
+  return ok;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "host_allocator.h"
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#define FRAME_CAPTURE_SLOT_COUNT 4
+#define FRAME_CAPTURE_MAX_PATH 256
+
+enum frame_capture_encoding {
+  FRAME_CAPTURE_ENCODING_PNG,
+  // Tightly packed, top-down RGBA8 rows without a header.
+  FRAME_CAPTURE_ENCODING_RAW,
+};
+
+enum frame_capture_slot_state {
+  FRAME_CAPTURE_SLOT_FREE,
+  // The copy is recorded; waiting for its frame to complete on the GPU.
+  FRAME_CAPTURE_SLOT_IN_FLIGHT,
+  // Owned by the worker thread until it's back to FREE.
+  FRAME_CAPTURE_SLOT_ENCODING,
+};
+
+struct frame_capture_slot {
+  enum frame_capture_slot_state state;
+  uint64_t frame_serial;
+  VkExtent2D extent;
+  bool bgra;
+  enum frame_capture_encoding encoding;
+  char path[FRAME_CAPTURE_MAX_PATH];
+};
+
+// The image to copy and how it is used around the copy. The image is moved
+// to TRANSFER_SRC_OPTIMAL for the copy and back to `layout` afterwards.
+struct frame_capture_source {
+  VkImage image;
+  VkFormat format;
+  VkExtent2D extent;
+  // For layered targets, such as the ones multiview renders into.
+  uint32_t array_layer;
+  VkImageLayout layout;
+  // Last write to the image before the copy.
+  VkPipelineStageFlags src_stage_mask;
+  VkAccessFlags src_access_mask;
+  // First use of the image after the copy.
+  VkPipelineStageFlags dst_stage_mask;
+  VkAccessFlags dst_access_mask;
+};
+
+// Asynchronous readback of color images into a ring of host visible regions.
+// A copy is recorded into the frame's command buffer; once the caller reports
+// that frame as completed, the pixels are handed to a worker thread that
+// writes them to disk. Nothing here waits on the GPU, and when every slot is
+// busy a capture is dropped rather than stalling the frame.
+struct frame_capture {
+  struct host_allocator *host_allocator;
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  char *mapped;
+  VkDeviceSize region_size;
+  VkDeviceSize non_coherent_atom_size;
+  bool coherent;
+  VkExtent2D max_extent;
+
+  // Slot states are written by both threads and guarded by mutex, the rest
+  // of a slot belongs to whichever thread its state says owns it.
+  struct frame_capture_slot slots[FRAME_CAPTURE_SLOT_COUNT];
+  uint32_t queue[FRAME_CAPTURE_SLOT_COUNT];
+  uint32_t queue_head;
+  uint32_t queue_count;
+  bool quit;
+  SDL_Mutex *mutex;
+  SDL_Condition *condition;
+  SDL_Thread *worker;
+
+  // Worker-only scratch: one converted row and one PNG data chunk.
+  uint8_t *scratch;
+  uint32_t crc_table[256];
+  uint64_t dropped_count;
+};
+
+bool frame_capture_supports_format(VkFormat format);
+
+// Every captured image must fit in max_extent.
+bool frame_capture_init(struct frame_capture *capture,
+                        VkPhysicalDevice physical_device, VkDevice device,
+                        const VkAllocationCallbacks *allocation_callbacks,
+                        struct host_allocator *host_allocator,
+                        VkExtent2D max_extent);
+// The device must be idle. Writes out every capture still pending.
+void frame_capture_deinit(struct frame_capture *capture, VkDevice device,
+                          const VkAllocationCallbacks *allocation_callbacks);
+
+// Records a copy of source into a free slot, tagged with frame_serial. Must
+// be recorded outside of a render pass. Returns false, recording nothing, if
+// no slot is free or the source can't be captured.
+bool frame_capture_cmd_copy(struct frame_capture *capture,
+                            VkCommandBuffer command_buffer,
+                            const struct frame_capture_source *source,
+                            uint64_t frame_serial, const char *path,
+                            enum frame_capture_encoding encoding);
+
+// Hands every capture of a frame up to and including completed_serial over
+// to the worker thread. Call once the fence of that frame has signaled.
+bool frame_capture_collect(struct frame_capture *capture, VkDevice device,
+                           uint64_t completed_serial);
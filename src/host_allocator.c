@@ -0,0 +1,341 @@
+#include "host_allocator.h"
+
+#include "log.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HOST_ALLOCATION_KIND_ARENA 0xfffe
+#define HOST_ALLOCATION_KIND_LARGE 0xffff
+
+// Sits right in front of every pointer handed out, so a free only needs the
+// pointer to find its way back to the pool, the arena or the system heap.
+struct host_allocation_header {
+  uint64_t size;
+  uint32_t offset;
+  uint16_t kind;
+  uint8_t scope;
+  uint8_t reserved;
+};
+static_assert(sizeof(struct host_allocation_header) ==
+                  HOST_ALLOCATOR_MIN_ALIGNMENT,
+              "allocation header must keep user pointers aligned");
+
+struct host_allocator_chunk {
+  struct host_allocator_chunk *next;
+};
+static_assert(sizeof(struct host_allocator_chunk) <=
+                  HOST_ALLOCATOR_MIN_ALIGNMENT,
+              "chunk header must fit in front of the first block");
+
+static size_t align_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static uint32_t size_class_index(size_t size) {
+  uint32_t index = 0;
+  while (index < HOST_ALLOCATOR_SIZE_CLASS_COUNT &&
+         ((size_t)HOST_ALLOCATOR_MIN_ALIGNMENT << index) < size) {
+    index++;
+  }
+  return index;
+}
+
+static bool host_allocator_pool_grow(struct host_allocator_pool *pool) {
+  struct host_allocator_chunk *chunk =
+      aligned_alloc(HOST_ALLOCATOR_MIN_ALIGNMENT, HOST_ALLOCATOR_CHUNK_SIZE);
+  if (!chunk) {
+    return false;
+  }
+  chunk->next = pool->chunks;
+  pool->chunks = chunk;
+
+  char *blocks = (char *)chunk + HOST_ALLOCATOR_MIN_ALIGNMENT;
+  uint32_t block_count =
+      (HOST_ALLOCATOR_CHUNK_SIZE - HOST_ALLOCATOR_MIN_ALIGNMENT) /
+      pool->block_size;
+  for (uint32_t block_index = block_count; block_index-- > 0;) {
+    void *block = blocks + (size_t)block_index * pool->block_size;
+    *(void **)block = pool->free_list;
+    pool->free_list = block;
+  }
+  return true;
+}
+
+static void record_allocation(struct host_allocator *allocator,
+                              VkSystemAllocationScope scope, size_t size) {
+  struct host_allocator_scope_stats *stats = &allocator->scopes[scope];
+  stats->allocation_count++;
+  stats->live_bytes += size;
+  if (stats->live_bytes > stats->peak_bytes) {
+    stats->peak_bytes = stats->live_bytes;
+  }
+}
+
+static void record_free(struct host_allocator *allocator,
+                        VkSystemAllocationScope scope, size_t size) {
+  struct host_allocator_scope_stats *stats = &allocator->scopes[scope];
+  stats->free_count++;
+  stats->live_bytes -= size;
+}
+
+static void *host_allocator_allocate_locked(struct host_allocator *allocator,
+                                            size_t size, size_t alignment,
+                                            VkSystemAllocationScope scope) {
+  assert(scope < HOST_ALLOCATOR_SCOPE_COUNT);
+  struct host_allocation_header *header = NULL;
+
+  if (alignment <= HOST_ALLOCATOR_MIN_ALIGNMENT) {
+    if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+      size_t needed = HOST_ALLOCATOR_MIN_ALIGNMENT +
+                      align_up(size, HOST_ALLOCATOR_MIN_ALIGNMENT);
+      if (allocator->command_arena_offset + needed <=
+          HOST_ALLOCATOR_COMMAND_ARENA_SIZE) {
+        header = (struct host_allocation_header *)(allocator->command_arena +
+                                                   allocator
+                                                       ->command_arena_offset);
+        header->kind = HOST_ALLOCATION_KIND_ARENA;
+        header->offset = HOST_ALLOCATOR_MIN_ALIGNMENT;
+        allocator->command_arena_offset += needed;
+        allocator->command_arena_live_count++;
+      } else {
+        allocator->command_arena_overflow_count++;
+      }
+    }
+
+    uint32_t size_class = size_class_index(size);
+    if (!header && size_class < HOST_ALLOCATOR_SIZE_CLASS_COUNT) {
+      struct host_allocator_pool *pool = &allocator->pools[size_class];
+      if (pool->free_list || host_allocator_pool_grow(pool)) {
+        header = pool->free_list;
+        pool->free_list = *(void **)pool->free_list;
+        header->kind = (uint16_t)size_class;
+        header->offset = HOST_ALLOCATOR_MIN_ALIGNMENT;
+      }
+    }
+  }
+
+  if (!header) {
+    size_t large_alignment = alignment > HOST_ALLOCATOR_MIN_ALIGNMENT
+                                 ? alignment
+                                 : HOST_ALLOCATOR_MIN_ALIGNMENT;
+    char *base = aligned_alloc(large_alignment,
+                               align_up(large_alignment + size,
+                                        large_alignment));
+    if (!base) {
+      return NULL;
+    }
+    header = (struct host_allocation_header *)(base + large_alignment) - 1;
+    header->kind = HOST_ALLOCATION_KIND_LARGE;
+    header->offset = (uint32_t)large_alignment;
+  }
+
+  header->size = size;
+  header->scope = (uint8_t)scope;
+  record_allocation(allocator, scope, size);
+  return header + 1;
+}
+
+static void host_allocator_free_locked(struct host_allocator *allocator,
+                                       void *memory) {
+  struct host_allocation_header *header =
+      (struct host_allocation_header *)memory - 1;
+  record_free(allocator, header->scope, header->size);
+
+  if (header->kind == HOST_ALLOCATION_KIND_ARENA) {
+    assert(allocator->command_arena_live_count > 0);
+    if (--allocator->command_arena_live_count == 0) {
+      allocator->command_arena_offset = 0;
+    }
+  } else if (header->kind == HOST_ALLOCATION_KIND_LARGE) {
+    free((char *)memory - header->offset);
+  } else {
+    struct host_allocator_pool *pool = &allocator->pools[header->kind];
+    *(void **)header = pool->free_list;
+    pool->free_list = header;
+  }
+}
+
+static void *VKAPI_CALL host_allocator_vk_allocation(
+    void *user_data, size_t size, size_t alignment,
+    VkSystemAllocationScope allocation_scope) {
+  struct host_allocator *allocator = user_data;
+  SDL_LockSpinlock(&allocator->lock);
+  void *memory = host_allocator_allocate_locked(allocator, size, alignment,
+                                                allocation_scope);
+  SDL_UnlockSpinlock(&allocator->lock);
+  return memory;
+}
+
+static void *VKAPI_CALL host_allocator_vk_reallocation(
+    void *user_data, void *original, size_t size, size_t alignment,
+    VkSystemAllocationScope allocation_scope) {
+  struct host_allocator *allocator = user_data;
+  if (!original) {
+    return host_allocator_vk_allocation(user_data, size, alignment,
+                                        allocation_scope);
+  }
+
+  SDL_LockSpinlock(&allocator->lock);
+  if (size == 0) {
+    host_allocator_free_locked(allocator, original);
+    SDL_UnlockSpinlock(&allocator->lock);
+    return NULL;
+  }
+
+  struct host_allocation_header *header =
+      (struct host_allocation_header *)original - 1;
+  struct host_allocator_scope_stats *stats = &allocator->scopes[header->scope];
+  stats->reallocation_count++;
+
+  // Growing or shrinking inside the same size class keeps the block.
+  if (header->kind < HOST_ALLOCATOR_SIZE_CLASS_COUNT &&
+      alignment <= HOST_ALLOCATOR_MIN_ALIGNMENT &&
+      size <= ((size_t)HOST_ALLOCATOR_MIN_ALIGNMENT << header->kind)) {
+    stats->live_bytes = stats->live_bytes - header->size + size;
+    if (stats->live_bytes > stats->peak_bytes) {
+      stats->peak_bytes = stats->live_bytes;
+    }
+    header->size = size;
+    SDL_UnlockSpinlock(&allocator->lock);
+    return original;
+  }
+
+  void *memory = host_allocator_allocate_locked(allocator, size, alignment,
+                                                allocation_scope);
+  if (memory) {
+    memcpy(memory, original, header->size < size ? header->size : size);
+    host_allocator_free_locked(allocator, original);
+  }
+  SDL_UnlockSpinlock(&allocator->lock);
+  return memory;
+}
+
+static void VKAPI_CALL host_allocator_vk_free(void *user_data, void *memory) {
+  struct host_allocator *allocator = user_data;
+  if (!memory) {
+    return;
+  }
+  SDL_LockSpinlock(&allocator->lock);
+  host_allocator_free_locked(allocator, memory);
+  SDL_UnlockSpinlock(&allocator->lock);
+}
+
+static void VKAPI_CALL host_allocator_vk_internal_allocation(
+    void *user_data, size_t size, VkInternalAllocationType allocation_type,
+    VkSystemAllocationScope allocation_scope) {
+  (void)allocation_type;
+  struct host_allocator *allocator = user_data;
+  SDL_LockSpinlock(&allocator->lock);
+  struct host_allocator_scope_stats *stats =
+      &allocator->scopes[allocation_scope];
+  stats->internal_live_bytes += size;
+  if (stats->internal_live_bytes > stats->internal_peak_bytes) {
+    stats->internal_peak_bytes = stats->internal_live_bytes;
+  }
+  SDL_UnlockSpinlock(&allocator->lock);
+}
+
+static void VKAPI_CALL host_allocator_vk_internal_free(
+    void *user_data, size_t size, VkInternalAllocationType allocation_type,
+    VkSystemAllocationScope allocation_scope) {
+  (void)allocation_type;
+  struct host_allocator *allocator = user_data;
+  SDL_LockSpinlock(&allocator->lock);
+  allocator->scopes[allocation_scope].internal_live_bytes -= size;
+  SDL_UnlockSpinlock(&allocator->lock);
+}
+
+bool host_allocator_init(struct host_allocator *allocator) {
+  *allocator = (struct host_allocator){0};
+  allocator->command_arena = aligned_alloc(HOST_ALLOCATOR_MIN_ALIGNMENT,
+                                           HOST_ALLOCATOR_COMMAND_ARENA_SIZE);
+  if (!allocator->command_arena) {
+    return false;
+  }
+
+  for (uint32_t size_class = 0; size_class < HOST_ALLOCATOR_SIZE_CLASS_COUNT;
+       size_class++) {
+    allocator->pools[size_class].block_size =
+        HOST_ALLOCATOR_MIN_ALIGNMENT +
+        (HOST_ALLOCATOR_MIN_ALIGNMENT << size_class);
+  }
+
+  allocator->callbacks = (VkAllocationCallbacks){
+      .pUserData = allocator,
+      .pfnAllocation = host_allocator_vk_allocation,
+      .pfnReallocation = host_allocator_vk_reallocation,
+      .pfnFree = host_allocator_vk_free,
+      .pfnInternalAllocation = host_allocator_vk_internal_allocation,
+      .pfnInternalFree = host_allocator_vk_internal_free};
+  return true;
+}
+
+void host_allocator_deinit(struct host_allocator *allocator) {
+  for (uint32_t scope = 0; scope < HOST_ALLOCATOR_SCOPE_COUNT; scope++) {
+    if (allocator->scopes[scope].live_bytes != 0) {
+      LOG("Host allocator: %llu bytes still live in scope %u",
+          (unsigned long long)allocator->scopes[scope].live_bytes, scope);
+    }
+  }
+
+  for (uint32_t size_class = 0; size_class < HOST_ALLOCATOR_SIZE_CLASS_COUNT;
+       size_class++) {
+    struct host_allocator_chunk *chunk = allocator->pools[size_class].chunks;
+    while (chunk) {
+      struct host_allocator_chunk *next = chunk->next;
+      free(chunk);
+      chunk = next;
+    }
+  }
+  free(allocator->command_arena);
+  *allocator = (struct host_allocator){0};
+}
+
+const VkAllocationCallbacks *
+host_allocator_callbacks(struct host_allocator *allocator) {
+  return &allocator->callbacks;
+}
+
+void *host_allocator_alloc(struct host_allocator *allocator, size_t size,
+                           VkSystemAllocationScope scope) {
+  return host_allocator_vk_allocation(allocator, size,
+                                      HOST_ALLOCATOR_MIN_ALIGNMENT, scope);
+}
+
+void host_allocator_free(struct host_allocator *allocator, void *memory) {
+  host_allocator_vk_free(allocator, memory);
+}
+
+struct host_allocator_scope_stats
+host_allocator_get_scope_stats(struct host_allocator *allocator,
+                               VkSystemAllocationScope scope) {
+  assert(scope < HOST_ALLOCATOR_SCOPE_COUNT);
+  SDL_LockSpinlock(&allocator->lock);
+  struct host_allocator_scope_stats stats = allocator->scopes[scope];
+  SDL_UnlockSpinlock(&allocator->lock);
+  return stats;
+}
+
+void host_allocator_log_stats(struct host_allocator *allocator) {
+#ifndef NDEBUG
+  static const char *scope_names[HOST_ALLOCATOR_SCOPE_COUNT] = {
+      "command", "object", "cache", "device", "instance"};
+  for (uint32_t scope = 0; scope < HOST_ALLOCATOR_SCOPE_COUNT; scope++) {
+    struct host_allocator_scope_stats stats =
+        host_allocator_get_scope_stats(allocator, scope);
+    LOG("Host allocations [%s]: count=%llu reallocs=%llu frees=%llu "
+        "live=%llu B peak=%llu B internal_peak=%llu B",
+        scope_names[scope], (unsigned long long)stats.allocation_count,
+        (unsigned long long)stats.reallocation_count,
+        (unsigned long long)stats.free_count,
+        (unsigned long long)stats.live_bytes,
+        (unsigned long long)stats.peak_bytes,
+        (unsigned long long)stats.internal_peak_bytes);
+  }
+  LOG("Host allocations: command arena overflowed %llu times",
+      (unsigned long long)allocator->command_arena_overflow_count);
+#else
+  (void)allocator;
+#endif
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Size classes are 16 << index bytes, so 16 B up to 4 KiB. Anything bigger or
+// with an alignment above HOST_ALLOCATOR_MIN_ALIGNMENT goes to aligned_alloc.
+#define HOST_ALLOCATOR_SIZE_CLASS_COUNT 9
+#define HOST_ALLOCATOR_MIN_ALIGNMENT 16
+#define HOST_ALLOCATOR_CHUNK_SIZE (64 * 1024)
+#define HOST_ALLOCATOR_COMMAND_ARENA_SIZE (256 * 1024)
+#define HOST_ALLOCATOR_SCOPE_COUNT (VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1)
+
+struct host_allocator_chunk;
+
+struct host_allocator_pool {
+  struct host_allocator_chunk *chunks;
+  void *free_list;
+  uint32_t block_size;
+};
+
+struct host_allocator_scope_stats {
+  uint64_t allocation_count;
+  uint64_t reallocation_count;
+  uint64_t free_count;
+  uint64_t live_bytes;
+  uint64_t peak_bytes;
+  uint64_t internal_live_bytes;
+  uint64_t internal_peak_bytes;
+};
+
+// Backs VkAllocationCallbacks for every Vulkan object the renderer creates.
+// Driver allocations in VK_SYSTEM_ALLOCATION_SCOPE_COMMAND only live for the
+// duration of a single Vulkan command, so they are bump allocated from an arena
+// that rewinds once its last allocation is freed.
+struct host_allocator {
+  SDL_SpinLock lock;
+  struct host_allocator_pool pools[HOST_ALLOCATOR_SIZE_CLASS_COUNT];
+  char *command_arena;
+  size_t command_arena_offset;
+  uint32_t command_arena_live_count;
+  uint64_t command_arena_overflow_count;
+  struct host_allocator_scope_stats scopes[HOST_ALLOCATOR_SCOPE_COUNT];
+  VkAllocationCallbacks callbacks;
+};
+
+bool host_allocator_init(struct host_allocator *allocator);
+void host_allocator_deinit(struct host_allocator *allocator);
+
+const VkAllocationCallbacks *
+host_allocator_callbacks(struct host_allocator *allocator);
+
+void *host_allocator_alloc(struct host_allocator *allocator, size_t size,
+                           VkSystemAllocationScope scope);
+void host_allocator_free(struct host_allocator *allocator, void *memory);
+
+// Snapshot of the counters of one scope, safe to call while other threads
+// allocate.
+struct host_allocator_scope_stats
+host_allocator_get_scope_stats(struct host_allocator *allocator,
+                               VkSystemAllocationScope scope);
+void host_allocator_log_stats(struct host_allocator *allocator);
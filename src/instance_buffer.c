@@ -0,0 +1,166 @@
+#include "instance_buffer.h"
+
+#include "log.h"
+#include "vulkan_utils.h"
+#include <assert.h>
+#include <string.h>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static VkDeviceSize align_down(VkDeviceSize value, VkDeviceSize alignment) {
+  return value & ~(alignment - 1);
+}
+
+bool instance_buffer_init(struct instance_buffer *instance_buffer,
+                          VkPhysicalDevice physical_device, VkDevice device,
+                          const VkAllocationCallbacks *allocation_callbacks,
+                          uint32_t capacity, uint32_t region_count) {
+  assert(capacity > 0);
+  assert(region_count > 0 && region_count <= SCENE_MAX_GPU_COPIES);
+  *instance_buffer = (struct instance_buffer){0};
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+  instance_buffer->non_coherent_atom_size =
+      properties.limits.nonCoherentAtomSize;
+  if (instance_buffer->non_coherent_atom_size > alignment) {
+    alignment = instance_buffer->non_coherent_atom_size;
+  }
+  instance_buffer->region_size =
+      align_up(capacity * sizeof(struct scene_instance), alignment);
+  instance_buffer->region_count = region_count;
+  instance_buffer->capacity = capacity;
+
+  static const VkMemoryPropertyFlags property_preferences[] = {
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+  VkMemoryPropertyFlags memory_properties;
+  if (!create_buffer(physical_device, device, allocation_callbacks,
+                     instance_buffer->region_size * region_count,
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, property_preferences,
+                     sizeof(property_preferences) /
+                         sizeof(VkMemoryPropertyFlags),
+                     0, &instance_buffer->buffer, &instance_buffer->memory,
+                     &memory_properties)) {
+    goto err;
+  }
+  instance_buffer->coherent =
+      memory_properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  void *mapped;
+  if (vkMapMemory(device, instance_buffer->memory, 0, VK_WHOLE_SIZE, 0,
+                  &mapped) != VK_SUCCESS) {
+    LOG("Couldn't map instance buffer memory");
+    goto destroy_buffer;
+  }
+  instance_buffer->mapped = mapped;
+  // Slots that were never written read as invisible (flags 0).
+  memset(instance_buffer->mapped, 0,
+         instance_buffer->region_size * region_count);
+  if (!instance_buffer->coherent) {
+    vkFlushMappedMemoryRanges(
+        device, 1,
+        &(const VkMappedMemoryRange){
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = instance_buffer->memory,
+            .size = VK_WHOLE_SIZE});
+  }
+
+  return true;
+destroy_buffer:
+  vkDestroyBuffer(device, instance_buffer->buffer, allocation_callbacks);
+  vkFreeMemory(device, instance_buffer->memory, allocation_callbacks);
+err:
+  return false;
+}
+
+void instance_buffer_deinit(struct instance_buffer *instance_buffer,
+                            VkDevice device,
+                            const VkAllocationCallbacks *allocation_callbacks) {
+  vkUnmapMemory(device, instance_buffer->memory);
+  vkDestroyBuffer(device, instance_buffer->buffer, allocation_callbacks);
+  vkFreeMemory(device, instance_buffer->memory, allocation_callbacks);
+  *instance_buffer = (struct instance_buffer){0};
+}
+
+static bool flush_instances(struct instance_buffer *instance_buffer,
+                            VkDevice device, VkDeviceSize region_start,
+                            uint32_t first, uint32_t end) {
+  if (instance_buffer->coherent || first == end) {
+    return true;
+  }
+
+  // One range over the written span; for scattered updates this flushes some
+  // untouched instances too, which is cheaper than a range per instance.
+  VkDeviceSize start =
+      align_down(region_start + first * sizeof(struct scene_instance),
+                 instance_buffer->non_coherent_atom_size);
+  VkDeviceSize stop =
+      align_up(region_start + end * sizeof(struct scene_instance),
+               instance_buffer->non_coherent_atom_size);
+  return vkFlushMappedMemoryRanges(
+             device, 1,
+             &(const VkMappedMemoryRange){
+                 .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                 .memory = instance_buffer->memory,
+                 .offset = start,
+                 .size = stop - start}) == VK_SUCCESS;
+}
+
+bool instance_buffer_sync(struct instance_buffer *instance_buffer,
+                          VkDevice device, struct scene *scene,
+                          uint32_t frame_index, uint32_t *out_dynamic_offset,
+                          uint32_t *out_first, uint32_t *out_end) {
+  assert(scene->capacity <= instance_buffer->capacity);
+  assert(scene->gpu_copy_count == instance_buffer->region_count);
+  uint32_t region = frame_index % instance_buffer->region_count;
+  VkDeviceSize region_start = region * instance_buffer->region_size;
+  *out_dynamic_offset = (uint32_t)region_start;
+
+  scene_write_instances(
+      scene, region,
+      (struct scene_instance *)(instance_buffer->mapped + region_start),
+      out_first, out_end);
+  return flush_instances(instance_buffer, device, region_start, *out_first,
+                         *out_end);
+}
+
+bool instance_buffer_write(struct instance_buffer *instance_buffer,
+                           VkDevice device, uint32_t frame_index,
+                           uint32_t first, uint32_t count,
+                           const struct scene_instance *instances) {
+  if (first > instance_buffer->capacity ||
+      count > instance_buffer->capacity - first) {
+    LOG("Instances [%u, %u) don't fit the instance buffer", first,
+        first + count);
+    return false;
+  }
+  uint32_t region = frame_index % instance_buffer->region_count;
+  VkDeviceSize region_start = region * instance_buffer->region_size;
+  memcpy(instance_buffer->mapped + region_start +
+             first * sizeof(struct scene_instance),
+         instances, count * sizeof(struct scene_instance));
+  return flush_instances(instance_buffer, device, region_start, first,
+                         first + count);
+}
+
+uint32_t
+instance_buffer_dynamic_offset(const struct instance_buffer *instance_buffer,
+                               uint32_t frame_index) {
+  uint32_t region = frame_index % instance_buffer->region_count;
+  return (uint32_t)(region * instance_buffer->region_size);
+}
+
+VkDescriptorBufferInfo
+instance_buffer_descriptor_info(const struct instance_buffer *instance_buffer) {
+  return (VkDescriptorBufferInfo){.buffer = instance_buffer->buffer,
+                                  .offset = 0,
+                                  .range = instance_buffer->region_size};
+}
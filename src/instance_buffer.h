@@ -0,0 +1,51 @@
+#pragma once
+
+#include "scene.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Persistently mapped copy of the scene's instances per frame in flight, in
+// one buffer. Each region is only patched with the instances that changed
+// since that region was last written, so a static scene costs nothing per
+// frame. Bound as a STORAGE_BUFFER_DYNAMIC; the dynamic offset selects the
+// region of the frame being recorded.
+struct instance_buffer {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  char *mapped;
+  VkDeviceSize region_size;
+  VkDeviceSize non_coherent_atom_size;
+  uint32_t region_count;
+  uint32_t capacity;
+  bool coherent;
+};
+
+bool instance_buffer_init(struct instance_buffer *instance_buffer,
+                          VkPhysicalDevice physical_device, VkDevice device,
+                          const VkAllocationCallbacks *allocation_callbacks,
+                          uint32_t capacity, uint32_t region_count);
+void instance_buffer_deinit(struct instance_buffer *instance_buffer,
+                            VkDevice device,
+                            const VkAllocationCallbacks *allocation_callbacks);
+
+// Copies the instances that are dirty for this frame's region and flushes
+// them. Call once the fence of the frame that last read the region has
+// signaled. Writes the region's dynamic offset to *out_dynamic_offset and
+// the span of instances written, possibly empty, to [*out_first, *out_end).
+bool instance_buffer_sync(struct instance_buffer *instance_buffer,
+                          VkDevice device, struct scene *scene,
+                          uint32_t frame_index, uint32_t *out_dynamic_offset,
+                          uint32_t *out_first, uint32_t *out_end);
+// Copies instances into [first, first + count) of this frame's region
+// directly, bypassing the scene, for replaying recorded uploads.
+bool instance_buffer_write(struct instance_buffer *instance_buffer,
+                           VkDevice device, uint32_t frame_index,
+                           uint32_t first, uint32_t count,
+                           const struct scene_instance *instances);
+uint32_t
+instance_buffer_dynamic_offset(const struct instance_buffer *instance_buffer,
+                               uint32_t frame_index);
+
+VkDescriptorBufferInfo
+instance_buffer_descriptor_info(const struct instance_buffer *instance_buffer);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdio.h>
+
+#ifdef NDEBUG
+#define LOG(...)
+#else
+#define LOG(...)                                                               \
+  do {                                                                         \
+    fprintf(stderr, __VA_ARGS__);                                              \
+    fprintf(stderr, "\n");                                                     \
+  } while (0)
+#endif
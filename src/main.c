@@ -4,22 +4,62 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
 
-#ifdef NDEBUG
-#define LOG(...)
-#else
-#define LOG(...)                                                               \
-  do {                                                                         \
-    fprintf(stderr, __VA_ARGS__);                                              \
-    fprintf(stderr, "\n");                                                     \
-  } while (0)
-#endif
+#include "command_stream.h"
+#include "device_features.h"
+#include "dynamic_resolution.h"
+#include "event_queue.h"
+#include "frame_capture.h"
+#include "host_allocator.h"
+#include "instance_buffer.h"
+#include "log.h"
+#include "math3d.h"
+#include "multiview.h"
+#include "occlusion_culler.h"
+#include "post_process.h"
+#include "resource_manager.h"
+#include "scene.h"
+#include "shader_variant.h"
+#include "sprite_batch.h"
+#include "telemetry.h"
+#include "uniform_ring.h"
+#include "vulkan_utils.h"
 
 #define MAX_SWAPCHAIN_IMAGE_COUNT 32
+#define MAX_FRAMES_IN_FLIGHT 2
+#define UNIFORM_RING_REGION_SIZE (256 * 1024)
+#define SCENE_CAPACITY 4096
+#define STATS_LOG_INTERVAL 600
+// Instances per recorded upload record, staged on the stack.
+#define RECORD_UPLOAD_CHUNK 64
+#define THUMBNAIL_VIEW_COUNT 4
+#define TARGET_FRAME_TIME_MS 16.6f
+#define MIN_RENDER_SCALE 0.5f
+#define POST_SCENE_FORMAT VK_FORMAT_R16G16B16A16_SFLOAT
+#define OVERLAY_HISTORY_LENGTH 120
+// The frame time graph: a panel, a bar per history entry and a target line.
+#define OVERLAY_HUD_SPRITES (OVERLAY_HISTORY_LENGTH + 2)
+#define OVERLAY_MAX_STRESS_SPRITES (256u * 1024u)
+#define OVERLAY_STRESS_SPACING 4
+
+static_assert(MAX_SWAPCHAIN_IMAGE_COUNT <= POST_PROCESS_MAX_OUTPUT_IMAGES,
+              "every swapchain image must fit in the post-processing chain");
+
+// Per-draw constants, bound as a dynamic uniform buffer at set 0, binding 0.
+// Per-instance data comes from the scene's instance buffer at binding 1,
+// indexed through the culling pass' visible index list at binding 2.
+struct draw_uniforms {
+  struct mat4 transform;
+  struct vec4 color;
+};
 
 struct vulkan_renderer {
+  // No window, surface or swapchain: frames are drawn into the offscreen
+  // scene target and never presented. Used to replay command streams.
+  bool headless;
   VkInstance instance;
   VkPhysicalDevice physical_device;
   VkDevice device;
@@ -32,12 +72,105 @@ struct vulkan_renderer {
   VkFormat swapchain_image_format;
   VkExtent2D swapchain_extent;
   VkImageView swapchain_image_views[MAX_SWAPCHAIN_IMAGE_COUNT];
+  bool swapchain_capturable;
+  bool swapchain_transfer_dst;
+  // The post-processing chain writes straight into the swapchain images.
+  bool swapchain_storage;
+  // Owns the render targets and the graphics pipeline; whatever it destroys
+  // waits for the frame timeline.
+  struct resource_manager resources;
+  VkFormat depth_format;
+  struct resource_handle depth_image;
+  struct resource_handle depth_image_view;
+  // With render_offscreen the scene is drawn into the corner of scene_color
+  // that dynamic_resolution picks and then scaled up onto the swapchain
+  // image. Without blit support it's drawn straight into the swapchain image
+  // at full size.
+  bool render_offscreen;
+  // POST_SCENE_FORMAT with post-processing, the swapchain format otherwise.
+  VkFormat scene_color_format;
+  struct resource_handle scene_color_image;
+  struct resource_handle scene_color_view;
+  VkFilter upscale_filter;
+  // With post_enabled the scene is rendered in HDR and the post-processing
+  // chain takes the upscale's place. Effects are picked with the
+  // VKGUIDE_POST_EFFECTS environment variable, all of them by default.
+  struct post_process_config post_config;
+  bool post_enabled;
+  struct post_process post;
+  struct dynamic_resolution dynamic_resolution;
+  // What this frame renders at: dynamic_resolution's pick, or the recorded
+  // size when replaying.
+  VkExtent2D render_extent;
+  // While recording, every drawn frame is written to recorder until
+  // record_frames_left reaches zero.
+  bool recording;
+  struct command_stream_writer recorder;
+  uint32_t record_frames_left;
+  // Each region of the instance buffer only gets what changed since it was
+  // last written, so the first frame of each region records all of it.
+  uint32_t record_full_upload_frames;
+  // Opt-in with the VKGUIDE_TELEMETRY_SOCKET environment variable.
+  bool telemetry_enabled;
+  struct telemetry_server telemetry;
+  uint64_t last_frame_start_ns;
+  // Both passes render to the same framebuffers. render_pass clears and draws
+  // the instances visible last frame, late_render_pass adds the ones the
+  // occlusion culler found to have become visible.
   VkRenderPass render_pass;
+  VkRenderPass late_render_pass;
   VkPipelineLayout pipeline_layout;
-  VkPipeline pipeline;
+  struct resource_handle pipeline;
   VkFramebuffer swapchain_framebuffers[MAX_SWAPCHAIN_IMAGE_COUNT];
   uint32_t swapchain_image_count;
   bool enable_validation_layers;
+  uint32_t instance_version;
+  bool has_physical_device_properties2;
+  struct device_features features;
+  struct host_allocator host_allocator;
+  const VkAllocationCallbacks *allocation_callbacks;
+  VkDescriptorSetLayout descriptor_set_layout;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet draw_descriptor_set;
+  VkCommandPool command_pool;
+  VkCommandBuffer command_buffers[MAX_FRAMES_IN_FLIGHT];
+  // When rendering offscreen, whatever touches the swapchain image goes here
+  // instead, in a batch of its own that is the only one to wait for the
+  // image.
+  VkCommandBuffer output_command_buffers[MAX_FRAMES_IN_FLIGHT];
+  VkSemaphore image_available_semaphores[MAX_FRAMES_IN_FLIGHT];
+  VkSemaphore render_finished_semaphores[MAX_SWAPCHAIN_IMAGE_COUNT];
+  // With timeline semaphores, frame n signals frame_timeline to n + 1 and
+  // the fences are never created.
+  VkSemaphore frame_timeline;
+  VkFence in_flight_fences[MAX_FRAMES_IN_FLIGHT];
+  struct uniform_ring uniform_ring;
+  struct scene scene;
+  struct scene_handle scene_root;
+  struct instance_buffer instance_buffer;
+  struct occlusion_culler occlusion_culler;
+  struct occlusion_stats occlusion_stats;
+  struct frame_capture frame_capture;
+  // Extra views of the scene, rendered in one multiview pass and copied
+  // along the bottom of the swapchain image. Off unless the
+  // VKGUIDE_THUMBNAILS environment variable is set to anything but 0, and
+  // only when multiview is there.
+  bool thumbnails_enabled;
+  struct multiview_pass thumbnails;
+  // Sprites drawn over the finished frame when the VKGUIDE_OVERLAY_SPRITES
+  // environment variable is set: a CPU frame time graph and that many small
+  // quads to load the batch with. Never headless, and not recorded.
+  bool overlay_enabled;
+  uint32_t overlay_sprite_count;
+  struct sprite_batch overlay;
+  float frame_time_history[OVERLAY_HISTORY_LENGTH];
+  bool capture_requested;
+  enum frame_capture_encoding capture_encoding;
+  // The root spins one step per drawn frame while animate is set.
+  bool animate;
+  float animation_angle;
+  uint32_t current_frame;
+  uint64_t frame_number;
 };
 
 #define MAX_EXTENSION_COUNT 256
@@ -56,7 +189,20 @@ vulkan_debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
   return VK_FALSE;
 }
 
+bool extension_with_name_is_in_array(VkExtensionProperties *array,
+                                     uint32_t length,
+                                     const char *extension_name) {
+  for (uint32_t index = 0; index < length; index++) {
+    if (strcmp(array[index].extensionName, extension_name) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 bool vulkan_renderer_create_instance(struct vulkan_renderer *renderer) {
+  renderer->instance_version = device_features_instance_version();
 
   VkApplicationInfo application_info = {
       .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -64,13 +210,16 @@ bool vulkan_renderer_create_instance(struct vulkan_renderer *renderer) {
       .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
       .pEngineName = "None",
       .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-      .apiVersion = VK_API_VERSION_1_0};
+      .apiVersion = renderer->instance_version};
 
   const char *requested_extensions[MAX_EXTENSION_COUNT] = {0};
   uint32_t requested_extension_count = 0;
-  uint32_t required_instance_extension_count;
-  const char *const *required_instance_extensions =
-      SDL_Vulkan_GetInstanceExtensions(&required_instance_extension_count);
+  uint32_t required_instance_extension_count = 0;
+  const char *const *required_instance_extensions = NULL;
+  if (!renderer->headless) {
+    required_instance_extensions =
+        SDL_Vulkan_GetInstanceExtensions(&required_instance_extension_count);
+  }
 
   assert(requested_extension_count + required_instance_extension_count <
          MAX_EXTENSION_COUNT);
@@ -86,6 +235,25 @@ bool vulkan_renderer_create_instance(struct vulkan_renderer *renderer) {
         VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
   }
 
+  // VK_KHR_multiview depends on this on a Vulkan 1.0 instance, later ones
+  // have it in core.
+  uint32_t available_extension_count;
+  vkEnumerateInstanceExtensionProperties(NULL, &available_extension_count,
+                                         NULL);
+  assert(available_extension_count < MAX_EXTENSION_COUNT);
+  VkExtensionProperties available_extensions[MAX_EXTENSION_COUNT];
+  vkEnumerateInstanceExtensionProperties(NULL, &available_extension_count,
+                                         available_extensions);
+  renderer->has_physical_device_properties2 =
+      renderer->instance_version == VK_API_VERSION_1_0 &&
+      extension_with_name_is_in_array(
+          available_extensions, available_extension_count,
+          VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+  if (renderer->has_physical_device_properties2) {
+    additional_extensions[additional_extension_count++] =
+        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+  }
+
   assert(requested_extension_count + additional_extension_count <
          MAX_EXTENSION_COUNT);
   memcpy(requested_extensions + requested_extension_count,
@@ -112,8 +280,13 @@ bool vulkan_renderer_create_instance(struct vulkan_renderer *renderer) {
     uint32_t available_layer_count;
     vkEnumerateInstanceLayerProperties(&available_layer_count, NULL);
 
-    VkLayerProperties *available_layers =
-        malloc(available_layer_count * sizeof(VkLayerProperties));
+    VkLayerProperties *available_layers = host_allocator_alloc(
+        &renderer->host_allocator,
+        available_layer_count * sizeof(VkLayerProperties),
+        VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+    if (!available_layers) {
+      goto err;
+    }
     vkEnumerateInstanceLayerProperties(&available_layer_count,
                                        available_layers);
 
@@ -138,7 +311,7 @@ bool vulkan_renderer_create_instance(struct vulkan_renderer *renderer) {
       }
     }
 
-    free(available_layers);
+    host_allocator_free(&renderer->host_allocator, available_layers);
     if (!requested_layers_found) {
       LOG("Not all requested layers are available.");
       goto err;
@@ -160,7 +333,8 @@ bool vulkan_renderer_create_instance(struct vulkan_renderer *renderer) {
   }
 
   VkResult create_instance_result =
-      vkCreateInstance(&instance_create_info, NULL, &renderer->instance);
+      vkCreateInstance(&instance_create_info, renderer->allocation_callbacks,
+                       &renderer->instance);
   if (create_instance_result != VK_SUCCESS) {
     LOG("Vulkan instance creation failed, VkResult=%d", create_instance_result);
     goto err;
@@ -171,7 +345,7 @@ err:
 }
 
 void vulkan_renderer_destroy_instance(struct vulkan_renderer *renderer) {
-  vkDestroyInstance(renderer->instance, NULL);
+  vkDestroyInstance(renderer->instance, renderer->allocation_callbacks);
 }
 VkResult vkCreateDebugUtilsMessengerEXT(
     VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT *create_info,
@@ -212,7 +386,8 @@ bool vulkan_renderer_create_debug_messenger(struct vulkan_renderer *renderer) {
                                 VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
                                 VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
                  .pfnUserCallback = vulkan_debug_callback},
-             NULL, &renderer->debug_messenger) == VK_SUCCESS;
+             renderer->allocation_callbacks,
+             &renderer->debug_messenger) == VK_SUCCESS;
 }
 
 struct queue_family_indices {
@@ -244,11 +419,15 @@ struct queue_family_indices find_queue_families(VkPhysicalDevice device,
        queue_family_index++) {
     VkQueueFamilyProperties *queue_family = &queue_families[queue_family_index];
 
-    VkBool32 present_support;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, queue_family_index, surface,
-                                         &present_support);
+    VkBool32 present_support = VK_FALSE;
+    if (surface != VK_NULL_HANDLE) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, queue_family_index, surface,
+                                           &present_support);
+    }
 
-    if (queue_family->queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+    // The culling passes run compute work on the graphics queue.
+    VkQueueFlags graphics_flags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+    if ((queue_family->queueFlags & graphics_flags) == graphics_flags) {
       indices.graphics_family = queue_family_index;
       indices.has_graphics_family = true;
     }
@@ -257,6 +436,11 @@ struct queue_family_indices find_queue_families(VkPhysicalDevice device,
       indices.present_family = queue_family_index;
       indices.has_present_family = true;
     }
+    // Headless, nothing is presented and the graphics queue stands in.
+    if (surface == VK_NULL_HANDLE && indices.has_graphics_family) {
+      indices.present_family = indices.graphics_family;
+      indices.has_present_family = true;
+    }
 
     if (queue_family_indices_is_complete(&indices)) {
       break;
@@ -266,18 +450,6 @@ struct queue_family_indices find_queue_families(VkPhysicalDevice device,
   return indices;
 }
 
-bool extension_with_name_is_in_array(VkExtensionProperties *array,
-                                     uint32_t length,
-                                     const char *extension_name) {
-  for (uint32_t index = 0; index < length; index++) {
-    if (strcmp(array[index].extensionName, extension_name) == 0) {
-      return true;
-    }
-  }
-
-  return false;
-}
-
 bool device_supports_requested_extensions(VkPhysicalDevice device,
                                           const char **required_extensions,
                                           uint32_t required_extension_count) {
@@ -342,6 +514,9 @@ bool is_device_suitable(VkPhysicalDevice device, VkSurfaceKHR surface,
                         uint32_t required_extension_count) {
   struct queue_family_indices queue_family_indices =
       find_queue_families(device, surface);
+  if (surface == VK_NULL_HANDLE) {
+    return queue_family_indices_is_complete(&queue_family_indices);
+  }
 
   bool extensions_supported = device_supports_requested_extensions(
       device, required_extensions, required_extension_count);
@@ -440,19 +615,70 @@ bool vulkan_renderer_create_logical_device(struct vulkan_renderer *renderer) {
 
   VkPhysicalDeviceFeatures device_features = {0};
 
+  const char *enabled_extensions[MAX_EXTENSION_COUNT];
+  uint32_t enabled_extension_count =
+      renderer->headless ? 0 : required_extension_count;
+  memcpy(enabled_extensions, required_extensions,
+         required_extension_count * sizeof(const char *));
+
+  // Everything is optional; whatever the device has gets enabled and the
+  // rest of the renderer picks its paths from renderer->features.
+  struct device_features *features = &renderer->features;
+  device_features_query(renderer->physical_device, renderer->instance_version,
+                        features);
+  // Post-processing writes straight into the swapchain images with it.
+  device_features.shaderStorageImageWriteWithoutFormat =
+      features->storage_image_write_without_format;
+  if (features->api_version == VK_API_VERSION_1_0) {
+    // The multiview feature is mandatory for every device that exposes the
+    // extension, so there is nothing else to query.
+    static const char *multiview_extensions[] = {
+        VK_KHR_MULTIVIEW_EXTENSION_NAME};
+    features->multiview =
+        (renderer->instance_version > VK_API_VERSION_1_0 ||
+         renderer->has_physical_device_properties2) &&
+        device_supports_requested_extensions(renderer->physical_device,
+                                             multiview_extensions, 1);
+    if (features->multiview) {
+      enabled_extensions[enabled_extension_count++] =
+          VK_KHR_MULTIVIEW_EXTENSION_NAME;
+    }
+  }
+  // Heap usage and budget for telemetry. Its dependency on
+  // VK_KHR_get_physical_device_properties2 is only met by a 1.1 instance
+  // here, since the 1.0 path doesn't load the KHR entry points.
+  static const char *memory_budget_extensions[] = {
+      VK_EXT_MEMORY_BUDGET_EXTENSION_NAME};
+  features->memory_budget =
+      renderer->instance_version >= VK_API_VERSION_1_1 &&
+      device_supports_requested_extensions(renderer->physical_device,
+                                           memory_budget_extensions, 1);
+  if (features->memory_budget) {
+    enabled_extensions[enabled_extension_count++] =
+        VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+  }
+  // Queue submission needs a timeline semaphore to signal along with
+  // synchronization2, which every 1.3 device has anyway.
+  features->synchronization2 =
+      features->synchronization2 && features->timeline_semaphore;
+  struct device_feature_chain feature_chain;
+
   if (vkCreateDevice(renderer->physical_device,
                      &(const VkDeviceCreateInfo){
                          .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+                         .pNext = device_features_chain(features,
+                                                        &feature_chain),
                          .pQueueCreateInfos = queue_create_infos,
                          .queueCreateInfoCount = queue_create_info_count,
                          .pEnabledFeatures = &device_features,
-                         .ppEnabledExtensionNames = required_extensions,
-                         .enabledExtensionCount = required_extension_count,
+                         .ppEnabledExtensionNames = enabled_extensions,
+                         .enabledExtensionCount = enabled_extension_count,
                          // TODO maybe add the validation layers
                          // Not required according to vulkan-tutorial, but might
                          // be good for compatibility
                      },
-                     NULL, &renderer->device) != VK_SUCCESS) {
+                     renderer->allocation_callbacks,
+                     &renderer->device) != VK_SUCCESS) {
     LOG("Couldn't create logical vulkan device");
     return false;
   }
@@ -463,6 +689,7 @@ bool vulkan_renderer_create_logical_device(struct vulkan_renderer *renderer) {
                    &renderer->present_queue);
   LOG("graphics_queue: %p", (void *)renderer->graphics_queue);
   LOG("present_queue: %p", (void *)renderer->present_queue);
+  device_features_log(features);
 
   return true;
 }
@@ -484,6 +711,29 @@ choose_swapchain_surface_format(VkSurfaceFormatKHR *available_formats,
   return available_formats[0];
 }
 
+// Picks an sRGB color space format that compute shaders can write to.
+bool choose_swapchain_storage_format(VkPhysicalDevice physical_device,
+                                     VkSurfaceFormatKHR *available_formats,
+                                     uint32_t available_format_count,
+                                     VkSurfaceFormatKHR *out_format) {
+  for (uint32_t available_format_index = 0;
+       available_format_index < available_format_count;
+       available_format_index++) {
+    VkSurfaceFormatKHR available_format =
+        available_formats[available_format_index];
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physical_device,
+                                        available_format.format, &properties);
+    if (available_format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR &&
+        (properties.optimalTilingFeatures &
+         VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+      *out_format = available_format;
+      return true;
+    }
+  }
+  return false;
+}
+
 VkPresentModeKHR
 choose_swapchain_present_mode(VkPresentModeKHR *available_present_modes,
                               uint32_t available_present_mode_count) {
@@ -527,6 +777,17 @@ bool vulkan_renderer_create_swapchain(struct vulkan_renderer *renderer,
 
   VkSurfaceFormatKHR surface_format = choose_swapchain_surface_format(
       swapchain_support.formats, swapchain_support.format_count);
+  // Post-processing writes the swapchain image from a compute shader when it
+  // can, which usually means a UNORM format the shader encodes sRGB into.
+  renderer->swapchain_storage =
+      renderer->post_config.effects &&
+      renderer->features.storage_image_write_without_format &&
+      (swapchain_support.capabilities.supportedUsageFlags &
+       VK_IMAGE_USAGE_STORAGE_BIT) &&
+      choose_swapchain_storage_format(renderer->physical_device,
+                                      swapchain_support.formats,
+                                      swapchain_support.format_count,
+                                      &surface_format);
   VkPresentModeKHR present_mode = choose_swapchain_present_mode(
       swapchain_support.present_modes, swapchain_support.present_mode_count);
   VkExtent2D extent = choose_swapchain_extent(
@@ -546,6 +807,24 @@ bool vulkan_renderer_create_swapchain(struct vulkan_renderer *renderer,
   create_info.imageExtent = extent;
   create_info.imageArrayLayers = 1;
   create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  // Frame captures copy straight out of the swapchain images.
+  renderer->swapchain_capturable =
+      (swapchain_support.capabilities.supportedUsageFlags &
+       VK_IMAGE_USAGE_TRANSFER_SRC_BIT) &&
+      frame_capture_supports_format(surface_format.format);
+  if (renderer->swapchain_capturable) {
+    create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
+  // Multiview thumbnails are copied into the swapchain images.
+  renderer->swapchain_transfer_dst =
+      swapchain_support.capabilities.supportedUsageFlags &
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  if (renderer->swapchain_transfer_dst) {
+    create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  }
+  if (renderer->swapchain_storage) {
+    create_info.imageUsage |= VK_IMAGE_USAGE_STORAGE_BIT;
+  }
 
   struct queue_family_indices indices =
       find_queue_families(renderer->physical_device, renderer->surface);
@@ -566,7 +845,8 @@ bool vulkan_renderer_create_swapchain(struct vulkan_renderer *renderer,
   create_info.clipped = VK_TRUE;
   create_info.oldSwapchain = VK_NULL_HANDLE;
 
-  if (vkCreateSwapchainKHR(renderer->device, &create_info, NULL,
+  if (vkCreateSwapchainKHR(renderer->device, &create_info,
+                           renderer->allocation_callbacks,
                            &renderer->swapchain) != VK_SUCCESS) {
     LOG("Couldn't create swapchain");
     return false;
@@ -581,6 +861,8 @@ bool vulkan_renderer_create_swapchain(struct vulkan_renderer *renderer,
                           &actual_image_count, renderer->swapchain_images);
   renderer->swapchain_image_format = surface_format.format;
   renderer->swapchain_extent = extent;
+  telemetry_set_swapchain(extent, surface_format.format, present_mode,
+                          actual_image_count);
   return true;
 }
 
@@ -599,7 +881,8 @@ bool vulkan_renderer_create_swapchain_image_views(
                 .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                                      .levelCount = 1,
                                      .layerCount = 1}},
-            NULL, &renderer->swapchain_image_views[swapchain_image_index]) !=
+            renderer->allocation_callbacks,
+            &renderer->swapchain_image_views[swapchain_image_index]) !=
         VK_SUCCESS) {
       goto err;
     }
@@ -611,76 +894,41 @@ err:
   for (uint32_t image_view_index = 0; image_view_index < swapchain_image_index;
        image_view_index++) {
     vkDestroyImageView(renderer->device,
-                       renderer->swapchain_image_views[image_view_index], NULL);
+                       renderer->swapchain_image_views[image_view_index],
+                       renderer->allocation_callbacks);
   }
   return false;
 }
 
-char *load_shader_from_file(const char *path, size_t *out_size) {
-  FILE *file_handle = fopen(path, "rb");
-  if (!file_handle) {
-    goto err;
-  }
-
-  if (fseek(file_handle, 0, SEEK_END) < 0) {
-    goto close_file;
-  }
-
-  long file_size = ftell(file_handle);
-  if (file_size < 0) {
-    goto close_file;
-  }
-  rewind(file_handle);
-  char *shader_file_content = malloc(file_size);
-  if (fread(shader_file_content, file_size, 1, file_handle) != 1) {
-    goto free_shader_file_content;
-  }
-
-  if (fclose(file_handle) != 0) {
-    goto err;
-  }
-
-  *out_size = file_size;
-  return shader_file_content;
-free_shader_file_content:
-  free(shader_file_content);
-close_file:
-  fclose(file_handle);
-err:
-  return NULL;
-}
-
-VkShaderModule create_shader_module(VkDevice device, char *code,
-                                    size_t code_size) {
-  VkShaderModule shader_module;
-  if (vkCreateShaderModule(
-          device,
-          &(const VkShaderModuleCreateInfo){
-              .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-              .codeSize = code_size,
-              .pCode = (const uint32_t *)code,
-          },
-          NULL, &shader_module) != VK_SUCCESS) {
-    return NULL;
-  }
-
-  return shader_module;
+// Stands in for the swapchain without a window: a single image slot with
+// nothing behind it, since headless frames stay in the scene target.
+void vulkan_renderer_create_headless_swapchain(struct vulkan_renderer *renderer,
+                                               VkExtent2D extent,
+                                               VkFormat format) {
+  renderer->swapchain = VK_NULL_HANDLE;
+  renderer->swapchain_image_count = 1;
+  renderer->swapchain_images[0] = VK_NULL_HANDLE;
+  renderer->swapchain_image_views[0] = VK_NULL_HANDLE;
+  renderer->swapchain_image_format = format;
+  renderer->swapchain_extent = extent;
+  renderer->swapchain_capturable = false;
+  renderer->swapchain_transfer_dst = false;
+  renderer->swapchain_storage = false;
 }
 
 bool vulkan_renderer_create_graphics_pipeline(
     struct vulkan_renderer *renderer) {
-  size_t vertex_shader_code_size;
-  char *vertex_shader_code = load_shader_from_file("shaders/triangle.vert.spv",
-                                                   &vertex_shader_code_size);
-  size_t fragment_shader_code_size;
-  char *fragment_shader_code = load_shader_from_file(
-      "shaders/triangle.frag.spv", &fragment_shader_code_size);
-  VkShaderModule vertex_shader_module = create_shader_module(
-      renderer->device, vertex_shader_code, vertex_shader_code_size);
-  VkShaderModule fragment_shader_module = create_shader_module(
-      renderer->device, fragment_shader_code, fragment_shader_code_size);
-  free(vertex_shader_code);
-  free(fragment_shader_code);
+  VkShaderModule vertex_shader_module = shader_variant_create_module(
+      renderer->device, renderer->allocation_callbacks,
+      &renderer->host_allocator,
+      shader_variant_key_make(SHADER_SOURCE_TRIANGLE_VERT, 0));
+  VkShaderModule fragment_shader_module = shader_variant_create_module(
+      renderer->device, renderer->allocation_callbacks,
+      &renderer->host_allocator,
+      shader_variant_key_make(SHADER_SOURCE_TRIANGLE_FRAG, 0));
+  if (!vertex_shader_module || !fragment_shader_module) {
+    goto destroy_shader_modules;
+  }
 
   VkPipelineShaderStageCreateInfo vertex_shader_stage_info = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -755,15 +1003,25 @@ bool vulkan_renderer_create_graphics_pipeline(
       .attachmentCount = 1,
       .pAttachments = &color_blend_attachment};
 
+  VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+      .depthTestEnable = VK_TRUE,
+      .depthWriteEnable = VK_TRUE,
+      .depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL};
+
   if (vkCreatePipelineLayout(
           renderer->device,
           &(const VkPipelineLayoutCreateInfo){
               .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+              .setLayoutCount = 1,
+              .pSetLayouts = &renderer->descriptor_set_layout,
           },
-          NULL, &renderer->pipeline_layout) != VK_SUCCESS) {
+          renderer->allocation_callbacks,
+          &renderer->pipeline_layout) != VK_SUCCESS) {
     goto destroy_shader_modules;
   }
 
+  VkPipeline pipeline;
   if (vkCreateGraphicsPipelines(
           renderer->device, VK_NULL_HANDLE, 1,
           &(const VkGraphicsPipelineCreateInfo){
@@ -775,6 +1033,7 @@ bool vulkan_renderer_create_graphics_pipeline(
               .pViewportState = &viewport_state,
               .pRasterizationState = &rasterizer,
               .pMultisampleState = &multisampling,
+              .pDepthStencilState = &depth_stencil,
               .pColorBlendState = &color_blending,
               .pDynamicState = &dynamic_state,
               .layout = renderer->pipeline_layout,
@@ -782,52 +1041,361 @@ bool vulkan_renderer_create_graphics_pipeline(
               .subpass = 0,
 
           },
-          NULL, &renderer->pipeline) != VK_SUCCESS) {
-    goto destroy_shader_modules;
+          renderer->allocation_callbacks, &pipeline) != VK_SUCCESS) {
+    goto destroy_pipeline_layout;
+  }
+  telemetry_count(TELEMETRY_COUNTER_PIPELINE_COMPILES, 1);
+  if (!resource_manager_add_pipeline(&renderer->resources, pipeline,
+                                     &renderer->pipeline)) {
+    goto destroy_pipeline_layout;
   }
 
-  vkDestroyShaderModule(renderer->device, vertex_shader_module, NULL);
-  vkDestroyShaderModule(renderer->device, fragment_shader_module, NULL);
+  vkDestroyShaderModule(renderer->device, vertex_shader_module,
+                        renderer->allocation_callbacks);
+  vkDestroyShaderModule(renderer->device, fragment_shader_module,
+                        renderer->allocation_callbacks);
   return true;
+destroy_pipeline_layout:
+  vkDestroyPipelineLayout(renderer->device, renderer->pipeline_layout,
+                          renderer->allocation_callbacks);
 destroy_shader_modules:
-  vkDestroyShaderModule(renderer->device, vertex_shader_module, NULL);
-  vkDestroyShaderModule(renderer->device, fragment_shader_module, NULL);
+  vkDestroyShaderModule(renderer->device, vertex_shader_module,
+                        renderer->allocation_callbacks);
+  vkDestroyShaderModule(renderer->device, fragment_shader_module,
+                        renderer->allocation_callbacks);
+  return false;
+}
+
+bool choose_depth_format(VkPhysicalDevice physical_device,
+                         VkFormat *out_format) {
+  // The depth buffer is sampled when building the depth pyramid.
+  static const VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT,
+                                        VK_FORMAT_D16_UNORM};
+  VkFormatFeatureFlags required_features =
+      VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT |
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+  for (uint32_t candidate_index = 0;
+       candidate_index < sizeof(candidates) / sizeof(VkFormat);
+       candidate_index++) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(
+        physical_device, candidates[candidate_index], &properties);
+    if ((properties.optimalTilingFeatures & required_features) ==
+        required_features) {
+      *out_format = candidates[candidate_index];
+      return true;
+    }
+  }
+  return false;
+}
+
+bool vulkan_renderer_create_depth_resources(struct vulkan_renderer *renderer) {
+  if (!choose_depth_format(renderer->physical_device,
+                           &renderer->depth_format)) {
+    LOG("No sampleable depth format");
+    goto err;
+  }
+
+  if (!resource_manager_create_image(
+          &renderer->resources,
+          &(const VkImageCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+              .imageType = VK_IMAGE_TYPE_2D,
+              .format = renderer->depth_format,
+              .extent = {renderer->swapchain_extent.width,
+                         renderer->swapchain_extent.height, 1},
+              .mipLevels = 1,
+              .arrayLayers = 1,
+              .samples = VK_SAMPLE_COUNT_1_BIT,
+              .tiling = VK_IMAGE_TILING_OPTIMAL,
+              .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                       VK_IMAGE_USAGE_SAMPLED_BIT,
+              .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+              .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED},
+          &renderer->depth_image)) {
+    goto err;
+  }
+
+  if (!resource_manager_create_image_view(
+          &renderer->resources,
+          &(const VkImageViewCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+              .image = resource_manager_image(&renderer->resources,
+                                              renderer->depth_image)
+                           ->image,
+              .viewType = VK_IMAGE_VIEW_TYPE_2D,
+              .format = renderer->depth_format,
+              .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+                                   .levelCount = 1,
+                                   .layerCount = 1}},
+          &renderer->depth_image_view)) {
+    goto destroy_depth_image;
+  }
+
+  return true;
+destroy_depth_image:
+  resource_manager_destroy(&renderer->resources, RESOURCE_TYPE_IMAGE,
+                           renderer->depth_image, renderer->frame_number);
+err:
+  return false;
+}
+
+// The targets go once the frames drawn so far have completed.
+void vulkan_renderer_destroy_depth_resources(
+    struct vulkan_renderer *renderer) {
+  resource_manager_destroy(&renderer->resources, RESOURCE_TYPE_IMAGE_VIEW,
+                           renderer->depth_image_view, renderer->frame_number);
+  resource_manager_destroy(&renderer->resources, RESOURCE_TYPE_IMAGE,
+                           renderer->depth_image, renderer->frame_number);
+}
+
+bool vulkan_renderer_create_scene_target(struct vulkan_renderer *renderer) {
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(renderer->physical_device,
+                                      renderer->swapchain_image_format,
+                                      &properties);
+  // Headless, the scene target is all there is and nothing gets blitted.
+  VkFormatFeatureFlags required_features =
+      VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT;
+  if (!renderer->headless) {
+    required_features |=
+        VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+  }
+  renderer->render_offscreen =
+      (renderer->headless || renderer->swapchain_transfer_dst) &&
+      (properties.optimalTilingFeatures & required_features) ==
+          required_features;
+
+  // Without the storage path the chain blits its result onto the swapchain
+  // image. Headless frames are left as rendered.
+  VkFormatProperties post_properties;
+  vkGetPhysicalDeviceFormatProperties(
+      renderer->physical_device, POST_SCENE_FORMAT, &post_properties);
+  VkFormatFeatureFlags post_features =
+      VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT |
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT |
+      VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+  bool post_blit =
+      renderer->swapchain_transfer_dst &&
+      (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT) &&
+      (post_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
+  renderer->post_enabled =
+      !renderer->headless && renderer->post_config.effects &&
+      (renderer->swapchain_storage || post_blit) &&
+      (post_properties.optimalTilingFeatures & post_features) == post_features;
+  if (!renderer->headless && renderer->post_config.effects &&
+      !renderer->post_enabled) {
+    LOG("Can't post-process into the swapchain, presenting the scene as is");
+  }
+  renderer->render_offscreen |= renderer->post_enabled;
+  renderer->scene_color_format = renderer->post_enabled
+                                     ? POST_SCENE_FORMAT
+                                     : renderer->swapchain_image_format;
+  if (!renderer->render_offscreen) {
+    if (renderer->headless) {
+      LOG("Can't render to format %d", renderer->swapchain_image_format);
+      return false;
+    }
+    LOG("Can't blit to the swapchain, rendering at full resolution");
+    return true;
+  }
+  renderer->upscale_filter =
+      properties.optimalTilingFeatures &
+              VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+          ? VK_FILTER_LINEAR
+          : VK_FILTER_NEAREST;
+
+  // Allocated once at the largest size it can be rendered at.
+  if (!resource_manager_create_image(
+          &renderer->resources,
+          &(const VkImageCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+              .imageType = VK_IMAGE_TYPE_2D,
+              .format = renderer->scene_color_format,
+              .extent = {renderer->swapchain_extent.width,
+                         renderer->swapchain_extent.height, 1},
+              .mipLevels = 1,
+              .arrayLayers = 1,
+              .samples = VK_SAMPLE_COUNT_1_BIT,
+              .tiling = VK_IMAGE_TILING_OPTIMAL,
+              .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                       (renderer->post_enabled
+                            ? VK_IMAGE_USAGE_SAMPLED_BIT
+                            : VK_IMAGE_USAGE_TRANSFER_SRC_BIT),
+              .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+              .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED},
+          &renderer->scene_color_image)) {
+    goto err;
+  }
+
+  if (!resource_manager_create_image_view(
+          &renderer->resources,
+          &(const VkImageViewCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+              .image = resource_manager_image(&renderer->resources,
+                                              renderer->scene_color_image)
+                           ->image,
+              .viewType = VK_IMAGE_VIEW_TYPE_2D,
+              .format = renderer->scene_color_format,
+              .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                   .levelCount = 1,
+                                   .layerCount = 1}},
+          &renderer->scene_color_view)) {
+    goto destroy_scene_color_image;
+  }
+
+  return true;
+destroy_scene_color_image:
+  resource_manager_destroy(&renderer->resources, RESOURCE_TYPE_IMAGE,
+                           renderer->scene_color_image,
+                           renderer->frame_number);
+err:
   return false;
 }
 
+void vulkan_renderer_destroy_scene_target(struct vulkan_renderer *renderer) {
+  if (!renderer->render_offscreen) {
+    return;
+  }
+  resource_manager_destroy(&renderer->resources, RESOURCE_TYPE_IMAGE_VIEW,
+                           renderer->scene_color_view, renderer->frame_number);
+  resource_manager_destroy(&renderer->resources, RESOURCE_TYPE_IMAGE,
+                           renderer->scene_color_image,
+                           renderer->frame_number);
+}
+
 bool vulkan_renderer_create_render_pass(struct vulkan_renderer *renderer) {
-  VkAttachmentDescription color_attachment = {
-      .format = renderer->swapchain_image_format,
-      .samples = VK_SAMPLE_COUNT_1_BIT,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-      .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+  // Early pass: clears, then leaves depth readable by the pyramid build.
+  VkAttachmentDescription attachments[] = {
+      {.format = renderer->scene_color_format,
+       .samples = VK_SAMPLE_COUNT_1_BIT,
+       .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+       .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+       .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+       .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+       .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+       .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+      {.format = renderer->depth_format,
+       .samples = VK_SAMPLE_COUNT_1_BIT,
+       .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+       .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+       .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+       .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+       .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+       .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL}};
 
   VkAttachmentReference color_attachment_ref = {
       .attachment = 0,
       .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
   };
+  VkAttachmentReference depth_attachment_ref = {
+      .attachment = 1,
+      .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+  };
 
   VkSubpassDescription subpass = {.pipelineBindPoint =
                                       VK_PIPELINE_BIND_POINT_GRAPHICS,
                                   .colorAttachmentCount = 1,
-                                  .pColorAttachments = &color_attachment_ref};
+                                  .pColorAttachments = &color_attachment_ref,
+                                  .pDepthStencilAttachment =
+                                      &depth_attachment_ref};
+
+  // The image acquire semaphore is waited on at the color attachment output
+  // stage, so the layout transition has to wait for that stage too. Depth is
+  // shared by all frames in flight, so the clear also waits for the previous
+  // frame's depth writes and pyramid reads; so is the offscreen color target,
+  // which the previous frame's upscale or post-processing reads.
+  VkSubpassDependency dependencies[] = {
+      {.srcSubpass = VK_SUBPASS_EXTERNAL,
+       .dstSubpass = 0,
+       .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                       VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+       .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+       .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                       VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+       .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT},
+      {.srcSubpass = 0,
+       .dstSubpass = VK_SUBPASS_EXTERNAL,
+       .srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+       .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+       .dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+       .dstAccessMask = VK_ACCESS_SHADER_READ_BIT}};
 
   if (vkCreateRenderPass(renderer->device,
                          &(const VkRenderPassCreateInfo){
                              .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-                             .attachmentCount = 1,
-                             .pAttachments = &color_attachment,
+                             .attachmentCount = 2,
+                             .pAttachments = attachments,
                              .subpassCount = 1,
-                             .pSubpasses = &subpass},
-                         NULL, &renderer->render_pass) != VK_SUCCESS) {
-    return false;
+                             .pSubpasses = &subpass,
+                             .dependencyCount = 2,
+                             .pDependencies = dependencies},
+                         renderer->allocation_callbacks,
+                         &renderer->render_pass) != VK_SUCCESS) {
+    goto err;
+  }
+
+  // Late pass: loads what the early pass drew and presents it, or hands it
+  // to the upscale or the post-processing chain.
+  attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  attachments[0].finalLayout =
+      renderer->post_enabled       ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+      : renderer->render_offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                   : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[1].initialLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  VkSubpassDependency late_dependencies[] = {
+      {.srcSubpass = VK_SUBPASS_EXTERNAL,
+       .dstSubpass = 0,
+       .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+       .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+       .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                       VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+       .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT},
+      // Only used when rendering offscreen.
+      {.srcSubpass = 0,
+       .dstSubpass = VK_SUBPASS_EXTERNAL,
+       .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+       .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+       .dstStageMask = renderer->post_enabled
+                           ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                           : VK_PIPELINE_STAGE_TRANSFER_BIT,
+       .dstAccessMask = renderer->post_enabled ? VK_ACCESS_SHADER_READ_BIT
+                                               : VK_ACCESS_TRANSFER_READ_BIT}};
+
+  if (vkCreateRenderPass(renderer->device,
+                         &(const VkRenderPassCreateInfo){
+                             .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+                             .attachmentCount = 2,
+                             .pAttachments = attachments,
+                             .subpassCount = 1,
+                             .pSubpasses = &subpass,
+                             .dependencyCount =
+                                 renderer->render_offscreen ? 2 : 1,
+                             .pDependencies = late_dependencies},
+                         renderer->allocation_callbacks,
+                         &renderer->late_render_pass) != VK_SUCCESS) {
+    goto destroy_render_pass;
   }
 
   return true;
+destroy_render_pass:
+  vkDestroyRenderPass(renderer->device, renderer->render_pass,
+                      renderer->allocation_callbacks);
+err:
+  return false;
 }
 
 bool vulkan_renderer_create_framebuffers(struct vulkan_renderer *renderer) {
@@ -835,19 +1403,24 @@ bool vulkan_renderer_create_framebuffers(struct vulkan_renderer *renderer) {
        swapchain_image_view_index < renderer->swapchain_image_count;
        swapchain_image_view_index++) {
     VkImageView attachments[] = {
-        renderer->swapchain_image_views[swapchain_image_view_index]};
+        renderer->render_offscreen
+            ? resource_manager_image_view(&renderer->resources,
+                                          renderer->scene_color_view)
+            : renderer->swapchain_image_views[swapchain_image_view_index],
+        resource_manager_image_view(&renderer->resources,
+                                    renderer->depth_image_view)};
 
     if (vkCreateFramebuffer(
             renderer->device,
             &(const VkFramebufferCreateInfo){
                 .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
                 .renderPass = renderer->render_pass,
-                .attachmentCount = 1,
+                .attachmentCount = 2,
                 .pAttachments = attachments,
                 .width = renderer->swapchain_extent.width,
                 .height = renderer->swapchain_extent.height,
                 .layers = 1},
-            NULL,
+            renderer->allocation_callbacks,
             &renderer->swapchain_framebuffers[swapchain_image_view_index]) !=
         VK_SUCCESS) {
       return false;
@@ -855,173 +1428,2076 @@ bool vulkan_renderer_create_framebuffers(struct vulkan_renderer *renderer) {
   }
   return true;
 }
-bool vulkan_renderer_init(struct vulkan_renderer *renderer,
-                          SDL_Window *window) {
-  assert(renderer);
-  assert(window);
-#ifdef NDEBUG
-  renderer->enable_validation_layers = false;
-#else
-  renderer->enable_validation_layers = true;
-#endif
+bool vulkan_renderer_create_descriptor_set_layout(
+    struct vulkan_renderer *renderer) {
+  return vkCreateDescriptorSetLayout(
+             renderer->device,
+             &(const VkDescriptorSetLayoutCreateInfo){
+                 .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+                 .bindingCount = 3,
+                 .pBindings =
+                     (const VkDescriptorSetLayoutBinding[]){
+                         {.binding = 0,
+                          .descriptorType =
+                              VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                          .descriptorCount = 1,
+                          .stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+                                        VK_SHADER_STAGE_FRAGMENT_BIT},
+                         {.binding = 1,
+                          .descriptorType =
+                              VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                          .descriptorCount = 1,
+                          .stageFlags = VK_SHADER_STAGE_VERTEX_BIT},
+                         {.binding = 2,
+                          .descriptorType =
+                              VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                          .descriptorCount = 1,
+                          .stageFlags = VK_SHADER_STAGE_VERTEX_BIT}}},
+             renderer->allocation_callbacks,
+             &renderer->descriptor_set_layout) == VK_SUCCESS;
+}
 
-  if (!vulkan_renderer_create_instance(renderer)) {
+bool vulkan_renderer_create_descriptor_sets(struct vulkan_renderer *renderer) {
+  if (vkCreateDescriptorPool(
+          renderer->device,
+          &(const VkDescriptorPoolCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+              .maxSets = 1,
+              .poolSizeCount = 2,
+              .pPoolSizes =
+                  (const VkDescriptorPoolSize[]){
+                      {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                       .descriptorCount = 1},
+                      {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                       .descriptorCount = 2}}},
+          renderer->allocation_callbacks,
+          &renderer->descriptor_pool) != VK_SUCCESS) {
     goto err;
   }
 
-  if (renderer->enable_validation_layers) {
-    if (!vulkan_renderer_create_debug_messenger(renderer)) {
-      LOG("Couldn't create Vulkan renderer debug messenger.");
-    }
+  if (vkAllocateDescriptorSets(
+          renderer->device,
+          &(const VkDescriptorSetAllocateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+              .descriptorPool = renderer->descriptor_pool,
+              .descriptorSetCount = 1,
+              .pSetLayouts = &renderer->descriptor_set_layout},
+          &renderer->draw_descriptor_set) != VK_SUCCESS) {
+    goto destroy_descriptor_pool;
   }
 
-  if (!SDL_Vulkan_CreateSurface(window, renderer->instance, NULL,
-                                &renderer->surface)) {
-    LOG("Couldn't create Vulkan rendering surface: %s", SDL_GetError());
-    goto destroy_instance;
-  }
+  // Written once: every draw selects its slice of the uniform ring and the
+  // instance region of its frame through dynamic offsets instead of
+  // descriptor updates.
+  VkDescriptorBufferInfo uniform_buffer_info = uniform_ring_descriptor_info(
+      &renderer->uniform_ring, sizeof(struct draw_uniforms));
+  VkDescriptorBufferInfo instance_buffer_info =
+      instance_buffer_descriptor_info(&renderer->instance_buffer);
+  VkDescriptorBufferInfo visible_index_info =
+      occlusion_culler_visible_index_info(&renderer->occlusion_culler);
+  vkUpdateDescriptorSets(
+      renderer->device, 3,
+      (const VkWriteDescriptorSet[]){
+          {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+           .dstSet = renderer->draw_descriptor_set,
+           .dstBinding = 0,
+           .descriptorCount = 1,
+           .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+           .pBufferInfo = &uniform_buffer_info},
+          {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+           .dstSet = renderer->draw_descriptor_set,
+           .dstBinding = 1,
+           .descriptorCount = 1,
+           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+           .pBufferInfo = &instance_buffer_info},
+          {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+           .dstSet = renderer->draw_descriptor_set,
+           .dstBinding = 2,
+           .descriptorCount = 1,
+           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+           .pBufferInfo = &visible_index_info}},
+      0, NULL);
 
-  if (!vulkan_renderer_pick_physical_device(renderer)) {
-    LOG("Couldn't pick the appropriate physical device.");
-    goto destroy_surface;
-  }
+  return true;
+destroy_descriptor_pool:
+  vkDestroyDescriptorPool(renderer->device, renderer->descriptor_pool,
+                          renderer->allocation_callbacks);
+err:
+  return false;
+}
 
-  if (!vulkan_renderer_create_logical_device(renderer)) {
-    LOG("Couldn't create the logical device");
-    goto destroy_surface;
-  }
+bool vulkan_renderer_create_command_buffers(struct vulkan_renderer *renderer) {
+  struct queue_family_indices indices =
+      find_queue_families(renderer->physical_device, renderer->surface);
 
-  int window_width_px;
-  int window_height_px;
-  if (!SDL_GetWindowSizeInPixels(window, &window_width_px, &window_height_px)) {
-    LOG("Couldn't get window size");
-    goto destroy_surface;
+  if (vkCreateCommandPool(
+          renderer->device,
+          &(const VkCommandPoolCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+              .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+              .queueFamilyIndex = indices.graphics_family},
+          renderer->allocation_callbacks,
+          &renderer->command_pool) != VK_SUCCESS) {
+    return false;
   }
 
-  if (!vulkan_renderer_create_swapchain(renderer, window_width_px,
-                                        window_height_px)) {
-    LOG("Couldn't create swapchain");
-    goto destroy_logical_device;
+  if (vkAllocateCommandBuffers(
+          renderer->device,
+          &(const VkCommandBufferAllocateInfo){
+              .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+              .commandPool = renderer->command_pool,
+              .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+              .commandBufferCount = MAX_FRAMES_IN_FLIGHT},
+          renderer->command_buffers) != VK_SUCCESS ||
+      vkAllocateCommandBuffers(
+          renderer->device,
+          &(const VkCommandBufferAllocateInfo){
+              .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+              .commandPool = renderer->command_pool,
+              .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+              .commandBufferCount = MAX_FRAMES_IN_FLIGHT},
+          renderer->output_command_buffers) != VK_SUCCESS) {
+    vkDestroyCommandPool(renderer->device, renderer->command_pool,
+                         renderer->allocation_callbacks);
+    return false;
   }
 
-  if (!vulkan_renderer_create_swapchain_image_views(renderer)) {
-    LOG("Couldn't create swapchain image views");
-    goto destroy_swapchain;
+  return true;
+}
+
+void vulkan_renderer_destroy_sync_objects(struct vulkan_renderer *renderer) {
+  for (uint32_t frame_index = 0; frame_index < MAX_FRAMES_IN_FLIGHT;
+       frame_index++) {
+    vkDestroySemaphore(renderer->device,
+                       renderer->image_available_semaphores[frame_index],
+                       renderer->allocation_callbacks);
+    vkDestroyFence(renderer->device, renderer->in_flight_fences[frame_index],
+                   renderer->allocation_callbacks);
   }
+  vkDestroySemaphore(renderer->device, renderer->frame_timeline,
+                     renderer->allocation_callbacks);
+  for (uint32_t swapchain_image_index = 0;
+       swapchain_image_index < renderer->swapchain_image_count;
+       swapchain_image_index++) {
+    vkDestroySemaphore(
+        renderer->device,
+        renderer->render_finished_semaphores[swapchain_image_index],
+        renderer->allocation_callbacks);
+  }
+}
 
-  if (!vulkan_renderer_create_render_pass(renderer)) {
-    LOG("Couldn't create render pass");
-    goto destroy_swapchain_image_views;
+bool vulkan_renderer_create_sync_objects(struct vulkan_renderer *renderer) {
+  // Handles that never get created stay VK_NULL_HANDLE, which the destroy
+  // functions accept, so a partial failure can clean up everything.
+  memset(renderer->image_available_semaphores, 0,
+         sizeof(renderer->image_available_semaphores));
+  memset(renderer->render_finished_semaphores, 0,
+         sizeof(renderer->render_finished_semaphores));
+  memset(renderer->in_flight_fences, 0, sizeof(renderer->in_flight_fences));
+  renderer->frame_timeline = VK_NULL_HANDLE;
+
+  const VkSemaphoreCreateInfo semaphore_create_info = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+  for (uint32_t frame_index = 0; frame_index < MAX_FRAMES_IN_FLIGHT;
+       frame_index++) {
+    if (vkCreateSemaphore(
+            renderer->device, &semaphore_create_info,
+            renderer->allocation_callbacks,
+            &renderer->image_available_semaphores[frame_index]) != VK_SUCCESS) {
+      goto err;
+    }
   }
 
-  if (!vulkan_renderer_create_graphics_pipeline(renderer)) {
-    LOG("Couldn't create graphics pipeline");
-    goto destroy_render_pass;
+  if (renderer->features.timeline_semaphore) {
+    if (vkCreateSemaphore(
+            renderer->device,
+            &(const VkSemaphoreCreateInfo){
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                .pNext =
+                    &(const VkSemaphoreTypeCreateInfo){
+                        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+                        .initialValue = 0}},
+            renderer->allocation_callbacks,
+            &renderer->frame_timeline) != VK_SUCCESS) {
+      goto err;
+    }
+  } else {
+    for (uint32_t frame_index = 0; frame_index < MAX_FRAMES_IN_FLIGHT;
+         frame_index++) {
+      if (vkCreateFence(renderer->device,
+                        &(const VkFenceCreateInfo){
+                            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+                            .flags = VK_FENCE_CREATE_SIGNALED_BIT},
+                        renderer->allocation_callbacks,
+                        &renderer->in_flight_fences[frame_index]) !=
+          VK_SUCCESS) {
+        goto err;
+      }
+    }
   }
 
-  if (!vulkan_renderer_create_framebuffers(renderer)) {
-    LOG("Couldn't create framebuffers");
-    goto destroy_graphics_pipeline;
+  // Presentation may still hold the semaphore after the frame's fence
+  // signals, so render finished semaphores belong to swapchain images.
+  for (uint32_t swapchain_image_index = 0;
+       swapchain_image_index < renderer->swapchain_image_count;
+       swapchain_image_index++) {
+    if (vkCreateSemaphore(
+            renderer->device, &semaphore_create_info,
+            renderer->allocation_callbacks,
+            &renderer->render_finished_semaphores[swapchain_image_index]) !=
+        VK_SUCCESS) {
+      goto err;
+    }
   }
 
+  renderer->current_frame = 0;
+  renderer->frame_number = 0;
   return true;
-
-destroy_graphics_pipeline:
-  vkDestroyPipeline(renderer->device, renderer->pipeline, NULL);
-destroy_render_pass:
-  vkDestroyPipelineLayout(renderer->device, renderer->pipeline_layout, NULL);
-  vkDestroyRenderPass(renderer->device, renderer->render_pass, NULL);
-destroy_swapchain_image_views:
-  for (uint32_t swapchain_image_view_index = 0;
-       swapchain_image_view_index < renderer->swapchain_image_count;
-       swapchain_image_view_index++) {
-    vkDestroyImageView(
-        renderer->device,
-        renderer->swapchain_image_views[swapchain_image_view_index], NULL);
-  }
-destroy_swapchain:
-  vkDestroySwapchainKHR(renderer->device, renderer->swapchain, NULL);
-destroy_logical_device:
-  vkDestroyDevice(renderer->device, NULL);
-destroy_surface:
-  vkDestroySurfaceKHR(renderer->instance, renderer->surface, NULL);
-destroy_instance:
-  if (renderer->enable_validation_layers) {
-    vkDestroyDebugUtilsMessengerEXT(renderer->instance,
-                                    renderer->debug_messenger, NULL);
-  }
-  vulkan_renderer_destroy_instance(renderer);
 err:
+  vulkan_renderer_destroy_sync_objects(renderer);
   return false;
 }
 
-void vulkan_renderer_deinit(struct vulkan_renderer *renderer) {
-  for (uint32_t framebuffer_index = 0;
-       framebuffer_index < renderer->swapchain_image_count;
-       framebuffer_index++) {
-    vkDestroyFramebuffer(renderer->device,
-                         renderer->swapchain_framebuffers[framebuffer_index],
-                         NULL);
-  }
-  vkDestroyPipeline(renderer->device, renderer->pipeline, NULL);
-  vkDestroyPipelineLayout(renderer->device, renderer->pipeline_layout, NULL);
-  vkDestroyRenderPass(renderer->device, renderer->render_pass, NULL);
-  for (uint32_t swapchain_image_view_index = 0;
-       swapchain_image_view_index < renderer->swapchain_image_count;
-       swapchain_image_view_index++) {
-    vkDestroyImageView(
-        renderer->device,
-        renderer->swapchain_image_views[swapchain_image_view_index], NULL);
+void vulkan_renderer_cmd_draw_phase(struct vulkan_renderer *renderer,
+                                    VkCommandBuffer command_buffer,
+                                    uint32_t image_index,
+                                    enum occlusion_phase phase,
+                                    const uint32_t *dynamic_offsets) {
+  VkExtent2D extent = renderer->render_extent;
+  VkClearValue clear_values[] = {
+      {.color = {.float32 = {0.0f, 0.0f, 0.0f, 1.0f}}},
+      {.depthStencil = {.depth = 1.0f}}};
+  vkCmdBeginRenderPass(
+      command_buffer,
+      &(const VkRenderPassBeginInfo){
+          .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+          .renderPass = phase == OCCLUSION_PHASE_EARLY
+                            ? renderer->render_pass
+                            : renderer->late_render_pass,
+          .framebuffer = renderer->swapchain_framebuffers[image_index],
+          .renderArea = {.extent = extent},
+          .clearValueCount = 2,
+          .pClearValues = clear_values},
+      VK_SUBPASS_CONTENTS_INLINE);
+
+  vkCmdBindPipeline(
+      command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+      resource_manager_pipeline(&renderer->resources, renderer->pipeline));
+  vkCmdSetViewport(command_buffer, 0, 1,
+                   &(const VkViewport){.width = (float)extent.width,
+                                       .height = (float)extent.height,
+                                       .maxDepth = 1.0f});
+  vkCmdSetScissor(command_buffer, 0, 1,
+                  &(const VkRect2D){.offset = {0}, .extent = extent});
+
+  uint32_t phase_dynamic_offsets[3] = {
+      dynamic_offsets[0], dynamic_offsets[1],
+      occlusion_culler_visible_index_offset(&renderer->occlusion_culler,
+                                            phase)};
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          renderer->pipeline_layout, 0, 1,
+                          &renderer->draw_descriptor_set, 3,
+                          phase_dynamic_offsets);
+  occlusion_culler_cmd_draw(&renderer->occlusion_culler, command_buffer,
+                            phase);
+
+  vkCmdEndRenderPass(command_buffer);
+}
+
+// Scales the rendered corner of the scene target up to the whole swapchain
+// image, leaving that in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR.
+void vulkan_renderer_cmd_upscale(struct vulkan_renderer *renderer,
+                                 VkCommandBuffer command_buffer,
+                                 uint32_t image_index) {
+  VkImage image = renderer->swapchain_images[image_index];
+  VkImageSubresourceRange color_range = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .levelCount = 1,
+      .layerCount = 1};
+  // The acquire semaphore is waited on at the transfer stage when rendering
+  // offscreen, so this chains the transition after it.
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+      &(const VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+          .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = image,
+          .subresourceRange = color_range});
+
+  VkExtent2D source = renderer->render_extent;
+  VkExtent2D destination = renderer->swapchain_extent;
+  VkImage scene_color_image =
+      resource_manager_image(&renderer->resources, renderer->scene_color_image)
+          ->image;
+  vkCmdBlitImage(
+      command_buffer, scene_color_image,
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+      &(const VkImageBlit){
+          .srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .layerCount = 1},
+          .srcOffsets = {{0, 0, 0},
+                         {(int32_t)source.width, (int32_t)source.height, 1}},
+          .dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .layerCount = 1},
+          .dstOffsets = {{0, 0, 0},
+                         {(int32_t)destination.width,
+                          (int32_t)destination.height, 1}}},
+      renderer->upscale_filter);
+
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1,
+      &(const VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = image,
+          .subresourceRange = color_range});
+}
+
+void thumbnail_view_projections(struct mat4 *view_projections) {
+  // Each view turns the scene a further quarter turn.
+  for (uint32_t view = 0; view < THUMBNAIL_VIEW_COUNT; view++) {
+    view_projections[view] = mat4_from_quat(quat_from_axis_angle(
+        (struct vec3){0.0f, 0.0f, 1.0f}, (float)view * 1.5707964f));
   }
-  vkDestroySwapchainKHR(renderer->device, renderer->swapchain, NULL);
-  vkDestroyDevice(renderer->device, NULL);
-  vkDestroySurfaceKHR(renderer->instance, renderer->surface, NULL);
-  if (renderer->enable_validation_layers) {
-    vkDestroyDebugUtilsMessengerEXT(renderer->instance,
-                                    renderer->debug_messenger, NULL);
+}
+
+// Appends a record to the command stream when recording.
+void vulkan_renderer_record(struct vulkan_renderer *renderer,
+                            enum command_stream_record_type type,
+                            const void *payload, uint32_t payload_size) {
+  if (renderer->recording) {
+    command_stream_write(&renderer->recorder, type, payload, payload_size,
+                         NULL, 0);
   }
-  vulkan_renderer_destroy_instance(renderer);
 }
 
-int main(void) {
-  if (!SDL_Init(SDL_INIT_VIDEO)) {
-    LOG("Couldn't initialize SDL: %s", SDL_GetError());
-    goto err;
+void vulkan_renderer_cmd_copy_thumbnails(struct vulkan_renderer *renderer,
+                                         VkCommandBuffer command_buffer,
+                                         uint32_t image_index) {
+  VkImage image = renderer->swapchain_images[image_index];
+  VkImageSubresourceRange color_range = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .levelCount = 1,
+      .layerCount = 1};
+  // The image was last written by the late pass, the upscale or the
+  // post-processing chain.
+  vkCmdPipelineBarrier(
+      command_buffer,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+          VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+      &(const VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                           VK_ACCESS_SHADER_WRITE_BIT |
+                           VK_ACCESS_TRANSFER_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+          .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = image,
+          .subresourceRange = color_range});
+
+  // Same format on both sides, so a plain copy works without blit support.
+  VkExtent2D extent = renderer->thumbnails.extent;
+  VkImageCopy regions[THUMBNAIL_VIEW_COUNT];
+  for (uint32_t view = 0; view < THUMBNAIL_VIEW_COUNT; view++) {
+    regions[view] = (VkImageCopy){
+        .srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                           .baseArrayLayer = view,
+                           .layerCount = 1},
+        .dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                           .layerCount = 1},
+        .dstOffset = {(int32_t)(view * extent.width),
+                      (int32_t)(renderer->swapchain_extent.height -
+                                extent.height),
+                      0},
+        .extent = {extent.width, extent.height, 1}};
   }
+  vkCmdCopyImage(command_buffer, renderer->thumbnails.color_image,
+                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, THUMBNAIL_VIEW_COUNT,
+                 regions);
+
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1,
+      &(const VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = image,
+          .subresourceRange = color_range});
+}
 
-  SDL_Window *window =
-      SDL_CreateWindow("vkguide", 1280, 720, SDL_WINDOW_VULKAN);
-  if (!window) {
-    LOG("Couldn't create window: %s", SDL_GetError());
-    goto quit_sdl;
+// The frame time graph in the top left corner, over a grid of quads that
+// drift a few pixels back and forth, spread over four z layers and both
+// blend modes.
+void vulkan_renderer_push_overlay(struct vulkan_renderer *renderer) {
+  struct sprite_batch *overlay = &renderer->overlay;
+  VkExtent2D extent = renderer->swapchain_extent;
+  sprite_batch_begin(overlay);
+
+  uint32_t columns = extent.width / OVERLAY_STRESS_SPACING + 1;
+  uint32_t rows = extent.height / OVERLAY_STRESS_SPACING + 1;
+  for (uint32_t sprite = 0; sprite < renderer->overlay_sprite_count;
+       sprite++) {
+    uint32_t cell = sprite % (columns * rows);
+    uint32_t phase = (uint32_t)(renderer->frame_number + sprite * 7) % 16;
+    float drift = (float)(phase < 8 ? phase : 16 - phase);
+    sprite_batch_push(
+        overlay,
+        &(const struct sprite){
+            .x = (float)(cell % columns * OVERLAY_STRESS_SPACING) + drift,
+            .y = (float)(cell / columns * OVERLAY_STRESS_SPACING),
+            .width = 3.0f,
+            .height = 3.0f,
+            .u1 = 1.0f,
+            .v1 = 1.0f,
+            // Translucent, with a hue picked by hashing the index.
+            .color = 0x60000000u | ((sprite * 2654435761u) & 0x00ffffffu),
+            .texture = SPRITE_BATCH_WHITE_TEXTURE,
+            .clip_rect = SPRITE_BATCH_NO_CLIP,
+            .blend = sprite % 3 == 0 ? SPRITE_BLEND_ADDITIVE
+                                     : SPRITE_BLEND_ALPHA,
+            .z = (int16_t)(sprite % 4)});
   }
 
-  struct vulkan_renderer renderer;
-  if (!vulkan_renderer_init(&renderer, window)) {
-    LOG("Couldn't init vulkan renderer");
-    goto destroy_window;
+  // Two pixels per frame across, 33.3ms up.
+  VkRect2D panel = {.offset = {16, 16},
+                    .extent = {2 * OVERLAY_HISTORY_LENGTH + 16, 96}};
+  float panel_bottom = (float)(panel.offset.y + (int32_t)panel.extent.height);
+  float pixels_per_ms = 80.0f / (2.0f * TARGET_FRAME_TIME_MS);
+  uint32_t panel_clip;
+  if (!sprite_batch_add_clip_rect(overlay, panel, &panel_clip)) {
+    return;
+  }
+  struct sprite sprite = {.u1 = 1.0f,
+                          .v1 = 1.0f,
+                          .texture = SPRITE_BATCH_WHITE_TEXTURE,
+                          .clip_rect = panel_clip,
+                          .blend = SPRITE_BLEND_ALPHA};
+  sprite.x = (float)panel.offset.x;
+  sprite.y = (float)panel.offset.y;
+  sprite.width = (float)panel.extent.width;
+  sprite.height = (float)panel.extent.height;
+  sprite.color = 0xc0101010u;
+  sprite.z = 100;
+  sprite_batch_push(overlay, &sprite);
+
+  // Oldest on the left.
+  sprite.width = 2.0f;
+  sprite.z = 101;
+  for (uint32_t entry = 0; entry < OVERLAY_HISTORY_LENGTH; entry++) {
+    float frame_ms =
+        renderer->frame_time_history[(renderer->frame_number + 1 + entry) %
+                                     OVERLAY_HISTORY_LENGTH];
+    sprite.x = (float)panel.offset.x + 8.0f + 2.0f * (float)entry;
+    sprite.height = frame_ms * pixels_per_ms;
+    sprite.y = panel_bottom - 8.0f - sprite.height;
+    sprite.color =
+        frame_ms <= TARGET_FRAME_TIME_MS ? 0xff40d040u : 0xff4040e0u;
+    sprite_batch_push(overlay, &sprite);
   }
 
-  while (true) {
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-      bool quit = event.type == SDL_EVENT_QUIT;
-      bool escape_pressed =
-          event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_ESCAPE;
+  sprite.x = (float)panel.offset.x;
+  sprite.width = (float)panel.extent.width;
+  sprite.height = 1.0f;
+  sprite.y = panel_bottom - 8.0f - TARGET_FRAME_TIME_MS * pixels_per_ms;
+  sprite.color = 0x80ffffffu;
+  sprite.z = 102;
+  sprite_batch_push(overlay, &sprite);
+}
 
-      if (quit || escape_pressed) {
-        goto out_main_loop;
-      }
-    }
+bool vulkan_renderer_begin_command_buffer(VkCommandBuffer command_buffer) {
+  return vkBeginCommandBuffer(
+             command_buffer,
+             &(const VkCommandBufferBeginInfo){
+                 .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                 .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT}) ==
+         VK_SUCCESS;
+}
 
-    // Render things
+// Records the scene into scene_command_buffer and everything that touches
+// the swapchain image after it into output_command_buffer. They are the same
+// command buffer when the scene is drawn straight into the swapchain image.
+bool vulkan_renderer_record_command_buffers(
+    struct vulkan_renderer *renderer, VkCommandBuffer scene_command_buffer,
+    VkCommandBuffer output_command_buffer, uint32_t image_index,
+    uint32_t instance_offset) {
+  VkCommandBuffer command_buffer = scene_command_buffer;
+  if (!vulkan_renderer_begin_command_buffer(command_buffer)) {
+    return false;
+  }
+  dynamic_resolution_cmd_begin(&renderer->dynamic_resolution, command_buffer,
+                               renderer->current_frame);
+
+  struct draw_uniforms uniforms = {.transform = mat4_identity(),
+                                    .color = {1.0f, 1.0f, 1.0f, 1.0f}};
+  uint32_t dynamic_offsets[2] = {0, instance_offset};
+  vulkan_renderer_record(renderer, COMMAND_STREAM_RECORD_DRAW_UNIFORMS,
+                         &uniforms, sizeof(uniforms));
+  if (!uniform_ring_push(&renderer->uniform_ring, &uniforms, sizeof(uniforms),
+                         &dynamic_offsets[0])) {
+    return false;
+  }
+
+  if (renderer->thumbnails_enabled) {
+    struct mat4 view_projections[THUMBNAIL_VIEW_COUNT];
+    thumbnail_view_projections(view_projections);
+    vulkan_renderer_record(renderer, COMMAND_STREAM_RECORD_THUMBNAILS,
+                           view_projections, sizeof(view_projections));
+    if (!multiview_pass_cmd_draw(&renderer->thumbnails, command_buffer,
+                                 &renderer->uniform_ring, view_projections,
+                                 instance_offset,
+                                 renderer->scene.slot_count)) {
+      return false;
+    }
+  }
+
+  vulkan_renderer_record(renderer, COMMAND_STREAM_RECORD_CULL_EARLY,
+                         &uniforms.transform, sizeof(uniforms.transform));
+  if (!occlusion_culler_cmd_cull_early(
+          &renderer->occlusion_culler, command_buffer, &renderer->uniform_ring,
+          renderer->current_frame, &uniforms.transform, renderer->render_extent,
+          instance_offset, renderer->scene.slot_count)) {
+    return false;
+  }
+  uint32_t phase = OCCLUSION_PHASE_EARLY;
+  vulkan_renderer_record(renderer, COMMAND_STREAM_RECORD_DRAW_PHASE, &phase,
+                         sizeof(phase));
+  vulkan_renderer_cmd_draw_phase(renderer, command_buffer, image_index,
+                                 OCCLUSION_PHASE_EARLY, dynamic_offsets);
+  vulkan_renderer_record(renderer, COMMAND_STREAM_RECORD_CULL_LATE, NULL, 0);
+  occlusion_culler_cmd_cull_late(&renderer->occlusion_culler, command_buffer);
+  phase = OCCLUSION_PHASE_LATE;
+  vulkan_renderer_record(renderer, COMMAND_STREAM_RECORD_DRAW_PHASE, &phase,
+                         sizeof(phase));
+  vulkan_renderer_cmd_draw_phase(renderer, command_buffer, image_index,
+                                 OCCLUSION_PHASE_LATE, dynamic_offsets);
+  // Only the scene is timed. Everything after it touches the swapchain image
+  // and so waits for its acquire, which under FIFO takes up to a refresh
+  // interval however little the GPU has to do. Offscreen, that wait is in a
+  // batch of its own, so the scene doesn't wait with it.
+  dynamic_resolution_cmd_end(&renderer->dynamic_resolution, command_buffer,
+                             renderer->current_frame);
+  if (output_command_buffer != scene_command_buffer) {
+    if (vkEndCommandBuffer(scene_command_buffer) != VK_SUCCESS ||
+        !vulkan_renderer_begin_command_buffer(output_command_buffer)) {
+      return false;
+    }
+    command_buffer = output_command_buffer;
+  }
+  if (renderer->post_enabled) {
+    post_process_cmd_run(&renderer->post, command_buffer,
+                         renderer->current_frame, image_index,
+                         renderer->render_extent);
+  } else if (renderer->render_offscreen) {
+    vulkan_renderer_cmd_upscale(renderer, command_buffer, image_index);
+  }
+  if (renderer->thumbnails_enabled) {
+    vulkan_renderer_cmd_copy_thumbnails(renderer, command_buffer,
+                                        image_index);
+  }
+  if (renderer->overlay_enabled) {
+    vulkan_renderer_push_overlay(renderer);
+    if (!sprite_batch_cmd_draw(&renderer->overlay, command_buffer,
+                               renderer->current_frame, image_index,
+                               renderer->frame_number + 1)) {
+      return false;
+    }
+    if (renderer->frame_number % STATS_LOG_INTERVAL == 0) {
+      LOG("Sprite overlay: sprites=%u draws=%u",
+          renderer->overlay.drawn_sprite_count, renderer->overlay.draw_count);
+    }
+  }
+
+  if (renderer->capture_requested) {
+    renderer->capture_requested = false;
+    char path[FRAME_CAPTURE_MAX_PATH];
+    snprintf(path, sizeof(path), "capture_%06llu.%s",
+             (unsigned long long)renderer->frame_number,
+             renderer->capture_encoding == FRAME_CAPTURE_ENCODING_PNG ? "png"
+                                                                      : "raw");
+    if (!frame_capture_cmd_copy(
+            &renderer->frame_capture, command_buffer,
+            &(const struct frame_capture_source){
+                .image = renderer->swapchain_images[image_index],
+                .format = renderer->swapchain_image_format,
+                .extent = renderer->swapchain_extent,
+                .layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                .src_stage_mask =
+                    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                    VK_PIPELINE_STAGE_TRANSFER_BIT,
+                .src_access_mask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                   VK_ACCESS_SHADER_WRITE_BIT |
+                                   VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dst_stage_mask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT},
+            renderer->frame_number, path, renderer->capture_encoding)) {
+      LOG("Skipped capture of frame %llu",
+          (unsigned long long)renderer->frame_number);
+    }
+  }
+
+  return vkEndCommandBuffer(command_buffer) == VK_SUCCESS;
+}
+
+bool vulkan_renderer_create_scene(struct vulkan_renderer *renderer) {
+  if (!scene_init(&renderer->scene, &renderer->host_allocator, SCENE_CAPACITY,
+                  MAX_FRAMES_IN_FLIGHT)) {
+    goto err;
+  }
+
+  // A spinning root with three smaller copies of the triangle at its corners.
+  if (!scene_create_node(&renderer->scene, NULL, &renderer->scene_root)) {
+    goto deinit_scene;
+  }
+  scene_set_flags(&renderer->scene, renderer->scene_root, 0);
+  static const struct vec3 child_positions[] = {
+      {0.0f, -0.5f, 0.0f}, {0.5f, 0.5f, 0.0f}, {-0.5f, 0.5f, 0.0f}};
+  for (uint32_t child_index = 0;
+       child_index < sizeof(child_positions) / sizeof(struct vec3);
+       child_index++) {
+    struct scene_handle child;
+    if (!scene_create_node(&renderer->scene, &renderer->scene_root, &child)) {
+      goto deinit_scene;
+    }
+    scene_set_local_transform(&renderer->scene, child,
+                              child_positions[child_index], quat_identity(),
+                              (struct vec3){0.4f, 0.4f, 0.4f});
+    scene_set_local_bounds(&renderer->scene, child,
+                           (struct vec3){0.0f, 0.0f, 0.0f}, 0.71f);
+  }
+
+  return true;
+deinit_scene:
+  scene_deinit(&renderer->scene);
+err:
+  return false;
+}
+
+// Waits until the frame that last used the current frame slot has finished
+// on the GPU. out_completed_frames is the number of frames known to have
+// finished, which may be more than that one.
+bool vulkan_renderer_wait_for_frame_slot(struct vulkan_renderer *renderer,
+                                         uint64_t *out_completed_frames) {
+  uint64_t slot_frames = renderer->frame_number >= MAX_FRAMES_IN_FLIGHT
+                             ? renderer->frame_number - MAX_FRAMES_IN_FLIGHT + 1
+                             : 0;
+  if (!renderer->features.timeline_semaphore) {
+    if (vkWaitForFences(renderer->device, 1,
+                        &renderer->in_flight_fences[renderer->current_frame],
+                        VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+      return false;
+    }
+    *out_completed_frames = slot_frames;
+    return true;
+  }
+
+  if (vkWaitSemaphores(renderer->device,
+                       &(const VkSemaphoreWaitInfo){
+                           .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                           .semaphoreCount = 1,
+                           .pSemaphores = &renderer->frame_timeline,
+                           .pValues = &slot_frames},
+                       UINT64_MAX) != VK_SUCCESS ||
+      vkGetSemaphoreCounterValue(renderer->device, renderer->frame_timeline,
+                                 out_completed_frames) != VK_SUCCESS) {
+    return false;
+  }
+  return true;
+}
+
+// Submits the frame, signaling the render finished semaphore of image_index
+// and whatever tells the CPU the frame completed. scene_command_buffer runs
+// first without waiting for the swapchain image, then output_command_buffer
+// in a batch that waits for it; either may be VK_NULL_HANDLE. Headless
+// frames have no swapchain image to wait for or hand over.
+bool vulkan_renderer_submit_frame(struct vulkan_renderer *renderer,
+                                  VkCommandBuffer scene_command_buffer,
+                                  VkCommandBuffer output_command_buffer,
+                                  uint32_t image_index) {
+  bool present = !renderer->headless;
+  VkSemaphore image_available_semaphore =
+      renderer->image_available_semaphores[renderer->current_frame];
+  VkSemaphore render_finished_semaphore =
+      renderer->render_finished_semaphores[image_index];
+  uint64_t frame_value = renderer->frame_number + 1;
+  // The first access to the swapchain image in the output batch: the early
+  // pass when drawing straight into it, the upscale blit when rendering
+  // offscreen, and with post-processing either the resolve pass writing it
+  // as a storage image or the blit that ends the chain. A wait at the
+  // transfer stage also holds back every transfer command recorded before
+  // that blit, of which there is one: post_process_cmd_run()'s clear of the
+  // exposure buffer. One at the compute shader stage holds back the bloom
+  // passes too. The culler's draw and stats buffer resets are transfers as
+  // well, but they are in the scene batch, which doesn't wait. Stages are
+  // the same bits for both submission paths.
+  VkPipelineStageFlags wait_stage =
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  if (renderer->post_enabled) {
+    wait_stage = post_process_output_stage(&renderer->post);
+  } else if (renderer->render_offscreen) {
+    wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  }
+  VkCommandBuffer command_buffers[2];
+  uint32_t batch_count = 0;
+  if (scene_command_buffer != VK_NULL_HANDLE) {
+    command_buffers[batch_count++] = scene_command_buffer;
+  }
+  if (output_command_buffer != VK_NULL_HANDLE) {
+    command_buffers[batch_count++] = output_command_buffer;
+  }
+  assert(batch_count > 0);
+  // Only the output batch waits, and only the last one signals: a signal
+  // covers every batch submitted before it.
+  bool wait = present && output_command_buffer != VK_NULL_HANDLE;
+  uint32_t last = batch_count - 1;
+
+  if (renderer->features.synchronization2) {
+    VkSemaphoreSubmitInfo signal_infos[2];
+    uint32_t signal_info_count = 0;
+    if (present) {
+      signal_infos[signal_info_count++] = (VkSemaphoreSubmitInfo){
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+          .semaphore = render_finished_semaphore,
+          .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT};
+    }
+    signal_infos[signal_info_count++] = (VkSemaphoreSubmitInfo){
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = renderer->frame_timeline,
+        .value = frame_value,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT};
+    VkCommandBufferSubmitInfo command_buffer_infos[2];
+    VkSubmitInfo2 submit_infos[2];
+    for (uint32_t batch = 0; batch < batch_count; batch++) {
+      command_buffer_infos[batch] = (VkCommandBufferSubmitInfo){
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+          .commandBuffer = command_buffers[batch]};
+      submit_infos[batch] = (VkSubmitInfo2){
+          .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+          .commandBufferInfoCount = 1,
+          .pCommandBufferInfos = &command_buffer_infos[batch]};
+    }
+    submit_infos[last].waitSemaphoreInfoCount = wait ? 1 : 0;
+    submit_infos[last].pWaitSemaphoreInfos = &(const VkSemaphoreSubmitInfo){
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = image_available_semaphore,
+        .stageMask = wait_stage};
+    submit_infos[last].signalSemaphoreInfoCount = signal_info_count;
+    submit_infos[last].pSignalSemaphoreInfos = signal_infos;
+    return vkQueueSubmit2(renderer->graphics_queue, batch_count, submit_infos,
+                          VK_NULL_HANDLE) == VK_SUCCESS;
+  }
+
+  bool timeline = renderer->features.timeline_semaphore;
+  VkSemaphore signal_semaphores[2];
+  // Binary semaphores ignore their value.
+  uint64_t signal_values[2];
+  uint32_t signal_count = 0;
+  if (present) {
+    signal_semaphores[signal_count] = render_finished_semaphore;
+    signal_values[signal_count++] = 0;
+  }
+  if (timeline) {
+    signal_semaphores[signal_count] = renderer->frame_timeline;
+    signal_values[signal_count++] = frame_value;
+  }
+  const VkTimelineSemaphoreSubmitInfo timeline_submit_info = {
+      .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+      .signalSemaphoreValueCount = signal_count,
+      .pSignalSemaphoreValues = signal_values};
+  VkSubmitInfo submit_infos[2];
+  for (uint32_t batch = 0; batch < batch_count; batch++) {
+    submit_infos[batch] = (VkSubmitInfo){
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffers[batch]};
+  }
+  submit_infos[last].pNext = timeline ? &timeline_submit_info : NULL;
+  submit_infos[last].waitSemaphoreCount = wait ? 1 : 0;
+  submit_infos[last].pWaitSemaphores = &image_available_semaphore;
+  submit_infos[last].pWaitDstStageMask = &wait_stage;
+  submit_infos[last].signalSemaphoreCount = signal_count;
+  submit_infos[last].pSignalSemaphores = signal_semaphores;
+  VkFence fence = timeline
+                      ? VK_NULL_HANDLE
+                      : renderer->in_flight_fences[renderer->current_frame];
+  return vkQueueSubmit(renderer->graphics_queue, batch_count, submit_infos,
+                       fence) == VK_SUCCESS;
+}
+
+// Writes the next frame_count drawn frames to a command stream at path.
+bool vulkan_renderer_start_recording(struct vulkan_renderer *renderer,
+                                     const char *path, uint32_t frame_count) {
+  assert(!renderer->recording);
+  assert(frame_count > 0);
+  if (!command_stream_writer_open(
+          &renderer->recorder, path,
+          &(const struct command_stream_config){
+              .width = renderer->swapchain_extent.width,
+              .height = renderer->swapchain_extent.height,
+              .color_format = renderer->swapchain_image_format,
+              .scene_capacity = renderer->scene.capacity,
+              .instance_size = sizeof(struct scene_instance)})) {
+    return false;
+  }
+  renderer->recording = true;
+  renderer->record_frames_left = frame_count;
+  renderer->record_full_upload_frames = MAX_FRAMES_IN_FLIGHT;
+  return true;
+}
+
+bool vulkan_renderer_stop_recording(struct vulkan_renderer *renderer) {
+  assert(renderer->recording);
+  renderer->recording = false;
+  return command_stream_writer_close(&renderer->recorder);
+}
+
+bool vulkan_renderer_draw_frame(struct vulkan_renderer *renderer) {
+  uint32_t frame_index = renderer->current_frame;
+  uint64_t frame_start_ns = SDL_GetTicksNS();
+  if (renderer->last_frame_start_ns != 0) {
+    telemetry_record_time(TELEMETRY_HISTOGRAM_CPU_FRAME_TIME,
+                          (frame_start_ns - renderer->last_frame_start_ns) /
+                              1000);
+  }
+  if (renderer->last_frame_start_ns != 0) {
+    renderer->frame_time_history[renderer->frame_number %
+                                 OVERLAY_HISTORY_LENGTH] =
+        (float)(frame_start_ns - renderer->last_frame_start_ns) / 1e6f;
+  }
+  renderer->last_frame_start_ns = frame_start_ns;
+
+  uint64_t completed_frames;
+  if (!vulkan_renderer_wait_for_frame_slot(renderer, &completed_frames)) {
+    LOG("Couldn't wait for frame slot");
+    return false;
+  }
+
+  // The GPU is done with everything this frame slot wrote last time round.
+  uniform_ring_begin_frame(&renderer->uniform_ring, frame_index);
+  resource_manager_collect(&renderer->resources, completed_frames);
+  if (dynamic_resolution_update(&renderer->dynamic_resolution,
+                                renderer->device, frame_index)) {
+    telemetry_record_time(
+        TELEMETRY_HISTOGRAM_GPU_FRAME_TIME,
+        (uint64_t)(renderer->dynamic_resolution.last_frame_ms * 1000.0f));
+  }
+  if (completed_frames > 0 &&
+      !frame_capture_collect(&renderer->frame_capture, renderer->device,
+                             completed_frames - 1)) {
+    LOG("Couldn't collect frame captures");
+    return false;
+  }
+  if (renderer->frame_number >= MAX_FRAMES_IN_FLIGHT &&
+      occlusion_culler_read_stats(&renderer->occlusion_culler,
+                                  renderer->device, frame_index,
+                                  &renderer->occlusion_stats) &&
+      renderer->frame_number % STATS_LOG_INTERVAL == 0) {
+    LOG("Occlusion culling: tested=%u frustum_culled=%u occlusion_culled=%u "
+        "drawn_early=%u drawn_late=%u",
+        renderer->occlusion_stats.tested,
+        renderer->occlusion_stats.frustum_culled,
+        renderer->occlusion_stats.occlusion_culled,
+        renderer->occlusion_stats.drawn_early,
+        renderer->occlusion_stats.drawn_late);
+  }
+  if (renderer->frame_number % STATS_LOG_INTERVAL == 0 &&
+      renderer->render_offscreen) {
+    LOG("Dynamic resolution: %ux%u scale=%.2f gpu_frame_ms=%.2f",
+        renderer->dynamic_resolution.extent.width,
+        renderer->dynamic_resolution.extent.height,
+        (double)renderer->dynamic_resolution.scale,
+        (double)renderer->dynamic_resolution.smoothed_frame_ms);
+  }
+
+  renderer->render_extent = renderer->dynamic_resolution.extent;
+
+  // Acquired before the scene is synced, so a frame that is skipped leaves
+  // the instance buffer and a recording untouched.
+  uint32_t image_index;
+  VkResult acquire_result = vkAcquireNextImageKHR(
+      renderer->device, renderer->swapchain, UINT64_MAX,
+      renderer->image_available_semaphores[frame_index], VK_NULL_HANDLE,
+      &image_index);
+  if (acquire_result == VK_ERROR_OUT_OF_DATE_KHR) {
+    telemetry_count(TELEMETRY_COUNTER_SWAPCHAIN_OUT_OF_DATE, 1);
+    return true;
+  }
+  if (acquire_result != VK_SUCCESS && acquire_result != VK_SUBOPTIMAL_KHR) {
+    LOG("Couldn't acquire swapchain image, VkResult=%d", acquire_result);
+    return false;
+  }
+
+  vulkan_renderer_record(
+      renderer, COMMAND_STREAM_RECORD_FRAME_BEGIN,
+      &(const struct command_stream_frame){
+          .frame_number = renderer->frame_number,
+          .render_width = renderer->render_extent.width,
+          .render_height = renderer->render_extent.height,
+          .instance_count = renderer->scene.slot_count},
+      sizeof(struct command_stream_frame));
+
+  if (renderer->animate) {
+    scene_set_rotation(&renderer->scene, renderer->scene_root,
+                       quat_from_axis_angle((struct vec3){0.0f, 0.0f, 1.0f},
+                                            renderer->animation_angle));
+    renderer->animation_angle += 0.01f;
+  }
+  scene_update(&renderer->scene);
+  uint32_t instance_offset;
+  uint32_t first_written;
+  uint32_t end_written;
+  if (!instance_buffer_sync(&renderer->instance_buffer, renderer->device,
+                            &renderer->scene, frame_index, &instance_offset,
+                            &first_written, &end_written)) {
+    LOG("Couldn't sync instance buffer");
+    return false;
+  }
+  if (renderer->recording) {
+    if (renderer->record_full_upload_frames > 0) {
+      renderer->record_full_upload_frames--;
+      first_written = 0;
+      end_written = renderer->scene.slot_count;
+    }
+    // Read from the scene rather than the instance buffer, whose memory may
+    // be uncached device memory that is slow to read from.
+    for (uint32_t first = first_written; first < end_written;
+         first += RECORD_UPLOAD_CHUNK) {
+      struct scene_instance instances[RECORD_UPLOAD_CHUNK];
+      uint32_t count = end_written - first < RECORD_UPLOAD_CHUNK
+                           ? end_written - first
+                           : RECORD_UPLOAD_CHUNK;
+      scene_read_instances(&renderer->scene, first, count, instances);
+      command_stream_write(
+          &renderer->recorder, COMMAND_STREAM_RECORD_INSTANCE_UPLOAD,
+          &(const struct command_stream_instance_upload){.first = first,
+                                                         .count = count},
+          sizeof(struct command_stream_instance_upload), instances,
+          count * sizeof(struct scene_instance));
+    }
+  }
+
+  // Only reset once work is guaranteed to be submitted, otherwise the next
+  // wait on this fence would never return.
+  if (!renderer->features.timeline_semaphore) {
+    vkResetFences(renderer->device, 1,
+                  &renderer->in_flight_fences[frame_index]);
+  }
+
+  VkCommandBuffer scene_command_buffer = renderer->command_buffers[frame_index];
+  VkCommandBuffer output_command_buffer = scene_command_buffer;
+  vkResetCommandBuffer(scene_command_buffer, 0);
+  if (renderer->render_offscreen) {
+    output_command_buffer = renderer->output_command_buffers[frame_index];
+    vkResetCommandBuffer(output_command_buffer, 0);
+  }
+  if (!vulkan_renderer_record_command_buffers(
+          renderer, scene_command_buffer, output_command_buffer, image_index,
+          instance_offset)) {
+    LOG("Couldn't record command buffer");
+    return false;
+  }
+
+  if (!uniform_ring_flush(&renderer->uniform_ring, renderer->device)) {
+    LOG("Couldn't flush uniform ring");
+    return false;
+  }
+
+  if (!vulkan_renderer_submit_frame(
+          renderer,
+          renderer->render_offscreen ? scene_command_buffer : VK_NULL_HANDLE,
+          output_command_buffer, image_index)) {
+    LOG("Couldn't submit draw command buffer");
+    return false;
+  }
+  telemetry_count(TELEMETRY_COUNTER_QUEUE_SUBMITS, 1);
+
+  VkSemaphore render_finished_semaphore =
+      renderer->render_finished_semaphores[image_index];
+  VkResult present_result = vkQueuePresentKHR(
+      renderer->present_queue,
+      &(const VkPresentInfoKHR){.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+                                .waitSemaphoreCount = 1,
+                                .pWaitSemaphores = &render_finished_semaphore,
+                                .swapchainCount = 1,
+                                .pSwapchains = &renderer->swapchain,
+                                .pImageIndices = &image_index});
+  if (present_result != VK_SUCCESS && present_result != VK_SUBOPTIMAL_KHR &&
+      present_result != VK_ERROR_OUT_OF_DATE_KHR) {
+    LOG("Couldn't present swapchain image, VkResult=%d", present_result);
+    return false;
+  }
+  telemetry_count(present_result == VK_ERROR_OUT_OF_DATE_KHR
+                      ? TELEMETRY_COUNTER_SWAPCHAIN_OUT_OF_DATE
+                      : TELEMETRY_COUNTER_PRESENTS,
+                  1);
+  telemetry_count(TELEMETRY_COUNTER_FRAMES, 1);
+
+  if (renderer->recording) {
+    vulkan_renderer_record(renderer, COMMAND_STREAM_RECORD_FRAME_END, NULL,
+                           0);
+    if (--renderer->record_frames_left == 0 &&
+        !vulkan_renderer_stop_recording(renderer)) {
+      return false;
+    }
+  }
+
+  renderer->current_frame = (frame_index + 1) % MAX_FRAMES_IN_FLIGHT;
+  renderer->frame_number++;
+  return true;
+}
+
+// Captures the next drawn frame to a file in the working directory.
+bool vulkan_renderer_request_capture(struct vulkan_renderer *renderer,
+                                     enum frame_capture_encoding encoding) {
+  if (!renderer->swapchain_capturable) {
+    LOG("Swapchain images can't be captured on this device");
+    return false;
+  }
+  renderer->capture_requested = true;
+  renderer->capture_encoding = encoding;
+  return true;
+}
+
+// Whether drawing another frame would show anything that isn't on screen.
+bool vulkan_renderer_has_changes(struct vulkan_renderer *renderer) {
+  uint32_t copy_index =
+      renderer->current_frame % renderer->scene.gpu_copy_count;
+  return renderer->animate || renderer->capture_requested ||
+         renderer->recording || scene_has_changes(&renderer->scene, copy_index);
+}
+
+// Waits for every submitted frame and writes out their captures, which
+// otherwise only happens as later frames are drawn. Call before going idle.
+bool vulkan_renderer_finish_frames(struct vulkan_renderer *renderer) {
+  if (vkDeviceWaitIdle(renderer->device) != VK_SUCCESS) {
+    LOG("Couldn't wait for device idle");
+    return false;
+  }
+  resource_manager_collect(&renderer->resources, renderer->frame_number);
+  if (renderer->frame_number > 0 &&
+      !frame_capture_collect(&renderer->frame_capture, renderer->device,
+                             renderer->frame_number - 1)) {
+    LOG("Couldn't collect frame captures");
+    return false;
+  }
+  // The time spent idle isn't a frame time.
+  renderer->last_frame_start_ns = 0;
+  return true;
+}
+
+struct replay_stats {
+  uint64_t frame_count;
+  uint64_t cpu_ns_total;
+  uint64_t cpu_ns_max;
+  uint64_t gpu_frame_count;
+  double gpu_ms_total;
+  double gpu_ms_max;
+};
+
+void replay_stats_add_gpu_time(struct replay_stats *stats, float frame_ms) {
+  stats->gpu_frame_count++;
+  stats->gpu_ms_total += frame_ms;
+  if (frame_ms > stats->gpu_ms_max) {
+    stats->gpu_ms_max = frame_ms;
+  }
+}
+
+// Re-records and submits the next frame of a command stream on a headless
+// renderer, as fast as the frame slots allow. Sets *out_done instead once the
+// stream has no frames left.
+bool vulkan_renderer_replay_frame(struct vulkan_renderer *renderer,
+                                  struct command_stream_reader *reader,
+                                  struct replay_stats *stats, bool *out_done) {
+  assert(renderer->headless);
+  enum command_stream_record_type type;
+  uint32_t size;
+  enum command_stream_read_result result =
+      command_stream_read(reader, &type, &size);
+  *out_done = result == COMMAND_STREAM_READ_END;
+  if (*out_done) {
+    return true;
+  }
+  if (result != COMMAND_STREAM_READ_RECORD ||
+      type != COMMAND_STREAM_RECORD_FRAME_BEGIN ||
+      size != sizeof(struct command_stream_frame)) {
+    LOG("Expected the start of a frame");
+    return false;
+  }
+  struct command_stream_frame frame;
+  memcpy(&frame, reader->payload, sizeof(frame));
+  if (frame.render_width == 0 || frame.render_height == 0 ||
+      frame.render_width > renderer->swapchain_extent.width ||
+      frame.render_height > renderer->swapchain_extent.height ||
+      frame.instance_count > renderer->instance_buffer.capacity) {
+    LOG("Recorded frame %llu doesn't fit the replay targets",
+        (unsigned long long)frame.frame_number);
+    return false;
+  }
+
+  uint32_t frame_index = renderer->current_frame;
+  uint64_t completed_frames;
+  if (!vulkan_renderer_wait_for_frame_slot(renderer, &completed_frames)) {
+    LOG("Couldn't wait for frame slot");
+    return false;
+  }
+  uniform_ring_begin_frame(&renderer->uniform_ring, frame_index);
+  resource_manager_collect(&renderer->resources, completed_frames);
+  if (dynamic_resolution_update(&renderer->dynamic_resolution,
+                                renderer->device, frame_index)) {
+    replay_stats_add_gpu_time(stats,
+                              renderer->dynamic_resolution.last_frame_ms);
+  }
+
+  // The CPU cost of a frame is everything from here up to the submit.
+  uint64_t frame_start_ns = SDL_GetTicksNS();
+  renderer->render_extent =
+      (VkExtent2D){frame.render_width, frame.render_height};
+  VkCommandBuffer command_buffer = renderer->command_buffers[frame_index];
+  vkResetCommandBuffer(command_buffer, 0);
+  if (vkBeginCommandBuffer(
+          command_buffer,
+          &(const VkCommandBufferBeginInfo){
+              .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+              .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT}) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  dynamic_resolution_cmd_begin(&renderer->dynamic_resolution, command_buffer,
+                               frame_index);
+
+  uint32_t dynamic_offsets[2] = {
+      0, instance_buffer_dynamic_offset(&renderer->instance_buffer,
+                                        frame_index)};
+  bool frame_ended = false;
+  while (!frame_ended) {
+    if (command_stream_read(reader, &type, &size) !=
+        COMMAND_STREAM_READ_RECORD) {
+      LOG("Recorded frame %llu is truncated",
+          (unsigned long long)frame.frame_number);
+      return false;
+    }
+    const char *payload = reader->payload;
+    switch (type) {
+    case COMMAND_STREAM_RECORD_INSTANCE_UPLOAD: {
+      struct command_stream_instance_upload upload;
+      if (size < sizeof(upload)) {
+        goto malformed;
+      }
+      memcpy(&upload, payload, sizeof(upload));
+      if (size != sizeof(upload) +
+                      (uint64_t)upload.count * sizeof(struct scene_instance)) {
+        goto malformed;
+      }
+      if (!instance_buffer_write(
+              &renderer->instance_buffer, renderer->device, frame_index,
+              upload.first, upload.count,
+              (const struct scene_instance *)(payload + sizeof(upload)))) {
+        return false;
+      }
+      break;
+    }
+    case COMMAND_STREAM_RECORD_DRAW_UNIFORMS:
+      if (size != sizeof(struct draw_uniforms)) {
+        goto malformed;
+      }
+      if (!uniform_ring_push(&renderer->uniform_ring, payload, size,
+                             &dynamic_offsets[0])) {
+        return false;
+      }
+      break;
+    case COMMAND_STREAM_RECORD_THUMBNAILS: {
+      struct mat4 view_projections[THUMBNAIL_VIEW_COUNT];
+      if (size != sizeof(view_projections)) {
+        goto malformed;
+      }
+      // Without multiview the rest of the frame still replays.
+      memcpy(view_projections, payload, sizeof(view_projections));
+      if (renderer->thumbnails_enabled &&
+          !multiview_pass_cmd_draw(&renderer->thumbnails, command_buffer,
+                                   &renderer->uniform_ring, view_projections,
+                                   dynamic_offsets[1], frame.instance_count)) {
+        return false;
+      }
+      break;
+    }
+    case COMMAND_STREAM_RECORD_CULL_EARLY: {
+      struct mat4 view_projection;
+      if (size != sizeof(view_projection)) {
+        goto malformed;
+      }
+      memcpy(&view_projection, payload, sizeof(view_projection));
+      if (!occlusion_culler_cmd_cull_early(
+              &renderer->occlusion_culler, command_buffer,
+              &renderer->uniform_ring, frame_index, &view_projection,
+              renderer->render_extent, dynamic_offsets[1],
+              frame.instance_count)) {
+        return false;
+      }
+      break;
+    }
+    case COMMAND_STREAM_RECORD_DRAW_PHASE: {
+      uint32_t phase;
+      if (size != sizeof(phase)) {
+        goto malformed;
+      }
+      memcpy(&phase, payload, sizeof(phase));
+      if (phase >= OCCLUSION_PHASE_COUNT) {
+        goto malformed;
+      }
+      vulkan_renderer_cmd_draw_phase(renderer, command_buffer, 0, phase,
+                                     dynamic_offsets);
+      // Timed up to the same point as a live frame.
+      if (phase == OCCLUSION_PHASE_LATE) {
+        dynamic_resolution_cmd_end(&renderer->dynamic_resolution,
+                                   command_buffer, frame_index);
+      }
+      break;
+    }
+    case COMMAND_STREAM_RECORD_CULL_LATE:
+      occlusion_culler_cmd_cull_late(&renderer->occlusion_culler,
+                                     command_buffer);
+      break;
+    case COMMAND_STREAM_RECORD_FRAME_END:
+      frame_ended = true;
+      break;
+    default:
+      goto malformed;
+    }
+  }
+
+  if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+    return false;
+  }
+  if (!uniform_ring_flush(&renderer->uniform_ring, renderer->device)) {
+    LOG("Couldn't flush uniform ring");
+    return false;
+  }
+  if (!renderer->features.timeline_semaphore) {
+    vkResetFences(renderer->device, 1,
+                  &renderer->in_flight_fences[frame_index]);
+  }
+  if (!vulkan_renderer_submit_frame(renderer, command_buffer, VK_NULL_HANDLE,
+                                    0)) {
+    LOG("Couldn't submit draw command buffer");
+    return false;
+  }
+  telemetry_count(TELEMETRY_COUNTER_QUEUE_SUBMITS, 1);
+  telemetry_count(TELEMETRY_COUNTER_FRAMES, 1);
+
+  uint64_t frame_ns = SDL_GetTicksNS() - frame_start_ns;
+  stats->frame_count++;
+  stats->cpu_ns_total += frame_ns;
+  if (frame_ns > stats->cpu_ns_max) {
+    stats->cpu_ns_max = frame_ns;
+  }
+  renderer->current_frame = (frame_index + 1) % MAX_FRAMES_IN_FLIGHT;
+  renderer->frame_number++;
+  return true;
+malformed:
+  LOG("Malformed record %u in recorded frame %llu", type,
+      (unsigned long long)frame.frame_number);
+  return false;
+}
+
+// Replays every frame of a command stream and prints how long they took.
+// Logging compiles out of release builds, which are the ones worth timing,
+// so the results go to stdout.
+bool vulkan_renderer_replay(struct vulkan_renderer *renderer,
+                            struct command_stream_reader *reader) {
+  struct replay_stats stats = {0};
+  uint64_t start_ns = SDL_GetTicksNS();
+  bool done = false;
+  while (!done) {
+    if (!vulkan_renderer_replay_frame(renderer, reader, &stats, &done)) {
+      return false;
+    }
+  }
+  if (vkDeviceWaitIdle(renderer->device) != VK_SUCCESS) {
+    return false;
+  }
+  uint64_t elapsed_ns = SDL_GetTicksNS() - start_ns;
+  // The last frames in flight were never waited on by a later frame.
+  for (uint32_t frame_index = 0; frame_index < MAX_FRAMES_IN_FLIGHT;
+       frame_index++) {
+    if (dynamic_resolution_update(&renderer->dynamic_resolution,
+                                  renderer->device, frame_index)) {
+      replay_stats_add_gpu_time(&stats,
+                                renderer->dynamic_resolution.last_frame_ms);
+    }
+  }
+
+  if (stats.frame_count == 0) {
+    printf("replay: no frames recorded\n");
+    return true;
+  }
+  printf("replay: %llu frames in %.3f s (%.1f fps)\n",
+         (unsigned long long)stats.frame_count, (double)elapsed_ns * 1e-9,
+         (double)stats.frame_count / ((double)elapsed_ns * 1e-9));
+  printf("replay: cpu avg %.3f ms, max %.3f ms\n",
+         (double)stats.cpu_ns_total * 1e-6 / (double)stats.frame_count,
+         (double)stats.cpu_ns_max * 1e-6);
+  if (stats.gpu_frame_count > 0) {
+    printf("replay: gpu avg %.3f ms, max %.3f ms over %llu frames\n",
+           stats.gpu_ms_total / (double)stats.gpu_frame_count,
+           stats.gpu_ms_max, (unsigned long long)stats.gpu_frame_count);
+  } else {
+    printf("replay: no gpu timestamps on this device\n");
+  }
+  return true;
+}
+
+// Without a window the renderer runs headless, sized and formatted after
+// headless_config.
+bool vulkan_renderer_init(struct vulkan_renderer *renderer, SDL_Window *window,
+                          const struct command_stream_config *headless_config) {
+  assert(renderer);
+  assert(window || headless_config);
+  renderer->headless = window == NULL;
+#ifdef NDEBUG
+  renderer->enable_validation_layers = false;
+#else
+  renderer->enable_validation_layers = true;
+#endif
+  renderer->capture_requested = false;
+  renderer->frame_number = 0;
+  renderer->animate = true;
+  renderer->animation_angle = 0.0f;
+  renderer->last_frame_start_ns = 0;
+  renderer->recording = false;
+  renderer->surface = VK_NULL_HANDLE;
+  renderer->post_config = post_process_config_default();
+  const char *post_effects = SDL_getenv("VKGUIDE_POST_EFFECTS");
+  if (post_effects && !post_process_parse_effects(
+                          post_effects, &renderer->post_config.effects)) {
+    LOG("Ignoring VKGUIDE_POST_EFFECTS=%s, expected a comma separated list "
+        "of bloom, tonemap, grade and fxaa, or none",
+        post_effects);
+  }
+  const char *overlay_sprites = SDL_getenv("VKGUIDE_OVERLAY_SPRITES");
+  renderer->overlay_enabled = overlay_sprites && !renderer->headless;
+  renderer->overlay_sprite_count = 0;
+  memset(renderer->frame_time_history, 0,
+         sizeof(renderer->frame_time_history));
+  if (renderer->overlay_enabled) {
+    char *end;
+    unsigned long count = strtoul(overlay_sprites, &end, 10);
+    if (end == overlay_sprites || *end != '\0' ||
+        count > OVERLAY_MAX_STRESS_SPRITES) {
+      LOG("Ignoring VKGUIDE_OVERLAY_SPRITES=%s, expected at most %u sprites",
+          overlay_sprites, OVERLAY_MAX_STRESS_SPRITES);
+    } else {
+      renderer->overlay_sprite_count = (uint32_t)count;
+    }
+  }
+  const char *thumbnails = SDL_getenv("VKGUIDE_THUMBNAILS");
+  renderer->thumbnails_enabled = thumbnails && strcmp(thumbnails, "0") != 0;
+
+  if (!host_allocator_init(&renderer->host_allocator)) {
+    LOG("Couldn't init host allocator");
+    goto err;
+  }
+  renderer->allocation_callbacks =
+      host_allocator_callbacks(&renderer->host_allocator);
+
+  if (!vulkan_renderer_create_instance(renderer)) {
+    goto deinit_host_allocator;
+  }
+
+  if (renderer->enable_validation_layers) {
+    if (!vulkan_renderer_create_debug_messenger(renderer)) {
+      LOG("Couldn't create Vulkan renderer debug messenger.");
+    }
   }
+
+  if (!renderer->headless &&
+      !SDL_Vulkan_CreateSurface(window, renderer->instance,
+                                renderer->allocation_callbacks,
+                                &renderer->surface)) {
+    LOG("Couldn't create Vulkan rendering surface: %s", SDL_GetError());
+    goto destroy_instance;
+  }
+
+  if (!vulkan_renderer_pick_physical_device(renderer)) {
+    LOG("Couldn't pick the appropriate physical device.");
+    goto destroy_surface;
+  }
+
+  if (!vulkan_renderer_create_logical_device(renderer)) {
+    LOG("Couldn't create the logical device");
+    goto destroy_surface;
+  }
+  resource_manager_init(&renderer->resources, renderer->physical_device,
+                        renderer->device, renderer->allocation_callbacks);
+
+  if (renderer->headless) {
+    vulkan_renderer_create_headless_swapchain(
+        renderer,
+        (VkExtent2D){headless_config->width, headless_config->height},
+        (VkFormat)headless_config->color_format);
+  } else {
+    int window_width_px;
+    int window_height_px;
+    if (!SDL_GetWindowSizeInPixels(window, &window_width_px,
+                                   &window_height_px)) {
+      LOG("Couldn't get window size");
+      goto deinit_resource_manager;
+    }
+
+    if (!vulkan_renderer_create_swapchain(renderer, window_width_px,
+                                          window_height_px)) {
+      LOG("Couldn't create swapchain");
+      goto deinit_resource_manager;
+    }
+
+    if (!vulkan_renderer_create_swapchain_image_views(renderer)) {
+      LOG("Couldn't create swapchain image views");
+      goto destroy_swapchain;
+    }
+  }
+
+  if (!vulkan_renderer_create_depth_resources(renderer)) {
+    LOG("Couldn't create depth buffer");
+    goto destroy_swapchain_image_views;
+  }
+
+  if (!vulkan_renderer_create_scene_target(renderer)) {
+    LOG("Couldn't create offscreen color target");
+    goto destroy_depth_resources;
+  }
+
+  // Both passes render into the rendered corner of full size targets, so
+  // with timestamps only the viewport changes from frame to frame.
+  if (!dynamic_resolution_init(
+          &renderer->dynamic_resolution, renderer->physical_device,
+          renderer->device, renderer->allocation_callbacks,
+          find_queue_families(renderer->physical_device, renderer->surface)
+              .graphics_family,
+          MAX_FRAMES_IN_FLIGHT, renderer->swapchain_extent,
+          renderer->render_offscreen ? MIN_RENDER_SCALE : 1.0f,
+          TARGET_FRAME_TIME_MS)) {
+    LOG("Couldn't create dynamic resolution timestamp queries");
+    goto destroy_scene_target;
+  }
+
+  if (!vulkan_renderer_create_render_pass(renderer)) {
+    LOG("Couldn't create render pass");
+    goto deinit_dynamic_resolution;
+  }
+
+  if (!vulkan_renderer_create_descriptor_set_layout(renderer)) {
+    LOG("Couldn't create descriptor set layout");
+    goto destroy_render_pass;
+  }
+
+  if (!vulkan_renderer_create_graphics_pipeline(renderer)) {
+    LOG("Couldn't create graphics pipeline");
+    goto destroy_descriptor_set_layout;
+  }
+
+  if (!vulkan_renderer_create_framebuffers(renderer)) {
+    LOG("Couldn't create framebuffers");
+    goto destroy_graphics_pipeline;
+  }
+
+  if (!vulkan_renderer_create_command_buffers(renderer)) {
+    LOG("Couldn't create command buffers");
+    goto destroy_framebuffers;
+  }
+
+  if (!vulkan_renderer_create_sync_objects(renderer)) {
+    LOG("Couldn't create synchronization objects");
+    goto destroy_command_pool;
+  }
+
+  if (!uniform_ring_init(&renderer->uniform_ring, renderer->physical_device,
+                         renderer->device, renderer->allocation_callbacks,
+                         UNIFORM_RING_REGION_SIZE, MAX_FRAMES_IN_FLIGHT,
+                         renderer->features.buffer_device_address)) {
+    LOG("Couldn't create uniform ring");
+    goto destroy_sync_objects;
+  }
+
+  if (!vulkan_renderer_create_scene(renderer)) {
+    LOG("Couldn't create scene");
+    goto deinit_uniform_ring;
+  }
+
+  if (!instance_buffer_init(&renderer->instance_buffer,
+                            renderer->physical_device, renderer->device,
+                            renderer->allocation_callbacks, SCENE_CAPACITY,
+                            MAX_FRAMES_IN_FLIGHT)) {
+    LOG("Couldn't create instance buffer");
+    goto deinit_scene;
+  }
+
+  if (!occlusion_culler_init(&renderer->occlusion_culler,
+                             renderer->physical_device, renderer->device,
+                             renderer->allocation_callbacks,
+                             &renderer->host_allocator,
+                             resource_manager_image_view(
+                                 &renderer->resources,
+                                 renderer->depth_image_view),
+                             renderer->swapchain_extent,
+                             &renderer->uniform_ring,
+                             &renderer->instance_buffer)) {
+    LOG("Couldn't create occlusion culler");
+    goto deinit_instance_buffer;
+  }
+
+  if (!vulkan_renderer_create_descriptor_sets(renderer)) {
+    LOG("Couldn't create descriptor sets");
+    goto deinit_occlusion_culler;
+  }
+
+  if (!frame_capture_init(&renderer->frame_capture, renderer->physical_device,
+                          renderer->device, renderer->allocation_callbacks,
+                          &renderer->host_allocator,
+                          renderer->swapchain_extent)) {
+    LOG("Couldn't create frame capture");
+    goto destroy_descriptor_pool;
+  }
+
+  if (renderer->post_enabled &&
+      !post_process_init(
+          &renderer->post, &renderer->resources, &renderer->host_allocator,
+          &renderer->features, &renderer->post_config,
+          resource_manager_image_view(&renderer->resources,
+                                      renderer->scene_color_view),
+          renderer->swapchain_extent,
+          &(const struct post_process_output){
+              .images = renderer->swapchain_images,
+              .views = renderer->swapchain_image_views,
+              .image_count = renderer->swapchain_image_count,
+              .format = renderer->swapchain_image_format,
+              .extent = renderer->swapchain_extent,
+              .storage = renderer->swapchain_storage},
+          MAX_FRAMES_IN_FLIGHT)) {
+    LOG("Couldn't create post-processing chain");
+    goto deinit_frame_capture;
+  }
+
+  // Headless, the thumbnails are drawn but there is nothing to copy them to.
+  if (renderer->thumbnails_enabled &&
+      !(renderer->features.multiview &&
+        (renderer->headless || renderer->swapchain_transfer_dst))) {
+    LOG("Can't draw multiview thumbnails on this device, leaving them out");
+    renderer->thumbnails_enabled = false;
+  }
+  if (renderer->thumbnails_enabled) {
+    VkExtent2D thumbnail_extent = {
+        renderer->swapchain_extent.width / THUMBNAIL_VIEW_COUNT,
+        renderer->swapchain_extent.height / THUMBNAIL_VIEW_COUNT};
+    if (!multiview_pass_init(
+            &renderer->thumbnails, renderer->physical_device, renderer->device,
+            renderer->allocation_callbacks, &renderer->host_allocator,
+            THUMBNAIL_VIEW_COUNT, thumbnail_extent,
+            renderer->swapchain_image_format, renderer->depth_format,
+            &renderer->uniform_ring, &renderer->instance_buffer)) {
+      LOG("Couldn't create multiview thumbnails");
+      goto deinit_post_process;
+    }
+  }
+
+  // Only a debugging aid, so the renderer goes on without it.
+  if (renderer->overlay_enabled &&
+      !sprite_batch_init(&renderer->overlay, &renderer->resources,
+                         &renderer->host_allocator,
+                         renderer->swapchain_image_views,
+                         renderer->swapchain_image_count,
+                         renderer->swapchain_image_format,
+                         renderer->swapchain_extent,
+                         OVERLAY_HUD_SPRITES + renderer->overlay_sprite_count,
+                         MAX_FRAMES_IN_FLIGHT)) {
+    LOG("Couldn't create sprite overlay");
+    renderer->overlay_enabled = false;
+  }
+
+  // Unattended runs can't afford to fail over the telemetry endpoint, so
+  // the renderer just goes on without it.
+  const char *telemetry_path = SDL_getenv("VKGUIDE_TELEMETRY_SOCKET");
+  renderer->telemetry_enabled =
+      telemetry_path &&
+      telemetry_server_start(&renderer->telemetry, telemetry_path,
+                             renderer->physical_device,
+                             renderer->features.memory_budget);
+
+  return true;
+
+deinit_post_process:
+  if (renderer->post_enabled) {
+    post_process_deinit(&renderer->post, renderer->frame_number);
+  }
+deinit_frame_capture:
+  frame_capture_deinit(&renderer->frame_capture, renderer->device,
+                       renderer->allocation_callbacks);
+
+destroy_descriptor_pool:
+  vkDestroyDescriptorPool(renderer->device, renderer->descriptor_pool,
+                          renderer->allocation_callbacks);
+deinit_occlusion_culler:
+  occlusion_culler_deinit(&renderer->occlusion_culler, renderer->device,
+                          renderer->allocation_callbacks);
+deinit_instance_buffer:
+  instance_buffer_deinit(&renderer->instance_buffer, renderer->device,
+                         renderer->allocation_callbacks);
+deinit_scene:
+  scene_deinit(&renderer->scene);
+deinit_uniform_ring:
+  uniform_ring_deinit(&renderer->uniform_ring, renderer->device,
+                      renderer->allocation_callbacks);
+destroy_sync_objects:
+  vulkan_renderer_destroy_sync_objects(renderer);
+destroy_command_pool:
+  vkDestroyCommandPool(renderer->device, renderer->command_pool,
+                       renderer->allocation_callbacks);
+destroy_framebuffers:
+  for (uint32_t framebuffer_index = 0;
+       framebuffer_index < renderer->swapchain_image_count;
+       framebuffer_index++) {
+    vkDestroyFramebuffer(renderer->device,
+                         renderer->swapchain_framebuffers[framebuffer_index],
+                         renderer->allocation_callbacks);
+  }
+destroy_graphics_pipeline:
+  resource_manager_destroy(&renderer->resources, RESOURCE_TYPE_PIPELINE,
+                           renderer->pipeline, renderer->frame_number);
+  vkDestroyPipelineLayout(renderer->device, renderer->pipeline_layout,
+                          renderer->allocation_callbacks);
+destroy_descriptor_set_layout:
+  vkDestroyDescriptorSetLayout(renderer->device,
+                               renderer->descriptor_set_layout,
+                               renderer->allocation_callbacks);
+destroy_render_pass:
+  vkDestroyRenderPass(renderer->device, renderer->late_render_pass,
+                      renderer->allocation_callbacks);
+  vkDestroyRenderPass(renderer->device, renderer->render_pass,
+                      renderer->allocation_callbacks);
+deinit_dynamic_resolution:
+  dynamic_resolution_deinit(&renderer->dynamic_resolution, renderer->device,
+                            renderer->allocation_callbacks);
+destroy_scene_target:
+  vulkan_renderer_destroy_scene_target(renderer);
+destroy_depth_resources:
+  vulkan_renderer_destroy_depth_resources(renderer);
+destroy_swapchain_image_views:
+  for (uint32_t swapchain_image_view_index = 0;
+       swapchain_image_view_index < renderer->swapchain_image_count;
+       swapchain_image_view_index++) {
+    vkDestroyImageView(
+        renderer->device,
+        renderer->swapchain_image_views[swapchain_image_view_index],
+        renderer->allocation_callbacks);
+  }
+destroy_swapchain:
+  vkDestroySwapchainKHR(renderer->device, renderer->swapchain,
+                        renderer->allocation_callbacks);
+deinit_resource_manager:
+  resource_manager_deinit(&renderer->resources);
+  vkDestroyDevice(renderer->device, renderer->allocation_callbacks);
+destroy_surface:
+  vkDestroySurfaceKHR(renderer->instance, renderer->surface,
+                      renderer->allocation_callbacks);
+destroy_instance:
+  if (renderer->enable_validation_layers) {
+    vkDestroyDebugUtilsMessengerEXT(renderer->instance,
+                                    renderer->debug_messenger,
+                                    renderer->allocation_callbacks);
+  }
+  vulkan_renderer_destroy_instance(renderer);
+deinit_host_allocator:
+  host_allocator_deinit(&renderer->host_allocator);
+err:
+  return false;
+}
+
+void vulkan_renderer_deinit(struct vulkan_renderer *renderer) {
+  if (renderer->recording) {
+    vulkan_renderer_stop_recording(renderer);
+  }
+  if (renderer->telemetry_enabled) {
+    telemetry_server_stop(&renderer->telemetry);
+  }
+  vkDeviceWaitIdle(renderer->device);
+  if (renderer->overlay_enabled) {
+    sprite_batch_deinit(&renderer->overlay, &renderer->host_allocator,
+                        renderer->frame_number);
+  }
+  if (renderer->thumbnails_enabled) {
+    multiview_pass_deinit(&renderer->thumbnails, renderer->device,
+                          renderer->allocation_callbacks);
+  }
+  if (renderer->post_enabled) {
+    post_process_deinit(&renderer->post, renderer->frame_number);
+  }
+  frame_capture_deinit(&renderer->frame_capture, renderer->device,
+                       renderer->allocation_callbacks);
+  vkDestroyDescriptorPool(renderer->device, renderer->descriptor_pool,
+                          renderer->allocation_callbacks);
+  occlusion_culler_deinit(&renderer->occlusion_culler, renderer->device,
+                          renderer->allocation_callbacks);
+  instance_buffer_deinit(&renderer->instance_buffer, renderer->device,
+                         renderer->allocation_callbacks);
+  scene_deinit(&renderer->scene);
+  uniform_ring_deinit(&renderer->uniform_ring, renderer->device,
+                      renderer->allocation_callbacks);
+  vulkan_renderer_destroy_sync_objects(renderer);
+  vkDestroyCommandPool(renderer->device, renderer->command_pool,
+                       renderer->allocation_callbacks);
+  for (uint32_t framebuffer_index = 0;
+       framebuffer_index < renderer->swapchain_image_count;
+       framebuffer_index++) {
+    vkDestroyFramebuffer(renderer->device,
+                         renderer->swapchain_framebuffers[framebuffer_index],
+                         renderer->allocation_callbacks);
+  }
+  resource_manager_destroy(&renderer->resources, RESOURCE_TYPE_PIPELINE,
+                           renderer->pipeline, renderer->frame_number);
+  vkDestroyPipelineLayout(renderer->device, renderer->pipeline_layout,
+                          renderer->allocation_callbacks);
+  vkDestroyDescriptorSetLayout(renderer->device,
+                               renderer->descriptor_set_layout,
+                               renderer->allocation_callbacks);
+  vkDestroyRenderPass(renderer->device, renderer->late_render_pass,
+                      renderer->allocation_callbacks);
+  vkDestroyRenderPass(renderer->device, renderer->render_pass,
+                      renderer->allocation_callbacks);
+  dynamic_resolution_deinit(&renderer->dynamic_resolution, renderer->device,
+                            renderer->allocation_callbacks);
+  vulkan_renderer_destroy_scene_target(renderer);
+  vulkan_renderer_destroy_depth_resources(renderer);
+  for (uint32_t swapchain_image_view_index = 0;
+       swapchain_image_view_index < renderer->swapchain_image_count;
+       swapchain_image_view_index++) {
+    vkDestroyImageView(
+        renderer->device,
+        renderer->swapchain_image_views[swapchain_image_view_index],
+        renderer->allocation_callbacks);
+  }
+  vkDestroySwapchainKHR(renderer->device, renderer->swapchain,
+                        renderer->allocation_callbacks);
+  resource_manager_deinit(&renderer->resources);
+  vkDestroyDevice(renderer->device, renderer->allocation_callbacks);
+  vkDestroySurfaceKHR(renderer->instance, renderer->surface,
+                      renderer->allocation_callbacks);
+  if (renderer->enable_validation_layers) {
+    vkDestroyDebugUtilsMessengerEXT(renderer->instance,
+                                    renderer->debug_messenger,
+                                    renderer->allocation_callbacks);
+  }
+  vulkan_renderer_destroy_instance(renderer);
+  host_allocator_log_stats(&renderer->host_allocator);
+  host_allocator_deinit(&renderer->host_allocator);
+}
+
+void print_usage(void) {
+  fprintf(stderr, "usage: vkguide [--on-demand] [--max-fps <fps>] "
+                  "[--record <file> <frames>]\n"
+                  "       vkguide --replay <file>\n");
+}
+
+// Parses a positive decimal count that fits in 32 bits.
+bool parse_count(const char *text, uint32_t *out_count) {
+  char *end;
+  unsigned long count = strtoul(text, &end, 10);
+  if (end == text || *end != '\0' || count == 0 || count > UINT32_MAX) {
+    return false;
+  }
+  *out_count = (uint32_t)count;
+  return true;
+}
+
+int replay_main(const char *path) {
+  // Nothing but timers and threads, so this runs without a display.
+  if (!SDL_Init(0)) {
+    LOG("Couldn't initialize SDL: %s", SDL_GetError());
+    goto err;
+  }
+
+  struct host_allocator allocator;
+  if (!host_allocator_init(&allocator)) {
+    goto quit_sdl;
+  }
+  struct command_stream_reader reader;
+  if (!command_stream_reader_open(&reader, &allocator, path,
+                                  sizeof(struct scene_instance))) {
+    fprintf(stderr, "Couldn't read command stream %s\n", path);
+    goto deinit_allocator;
+  }
+  if (reader.config.scene_capacity > SCENE_CAPACITY) {
+    fprintf(stderr, "%s needs room for %u instances, this build has %u\n",
+            path, reader.config.scene_capacity, SCENE_CAPACITY);
+    goto close_reader;
+  }
+
+  struct vulkan_renderer renderer;
+  if (!vulkan_renderer_init(&renderer, NULL, &reader.config)) {
+    fprintf(stderr, "Couldn't init headless vulkan renderer\n");
+    goto close_reader;
+  }
+  bool replayed = vulkan_renderer_replay(&renderer, &reader);
+  if (!replayed) {
+    fprintf(stderr, "Couldn't replay %s\n", path);
+  }
+
+  vulkan_renderer_deinit(&renderer);
+  command_stream_reader_close(&reader);
+  host_allocator_deinit(&allocator);
+  SDL_Quit();
+  return replayed ? 0 : 1;
+
+close_reader:
+  command_stream_reader_close(&reader);
+deinit_allocator:
+  host_allocator_deinit(&allocator);
+quit_sdl:
+  SDL_Quit();
+err:
+  return 1;
+}
+
+// The renderer runs on a thread of its own, fed through events by the main
+// thread, which owns the window and sleeps until SDL has something for it.
+struct render_loop {
+  struct vulkan_renderer *renderer;
+  struct event_queue events;
+  // Only draw when something changed instead of continuously.
+  bool on_demand;
+  // At least this long between the starts of two frames, 0 for no cap.
+  uint64_t min_frame_interval_ns;
+  // Exit once the recording has all of its frames.
+  bool stop_after_recording;
+  // Written by the render thread, read once it has been waited for.
+  int exit_code;
+};
+
+int render_thread_main(void *data) {
+  struct render_loop *loop = data;
+  struct vulkan_renderer *renderer = loop->renderer;
+  bool visible = true;
+  bool redraw = true;
+  bool idle = false;
+  uint64_t next_frame_ns = 0;
+
+  while (!event_queue_is_closed(&loop->events)) {
+    struct render_event event;
+    while (event_queue_pop(&loop->events, &event)) {
+      switch (event.type) {
+      case RENDER_EVENT_CAPTURE:
+        vulkan_renderer_request_capture(renderer, event.capture_encoding);
+        break;
+      case RENDER_EVENT_TOGGLE_ANIMATION:
+        renderer->animate = !renderer->animate;
+        break;
+      case RENDER_EVENT_WINDOW_EXPOSED:
+        redraw = true;
+        break;
+      case RENDER_EVENT_WINDOW_HIDDEN:
+        visible = false;
+        break;
+      case RENDER_EVENT_WINDOW_SHOWN:
+        visible = true;
+        redraw = true;
+        break;
+      }
+    }
+
+    bool draw = visible && (!loop->on_demand || redraw ||
+                            vulkan_renderer_has_changes(renderer));
+    if (!draw) {
+      if (!idle && !vulkan_renderer_finish_frames(renderer)) {
+        loop->exit_code = 1;
+        break;
+      }
+      idle = true;
+      event_queue_wait(&loop->events, UINT64_MAX);
+      continue;
+    }
+    // Events that arrive while waiting for the next frame are still handled
+    // right away.
+    uint64_t now_ns = SDL_GetTicksNS();
+    if (now_ns < next_frame_ns) {
+      event_queue_wait(&loop->events, next_frame_ns - now_ns);
+      continue;
+    }
+    next_frame_ns += loop->min_frame_interval_ns;
+    if (next_frame_ns < now_ns) {
+      next_frame_ns = now_ns;
+    }
+
+    idle = false;
+    redraw = false;
+    if (!vulkan_renderer_draw_frame(renderer)) {
+      LOG("Couldn't draw frame");
+      loop->exit_code = 1;
+      break;
+    }
+    if (loop->stop_after_recording && !renderer->recording) {
+      break;
+    }
+  }
+
+  // The main thread is blocked waiting for window events.
+  SDL_PushEvent(&(SDL_Event){.type = SDL_EVENT_QUIT});
+  return 0;
+}
+
+// Passes what the render thread needs to know about an SDL event on to it.
+// Returns false once the program should exit.
+bool render_loop_forward_event(struct render_loop *loop,
+                               const SDL_Event *event) {
+  struct render_event render_event = {0};
+  switch (event->type) {
+  case SDL_EVENT_QUIT:
+    return false;
+  case SDL_EVENT_KEY_DOWN:
+    if (event->key.key == SDLK_ESCAPE) {
+      return false;
+    }
+    // F12 saves a PNG of the next frame, Shift+F12 raw RGBA. Space pauses
+    // and resumes the animation.
+    if (event->key.key == SDLK_F12) {
+      render_event.type = RENDER_EVENT_CAPTURE;
+      render_event.capture_encoding = (event->key.mod & SDL_KMOD_SHIFT)
+                                          ? FRAME_CAPTURE_ENCODING_RAW
+                                          : FRAME_CAPTURE_ENCODING_PNG;
+    } else if (event->key.key == SDLK_SPACE && !event->key.repeat) {
+      render_event.type = RENDER_EVENT_TOGGLE_ANIMATION;
+    } else {
+      return true;
+    }
+    break;
+  case SDL_EVENT_WINDOW_EXPOSED:
+  case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+    render_event.type = RENDER_EVENT_WINDOW_EXPOSED;
+    break;
+  case SDL_EVENT_WINDOW_MINIMIZED:
+  case SDL_EVENT_WINDOW_HIDDEN:
+    render_event.type = RENDER_EVENT_WINDOW_HIDDEN;
+    break;
+  case SDL_EVENT_WINDOW_RESTORED:
+  case SDL_EVENT_WINDOW_SHOWN:
+    render_event.type = RENDER_EVENT_WINDOW_SHOWN;
+    break;
+  default:
+    return true;
+  }
+  if (!event_queue_push(&loop->events, &render_event)) {
+    LOG("Render event queue is full, %llu events dropped",
+        (unsigned long long)loop->events.dropped_count);
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  // --record captures the first frames drawn into a command stream and
+  // exits, --replay re-runs one headless and reports its frame times.
+  // --on-demand starts with the animation paused and only draws when
+  // something changed, --max-fps caps how often frames are drawn.
+  const char *record_path = NULL;
+  uint32_t record_frame_count = 0;
+  bool on_demand = false;
+  uint32_t max_fps = 0;
+  if (argc == 3 && strcmp(argv[1], "--replay") == 0) {
+    return replay_main(argv[2]);
+  }
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "--record") == 0 && arg + 2 < argc &&
+        parse_count(argv[arg + 2], &record_frame_count)) {
+      record_path = argv[arg + 1];
+      arg += 2;
+    } else if (strcmp(argv[arg], "--max-fps") == 0 && arg + 1 < argc &&
+               parse_count(argv[arg + 1], &max_fps)) {
+      arg++;
+    } else if (strcmp(argv[arg], "--on-demand") == 0) {
+      on_demand = true;
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+
+  if (!SDL_Init(SDL_INIT_VIDEO)) {
+    LOG("Couldn't initialize SDL: %s", SDL_GetError());
+    goto err;
+  }
+
+  SDL_Window *window =
+      SDL_CreateWindow("vkguide", 1280, 720, SDL_WINDOW_VULKAN);
+  if (!window) {
+    LOG("Couldn't create window: %s", SDL_GetError());
+    goto quit_sdl;
+  }
+
+  struct vulkan_renderer renderer;
+  if (!vulkan_renderer_init(&renderer, window, NULL)) {
+    LOG("Couldn't init vulkan renderer");
+    goto destroy_window;
+  }
+  renderer.animate = !on_demand;
+
+  int exit_code = 0;
+  if (record_path &&
+      !vulkan_renderer_start_recording(&renderer, record_path,
+                                       record_frame_count)) {
+    fprintf(stderr, "Couldn't record to %s\n", record_path);
+    exit_code = 1;
+    goto out_main_loop;
+  }
+
+  struct render_loop loop = {
+      .renderer = &renderer,
+      .on_demand = on_demand,
+      .min_frame_interval_ns =
+          max_fps > 0 ? (uint64_t)SDL_NS_PER_SECOND / max_fps : 0,
+      .stop_after_recording = record_path != NULL,
+      .exit_code = 0};
+  if (!event_queue_init(&loop.events)) {
+    exit_code = 1;
+    goto out_main_loop;
+  }
+  SDL_Thread *render_thread =
+      SDL_CreateThread(render_thread_main, "render", &loop);
+  if (!render_thread) {
+    LOG("Couldn't create render thread: %s", SDL_GetError());
+    exit_code = 1;
+    goto deinit_events;
+  }
+
+  SDL_Event event;
+  while (SDL_WaitEvent(&event) && render_loop_forward_event(&loop, &event)) {
+  }
+  event_queue_close(&loop.events);
+  SDL_WaitThread(render_thread, NULL);
+  exit_code = loop.exit_code;
+deinit_events:
+  event_queue_deinit(&loop.events);
 out_main_loop:
 
   vulkan_renderer_deinit(&renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
-  return 0;
+  return exit_code;
 
 destroy_window:
   SDL_DestroyWindow(window);
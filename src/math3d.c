@@ -0,0 +1,240 @@
+#include "math3d.h"
+
+#include "simd.h"
+#include <math.h>
+
+float vec3_length(struct vec3 v) { return sqrtf(vec3_dot(v, v)); }
+
+struct vec3 vec3_normalize(struct vec3 v) {
+  float length = vec3_length(v);
+  return length > 0.0f ? vec3_scale(v, 1.0f / length) : v;
+}
+
+struct mat4 mat4_identity(void) {
+  return (struct mat4){{1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f,
+                        0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f}};
+}
+
+struct mat4 mat4_mul(const struct mat4 *a, const struct mat4 *b) {
+  f32x4 a0 = f32x4_load(a->m + 0);
+  f32x4 a1 = f32x4_load(a->m + 4);
+  f32x4 a2 = f32x4_load(a->m + 8);
+  f32x4 a3 = f32x4_load(a->m + 12);
+
+  struct mat4 result;
+  for (int column = 0; column < 4; column++) {
+    const float *b_column = b->m + column * 4;
+    f32x4 r = f32x4_mul(a0, f32x4_splat(b_column[0]));
+    r = f32x4_madd(a1, f32x4_splat(b_column[1]), r);
+    r = f32x4_madd(a2, f32x4_splat(b_column[2]), r);
+    r = f32x4_madd(a3, f32x4_splat(b_column[3]), r);
+    f32x4_store(result.m + column * 4, r);
+  }
+  return result;
+}
+
+struct vec4 mat4_mul_vec4(const struct mat4 *m, struct vec4 v) {
+  f32x4 r = f32x4_mul(f32x4_load(m->m + 0), f32x4_splat(v.x));
+  r = f32x4_madd(f32x4_load(m->m + 4), f32x4_splat(v.y), r);
+  r = f32x4_madd(f32x4_load(m->m + 8), f32x4_splat(v.z), r);
+  r = f32x4_madd(f32x4_load(m->m + 12), f32x4_splat(v.w), r);
+  struct vec4 result;
+  f32x4_store(&result.x, r);
+  return result;
+}
+
+struct vec3 mat4_transform_point(const struct mat4 *m, struct vec3 p) {
+  struct vec4 r = mat4_mul_vec4(m, (struct vec4){p.x, p.y, p.z, 1.0f});
+  return (struct vec3){r.x, r.y, r.z};
+}
+
+struct mat4 mat4_transpose(const struct mat4 *m) {
+  f32x4 c0 = f32x4_load(m->m + 0);
+  f32x4 c1 = f32x4_load(m->m + 4);
+  f32x4 c2 = f32x4_load(m->m + 8);
+  f32x4 c3 = f32x4_load(m->m + 12);
+  f32x4_transpose(&c0, &c1, &c2, &c3);
+
+  struct mat4 result;
+  f32x4_store(result.m + 0, c0);
+  f32x4_store(result.m + 4, c1);
+  f32x4_store(result.m + 8, c2);
+  f32x4_store(result.m + 12, c3);
+  return result;
+}
+
+bool mat4_inverse(const struct mat4 *matrix, struct mat4 *out) {
+  const float *m = matrix->m;
+  float inv[16];
+
+  inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] +
+           m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+  inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] +
+           m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] +
+           m[12] * m[7] * m[10];
+  inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] +
+           m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+  inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] +
+            m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] +
+            m[12] * m[6] * m[9];
+  inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] +
+           m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] +
+           m[13] * m[3] * m[10];
+  inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] +
+           m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+  inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] +
+           m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] +
+           m[12] * m[3] * m[9];
+  inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] +
+            m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+  inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] +
+           m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+  inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] -
+           m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+  inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] +
+            m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+  inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] -
+            m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+  inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] -
+           m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+  inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] +
+           m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+  inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] -
+            m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+  inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] +
+            m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+  float determinant = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] +
+                      m[3] * inv[12];
+  if (determinant == 0.0f) {
+    return false;
+  }
+
+  f32x4 inverse_determinant = f32x4_splat(1.0f / determinant);
+  for (int column = 0; column < 4; column++) {
+    f32x4_store(out->m + column * 4,
+                f32x4_mul(f32x4_load(inv + column * 4), inverse_determinant));
+  }
+  return true;
+}
+
+struct mat4 mat4_translation(struct vec3 t) {
+  struct mat4 result = mat4_identity();
+  result.m[12] = t.x;
+  result.m[13] = t.y;
+  result.m[14] = t.z;
+  return result;
+}
+
+struct mat4 mat4_scale(struct vec3 s) {
+  struct mat4 result = mat4_identity();
+  result.m[0] = s.x;
+  result.m[5] = s.y;
+  result.m[10] = s.z;
+  return result;
+}
+
+struct mat4 mat4_from_quat(struct quat q) {
+  float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+  float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+  float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+  return (struct mat4){{1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz),
+                        2.0f * (xz - wy), 0.0f, 2.0f * (xy - wz),
+                        1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f,
+                        2.0f * (xz + wy), 2.0f * (yz - wx),
+                        1.0f - 2.0f * (xx + yy), 0.0f, 0.0f, 0.0f, 0.0f,
+                        1.0f}};
+}
+
+struct mat4 mat4_from_trs(struct vec3 translation, struct quat rotation,
+                          struct vec3 scale) {
+  struct mat4 result = mat4_from_quat(rotation);
+  f32x4 column0 = f32x4_mul(f32x4_load(result.m + 0), f32x4_splat(scale.x));
+  f32x4 column1 = f32x4_mul(f32x4_load(result.m + 4), f32x4_splat(scale.y));
+  f32x4 column2 = f32x4_mul(f32x4_load(result.m + 8), f32x4_splat(scale.z));
+  f32x4_store(result.m + 0, column0);
+  f32x4_store(result.m + 4, column1);
+  f32x4_store(result.m + 8, column2);
+  result.m[12] = translation.x;
+  result.m[13] = translation.y;
+  result.m[14] = translation.z;
+  return result;
+}
+
+struct mat4 mat4_perspective(float fov_y_radians, float aspect, float z_near,
+                             float z_far) {
+  float focal_length = 1.0f / tanf(fov_y_radians * 0.5f);
+  struct mat4 result = {{0}};
+  result.m[0] = focal_length / aspect;
+  result.m[5] = -focal_length;
+  result.m[10] = z_far / (z_near - z_far);
+  result.m[11] = -1.0f;
+  result.m[14] = z_near * z_far / (z_near - z_far);
+  return result;
+}
+
+struct mat4 mat4_orthographic(float left, float right, float bottom, float top,
+                              float z_near, float z_far) {
+  struct mat4 result = mat4_identity();
+  result.m[0] = 2.0f / (right - left);
+  result.m[5] = -2.0f / (top - bottom);
+  result.m[10] = 1.0f / (z_near - z_far);
+  result.m[12] = -(right + left) / (right - left);
+  result.m[13] = (top + bottom) / (top - bottom);
+  result.m[14] = z_near / (z_near - z_far);
+  return result;
+}
+
+struct mat4 mat4_look_at(struct vec3 eye, struct vec3 target, struct vec3 up) {
+  struct vec3 forward = vec3_normalize(vec3_sub(target, eye));
+  struct vec3 right = vec3_normalize(vec3_cross(forward, up));
+  struct vec3 camera_up = vec3_cross(right, forward);
+  return (struct mat4){{right.x, camera_up.x, -forward.x, 0.0f, right.y,
+                        camera_up.y, -forward.y, 0.0f, right.z, camera_up.z,
+                        -forward.z, 0.0f, -vec3_dot(right, eye),
+                        -vec3_dot(camera_up, eye), vec3_dot(forward, eye),
+                        1.0f}};
+}
+
+struct quat quat_identity(void) {
+  return (struct quat){0.0f, 0.0f, 0.0f, 1.0f};
+}
+
+struct quat quat_from_axis_angle(struct vec3 axis, float angle_radians) {
+  struct vec3 n = vec3_normalize(axis);
+  float s = sinf(angle_radians * 0.5f);
+  return (struct quat){n.x * s, n.y * s, n.z * s, cosf(angle_radians * 0.5f)};
+}
+
+struct quat quat_mul(struct quat a, struct quat b) {
+  return (struct quat){a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+                       a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+                       a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+                       a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z};
+}
+
+struct quat quat_normalize(struct quat q) {
+  float length = sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+  if (length == 0.0f) {
+    return quat_identity();
+  }
+  float inverse_length = 1.0f / length;
+  return (struct quat){q.x * inverse_length, q.y * inverse_length,
+                       q.z * inverse_length, q.w * inverse_length};
+}
+
+struct vec3 quat_rotate(struct quat q, struct vec3 v) {
+  // v + 2w(q x v) + 2(q x (q x v)), with t = 2(q x v).
+  struct vec3 axis = {q.x, q.y, q.z};
+  struct vec3 t = vec3_scale(vec3_cross(axis, v), 2.0f);
+  return vec3_add(vec3_add(v, vec3_scale(t, q.w)), vec3_cross(axis, t));
+}
+
+struct quat quat_nlerp(struct quat a, struct quat b, float t) {
+  float dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+  float sign = dot < 0.0f ? -1.0f : 1.0f;
+  return quat_normalize((struct quat){a.x + (b.x * sign - a.x) * t,
+                                      a.y + (b.y * sign - a.y) * t,
+                                      a.z + (b.z * sign - a.z) * t,
+                                      a.w + (b.w * sign - a.w) * t});
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Matrices are column-major and vectors are column vectors, matching GLSL, so
+// a struct mat4 can be copied straight into a uniform or storage buffer.
+// Projections target Vulkan clip space: y points down and depth is [0, 1].
+
+struct vec2 {
+  float x, y;
+};
+
+struct vec3 {
+  float x, y, z;
+};
+
+struct vec4 {
+  _Alignas(16) float x;
+  float y, z, w;
+};
+
+struct quat {
+  _Alignas(16) float x;
+  float y, z, w;
+};
+
+struct mat4 {
+  _Alignas(16) float m[16];
+};
+
+static inline struct vec3 vec3_add(struct vec3 a, struct vec3 b) {
+  return (struct vec3){a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+static inline struct vec3 vec3_sub(struct vec3 a, struct vec3 b) {
+  return (struct vec3){a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static inline struct vec3 vec3_scale(struct vec3 v, float s) {
+  return (struct vec3){v.x * s, v.y * s, v.z * s};
+}
+
+static inline float vec3_dot(struct vec3 a, struct vec3 b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline struct vec3 vec3_cross(struct vec3 a, struct vec3 b) {
+  return (struct vec3){a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+                       a.x * b.y - a.y * b.x};
+}
+
+float vec3_length(struct vec3 v);
+struct vec3 vec3_normalize(struct vec3 v);
+
+struct mat4 mat4_identity(void);
+struct mat4 mat4_mul(const struct mat4 *a, const struct mat4 *b);
+struct vec4 mat4_mul_vec4(const struct mat4 *m, struct vec4 v);
+struct vec3 mat4_transform_point(const struct mat4 *m, struct vec3 p);
+struct mat4 mat4_transpose(const struct mat4 *m);
+// Returns false and leaves *out untouched for singular matrices.
+bool mat4_inverse(const struct mat4 *m, struct mat4 *out);
+struct mat4 mat4_translation(struct vec3 t);
+struct mat4 mat4_scale(struct vec3 s);
+struct mat4 mat4_from_quat(struct quat q);
+// translation * rotation * scale, the usual node transform.
+struct mat4 mat4_from_trs(struct vec3 translation, struct quat rotation,
+                          struct vec3 scale);
+struct mat4 mat4_perspective(float fov_y_radians, float aspect, float z_near,
+                             float z_far);
+struct mat4 mat4_orthographic(float left, float right, float bottom, float top,
+                              float z_near, float z_far);
+struct mat4 mat4_look_at(struct vec3 eye, struct vec3 target, struct vec3 up);
+
+struct quat quat_identity(void);
+struct quat quat_from_axis_angle(struct vec3 axis, float angle_radians);
+struct quat quat_mul(struct quat a, struct quat b);
+struct quat quat_normalize(struct quat q);
+struct vec3 quat_rotate(struct quat q, struct vec3 v);
+// Normalized lerp along the shortest arc; cheap and good enough for
+// animation steps of a few degrees.
+struct quat quat_nlerp(struct quat a, struct quat b, float t);
@@ -0,0 +1,484 @@
+#include "multiview.h"
+
+#include "log.h"
+#include "shader_variant.h"
+#include "telemetry.h"
+#include "vulkan_utils.h"
+#include <assert.h>
+
+// Mirrors Views in the MULTIVIEW variant of shaders/triangle.vert (std140).
+struct multiview_uniforms {
+  struct mat4 view_projections[MULTIVIEW_MAX_VIEWS];
+};
+
+static bool create_target(struct multiview_pass *pass,
+                          VkPhysicalDevice physical_device, VkDevice device,
+                          const VkAllocationCallbacks *allocation_callbacks,
+                          VkFormat depth_format) {
+  VkImageCreateInfo image_info = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = pass->color_format,
+      .extent = {pass->extent.width, pass->extent.height, 1},
+      .mipLevels = 1,
+      .arrayLayers = pass->view_count,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+               VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+  if (!create_image(physical_device, device, allocation_callbacks,
+                    &image_info, &pass->color_image, &pass->color_memory)) {
+    goto err;
+  }
+
+  image_info.format = depth_format;
+  image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  if (!create_image(physical_device, device, allocation_callbacks,
+                    &image_info, &pass->depth_image, &pass->depth_memory)) {
+    goto destroy_color_image;
+  }
+
+  VkImageViewCreateInfo view_info = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = pass->color_image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+      .format = pass->color_format,
+      .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                           .levelCount = 1,
+                           .layerCount = pass->view_count}};
+  if (vkCreateImageView(device, &view_info, allocation_callbacks,
+                        &pass->color_view) != VK_SUCCESS) {
+    goto destroy_depth_image;
+  }
+
+  view_info.image = pass->depth_image;
+  view_info.format = depth_format;
+  view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+  if (vkCreateImageView(device, &view_info, allocation_callbacks,
+                        &pass->depth_view) != VK_SUCCESS) {
+    goto destroy_color_view;
+  }
+
+  return true;
+destroy_color_view:
+  vkDestroyImageView(device, pass->color_view, allocation_callbacks);
+destroy_depth_image:
+  vkDestroyImage(device, pass->depth_image, allocation_callbacks);
+  vkFreeMemory(device, pass->depth_memory, allocation_callbacks);
+destroy_color_image:
+  vkDestroyImage(device, pass->color_image, allocation_callbacks);
+  vkFreeMemory(device, pass->color_memory, allocation_callbacks);
+err:
+  return false;
+}
+
+static void destroy_target(struct multiview_pass *pass, VkDevice device,
+                           const VkAllocationCallbacks *allocation_callbacks) {
+  vkDestroyImageView(device, pass->depth_view, allocation_callbacks);
+  vkDestroyImageView(device, pass->color_view, allocation_callbacks);
+  vkDestroyImage(device, pass->depth_image, allocation_callbacks);
+  vkFreeMemory(device, pass->depth_memory, allocation_callbacks);
+  vkDestroyImage(device, pass->color_image, allocation_callbacks);
+  vkFreeMemory(device, pass->color_memory, allocation_callbacks);
+}
+
+static bool
+create_render_pass(struct multiview_pass *pass, VkDevice device,
+                   const VkAllocationCallbacks *allocation_callbacks,
+                   VkFormat depth_format) {
+  VkAttachmentDescription attachments[] = {
+      {.format = pass->color_format,
+       .samples = VK_SAMPLE_COUNT_1_BIT,
+       .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+       .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+       .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+       .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+       .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+       .finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL},
+      {.format = depth_format,
+       .samples = VK_SAMPLE_COUNT_1_BIT,
+       .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+       .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+       .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+       .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+       .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+       .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL}};
+
+  VkAttachmentReference color_attachment_ref = {
+      .attachment = 0,
+      .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+  VkAttachmentReference depth_attachment_ref = {
+      .attachment = 1,
+      .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+  };
+
+  // The target is shared by all frames in flight: the clear waits for the
+  // previous frame's reads of the color image and its depth writes.
+  VkSubpassDependency dependencies[] = {
+      {.srcSubpass = VK_SUBPASS_EXTERNAL,
+       .dstSubpass = 0,
+       .srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT |
+                       VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+       .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+       .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                       VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+       .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT},
+      {.srcSubpass = 0,
+       .dstSubpass = VK_SUBPASS_EXTERNAL,
+       .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+       .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+       .dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+       .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT}};
+
+  // Every view is rendered by the one subpass. The views are also declared
+  // correlated, since they look at the same scene.
+  uint32_t view_mask = (1u << pass->view_count) - 1;
+  if (vkCreateRenderPass(
+          device,
+          &(const VkRenderPassCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+              .pNext =
+                  &(const VkRenderPassMultiviewCreateInfo){
+                      .sType =
+                          VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO,
+                      .subpassCount = 1,
+                      .pViewMasks = &view_mask,
+                      .correlationMaskCount = 1,
+                      .pCorrelationMasks = &view_mask},
+              .attachmentCount = 2,
+              .pAttachments = attachments,
+              .subpassCount = 1,
+              .pSubpasses =
+                  &(const VkSubpassDescription){
+                      .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      .colorAttachmentCount = 1,
+                      .pColorAttachments = &color_attachment_ref,
+                      .pDepthStencilAttachment = &depth_attachment_ref},
+              .dependencyCount = 2,
+              .pDependencies = dependencies},
+          allocation_callbacks, &pass->render_pass) != VK_SUCCESS) {
+    goto err;
+  }
+
+  // With multiview the framebuffer has a single layer; the view mask selects
+  // the layers of the attachments.
+  if (vkCreateFramebuffer(
+          device,
+          &(const VkFramebufferCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+              .renderPass = pass->render_pass,
+              .attachmentCount = 2,
+              .pAttachments =
+                  (const VkImageView[]){pass->color_view, pass->depth_view},
+              .width = pass->extent.width,
+              .height = pass->extent.height,
+              .layers = 1},
+          allocation_callbacks, &pass->framebuffer) != VK_SUCCESS) {
+    goto destroy_render_pass;
+  }
+
+  return true;
+destroy_render_pass:
+  vkDestroyRenderPass(device, pass->render_pass, allocation_callbacks);
+err:
+  return false;
+}
+
+static bool create_pipeline(struct multiview_pass *pass, VkDevice device,
+                            const VkAllocationCallbacks *allocation_callbacks,
+                            struct host_allocator *host_allocator) {
+  VkDescriptorSetLayoutBinding bindings[] = {
+      {.binding = 0,
+       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+       .descriptorCount = 1,
+       .stageFlags = VK_SHADER_STAGE_VERTEX_BIT},
+      {.binding = 1,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+       .descriptorCount = 1,
+       .stageFlags = VK_SHADER_STAGE_VERTEX_BIT}};
+  if (vkCreateDescriptorSetLayout(
+          device,
+          &(const VkDescriptorSetLayoutCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+              .bindingCount = 2,
+              .pBindings = bindings},
+          allocation_callbacks, &pass->set_layout) != VK_SUCCESS) {
+    goto err;
+  }
+
+  if (vkCreatePipelineLayout(
+          device,
+          &(const VkPipelineLayoutCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+              .setLayoutCount = 1,
+              .pSetLayouts = &pass->set_layout},
+          allocation_callbacks, &pass->pipeline_layout) != VK_SUCCESS) {
+    goto destroy_set_layout;
+  }
+
+  shader_variant_key shader_keys[] = {
+      shader_variant_key_make(SHADER_SOURCE_TRIANGLE_VERT,
+                              SHADER_PERMUTATION_MULTIVIEW),
+      shader_variant_key_make(SHADER_SOURCE_TRIANGLE_FRAG, 0)};
+  static const VkShaderStageFlagBits shader_stages[] = {
+      VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT};
+  VkPipelineShaderStageCreateInfo stage_infos[2] = {0};
+  uint32_t stage_index = 0;
+  for (; stage_index < 2; stage_index++) {
+    VkShaderModule shader_module = shader_variant_create_module(
+        device, allocation_callbacks, host_allocator, shader_keys[stage_index]);
+    if (!shader_module) {
+      goto destroy_shader_modules;
+    }
+    stage_infos[stage_index] = (VkPipelineShaderStageCreateInfo){
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = shader_stages[stage_index],
+        .module = shader_module,
+        .pName = "main"};
+  }
+
+  VkPipelineVertexInputStateCreateInfo vertex_input_info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+  VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+      .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST};
+  VkViewport viewport = {.width = (float)pass->extent.width,
+                         .height = (float)pass->extent.height,
+                         .maxDepth = 1.0f};
+  VkRect2D scissor = {.extent = pass->extent};
+  VkPipelineViewportStateCreateInfo viewport_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+      .viewportCount = 1,
+      .pViewports = &viewport,
+      .scissorCount = 1,
+      .pScissors = &scissor};
+  VkPipelineRasterizationStateCreateInfo rasterizer = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+      .polygonMode = VK_POLYGON_MODE_FILL,
+      .cullMode = VK_CULL_MODE_BACK_BIT,
+      .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+      .lineWidth = 1.0f};
+  VkPipelineMultisampleStateCreateInfo multisampling = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+      .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+      .minSampleShading = 1.0f};
+  VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+      .depthTestEnable = VK_TRUE,
+      .depthWriteEnable = VK_TRUE,
+      .depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL};
+  VkPipelineColorBlendAttachmentState color_blend_attachment = {
+      .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT};
+  VkPipelineColorBlendStateCreateInfo color_blending = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+      .attachmentCount = 1,
+      .pAttachments = &color_blend_attachment};
+
+  // The view mask comes from the render pass; the pipeline needs nothing
+  // multiview specific beyond being created against it.
+  VkResult result = vkCreateGraphicsPipelines(
+      device, VK_NULL_HANDLE, 1,
+      &(const VkGraphicsPipelineCreateInfo){
+          .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+          .stageCount = 2,
+          .pStages = stage_infos,
+          .pVertexInputState = &vertex_input_info,
+          .pInputAssemblyState = &input_assembly,
+          .pViewportState = &viewport_state,
+          .pRasterizationState = &rasterizer,
+          .pMultisampleState = &multisampling,
+          .pDepthStencilState = &depth_stencil,
+          .pColorBlendState = &color_blending,
+          .layout = pass->pipeline_layout,
+          .renderPass = pass->render_pass,
+          .subpass = 0},
+      allocation_callbacks, &pass->pipeline);
+  if (result != VK_SUCCESS) {
+    goto destroy_shader_modules;
+  }
+  telemetry_count(TELEMETRY_COUNTER_PIPELINE_COMPILES, 1);
+
+  for (uint32_t stage = 0; stage < 2; stage++) {
+    vkDestroyShaderModule(device, stage_infos[stage].module,
+                          allocation_callbacks);
+  }
+  return true;
+destroy_shader_modules:
+  while (stage_index-- > 0) {
+    vkDestroyShaderModule(device, stage_infos[stage_index].module,
+                          allocation_callbacks);
+  }
+  vkDestroyPipelineLayout(device, pass->pipeline_layout, allocation_callbacks);
+destroy_set_layout:
+  vkDestroyDescriptorSetLayout(device, pass->set_layout, allocation_callbacks);
+err:
+  return false;
+}
+
+static void
+destroy_pipeline(struct multiview_pass *pass, VkDevice device,
+                 const VkAllocationCallbacks *allocation_callbacks) {
+  vkDestroyPipeline(device, pass->pipeline, allocation_callbacks);
+  vkDestroyPipelineLayout(device, pass->pipeline_layout, allocation_callbacks);
+  vkDestroyDescriptorSetLayout(device, pass->set_layout, allocation_callbacks);
+}
+
+static bool
+create_descriptor_set(struct multiview_pass *pass, VkDevice device,
+                      const VkAllocationCallbacks *allocation_callbacks,
+                      const struct uniform_ring *uniform_ring,
+                      const struct instance_buffer *instance_buffer) {
+  if (vkCreateDescriptorPool(
+          device,
+          &(const VkDescriptorPoolCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+              .maxSets = 1,
+              .poolSizeCount = 2,
+              .pPoolSizes =
+                  (const VkDescriptorPoolSize[]){
+                      {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                       .descriptorCount = 1},
+                      {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                       .descriptorCount = 1}}},
+          allocation_callbacks, &pass->descriptor_pool) != VK_SUCCESS) {
+    return false;
+  }
+
+  if (vkAllocateDescriptorSets(
+          device,
+          &(const VkDescriptorSetAllocateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+              .descriptorPool = pass->descriptor_pool,
+              .descriptorSetCount = 1,
+              .pSetLayouts = &pass->set_layout},
+          &pass->descriptor_set) != VK_SUCCESS) {
+    vkDestroyDescriptorPool(device, pass->descriptor_pool,
+                            allocation_callbacks);
+    return false;
+  }
+
+  VkDescriptorBufferInfo uniform_info = uniform_ring_descriptor_info(
+      uniform_ring, sizeof(struct multiview_uniforms));
+  VkDescriptorBufferInfo instance_info =
+      instance_buffer_descriptor_info(instance_buffer);
+  vkUpdateDescriptorSets(
+      device, 2,
+      (const VkWriteDescriptorSet[]){
+          {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+           .dstSet = pass->descriptor_set,
+           .dstBinding = 0,
+           .descriptorCount = 1,
+           .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+           .pBufferInfo = &uniform_info},
+          {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+           .dstSet = pass->descriptor_set,
+           .dstBinding = 1,
+           .descriptorCount = 1,
+           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+           .pBufferInfo = &instance_info}},
+      0, NULL);
+  return true;
+}
+
+bool multiview_pass_init(struct multiview_pass *pass,
+                         VkPhysicalDevice physical_device, VkDevice device,
+                         const VkAllocationCallbacks *allocation_callbacks,
+                         struct host_allocator *host_allocator,
+                         uint32_t view_count, VkExtent2D extent,
+                         VkFormat color_format, VkFormat depth_format,
+                         const struct uniform_ring *uniform_ring,
+                         const struct instance_buffer *instance_buffer) {
+  assert(view_count > 0 && view_count <= MULTIVIEW_MAX_VIEWS);
+  *pass = (struct multiview_pass){.view_count = view_count,
+                                  .extent = extent,
+                                  .color_format = color_format};
+
+  if (!create_target(pass, physical_device, device, allocation_callbacks,
+                     depth_format)) {
+    LOG("Couldn't create multiview target");
+    goto err;
+  }
+
+  if (!create_render_pass(pass, device, allocation_callbacks, depth_format)) {
+    LOG("Couldn't create multiview render pass");
+    goto destroy_target;
+  }
+
+  if (!create_pipeline(pass, device, allocation_callbacks, host_allocator)) {
+    LOG("Couldn't create multiview pipeline");
+    goto destroy_render_pass;
+  }
+
+  if (!create_descriptor_set(pass, device, allocation_callbacks, uniform_ring,
+                             instance_buffer)) {
+    LOG("Couldn't create multiview descriptor set");
+    goto destroy_pipeline;
+  }
+
+  return true;
+destroy_pipeline:
+  destroy_pipeline(pass, device, allocation_callbacks);
+destroy_render_pass:
+  vkDestroyFramebuffer(device, pass->framebuffer, allocation_callbacks);
+  vkDestroyRenderPass(device, pass->render_pass, allocation_callbacks);
+destroy_target:
+  destroy_target(pass, device, allocation_callbacks);
+err:
+  return false;
+}
+
+void multiview_pass_deinit(struct multiview_pass *pass, VkDevice device,
+                           const VkAllocationCallbacks *allocation_callbacks) {
+  vkDestroyDescriptorPool(device, pass->descriptor_pool, allocation_callbacks);
+  destroy_pipeline(pass, device, allocation_callbacks);
+  vkDestroyFramebuffer(device, pass->framebuffer, allocation_callbacks);
+  vkDestroyRenderPass(device, pass->render_pass, allocation_callbacks);
+  destroy_target(pass, device, allocation_callbacks);
+  *pass = (struct multiview_pass){0};
+}
+
+bool multiview_pass_cmd_draw(struct multiview_pass *pass,
+                             VkCommandBuffer command_buffer,
+                             struct uniform_ring *uniform_ring,
+                             const struct mat4 *view_projections,
+                             uint32_t instance_offset,
+                             uint32_t instance_count) {
+  struct multiview_uniforms uniforms = {0};
+  for (uint32_t view = 0; view < pass->view_count; view++) {
+    uniforms.view_projections[view] = view_projections[view];
+  }
+  uint32_t dynamic_offsets[2] = {0, instance_offset};
+  if (!uniform_ring_push(uniform_ring, &uniforms, sizeof(uniforms),
+                         &dynamic_offsets[0])) {
+    return false;
+  }
+
+  VkClearValue clear_values[] = {
+      {.color = {.float32 = {0.0f, 0.0f, 0.0f, 1.0f}}},
+      {.depthStencil = {.depth = 1.0f}}};
+  vkCmdBeginRenderPass(
+      command_buffer,
+      &(const VkRenderPassBeginInfo){
+          .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+          .renderPass = pass->render_pass,
+          .framebuffer = pass->framebuffer,
+          .renderArea = {.extent = pass->extent},
+          .clearValueCount = 2,
+          .pClearValues = clear_values},
+      VK_SUBPASS_CONTENTS_INLINE);
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    pass->pipeline);
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pass->pipeline_layout, 0, 1, &pass->descriptor_set,
+                          2, dynamic_offsets);
+  // One draw for every view: the implementation broadcasts it to each layer
+  // in the view mask.
+  vkCmdDraw(command_buffer, 3, instance_count, 0, 0);
+  vkCmdEndRenderPass(command_buffer);
+  return true;
+}
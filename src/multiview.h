@@ -0,0 +1,61 @@
+#pragma once
+
+#include "host_allocator.h"
+#include "instance_buffer.h"
+#include "math3d.h"
+#include "uniform_ring.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Enough for a cubemap, and within the maxMultiviewViewCount every
+// implementation of VK_KHR_multiview guarantees.
+#define MULTIVIEW_MAX_VIEWS 6
+
+// Renders the scene from up to MULTIVIEW_MAX_VIEWS cameras in a single pass
+// with VK_KHR_multiview. Every layer of a layered color/depth target is one
+// view; a single draw is broadcast to all of them and the vertex shader picks
+// its camera with gl_ViewIndex, so command recording and vertex fetch are
+// paid once instead of once per view.
+struct multiview_pass {
+  uint32_t view_count;
+  VkExtent2D extent;
+  VkFormat color_format;
+  VkImage color_image;
+  VkDeviceMemory color_memory;
+  VkImageView color_view;
+  VkImage depth_image;
+  VkDeviceMemory depth_memory;
+  VkImageView depth_view;
+  VkRenderPass render_pass;
+  VkFramebuffer framebuffer;
+
+  VkDescriptorSetLayout set_layout;
+  VkPipelineLayout pipeline_layout;
+  VkPipeline pipeline;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet descriptor_set;
+};
+
+// The device must have VK_KHR_multiview and its multiview feature enabled.
+bool multiview_pass_init(struct multiview_pass *pass,
+                         VkPhysicalDevice physical_device, VkDevice device,
+                         const VkAllocationCallbacks *allocation_callbacks,
+                         struct host_allocator *host_allocator,
+                         uint32_t view_count, VkExtent2D extent,
+                         VkFormat color_format, VkFormat depth_format,
+                         const struct uniform_ring *uniform_ring,
+                         const struct instance_buffer *instance_buffer);
+void multiview_pass_deinit(struct multiview_pass *pass, VkDevice device,
+                           const VkAllocationCallbacks *allocation_callbacks);
+
+// Draws instances [0, instance_count) into every layer, layer n through
+// view_projections[n]. Must be recorded outside of a render pass. Leaves the
+// color image in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, with the writes made
+// available to the transfer stage.
+bool multiview_pass_cmd_draw(struct multiview_pass *pass,
+                             VkCommandBuffer command_buffer,
+                             struct uniform_ring *uniform_ring,
+                             const struct mat4 *view_projections,
+                             uint32_t instance_offset,
+                             uint32_t instance_count);
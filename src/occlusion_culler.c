@@ -0,0 +1,845 @@
+#include "occlusion_culler.h"
+
+#include "cull.h"
+#include "log.h"
+#include "shader_variant.h"
+#include "telemetry.h"
+#include "vulkan_utils.h"
+#include <assert.h>
+
+#define CULL_WORKGROUP_SIZE 64
+#define REDUCE_WORKGROUP_SIZE 8
+// constant_ids in shaders/cull.comp and shaders/hiz_reduce.comp.
+#define CULL_CONSTANT_ID_WORKGROUP_SIZE 0
+#define CULL_CONSTANT_ID_COLLECT_STATS 1
+#define REDUCE_CONSTANT_ID_WORKGROUP_SIZE_X 0
+#define REDUCE_CONSTANT_ID_WORKGROUP_SIZE_Y 1
+// The counters only feed debug logging.
+#ifdef NDEBUG
+#define COLLECT_STATS VK_FALSE
+#else
+#define COLLECT_STATS VK_TRUE
+#endif
+
+// Mirrors CullUniforms in shaders/cull.comp (std140).
+struct cull_uniforms {
+  struct mat4 view_projection;
+  struct vec4 frustum_planes[6];
+  uint32_t instance_count;
+  uint32_t pyramid_width;
+  uint32_t pyramid_height;
+  uint32_t pyramid_level_count;
+};
+
+struct cull_push_constants {
+  uint32_t phase;
+  uint32_t late_index_base;
+};
+
+struct reduce_push_constants {
+  int32_t source_width;
+  int32_t source_height;
+  int32_t destination_width;
+  int32_t destination_height;
+};
+
+enum cull_dynamic_offset {
+  CULL_DYNAMIC_OFFSET_UNIFORMS,
+  CULL_DYNAMIC_OFFSET_INSTANCES,
+  CULL_DYNAMIC_OFFSET_STATS,
+};
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static VkDeviceSize align_down(VkDeviceSize value, VkDeviceSize alignment) {
+  return value & ~(alignment - 1);
+}
+
+static uint32_t div_round_up(uint32_t value, uint32_t divisor) {
+  return (value + divisor - 1) / divisor;
+}
+
+// Level 0 matches the depth buffer and every level halves it, rounding up,
+// so texel x of level n covers depth texels [x << n, (x + 1) << n).
+static uint32_t pyramid_level_extents(VkExtent2D depth_extent,
+                                      VkExtent2D *out_extents) {
+  VkExtent2D extent = depth_extent;
+  uint32_t level_count = 0;
+  while (true) {
+    assert(level_count < OCCLUSION_CULLER_MAX_PYRAMID_LEVELS);
+    out_extents[level_count++] = extent;
+    if (extent.width == 1 && extent.height == 1) {
+      return level_count;
+    }
+    extent.width = div_round_up(extent.width, 2);
+    extent.height = div_round_up(extent.height, 2);
+  }
+}
+
+static bool create_pyramid(struct occlusion_culler *culler,
+                           VkPhysicalDevice physical_device, VkDevice device,
+                           const VkAllocationCallbacks *allocation_callbacks,
+                           VkExtent2D depth_extent) {
+  culler->pyramid_level_count =
+      pyramid_level_extents(depth_extent, culler->pyramid_extents);
+
+  if (!create_image(physical_device, device, allocation_callbacks,
+                    &(const VkImageCreateInfo){
+                        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                        .imageType = VK_IMAGE_TYPE_2D,
+                        .format = VK_FORMAT_R32_SFLOAT,
+                        .extent = {depth_extent.width, depth_extent.height, 1},
+                        .mipLevels = culler->pyramid_level_count,
+                        .arrayLayers = 1,
+                        .samples = VK_SAMPLE_COUNT_1_BIT,
+                        .tiling = VK_IMAGE_TILING_OPTIMAL,
+                        .usage = VK_IMAGE_USAGE_STORAGE_BIT |
+                                 VK_IMAGE_USAGE_SAMPLED_BIT,
+                        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+                        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED},
+                    &culler->pyramid_image, &culler->pyramid_memory)) {
+    goto err;
+  }
+
+  VkImageViewCreateInfo view_info = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = culler->pyramid_image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = VK_FORMAT_R32_SFLOAT,
+      .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                           .levelCount = culler->pyramid_level_count,
+                           .layerCount = 1}};
+  if (vkCreateImageView(device, &view_info, allocation_callbacks,
+                        &culler->pyramid_view) != VK_SUCCESS) {
+    goto destroy_image;
+  }
+
+  uint32_t level = 0;
+  for (; level < culler->pyramid_level_count; level++) {
+    view_info.subresourceRange.baseMipLevel = level;
+    view_info.subresourceRange.levelCount = 1;
+    if (vkCreateImageView(device, &view_info, allocation_callbacks,
+                          &culler->pyramid_level_views[level]) != VK_SUCCESS) {
+      goto destroy_level_views;
+    }
+  }
+
+  if (vkCreateSampler(device,
+                      &(const VkSamplerCreateInfo){
+                          .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+                          .magFilter = VK_FILTER_NEAREST,
+                          .minFilter = VK_FILTER_NEAREST,
+                          .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+                          .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                          .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                          .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                          .maxLod = VK_LOD_CLAMP_NONE},
+                      allocation_callbacks, &culler->sampler) != VK_SUCCESS) {
+    goto destroy_level_views;
+  }
+
+  return true;
+destroy_level_views:
+  while (level-- > 0) {
+    vkDestroyImageView(device, culler->pyramid_level_views[level],
+                       allocation_callbacks);
+  }
+  vkDestroyImageView(device, culler->pyramid_view, allocation_callbacks);
+destroy_image:
+  vkDestroyImage(device, culler->pyramid_image, allocation_callbacks);
+  vkFreeMemory(device, culler->pyramid_memory, allocation_callbacks);
+err:
+  return false;
+}
+
+static void destroy_pyramid(struct occlusion_culler *culler, VkDevice device,
+                            const VkAllocationCallbacks *allocation_callbacks) {
+  vkDestroySampler(device, culler->sampler, allocation_callbacks);
+  for (uint32_t level = 0; level < culler->pyramid_level_count; level++) {
+    vkDestroyImageView(device, culler->pyramid_level_views[level],
+                       allocation_callbacks);
+  }
+  vkDestroyImageView(device, culler->pyramid_view, allocation_callbacks);
+  vkDestroyImage(device, culler->pyramid_image, allocation_callbacks);
+  vkFreeMemory(device, culler->pyramid_memory, allocation_callbacks);
+}
+
+static bool create_buffers(struct occlusion_culler *culler,
+                           VkPhysicalDevice physical_device, VkDevice device,
+                           const VkAllocationCallbacks *allocation_callbacks) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+  culler->non_coherent_atom_size = properties.limits.nonCoherentAtomSize;
+
+  static const VkMemoryPropertyFlags device_local_preferences[] = {
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0};
+  uint32_t device_local_preference_count =
+      sizeof(device_local_preferences) / sizeof(VkMemoryPropertyFlags);
+
+  if (!create_buffer(physical_device, device, allocation_callbacks,
+                     culler->capacity * sizeof(uint32_t),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     device_local_preferences, device_local_preference_count,
+                     0, &culler->visibility_buffer, &culler->visibility_memory,
+                     NULL)) {
+    goto err;
+  }
+
+  if (!create_buffer(physical_device, device, allocation_callbacks,
+                     OCCLUSION_PHASE_COUNT * sizeof(VkDrawIndirectCommand),
+                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     device_local_preferences, device_local_preference_count,
+                     0, &culler->draw_buffer, &culler->draw_memory, NULL)) {
+    goto destroy_visibility_buffer;
+  }
+
+  culler->visible_index_region_size =
+      align_up(culler->capacity * sizeof(uint32_t), alignment);
+  if (!create_buffer(
+          physical_device, device, allocation_callbacks,
+          OCCLUSION_PHASE_COUNT * culler->visible_index_region_size,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, device_local_preferences,
+          device_local_preference_count, 0, &culler->visible_index_buffer,
+          &culler->visible_index_memory, NULL)) {
+    goto destroy_draw_buffer;
+  }
+
+  // The CPU reads the counters back, so cached memory is preferred.
+  static const VkMemoryPropertyFlags readback_preferences[] = {
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+  VkDeviceSize region_alignment = alignment > culler->non_coherent_atom_size
+                                      ? alignment
+                                      : culler->non_coherent_atom_size;
+  culler->stats_region_size =
+      align_up(sizeof(struct occlusion_stats), region_alignment);
+  VkMemoryPropertyFlags memory_properties;
+  if (!create_buffer(physical_device, device, allocation_callbacks,
+                     culler->region_count * culler->stats_region_size,
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     readback_preferences,
+                     sizeof(readback_preferences) /
+                         sizeof(VkMemoryPropertyFlags),
+                     0, &culler->stats_buffer, &culler->stats_memory,
+                     &memory_properties)) {
+    goto destroy_visible_index_buffer;
+  }
+  culler->stats_coherent =
+      memory_properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  void *mapped;
+  if (vkMapMemory(device, culler->stats_memory, 0, VK_WHOLE_SIZE, 0,
+                  &mapped) != VK_SUCCESS) {
+    LOG("Couldn't map occlusion stats memory");
+    goto destroy_stats_buffer;
+  }
+  culler->stats_mapped = mapped;
+
+  return true;
+destroy_stats_buffer:
+  vkDestroyBuffer(device, culler->stats_buffer, allocation_callbacks);
+  vkFreeMemory(device, culler->stats_memory, allocation_callbacks);
+destroy_visible_index_buffer:
+  vkDestroyBuffer(device, culler->visible_index_buffer, allocation_callbacks);
+  vkFreeMemory(device, culler->visible_index_memory, allocation_callbacks);
+destroy_draw_buffer:
+  vkDestroyBuffer(device, culler->draw_buffer, allocation_callbacks);
+  vkFreeMemory(device, culler->draw_memory, allocation_callbacks);
+destroy_visibility_buffer:
+  vkDestroyBuffer(device, culler->visibility_buffer, allocation_callbacks);
+  vkFreeMemory(device, culler->visibility_memory, allocation_callbacks);
+err:
+  return false;
+}
+
+static void destroy_buffers(struct occlusion_culler *culler, VkDevice device,
+                            const VkAllocationCallbacks *allocation_callbacks) {
+  vkUnmapMemory(device, culler->stats_memory);
+  vkDestroyBuffer(device, culler->stats_buffer, allocation_callbacks);
+  vkFreeMemory(device, culler->stats_memory, allocation_callbacks);
+  vkDestroyBuffer(device, culler->visible_index_buffer, allocation_callbacks);
+  vkFreeMemory(device, culler->visible_index_memory, allocation_callbacks);
+  vkDestroyBuffer(device, culler->draw_buffer, allocation_callbacks);
+  vkFreeMemory(device, culler->draw_memory, allocation_callbacks);
+  vkDestroyBuffer(device, culler->visibility_buffer, allocation_callbacks);
+  vkFreeMemory(device, culler->visibility_memory, allocation_callbacks);
+}
+
+static bool create_compute_pipeline(
+    VkDevice device, const VkAllocationCallbacks *allocation_callbacks,
+    struct host_allocator *host_allocator, enum shader_source source,
+    struct shader_specialization *specialization, VkPipelineLayout layout,
+    VkPipeline *out_pipeline) {
+  VkShaderModule shader_module = shader_variant_create_module(
+      device, allocation_callbacks, host_allocator,
+      shader_variant_key_make(source, 0));
+  if (!shader_module) {
+    return false;
+  }
+
+  VkResult result = vkCreateComputePipelines(
+      device, VK_NULL_HANDLE, 1,
+      &(const VkComputePipelineCreateInfo){
+          .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+          .stage = {.sType =
+                        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                    .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .module = shader_module,
+                    .pName = "main",
+                    .pSpecializationInfo =
+                        shader_specialization_info(specialization)},
+          .layout = layout},
+      allocation_callbacks, out_pipeline);
+  vkDestroyShaderModule(device, shader_module, allocation_callbacks);
+  if (result != VK_SUCCESS) {
+    return false;
+  }
+  telemetry_count(TELEMETRY_COUNTER_PIPELINE_COMPILES, 1);
+  return true;
+}
+
+static bool create_pipelines(struct occlusion_culler *culler, VkDevice device,
+                             const VkAllocationCallbacks *allocation_callbacks,
+                             struct host_allocator *host_allocator) {
+  if (vkCreateDescriptorSetLayout(
+          device,
+          &(const VkDescriptorSetLayoutCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+              .bindingCount = 2,
+              .pBindings =
+                  (const VkDescriptorSetLayoutBinding[]){
+                      {.binding = 0,
+                       .descriptorType =
+                           VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                       .descriptorCount = 1,
+                       .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT},
+                      {.binding = 1,
+                       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                       .descriptorCount = 1,
+                       .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT}}},
+          allocation_callbacks, &culler->reduce_set_layout) != VK_SUCCESS) {
+    goto err;
+  }
+
+  VkDescriptorSetLayoutBinding cull_bindings[] = {
+      {.binding = 0,
+       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC},
+      {.binding = 1,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC},
+      {.binding = 2, .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+      {.binding = 3, .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+      {.binding = 4, .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+      {.binding = 5,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC},
+      {.binding = 6,
+       .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER}};
+  uint32_t cull_binding_count =
+      sizeof(cull_bindings) / sizeof(VkDescriptorSetLayoutBinding);
+  for (uint32_t binding = 0; binding < cull_binding_count; binding++) {
+    cull_bindings[binding].descriptorCount = 1;
+    cull_bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  if (vkCreateDescriptorSetLayout(
+          device,
+          &(const VkDescriptorSetLayoutCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+              .bindingCount = cull_binding_count,
+              .pBindings = cull_bindings},
+          allocation_callbacks, &culler->cull_set_layout) != VK_SUCCESS) {
+    goto destroy_reduce_set_layout;
+  }
+
+  if (vkCreatePipelineLayout(
+          device,
+          &(const VkPipelineLayoutCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+              .setLayoutCount = 1,
+              .pSetLayouts = &culler->reduce_set_layout,
+              .pushConstantRangeCount = 1,
+              .pPushConstantRanges =
+                  &(const VkPushConstantRange){
+                      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                      .size = sizeof(struct reduce_push_constants)}},
+          allocation_callbacks,
+          &culler->reduce_pipeline_layout) != VK_SUCCESS) {
+    goto destroy_cull_set_layout;
+  }
+
+  if (vkCreatePipelineLayout(
+          device,
+          &(const VkPipelineLayoutCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+              .setLayoutCount = 1,
+              .pSetLayouts = &culler->cull_set_layout,
+              .pushConstantRangeCount = 1,
+              .pPushConstantRanges =
+                  &(const VkPushConstantRange){
+                      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                      .size = sizeof(struct cull_push_constants)}},
+          allocation_callbacks, &culler->cull_pipeline_layout) != VK_SUCCESS) {
+    goto destroy_reduce_pipeline_layout;
+  }
+
+  struct shader_specialization reduce_specialization = {0};
+  shader_specialization_set(&reduce_specialization,
+                            REDUCE_CONSTANT_ID_WORKGROUP_SIZE_X,
+                            REDUCE_WORKGROUP_SIZE);
+  shader_specialization_set(&reduce_specialization,
+                            REDUCE_CONSTANT_ID_WORKGROUP_SIZE_Y,
+                            REDUCE_WORKGROUP_SIZE);
+  if (!create_compute_pipeline(device, allocation_callbacks, host_allocator,
+                               SHADER_SOURCE_HIZ_REDUCE_COMP,
+                               &reduce_specialization,
+                               culler->reduce_pipeline_layout,
+                               &culler->reduce_pipeline)) {
+    LOG("Couldn't create depth pyramid pipeline");
+    goto destroy_cull_pipeline_layout;
+  }
+
+  struct shader_specialization cull_specialization = {0};
+  shader_specialization_set(&cull_specialization,
+                            CULL_CONSTANT_ID_WORKGROUP_SIZE,
+                            CULL_WORKGROUP_SIZE);
+  shader_specialization_set(&cull_specialization,
+                            CULL_CONSTANT_ID_COLLECT_STATS, COLLECT_STATS);
+  if (!create_compute_pipeline(device, allocation_callbacks, host_allocator,
+                               SHADER_SOURCE_CULL_COMP, &cull_specialization,
+                               culler->cull_pipeline_layout,
+                               &culler->cull_pipeline)) {
+    LOG("Couldn't create cull pipeline");
+    goto destroy_reduce_pipeline;
+  }
+
+  return true;
+destroy_reduce_pipeline:
+  vkDestroyPipeline(device, culler->reduce_pipeline, allocation_callbacks);
+destroy_cull_pipeline_layout:
+  vkDestroyPipelineLayout(device, culler->cull_pipeline_layout,
+                          allocation_callbacks);
+destroy_reduce_pipeline_layout:
+  vkDestroyPipelineLayout(device, culler->reduce_pipeline_layout,
+                          allocation_callbacks);
+destroy_cull_set_layout:
+  vkDestroyDescriptorSetLayout(device, culler->cull_set_layout,
+                               allocation_callbacks);
+destroy_reduce_set_layout:
+  vkDestroyDescriptorSetLayout(device, culler->reduce_set_layout,
+                               allocation_callbacks);
+err:
+  return false;
+}
+
+static void
+destroy_pipelines(struct occlusion_culler *culler, VkDevice device,
+                  const VkAllocationCallbacks *allocation_callbacks) {
+  vkDestroyPipeline(device, culler->cull_pipeline, allocation_callbacks);
+  vkDestroyPipeline(device, culler->reduce_pipeline, allocation_callbacks);
+  vkDestroyPipelineLayout(device, culler->cull_pipeline_layout,
+                          allocation_callbacks);
+  vkDestroyPipelineLayout(device, culler->reduce_pipeline_layout,
+                          allocation_callbacks);
+  vkDestroyDescriptorSetLayout(device, culler->cull_set_layout,
+                               allocation_callbacks);
+  vkDestroyDescriptorSetLayout(device, culler->reduce_set_layout,
+                               allocation_callbacks);
+}
+
+static bool
+create_descriptor_sets(struct occlusion_culler *culler, VkDevice device,
+                       const VkAllocationCallbacks *allocation_callbacks,
+                       VkImageView depth_view,
+                       const struct uniform_ring *uniform_ring,
+                       const struct instance_buffer *instance_buffer) {
+  uint32_t level_count = culler->pyramid_level_count;
+  if (vkCreateDescriptorPool(
+          device,
+          &(const VkDescriptorPoolCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+              .maxSets = level_count + 1,
+              .poolSizeCount = 5,
+              .pPoolSizes =
+                  (const VkDescriptorPoolSize[]){
+                      {.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                       .descriptorCount = level_count + 1},
+                      {.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                       .descriptorCount = level_count},
+                      {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                       .descriptorCount = 1},
+                      {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                       .descriptorCount = 2},
+                      {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                       .descriptorCount = 3}}},
+          allocation_callbacks, &culler->descriptor_pool) != VK_SUCCESS) {
+    return false;
+  }
+
+  VkDescriptorSetLayout reduce_set_layouts[OCCLUSION_CULLER_MAX_PYRAMID_LEVELS];
+  for (uint32_t level = 0; level < level_count; level++) {
+    reduce_set_layouts[level] = culler->reduce_set_layout;
+  }
+  if (vkAllocateDescriptorSets(
+          device,
+          &(const VkDescriptorSetAllocateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+              .descriptorPool = culler->descriptor_pool,
+              .descriptorSetCount = level_count,
+              .pSetLayouts = reduce_set_layouts},
+          culler->reduce_sets) != VK_SUCCESS ||
+      vkAllocateDescriptorSets(
+          device,
+          &(const VkDescriptorSetAllocateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+              .descriptorPool = culler->descriptor_pool,
+              .descriptorSetCount = 1,
+              .pSetLayouts = &culler->cull_set_layout},
+          &culler->cull_set) != VK_SUCCESS) {
+    vkDestroyDescriptorPool(device, culler->descriptor_pool,
+                            allocation_callbacks);
+    return false;
+  }
+
+  // Level n reads level n - 1, or the depth buffer for level 0, and writes
+  // level n. The pyramid stays in the GENERAL layout for its whole life.
+  for (uint32_t level = 0; level < level_count; level++) {
+    VkDescriptorImageInfo source_info = {
+        .sampler = culler->sampler,
+        .imageView =
+            level == 0 ? depth_view : culler->pyramid_level_views[level - 1],
+        .imageLayout = level == 0
+                           ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+                           : VK_IMAGE_LAYOUT_GENERAL};
+    VkDescriptorImageInfo destination_info = {
+        .imageView = culler->pyramid_level_views[level],
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+    vkUpdateDescriptorSets(
+        device, 2,
+        (const VkWriteDescriptorSet[]){
+            {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+             .dstSet = culler->reduce_sets[level],
+             .dstBinding = 0,
+             .descriptorCount = 1,
+             .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+             .pImageInfo = &source_info},
+            {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+             .dstSet = culler->reduce_sets[level],
+             .dstBinding = 1,
+             .descriptorCount = 1,
+             .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+             .pImageInfo = &destination_info}},
+        0, NULL);
+  }
+
+  VkDescriptorBufferInfo buffer_infos[] = {
+      uniform_ring_descriptor_info(uniform_ring, sizeof(struct cull_uniforms)),
+      instance_buffer_descriptor_info(instance_buffer),
+      {.buffer = culler->visibility_buffer, .range = VK_WHOLE_SIZE},
+      {.buffer = culler->draw_buffer, .range = VK_WHOLE_SIZE},
+      {.buffer = culler->visible_index_buffer, .range = VK_WHOLE_SIZE},
+      {.buffer = culler->stats_buffer,
+       .range = sizeof(struct occlusion_stats)}};
+  VkDescriptorType buffer_types[] = {
+      VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC};
+  VkWriteDescriptorSet writes[7];
+  uint32_t buffer_count =
+      sizeof(buffer_infos) / sizeof(VkDescriptorBufferInfo);
+  for (uint32_t binding = 0; binding < buffer_count; binding++) {
+    writes[binding] = (VkWriteDescriptorSet){
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = culler->cull_set,
+        .dstBinding = binding,
+        .descriptorCount = 1,
+        .descriptorType = buffer_types[binding],
+        .pBufferInfo = &buffer_infos[binding]};
+  }
+  VkDescriptorImageInfo pyramid_info = {
+      .sampler = culler->sampler,
+      .imageView = culler->pyramid_view,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+  writes[buffer_count] = (VkWriteDescriptorSet){
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = culler->cull_set,
+      .dstBinding = buffer_count,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = &pyramid_info};
+  vkUpdateDescriptorSets(device, buffer_count + 1, writes, 0, NULL);
+
+  return true;
+}
+
+bool occlusion_culler_init(struct occlusion_culler *culler,
+                           VkPhysicalDevice physical_device, VkDevice device,
+                           const VkAllocationCallbacks *allocation_callbacks,
+                           struct host_allocator *host_allocator,
+                           VkImageView depth_view, VkExtent2D depth_extent,
+                           const struct uniform_ring *uniform_ring,
+                           const struct instance_buffer *instance_buffer) {
+  *culler = (struct occlusion_culler){
+      .capacity = instance_buffer->capacity,
+      .region_count = instance_buffer->region_count};
+
+  if (!create_pyramid(culler, physical_device, device, allocation_callbacks,
+                      depth_extent)) {
+    LOG("Couldn't create depth pyramid");
+    goto err;
+  }
+
+  if (!create_buffers(culler, physical_device, device,
+                      allocation_callbacks)) {
+    LOG("Couldn't create occlusion culling buffers");
+    goto destroy_pyramid;
+  }
+
+  if (!create_pipelines(culler, device, allocation_callbacks,
+                        host_allocator)) {
+    goto destroy_buffers;
+  }
+
+  if (!create_descriptor_sets(culler, device, allocation_callbacks,
+                              depth_view, uniform_ring, instance_buffer)) {
+    LOG("Couldn't create occlusion culling descriptor sets");
+    goto destroy_pipelines;
+  }
+
+  return true;
+destroy_pipelines:
+  destroy_pipelines(culler, device, allocation_callbacks);
+destroy_buffers:
+  destroy_buffers(culler, device, allocation_callbacks);
+destroy_pyramid:
+  destroy_pyramid(culler, device, allocation_callbacks);
+err:
+  return false;
+}
+
+void occlusion_culler_deinit(
+    struct occlusion_culler *culler, VkDevice device,
+    const VkAllocationCallbacks *allocation_callbacks) {
+  vkDestroyDescriptorPool(device, culler->descriptor_pool,
+                          allocation_callbacks);
+  destroy_pipelines(culler, device, allocation_callbacks);
+  destroy_buffers(culler, device, allocation_callbacks);
+  destroy_pyramid(culler, device, allocation_callbacks);
+  *culler = (struct occlusion_culler){0};
+}
+
+bool occlusion_culler_read_stats(struct occlusion_culler *culler,
+                                 VkDevice device, uint32_t frame_index,
+                                 struct occlusion_stats *out_stats) {
+  VkDeviceSize offset =
+      (frame_index % culler->region_count) * culler->stats_region_size;
+  if (!culler->stats_coherent) {
+    if (vkInvalidateMappedMemoryRanges(
+            device, 1,
+            &(const VkMappedMemoryRange){
+                .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                .memory = culler->stats_memory,
+                .offset = align_down(offset, culler->non_coherent_atom_size),
+                .size = culler->stats_region_size}) != VK_SUCCESS) {
+      return false;
+    }
+  }
+  *out_stats = *(const struct occlusion_stats *)(culler->stats_mapped + offset);
+  return true;
+}
+
+static void cmd_cull(struct occlusion_culler *culler,
+                     VkCommandBuffer command_buffer,
+                     enum occlusion_phase phase) {
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    culler->cull_pipeline);
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          culler->cull_pipeline_layout, 0, 1,
+                          &culler->cull_set, 3, culler->dynamic_offsets);
+  struct cull_push_constants push_constants = {
+      .phase = phase,
+      .late_index_base = (uint32_t)(culler->visible_index_region_size /
+                                    sizeof(uint32_t))};
+  vkCmdPushConstants(command_buffer, culler->cull_pipeline_layout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants),
+                     &push_constants);
+  vkCmdDispatch(command_buffer,
+                div_round_up(culler->instance_count, CULL_WORKGROUP_SIZE), 1,
+                1);
+
+  // The draw that follows consumes the command and the index list.
+  VkPipelineStageFlags destination_stages =
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+  VkAccessFlags destination_access =
+      VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+  if (phase == OCCLUSION_PHASE_LATE) {
+    destination_stages |= VK_PIPELINE_STAGE_HOST_BIT;
+    destination_access |= VK_ACCESS_HOST_READ_BIT;
+  }
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, destination_stages,
+      0, 1,
+      &(const VkMemoryBarrier){.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                               .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                               .dstAccessMask = destination_access},
+      0, NULL, 0, NULL);
+}
+
+bool occlusion_culler_cmd_cull_early(struct occlusion_culler *culler,
+                                     VkCommandBuffer command_buffer,
+                                     struct uniform_ring *uniform_ring,
+                                     uint32_t frame_index,
+                                     const struct mat4 *view_projection,
+                                     VkExtent2D depth_extent,
+                                     uint32_t instance_offset,
+                                     uint32_t instance_count) {
+  assert(instance_count <= culler->capacity);
+  assert(depth_extent.width <= culler->pyramid_extents[0].width &&
+         depth_extent.height <= culler->pyramid_extents[0].height);
+  // Only the rendered corner of the depth buffer is reduced, so the pyramid
+  // never mixes in depth left over from frames rendered at another size.
+  culler->frame_level_count =
+      pyramid_level_extents(depth_extent, culler->frame_extents);
+  struct frustum frustum = frustum_from_matrix(view_projection);
+  struct cull_uniforms uniforms = {
+      .view_projection = *view_projection,
+      .instance_count = instance_count,
+      .pyramid_width = depth_extent.width,
+      .pyramid_height = depth_extent.height,
+      .pyramid_level_count = culler->frame_level_count};
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    uniforms.frustum_planes[plane_index] = frustum.planes[plane_index];
+  }
+  if (!uniform_ring_push(
+          uniform_ring, &uniforms, sizeof(uniforms),
+          &culler->dynamic_offsets[CULL_DYNAMIC_OFFSET_UNIFORMS])) {
+    return false;
+  }
+  VkDeviceSize stats_offset =
+      (frame_index % culler->region_count) * culler->stats_region_size;
+  culler->dynamic_offsets[CULL_DYNAMIC_OFFSET_INSTANCES] = instance_offset;
+  culler->dynamic_offsets[CULL_DYNAMIC_OFFSET_STATS] = (uint32_t)stats_offset;
+  culler->instance_count = instance_count;
+
+  // The previous frame may still be reading the buffers reset below. Commands
+  // submitted earlier on this queue are part of the barrier's first scope.
+  vkCmdPipelineBarrier(command_buffer,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 0,
+                       NULL);
+
+  if (!culler->resources_initialized) {
+    // Nothing counts as visible before the first frame, so it is all drawn
+    // by the late phase.
+    vkCmdFillBuffer(command_buffer, culler->visibility_buffer, 0,
+                    VK_WHOLE_SIZE, 0);
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
+        &(const VkImageMemoryBarrier){
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .dstAccessMask =
+                VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = culler->pyramid_image,
+            .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                 .levelCount = culler->pyramid_level_count,
+                                 .layerCount = 1}});
+    culler->resources_initialized = true;
+  }
+
+  VkDrawIndirectCommand draws[OCCLUSION_PHASE_COUNT];
+  for (int phase = 0; phase < OCCLUSION_PHASE_COUNT; phase++) {
+    draws[phase] = (VkDrawIndirectCommand){.vertexCount = 3};
+  }
+  vkCmdUpdateBuffer(command_buffer, culler->draw_buffer, 0, sizeof(draws),
+                    draws);
+  vkCmdFillBuffer(command_buffer, culler->stats_buffer, stats_offset,
+                  culler->stats_region_size, 0);
+
+  // Also orders this frame's reads of visibility after the writes of the
+  // previous frame's late phase.
+  vkCmdPipelineBarrier(
+      command_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+      &(const VkMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+          .srcAccessMask =
+              VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+          .dstAccessMask =
+              VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT},
+      0, NULL, 0, NULL);
+
+  cmd_cull(culler, command_buffer, OCCLUSION_PHASE_EARLY);
+  return true;
+}
+
+void occlusion_culler_cmd_cull_late(struct occlusion_culler *culler,
+                                    VkCommandBuffer command_buffer) {
+  // The early render pass' outgoing dependency makes the depth buffer
+  // readable by compute shaders.
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    culler->reduce_pipeline);
+  for (uint32_t level = 0; level < culler->frame_level_count; level++) {
+    VkExtent2D source = culler->frame_extents[level == 0 ? 0 : level - 1];
+    VkExtent2D destination = culler->frame_extents[level];
+    struct reduce_push_constants push_constants = {
+        .source_width = (int32_t)source.width,
+        .source_height = (int32_t)source.height,
+        .destination_width = (int32_t)destination.width,
+        .destination_height = (int32_t)destination.height};
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            culler->reduce_pipeline_layout, 0, 1,
+                            &culler->reduce_sets[level], 0, NULL);
+    vkCmdPushConstants(command_buffer, culler->reduce_pipeline_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants),
+                       &push_constants);
+    vkCmdDispatch(command_buffer,
+                  div_round_up(destination.width, REDUCE_WORKGROUP_SIZE),
+                  div_round_up(destination.height, REDUCE_WORKGROUP_SIZE), 1);
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+        &(const VkMemoryBarrier){.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                 .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                                 .dstAccessMask = VK_ACCESS_SHADER_READ_BIT},
+        0, NULL, 0, NULL);
+  }
+
+  cmd_cull(culler, command_buffer, OCCLUSION_PHASE_LATE);
+}
+
+void occlusion_culler_cmd_draw(const struct occlusion_culler *culler,
+                               VkCommandBuffer command_buffer,
+                               enum occlusion_phase phase) {
+  vkCmdDrawIndirect(command_buffer, culler->draw_buffer,
+                    phase * sizeof(VkDrawIndirectCommand), 1,
+                    sizeof(VkDrawIndirectCommand));
+}
+
+uint32_t occlusion_culler_visible_index_offset(
+    const struct occlusion_culler *culler, enum occlusion_phase phase) {
+  return (uint32_t)(phase * culler->visible_index_region_size);
+}
+
+VkDescriptorBufferInfo
+occlusion_culler_visible_index_info(const struct occlusion_culler *culler) {
+  return (VkDescriptorBufferInfo){.buffer = culler->visible_index_buffer,
+                                  .offset = 0,
+                                  .range = culler->visible_index_region_size};
+}
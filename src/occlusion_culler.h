@@ -0,0 +1,131 @@
+#pragma once
+
+#include "host_allocator.h"
+#include "instance_buffer.h"
+#include "math3d.h"
+#include "uniform_ring.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#define OCCLUSION_CULLER_MAX_PYRAMID_LEVELS 16
+
+// Two-phase GPU occlusion culling against a hierarchical depth (Hi-Z)
+// pyramid. Each frame:
+//   1. occlusion_culler_cmd_cull_early() selects the instances that were
+//      visible last frame and are inside the frustum.
+//   2. The renderer draws them with occlusion_culler_cmd_draw(EARLY).
+//   3. occlusion_culler_cmd_cull_late() reduces the resulting depth buffer
+//      into the pyramid, tests every instance against it, records visibility
+//      for the next frame and selects the ones that just became visible.
+//   4. The renderer draws those with occlusion_culler_cmd_draw(LATE).
+// Draws are indirect: one command per phase whose instanceCount is written
+// by the cull shader, reading instance indices from a compacted list.
+enum occlusion_phase {
+  OCCLUSION_PHASE_EARLY,
+  OCCLUSION_PHASE_LATE,
+  OCCLUSION_PHASE_COUNT,
+};
+
+// Debug counters, accumulated on the GPU and read back per frame. Release
+// builds specialize the counting out of the cull shader and read zeros.
+struct occlusion_stats {
+  uint32_t tested;
+  uint32_t frustum_culled;
+  uint32_t occlusion_culled;
+  uint32_t drawn_early;
+  uint32_t drawn_late;
+};
+
+struct occlusion_culler {
+  VkImage pyramid_image;
+  VkDeviceMemory pyramid_memory;
+  VkImageView pyramid_view;
+  VkImageView pyramid_level_views[OCCLUSION_CULLER_MAX_PYRAMID_LEVELS];
+  VkExtent2D pyramid_extents[OCCLUSION_CULLER_MAX_PYRAMID_LEVELS];
+  uint32_t pyramid_level_count;
+  VkSampler sampler;
+
+  // One uint per instance: was it visible at the end of the last frame.
+  VkBuffer visibility_buffer;
+  VkDeviceMemory visibility_memory;
+  // OCCLUSION_PHASE_COUNT VkDrawIndirectCommands.
+  VkBuffer draw_buffer;
+  VkDeviceMemory draw_memory;
+  // One region of instance indices per phase.
+  VkBuffer visible_index_buffer;
+  VkDeviceMemory visible_index_memory;
+  VkDeviceSize visible_index_region_size;
+  // One struct occlusion_stats region per frame in flight.
+  VkBuffer stats_buffer;
+  VkDeviceMemory stats_memory;
+  char *stats_mapped;
+  VkDeviceSize stats_region_size;
+  VkDeviceSize non_coherent_atom_size;
+  bool stats_coherent;
+
+  VkDescriptorSetLayout reduce_set_layout;
+  VkDescriptorSetLayout cull_set_layout;
+  VkPipelineLayout reduce_pipeline_layout;
+  VkPipelineLayout cull_pipeline_layout;
+  VkPipeline reduce_pipeline;
+  VkPipeline cull_pipeline;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet reduce_sets[OCCLUSION_CULLER_MAX_PYRAMID_LEVELS];
+  VkDescriptorSet cull_set;
+
+  uint32_t capacity;
+  uint32_t region_count;
+  bool resources_initialized;
+
+  // Recorded by cmd_cull_early() for the rest of the frame.
+  VkExtent2D frame_extents[OCCLUSION_CULLER_MAX_PYRAMID_LEVELS];
+  uint32_t frame_level_count;
+  uint32_t dynamic_offsets[3];
+  uint32_t instance_count;
+};
+
+// depth_view must be sampleable and stay in
+// VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL between the two render
+// passes. The cull uniforms are allocated from uniform_ring.
+bool occlusion_culler_init(struct occlusion_culler *culler,
+                           VkPhysicalDevice physical_device, VkDevice device,
+                           const VkAllocationCallbacks *allocation_callbacks,
+                           struct host_allocator *host_allocator,
+                           VkImageView depth_view, VkExtent2D depth_extent,
+                           const struct uniform_ring *uniform_ring,
+                           const struct instance_buffer *instance_buffer);
+void occlusion_culler_deinit(struct occlusion_culler *culler, VkDevice device,
+                             const VkAllocationCallbacks *allocation_callbacks);
+
+// Reads the counters the GPU wrote the last time this frame slot was used.
+// Call after waiting on that frame's fence.
+bool occlusion_culler_read_stats(struct occlusion_culler *culler,
+                                 VkDevice device, uint32_t frame_index,
+                                 struct occlusion_stats *out_stats);
+
+// Must be recorded outside of a render pass. depth_extent is the area at the
+// origin of the depth buffer that this frame renders to, at most the
+// depth_extent given to init; the viewport must cover exactly that area.
+bool occlusion_culler_cmd_cull_early(struct occlusion_culler *culler,
+                                     VkCommandBuffer command_buffer,
+                                     struct uniform_ring *uniform_ring,
+                                     uint32_t frame_index,
+                                     const struct mat4 *view_projection,
+                                     VkExtent2D depth_extent,
+                                     uint32_t instance_offset,
+                                     uint32_t instance_count);
+void occlusion_culler_cmd_cull_late(struct occlusion_culler *culler,
+                                    VkCommandBuffer command_buffer);
+
+void occlusion_culler_cmd_draw(const struct occlusion_culler *culler,
+                               VkCommandBuffer command_buffer,
+                               enum occlusion_phase phase);
+
+// Dynamic offset of the phase's visible index list, for a
+// STORAGE_BUFFER_DYNAMIC binding described by
+// occlusion_culler_visible_index_info().
+uint32_t occlusion_culler_visible_index_offset(
+    const struct occlusion_culler *culler, enum occlusion_phase phase);
+VkDescriptorBufferInfo
+occlusion_culler_visible_index_info(const struct occlusion_culler *culler);
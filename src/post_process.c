@@ -0,0 +1,941 @@
+#include "post_process.h"
+
+#include "log.h"
+#include "shader_variant.h"
+#include "telemetry.h"
+#include <assert.h>
+#include <string.h>
+
+#define DOWN_WORKGROUP_SIZE 8
+#define UP_WORKGROUP_SIZE 8
+// Fixed by the shared memory tile in shaders/post_resolve.comp.
+#define RESOLVE_WORKGROUP_WIDTH 16
+#define RESOLVE_WORKGROUP_HEIGHT 8
+// constant_ids in shaders/post_bloom_down.comp, shaders/post_bloom_up.comp
+// and shaders/post_resolve.comp.
+#define DOWN_CONSTANT_ID_WORKGROUP_SIZE_X 0
+#define DOWN_CONSTANT_ID_WORKGROUP_SIZE_Y 1
+#define DOWN_CONSTANT_ID_FIRST_LEVEL 2
+#define DOWN_CONSTANT_ID_WRITE_BLOOM 3
+#define DOWN_CONSTANT_ID_MEASURE_LUMINANCE 4
+#define UP_CONSTANT_ID_WORKGROUP_SIZE_X 0
+#define UP_CONSTANT_ID_WORKGROUP_SIZE_Y 1
+#define RESOLVE_CONSTANT_ID_BLOOM 0
+#define RESOLVE_CONSTANT_ID_TONEMAP 1
+#define RESOLVE_CONSTANT_ID_COLOR_GRADE 2
+#define RESOLVE_CONSTANT_ID_FXAA 3
+#define RESOLVE_CONSTANT_ID_ENCODE_SRGB 4
+
+#define POST_FORMAT VK_FORMAT_R16G16B16A16_SFLOAT
+
+// Mirrors the Exposure buffer in shaders/post_bloom_down.comp.
+struct post_exposure {
+  int32_t log_luminance_sum;
+  uint32_t texel_count;
+};
+
+// Mirrors PostPushConstants in the post shaders, which all declare the
+// whole block so that they can share a pipeline layout.
+struct post_push_constants {
+  float source_texel_size[2];
+  int32_t destination_size[2];
+  float scene_uv_scale[2];
+  float scene_uv_max[2];
+  float bloom_threshold;
+  float bloom_knee;
+  float bloom_intensity;
+  float exposure_key;
+  float contrast;
+  float saturation;
+  // Pads gain to the 16 byte alignment of a vec4.
+  float padding[2];
+  float gain[4];
+};
+static_assert(sizeof(struct post_push_constants) == 80,
+              "struct post_push_constants must match PostPushConstants");
+
+// Every pass uses the same set layout, binding what it doesn't read too.
+enum post_binding {
+  POST_BINDING_SOURCE,
+  POST_BINDING_BLOOM,
+  POST_BINDING_DESTINATION,
+  POST_BINDING_EXPOSURE,
+  POST_BINDING_COUNT,
+};
+
+static const struct {
+  const char *name;
+  uint32_t effect;
+} effect_names[] = {
+    {"bloom", POST_EFFECT_BLOOM},
+    {"tonemap", POST_EFFECT_TONEMAP},
+    {"grade", POST_EFFECT_COLOR_GRADE},
+    {"fxaa", POST_EFFECT_FXAA},
+};
+
+struct post_process_config post_process_config_default(void) {
+  return (struct post_process_config){.effects = POST_EFFECT_ALL,
+                                      .bloom_level_count = 6,
+                                      .bloom_threshold = 0.8f,
+                                      .bloom_knee = 0.4f,
+                                      .bloom_intensity = 0.5f,
+                                      .exposure_key = 0.18f,
+                                      .gain = {1.0f, 1.0f, 1.0f},
+                                      .contrast = 1.1f,
+                                      .saturation = 1.1f};
+}
+
+bool post_process_parse_effects(const char *text, uint32_t *out_effects) {
+  if (strcmp(text, "none") == 0) {
+    *out_effects = 0;
+    return true;
+  }
+  uint32_t effects = 0;
+  uint32_t name_count = sizeof(effect_names) / sizeof(effect_names[0]);
+  const char *name = text;
+  while (true) {
+    size_t length = strcspn(name, ",");
+    uint32_t name_index = 0;
+    for (; name_index < name_count; name_index++) {
+      if (strlen(effect_names[name_index].name) == length &&
+          strncmp(name, effect_names[name_index].name, length) == 0) {
+        break;
+      }
+    }
+    if (name_index == name_count) {
+      return false;
+    }
+    effects |= effect_names[name_index].effect;
+    if (name[length] == '\0') {
+      break;
+    }
+    name += length + 1;
+  }
+  *out_effects = effects;
+  return true;
+}
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static uint32_t div_round_up(uint32_t value, uint32_t divisor) {
+  return (value + divisor - 1) / divisor;
+}
+
+// Formats a blit encodes to sRGB on its own.
+static bool format_is_srgb(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+  case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool has_effect(const struct post_process *post,
+                       enum post_effect effect) {
+  return post->config.effects & effect;
+}
+
+// Level 0 is half the output, rounded up, and every level halves the one
+// above until the configured count or a single texel.
+static uint32_t bloom_level_extents(VkExtent2D output_extent,
+                                    uint32_t max_level_count,
+                                    VkExtent2D *out_extents) {
+  VkExtent2D extent = {div_round_up(output_extent.width, 2),
+                       div_round_up(output_extent.height, 2)};
+  uint32_t level_count = 0;
+  while (level_count < max_level_count) {
+    out_extents[level_count++] = extent;
+    if (extent.width == 1 || extent.height == 1) {
+      break;
+    }
+    extent.width = div_round_up(extent.width, 2);
+    extent.height = div_round_up(extent.height, 2);
+  }
+  return level_count;
+}
+
+// Zeroed handles are never alive, so this also cleans up after a partial
+// init.
+static void destroy_resources(struct post_process *post,
+                              uint64_t retire_value) {
+  struct resource_manager *resources = post->resources;
+  const struct {
+    enum resource_type type;
+    struct resource_handle handle;
+  } owned[] = {
+      {RESOURCE_TYPE_PIPELINE, post->resolve_pipeline},
+      {RESOURCE_TYPE_PIPELINE, post->up_pipeline},
+      {RESOURCE_TYPE_PIPELINE, post->down_pipeline},
+      {RESOURCE_TYPE_PIPELINE, post->first_down_pipeline},
+      {RESOURCE_TYPE_BUFFER, post->exposure_buffer},
+      {RESOURCE_TYPE_SAMPLER, post->sampler},
+      {RESOURCE_TYPE_IMAGE_VIEW, post->intermediate_view},
+      {RESOURCE_TYPE_IMAGE, post->intermediate_image},
+  };
+  for (uint32_t index = 0; index < sizeof(owned) / sizeof(owned[0]);
+       index++) {
+    if (resource_manager_is_alive(resources, owned[index].type,
+                                  owned[index].handle)) {
+      resource_manager_destroy(resources, owned[index].type,
+                               owned[index].handle, retire_value);
+    }
+  }
+  for (uint32_t level = 0; level < post->bloom_level_count; level++) {
+    if (resource_manager_is_alive(resources, RESOURCE_TYPE_IMAGE_VIEW,
+                                  post->bloom_level_views[level])) {
+      resource_manager_destroy(resources, RESOURCE_TYPE_IMAGE_VIEW,
+                               post->bloom_level_views[level], retire_value);
+    }
+  }
+  if (resource_manager_is_alive(resources, RESOURCE_TYPE_IMAGE,
+                                post->bloom_image)) {
+    resource_manager_destroy(resources, RESOURCE_TYPE_IMAGE,
+                             post->bloom_image, retire_value);
+  }
+}
+
+static bool create_post_image(struct post_process *post, VkExtent2D extent,
+                              uint32_t level_count, VkImageUsageFlags usage,
+                              struct resource_handle *out_image) {
+  return resource_manager_create_image(
+      post->resources,
+      &(const VkImageCreateInfo){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+          .imageType = VK_IMAGE_TYPE_2D,
+          .format = POST_FORMAT,
+          .extent = {extent.width, extent.height, 1},
+          .mipLevels = level_count,
+          .arrayLayers = 1,
+          .samples = VK_SAMPLE_COUNT_1_BIT,
+          .tiling = VK_IMAGE_TILING_OPTIMAL,
+          .usage = usage,
+          .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+          .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED},
+      out_image);
+}
+
+static bool create_post_view(struct post_process *post,
+                             struct resource_handle image, uint32_t level,
+                             struct resource_handle *out_view) {
+  return resource_manager_create_image_view(
+      post->resources,
+      &(const VkImageViewCreateInfo){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+          .image = resource_manager_image(post->resources, image)->image,
+          .viewType = VK_IMAGE_VIEW_TYPE_2D,
+          .format = POST_FORMAT,
+          .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                               .baseMipLevel = level,
+                               .levelCount = 1,
+                               .layerCount = 1}},
+      out_view);
+}
+
+static bool create_images(struct post_process *post) {
+  // Without bloom the first pass still needs somewhere to write to.
+  post->bloom_level_count = bloom_level_extents(
+      post->output_extent,
+      has_effect(post, POST_EFFECT_BLOOM) ? post->config.bloom_level_count
+                                          : 1,
+      post->bloom_extents);
+  if (!create_post_image(
+          post, post->bloom_extents[0], post->bloom_level_count,
+          VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+          &post->bloom_image)) {
+    return false;
+  }
+  for (uint32_t level = 0; level < post->bloom_level_count; level++) {
+    if (!create_post_view(post, post->bloom_image, level,
+                          &post->bloom_level_views[level])) {
+      return false;
+    }
+  }
+
+  if (!post->output_storage &&
+      (!create_post_image(post, post->output_extent, 1,
+                          VK_IMAGE_USAGE_STORAGE_BIT |
+                              VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                          &post->intermediate_image) ||
+       !create_post_view(post, post->intermediate_image, 0,
+                         &post->intermediate_view))) {
+    return false;
+  }
+
+  return resource_manager_create_sampler(
+      post->resources,
+      &(const VkSamplerCreateInfo){
+          .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+          .magFilter = VK_FILTER_LINEAR,
+          .minFilter = VK_FILTER_LINEAR,
+          .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+          .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+          .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+          .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE},
+      &post->sampler);
+}
+
+static bool create_exposure_buffer(struct post_process *post) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(post->resources->physical_device,
+                                &properties);
+  post->exposure_region_size =
+      align_up(sizeof(struct post_exposure),
+               properties.limits.minStorageBufferOffsetAlignment);
+  static const VkMemoryPropertyFlags device_local_preferences[] = {
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0};
+  return resource_manager_create_buffer(
+      post->resources, post->region_count * post->exposure_region_size,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      device_local_preferences,
+      sizeof(device_local_preferences) / sizeof(VkMemoryPropertyFlags),
+      &post->exposure_buffer);
+}
+
+static bool
+create_compute_pipeline(struct post_process *post,
+                        struct host_allocator *host_allocator,
+                        shader_variant_key key,
+                        struct shader_specialization *specialization,
+                        struct resource_handle *out_pipeline) {
+  struct resource_manager *resources = post->resources;
+  VkShaderModule shader_module = shader_variant_create_module(
+      resources->device, resources->allocation_callbacks, host_allocator,
+      key);
+  if (!shader_module) {
+    return false;
+  }
+
+  VkPipeline pipeline;
+  VkResult result = vkCreateComputePipelines(
+      resources->device, VK_NULL_HANDLE, 1,
+      &(const VkComputePipelineCreateInfo){
+          .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+          .stage = {.sType =
+                        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                    .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .module = shader_module,
+                    .pName = "main",
+                    .pSpecializationInfo =
+                        shader_specialization_info(specialization)},
+          .layout = post->pipeline_layout},
+      resources->allocation_callbacks, &pipeline);
+  vkDestroyShaderModule(resources->device, shader_module,
+                        resources->allocation_callbacks);
+  if (result != VK_SUCCESS) {
+    return false;
+  }
+  telemetry_count(TELEMETRY_COUNTER_PIPELINE_COMPILES, 1);
+  return resource_manager_add_pipeline(resources, pipeline, out_pipeline);
+}
+
+static void destroy_layouts(struct post_process *post) {
+  struct resource_manager *resources = post->resources;
+  vkDestroyPipelineLayout(resources->device, post->pipeline_layout,
+                          resources->allocation_callbacks);
+  vkDestroyDescriptorSetLayout(resources->device, post->set_layout,
+                               resources->allocation_callbacks);
+}
+
+static bool create_layouts(struct post_process *post) {
+  struct resource_manager *resources = post->resources;
+  VkDescriptorSetLayoutBinding bindings[POST_BINDING_COUNT] = {
+      [POST_BINDING_SOURCE] = {.descriptorType =
+                                   VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER},
+      [POST_BINDING_BLOOM] = {.descriptorType =
+                                  VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER},
+      [POST_BINDING_DESTINATION] = {.descriptorType =
+                                        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE},
+      [POST_BINDING_EXPOSURE] = {.descriptorType =
+                                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC},
+  };
+  for (uint32_t binding = 0; binding < POST_BINDING_COUNT; binding++) {
+    bindings[binding].binding = binding;
+    bindings[binding].descriptorCount = 1;
+    bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  if (vkCreateDescriptorSetLayout(
+          resources->device,
+          &(const VkDescriptorSetLayoutCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+              .bindingCount = POST_BINDING_COUNT,
+              .pBindings = bindings},
+          resources->allocation_callbacks, &post->set_layout) != VK_SUCCESS) {
+    return false;
+  }
+
+  if (vkCreatePipelineLayout(
+          resources->device,
+          &(const VkPipelineLayoutCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+              .setLayoutCount = 1,
+              .pSetLayouts = &post->set_layout,
+              .pushConstantRangeCount = 1,
+              .pPushConstantRanges =
+                  &(const VkPushConstantRange){
+                      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                      .size = sizeof(struct post_push_constants)}},
+          resources->allocation_callbacks,
+          &post->pipeline_layout) != VK_SUCCESS) {
+    vkDestroyDescriptorSetLayout(resources->device, post->set_layout,
+                                 resources->allocation_callbacks);
+    return false;
+  }
+  return true;
+}
+
+// Only the pipelines the configured chain runs are created.
+static bool create_pipelines(struct post_process *post,
+                             struct host_allocator *host_allocator,
+                             const struct device_features *features) {
+  bool bloom = has_effect(post, POST_EFFECT_BLOOM);
+  bool tonemap = has_effect(post, POST_EFFECT_TONEMAP);
+  if (bloom || tonemap) {
+    struct shader_specialization specialization = {0};
+    shader_specialization_set(&specialization,
+                              DOWN_CONSTANT_ID_WORKGROUP_SIZE_X,
+                              DOWN_WORKGROUP_SIZE);
+    shader_specialization_set(&specialization,
+                              DOWN_CONSTANT_ID_WORKGROUP_SIZE_Y,
+                              DOWN_WORKGROUP_SIZE);
+    shader_specialization_set(&specialization, DOWN_CONSTANT_ID_FIRST_LEVEL,
+                              VK_TRUE);
+    shader_specialization_set(&specialization, DOWN_CONSTANT_ID_WRITE_BLOOM,
+                              bloom);
+    shader_specialization_set(&specialization,
+                              DOWN_CONSTANT_ID_MEASURE_LUMINANCE, tonemap);
+    // The reduction falls back to shared memory alone without subgroups.
+    shader_variant_key key = shader_variant_key_make(
+        SHADER_SOURCE_POST_BLOOM_DOWN_COMP,
+        features->subgroup_arithmetic ? SHADER_PERMUTATION_SUBGROUPS : 0);
+    if (!create_compute_pipeline(post, host_allocator, key, &specialization,
+                                 &post->first_down_pipeline)) {
+      LOG("Couldn't create bloom prefilter pipeline");
+      return false;
+    }
+
+    if (bloom && post->bloom_level_count > 1) {
+      shader_specialization_set(&specialization,
+                                DOWN_CONSTANT_ID_FIRST_LEVEL, VK_FALSE);
+      shader_specialization_set(&specialization,
+                                DOWN_CONSTANT_ID_WRITE_BLOOM, VK_TRUE);
+      shader_specialization_set(&specialization,
+                                DOWN_CONSTANT_ID_MEASURE_LUMINANCE, VK_FALSE);
+      if (!create_compute_pipeline(post, host_allocator, key, &specialization,
+                                   &post->down_pipeline)) {
+        LOG("Couldn't create bloom downsample pipeline");
+        return false;
+      }
+
+      struct shader_specialization up_specialization = {0};
+      shader_specialization_set(&up_specialization,
+                                UP_CONSTANT_ID_WORKGROUP_SIZE_X,
+                                UP_WORKGROUP_SIZE);
+      shader_specialization_set(&up_specialization,
+                                UP_CONSTANT_ID_WORKGROUP_SIZE_Y,
+                                UP_WORKGROUP_SIZE);
+      if (!create_compute_pipeline(
+              post, host_allocator,
+              shader_variant_key_make(SHADER_SOURCE_POST_BLOOM_UP_COMP, 0),
+              &up_specialization, &post->up_pipeline)) {
+        LOG("Couldn't create bloom upsample pipeline");
+        return false;
+      }
+    }
+  }
+
+  struct shader_specialization specialization = {0};
+  shader_specialization_set(&specialization, RESOLVE_CONSTANT_ID_BLOOM,
+                            bloom);
+  shader_specialization_set(&specialization, RESOLVE_CONSTANT_ID_TONEMAP,
+                            tonemap);
+  shader_specialization_set(&specialization, RESOLVE_CONSTANT_ID_COLOR_GRADE,
+                            has_effect(post, POST_EFFECT_COLOR_GRADE));
+  shader_specialization_set(&specialization, RESOLVE_CONSTANT_ID_FXAA,
+                            has_effect(post, POST_EFFECT_FXAA));
+  // The blit encodes when the output is sRGB; a storage write never does.
+  shader_specialization_set(&specialization, RESOLVE_CONSTANT_ID_ENCODE_SRGB,
+                            !format_is_srgb(post->output_format));
+  if (!create_compute_pipeline(
+          post, host_allocator,
+          shader_variant_key_make(SHADER_SOURCE_POST_RESOLVE_COMP,
+                                  post->output_storage
+                                      ? SHADER_PERMUTATION_SWAPCHAIN_OUTPUT
+                                      : 0),
+          &specialization, &post->resolve_pipeline)) {
+    LOG("Couldn't create post-processing resolve pipeline");
+    return false;
+  }
+  return true;
+}
+
+static void write_set(struct post_process *post, VkDescriptorSet set,
+                      VkImageView source_view, VkImageLayout source_layout,
+                      VkImageView destination_view) {
+  struct resource_manager *resources = post->resources;
+  VkSampler sampler = resource_manager_sampler(resources, post->sampler);
+  VkDescriptorImageInfo source_info = {.sampler = sampler,
+                                       .imageView = source_view,
+                                       .imageLayout = source_layout};
+  VkDescriptorImageInfo bloom_info = {
+      .sampler = sampler,
+      .imageView =
+          resource_manager_image_view(resources, post->bloom_level_views[0]),
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+  VkDescriptorImageInfo destination_info = {
+      .imageView = destination_view, .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+  VkDescriptorBufferInfo exposure_info = {
+      .buffer = resource_manager_buffer(resources, post->exposure_buffer)
+                    ->buffer,
+      .range = sizeof(struct post_exposure)};
+  VkWriteDescriptorSet writes[POST_BINDING_COUNT] = {
+      [POST_BINDING_SOURCE] = {.descriptorType =
+                                   VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                               .pImageInfo = &source_info},
+      [POST_BINDING_BLOOM] = {.descriptorType =
+                                  VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                              .pImageInfo = &bloom_info},
+      [POST_BINDING_DESTINATION] = {.descriptorType =
+                                        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                    .pImageInfo = &destination_info},
+      [POST_BINDING_EXPOSURE] = {.descriptorType =
+                                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                                 .pBufferInfo = &exposure_info},
+  };
+  for (uint32_t binding = 0; binding < POST_BINDING_COUNT; binding++) {
+    writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[binding].dstSet = set;
+    writes[binding].dstBinding = binding;
+    writes[binding].descriptorCount = 1;
+  }
+  vkUpdateDescriptorSets(resources->device, POST_BINDING_COUNT, writes, 0,
+                         NULL);
+}
+
+static bool create_descriptor_sets(struct post_process *post,
+                                   VkImageView scene_view,
+                                   const VkImageView *output_views) {
+  struct resource_manager *resources = post->resources;
+  uint32_t level_count = post->bloom_level_count;
+  uint32_t resolve_set_count =
+      post->output_storage ? post->output_image_count : 1;
+  uint32_t set_count = level_count + (level_count - 1) + resolve_set_count;
+  if (vkCreateDescriptorPool(
+          resources->device,
+          &(const VkDescriptorPoolCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+              .maxSets = set_count,
+              .poolSizeCount = 3,
+              .pPoolSizes =
+                  (const VkDescriptorPoolSize[]){
+                      {.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                       .descriptorCount = 2 * set_count},
+                      {.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                       .descriptorCount = set_count},
+                      {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                       .descriptorCount = set_count}}},
+          resources->allocation_callbacks,
+          &post->descriptor_pool) != VK_SUCCESS) {
+    return false;
+  }
+
+  VkDescriptorSetLayout set_layouts[2 * POST_PROCESS_MAX_BLOOM_LEVELS - 1 +
+                                    POST_PROCESS_MAX_OUTPUT_IMAGES];
+  for (uint32_t set = 0; set < set_count; set++) {
+    set_layouts[set] = post->set_layout;
+  }
+  VkDescriptorSet sets[2 * POST_PROCESS_MAX_BLOOM_LEVELS - 1 +
+                       POST_PROCESS_MAX_OUTPUT_IMAGES];
+  if (vkAllocateDescriptorSets(
+          resources->device,
+          &(const VkDescriptorSetAllocateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+              .descriptorPool = post->descriptor_pool,
+              .descriptorSetCount = set_count,
+              .pSetLayouts = set_layouts},
+          sets) != VK_SUCCESS) {
+    vkDestroyDescriptorPool(resources->device, post->descriptor_pool,
+                            resources->allocation_callbacks);
+    return false;
+  }
+
+  // Going down, level n reads level n - 1, or the scene for level 0. Going
+  // up, level n reads level n + 1 and adds onto itself.
+  uint32_t set_index = 0;
+  for (uint32_t level = 0; level < level_count; level++) {
+    post->down_sets[level] = sets[set_index++];
+    write_set(post, post->down_sets[level],
+              level == 0 ? scene_view
+                         : resource_manager_image_view(
+                               resources, post->bloom_level_views[level - 1]),
+              level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                         : VK_IMAGE_LAYOUT_GENERAL,
+              resource_manager_image_view(resources,
+                                          post->bloom_level_views[level]));
+  }
+  for (uint32_t level = 0; level + 1 < level_count; level++) {
+    post->up_sets[level] = sets[set_index++];
+    write_set(post, post->up_sets[level],
+              resource_manager_image_view(resources,
+                                          post->bloom_level_views[level + 1]),
+              VK_IMAGE_LAYOUT_GENERAL,
+              resource_manager_image_view(resources,
+                                          post->bloom_level_views[level]));
+  }
+  for (uint32_t output = 0; output < resolve_set_count; output++) {
+    post->resolve_sets[output] = sets[set_index++];
+    write_set(post, post->resolve_sets[output], scene_view,
+              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+              post->output_storage
+                  ? output_views[output]
+                  : resource_manager_image_view(resources,
+                                                post->intermediate_view));
+  }
+  return true;
+}
+
+bool post_process_init(struct post_process *post,
+                       struct resource_manager *resources,
+                       struct host_allocator *host_allocator,
+                       const struct device_features *features,
+                       const struct post_process_config *config,
+                       VkImageView scene_view, VkExtent2D scene_extent,
+                       const struct post_process_output *output,
+                       uint32_t region_count) {
+  assert(output->image_count <= POST_PROCESS_MAX_OUTPUT_IMAGES);
+  assert(config->bloom_level_count >= 1 &&
+         config->bloom_level_count <= POST_PROCESS_MAX_BLOOM_LEVELS);
+  *post = (struct post_process){.resources = resources,
+                                .config = *config,
+                                .scene_extent = scene_extent,
+                                .output_image_count = output->image_count,
+                                .output_format = output->format,
+                                .output_extent = output->extent,
+                                .output_storage = output->storage,
+                                .region_count = region_count};
+  memcpy(post->output_images, output->images,
+         output->image_count * sizeof(VkImage));
+
+  if (!create_images(post)) {
+    LOG("Couldn't create post-processing images");
+    goto destroy_resources;
+  }
+
+  if (!create_exposure_buffer(post)) {
+    LOG("Couldn't create exposure buffer");
+    goto destroy_resources;
+  }
+
+  if (!create_layouts(post)) {
+    LOG("Couldn't create post-processing pipeline layout");
+    goto destroy_resources;
+  }
+
+  if (!create_pipelines(post, host_allocator, features)) {
+    goto destroy_layouts;
+  }
+
+  if (!create_descriptor_sets(post, scene_view, output->views)) {
+    LOG("Couldn't create post-processing descriptor sets");
+    goto destroy_layouts;
+  }
+
+  LOG("Post-processing: effects=0x%x bloom_levels=%u output=%s",
+      post->config.effects, post->bloom_level_count,
+      post->output_storage ? "storage" : "blit");
+  return true;
+destroy_layouts:
+  destroy_layouts(post);
+destroy_resources:
+  // Nothing has used them yet.
+  destroy_resources(post, 0);
+  return false;
+}
+
+void post_process_deinit(struct post_process *post, uint64_t retire_value) {
+  struct resource_manager *resources = post->resources;
+  vkDestroyDescriptorPool(resources->device, post->descriptor_pool,
+                          resources->allocation_callbacks);
+  destroy_layouts(post);
+  destroy_resources(post, retire_value);
+  *post = (struct post_process){0};
+}
+
+VkPipelineStageFlags
+post_process_output_stage(const struct post_process *post) {
+  return post->output_storage ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                              : VK_PIPELINE_STAGE_TRANSFER_BIT;
+}
+
+static void cmd_compute_barrier(VkCommandBuffer command_buffer) {
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+      &(const VkMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+          .dstAccessMask =
+              VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT},
+      0, NULL, 0, NULL);
+}
+
+static void cmd_dispatch(struct post_process *post,
+                         VkCommandBuffer command_buffer, VkDescriptorSet set,
+                         uint32_t exposure_offset,
+                         struct post_push_constants *push_constants,
+                         VkExtent2D source, VkExtent2D destination,
+                         uint32_t workgroup_width, uint32_t workgroup_height) {
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          post->pipeline_layout, 0, 1, &set, 1,
+                          &exposure_offset);
+  push_constants->source_texel_size[0] = 1.0f / (float)source.width;
+  push_constants->source_texel_size[1] = 1.0f / (float)source.height;
+  push_constants->destination_size[0] = (int32_t)destination.width;
+  push_constants->destination_size[1] = (int32_t)destination.height;
+  vkCmdPushConstants(command_buffer, post->pipeline_layout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(*push_constants),
+                     push_constants);
+  vkCmdDispatch(command_buffer,
+                div_round_up(destination.width, workgroup_width),
+                div_round_up(destination.height, workgroup_height), 1);
+}
+
+static void cmd_bloom(struct post_process *post,
+                      VkCommandBuffer command_buffer, uint32_t exposure_offset,
+                      struct post_push_constants *push_constants) {
+  struct resource_manager *resources = post->resources;
+  vkCmdBindPipeline(
+      command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+      resource_manager_pipeline(resources, post->first_down_pipeline));
+  cmd_dispatch(post, command_buffer, post->down_sets[0], exposure_offset,
+               push_constants, post->scene_extent, post->bloom_extents[0],
+               DOWN_WORKGROUP_SIZE, DOWN_WORKGROUP_SIZE);
+  cmd_compute_barrier(command_buffer);
+  if (!has_effect(post, POST_EFFECT_BLOOM) || post->bloom_level_count == 1) {
+    return;
+  }
+
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    resource_manager_pipeline(resources, post->down_pipeline));
+  for (uint32_t level = 1; level < post->bloom_level_count; level++) {
+    cmd_dispatch(post, command_buffer, post->down_sets[level],
+                 exposure_offset, push_constants,
+                 post->bloom_extents[level - 1], post->bloom_extents[level],
+                 DOWN_WORKGROUP_SIZE, DOWN_WORKGROUP_SIZE);
+    cmd_compute_barrier(command_buffer);
+  }
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    resource_manager_pipeline(resources, post->up_pipeline));
+  for (uint32_t level = post->bloom_level_count - 1; level-- > 0;) {
+    cmd_dispatch(post, command_buffer, post->up_sets[level], exposure_offset,
+                 push_constants, post->bloom_extents[level + 1],
+                 post->bloom_extents[level], UP_WORKGROUP_SIZE,
+                 UP_WORKGROUP_SIZE);
+    cmd_compute_barrier(command_buffer);
+  }
+}
+
+// Copies the intermediate image onto the output image, converting to its
+// format.
+static void cmd_blit_output(struct post_process *post,
+                            VkCommandBuffer command_buffer, VkImage image) {
+  VkImageSubresourceRange color_range = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .levelCount = 1,
+      .layerCount = 1};
+  // The acquire semaphore is waited on at the transfer stage, so this chains
+  // the transition after it.
+  vkCmdPipelineBarrier(
+      command_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+      &(const VkMemoryBarrier){.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                               .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                               .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT},
+      0, NULL, 1,
+      &(const VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+          .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = image,
+          .subresourceRange = color_range});
+
+  VkExtent2D extent = post->output_extent;
+  vkCmdBlitImage(
+      command_buffer,
+      resource_manager_image(post->resources, post->intermediate_image)
+          ->image,
+      VK_IMAGE_LAYOUT_GENERAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      1,
+      &(const VkImageBlit){
+          .srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .layerCount = 1},
+          .srcOffsets = {{0, 0, 0},
+                         {(int32_t)extent.width, (int32_t)extent.height, 1}},
+          .dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .layerCount = 1},
+          .dstOffsets = {{0, 0, 0},
+                         {(int32_t)extent.width, (int32_t)extent.height, 1}}},
+      VK_FILTER_NEAREST);
+
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1,
+      &(const VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = image,
+          .subresourceRange = color_range});
+}
+
+static void cmd_init_images(struct post_process *post,
+                            VkCommandBuffer command_buffer) {
+  VkImageMemoryBarrier barriers[2];
+  uint32_t barrier_count = 0;
+  struct resource_handle images[] = {post->bloom_image,
+                                     post->intermediate_image};
+  uint32_t level_counts[] = {post->bloom_level_count, 1};
+  for (uint32_t index = 0; index < 2; index++) {
+    const struct resource_image *image =
+        resource_manager_image(post->resources, images[index]);
+    if (!image) {
+      continue;
+    }
+    barriers[barrier_count++] = (VkImageMemoryBarrier){
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .dstAccessMask =
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image->image,
+        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .levelCount = level_counts[index],
+                             .layerCount = 1}};
+  }
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0,
+                       NULL, barrier_count, barriers);
+}
+
+void post_process_cmd_run(struct post_process *post,
+                          VkCommandBuffer command_buffer,
+                          uint32_t frame_index, uint32_t image_index,
+                          VkExtent2D render_extent) {
+  assert(image_index < post->output_image_count);
+  assert(render_extent.width <= post->scene_extent.width &&
+         render_extent.height <= post->scene_extent.height);
+  const struct post_process_config *config = &post->config;
+  VkDeviceSize exposure_offset =
+      (frame_index % post->region_count) * post->exposure_region_size;
+  // Samples stay half a texel inside the rendered corner, so nothing left
+  // over from frames rendered at another size is filtered in.
+  float scene_width = (float)post->scene_extent.width;
+  float scene_height = (float)post->scene_extent.height;
+  struct post_push_constants push_constants = {
+      .scene_uv_scale = {(float)render_extent.width / scene_width,
+                         (float)render_extent.height / scene_height},
+      .scene_uv_max = {((float)render_extent.width - 0.5f) / scene_width,
+                       ((float)render_extent.height - 0.5f) / scene_height},
+      .bloom_threshold = config->bloom_threshold,
+      .bloom_knee = config->bloom_knee,
+      // Level 0 holds the sum of every level.
+      .bloom_intensity =
+          config->bloom_intensity / (float)post->bloom_level_count,
+      .exposure_key = config->exposure_key,
+      .contrast = config->contrast,
+      .saturation = config->saturation,
+      .gain = {config->gain[0], config->gain[1], config->gain[2], 1.0f}};
+
+  // The previous frame may still be reading what is cleared and written
+  // below. Commands submitted earlier on this queue are part of the
+  // barrier's first scope.
+  vkCmdPipelineBarrier(
+      command_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+  if (!post->resources_initialized) {
+    cmd_init_images(post, command_buffer);
+    post->resources_initialized = true;
+  }
+  vkCmdFillBuffer(
+      command_buffer,
+      resource_manager_buffer(post->resources, post->exposure_buffer)->buffer,
+      exposure_offset, sizeof(struct post_exposure), 0);
+  vkCmdPipelineBarrier(
+      command_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+      &(const VkMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+          .srcAccessMask =
+              VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+          .dstAccessMask =
+              VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT},
+      0, NULL, 0, NULL);
+
+  if (has_effect(post, POST_EFFECT_BLOOM) ||
+      has_effect(post, POST_EFFECT_TONEMAP)) {
+    cmd_bloom(post, command_buffer, (uint32_t)exposure_offset,
+              &push_constants);
+  }
+
+  VkImage image = post->output_images[image_index];
+  VkImageSubresourceRange color_range = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .levelCount = 1,
+      .layerCount = 1};
+  if (post->output_storage) {
+    // The acquire semaphore is waited on at the compute shader stage, so
+    // this chains the transition after it.
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
+        &(const VkImageMemoryBarrier){
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = image,
+            .subresourceRange = color_range});
+  }
+  vkCmdBindPipeline(
+      command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+      resource_manager_pipeline(post->resources, post->resolve_pipeline));
+  cmd_dispatch(post, command_buffer,
+               post->resolve_sets[post->output_storage ? image_index : 0],
+               (uint32_t)exposure_offset, &push_constants, post->scene_extent,
+               post->output_extent, RESOLVE_WORKGROUP_WIDTH,
+               RESOLVE_WORKGROUP_HEIGHT);
+
+  if (!post->output_storage) {
+    cmd_blit_output(post, command_buffer, image);
+    return;
+  }
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1,
+      &(const VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+          .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = image,
+          .subresourceRange = color_range});
+}
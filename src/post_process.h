@@ -0,0 +1,141 @@
+#pragma once
+
+#include "device_features.h"
+#include "host_allocator.h"
+#include "resource_manager.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#define POST_PROCESS_MAX_BLOOM_LEVELS 8
+#define POST_PROCESS_MAX_OUTPUT_IMAGES 32
+
+// Effects of the chain, in the order they apply. Any subset can be enabled.
+enum post_effect {
+  // Bright parts of the scene bleed into their surroundings.
+  POST_EFFECT_BLOOM = 1u << 0,
+  // Exposure adapts to the average scene luminance, then an ACES filmic
+  // curve maps the HDR scene into the output range.
+  POST_EFFECT_TONEMAP = 1u << 1,
+  // Gain, contrast and saturation, applied before tonemapping.
+  POST_EFFECT_COLOR_GRADE = 1u << 2,
+  POST_EFFECT_FXAA = 1u << 3,
+  POST_EFFECT_ALL = (1u << 4) - 1,
+};
+
+struct post_process_config {
+  uint32_t effects;
+  // Levels below half the output resolution, each half the size of the one
+  // above.
+  uint32_t bloom_level_count;
+  float bloom_threshold;
+  float bloom_knee;
+  float bloom_intensity;
+  // The luminance the scene average is exposed to.
+  float exposure_key;
+  float gain[3];
+  float contrast;
+  float saturation;
+};
+
+// Every effect, with settings that suit the demo scene.
+struct post_process_config post_process_config_default(void);
+// Parses a comma separated list of effect names, "bloom", "tonemap", "grade"
+// and "fxaa", or "none", into out_effects.
+bool post_process_parse_effects(const char *text, uint32_t *out_effects);
+
+// Where the chain ends. With storage set the last pass writes straight into
+// the images, which must have been created with VK_IMAGE_USAGE_STORAGE_BIT
+// in a format that supports it. Otherwise it writes an intermediate image
+// that is blitted onto them, and they need VK_IMAGE_USAGE_TRANSFER_DST_BIT.
+struct post_process_output {
+  const VkImage *images;
+  const VkImageView *views;
+  uint32_t image_count;
+  VkFormat format;
+  VkExtent2D extent;
+  bool storage;
+};
+
+// A chain of compute passes from the HDR scene target to the output:
+//   1. The first bloom level downsamples the scene, keeping only what is
+//      above the bloom threshold, and reduces its log luminance into the
+//      frame's exposure value with one atomic per workgroup.
+//   2. The other bloom levels halve the one above, then every level but the
+//      smallest adds the one below onto itself on the way back up.
+//   3. One resolve pass scales the scene up from the size it was rendered
+//      at, adds bloom, exposes, grades, tonemaps, applies FXAA and writes
+//      the output.
+// Effects left out are specialized out of the shaders, and with neither
+// bloom nor tonemapping the first two steps are skipped.
+struct post_process {
+  struct resource_manager *resources;
+  struct post_process_config config;
+  VkExtent2D scene_extent;
+  VkImage output_images[POST_PROCESS_MAX_OUTPUT_IMAGES];
+  uint32_t output_image_count;
+  VkFormat output_format;
+  VkExtent2D output_extent;
+  bool output_storage;
+
+  // Mip chain in the GENERAL layout for its whole life, level 0 at half the
+  // output size. Also there without bloom, as the first pass' destination.
+  struct resource_handle bloom_image;
+  struct resource_handle bloom_level_views[POST_PROCESS_MAX_BLOOM_LEVELS];
+  VkExtent2D bloom_extents[POST_PROCESS_MAX_BLOOM_LEVELS];
+  uint32_t bloom_level_count;
+  // Only without storage output: what the resolve writes and the blit
+  // reads, also kept in the GENERAL layout.
+  struct resource_handle intermediate_image;
+  struct resource_handle intermediate_view;
+  struct resource_handle sampler;
+  // One luminance sum per frame in flight, cleared at the start of the
+  // chain.
+  struct resource_handle exposure_buffer;
+  VkDeviceSize exposure_region_size;
+  uint32_t region_count;
+
+  VkDescriptorSetLayout set_layout;
+  VkPipelineLayout pipeline_layout;
+  struct resource_handle first_down_pipeline;
+  struct resource_handle down_pipeline;
+  struct resource_handle up_pipeline;
+  struct resource_handle resolve_pipeline;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet down_sets[POST_PROCESS_MAX_BLOOM_LEVELS];
+  VkDescriptorSet up_sets[POST_PROCESS_MAX_BLOOM_LEVELS];
+  // One per output image with storage output, a single one otherwise.
+  VkDescriptorSet resolve_sets[POST_PROCESS_MAX_OUTPUT_IMAGES];
+  bool resources_initialized;
+};
+
+// scene_view is the HDR scene target of scene_extent, which must be in
+// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL and visible to compute shader
+// reads whenever the chain runs. Images, views, the sampler, the buffer and
+// the pipelines are owned by resources.
+bool post_process_init(struct post_process *post,
+                       struct resource_manager *resources,
+                       struct host_allocator *host_allocator,
+                       const struct device_features *features,
+                       const struct post_process_config *config,
+                       VkImageView scene_view, VkExtent2D scene_extent,
+                       const struct post_process_output *output,
+                       uint32_t region_count);
+// Call once the device is done with the chain. What the resource manager
+// owns is handed back to it with retire_value.
+void post_process_deinit(struct post_process *post, uint64_t retire_value);
+
+// The stage the chain first touches an output image in, for the wait on its
+// acquire semaphore. Whatever else is in the batch with that wait waits too,
+// so the chain belongs in a batch after the scene's.
+VkPipelineStageFlags
+post_process_output_stage(const struct post_process *post);
+
+// Must be recorded outside of a render pass. render_extent is the corner of
+// the scene target this frame was rendered to. Leaves output image
+// image_index in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, written at the stage
+// post_process_output_stage() returns.
+void post_process_cmd_run(struct post_process *post,
+                          VkCommandBuffer command_buffer,
+                          uint32_t frame_index, uint32_t image_index,
+                          VkExtent2D render_extent);
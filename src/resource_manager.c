@@ -0,0 +1,304 @@
+#include "resource_manager.h"
+
+#include "log.h"
+#include "vulkan_utils.h"
+#include <assert.h>
+
+static const char *const resource_type_names[RESOURCE_TYPE_COUNT] = {
+    [RESOURCE_TYPE_PIPELINE] = "pipeline",
+    [RESOURCE_TYPE_SAMPLER] = "sampler",
+    [RESOURCE_TYPE_IMAGE_VIEW] = "image view",
+    [RESOURCE_TYPE_IMAGE] = "image",
+    [RESOURCE_TYPE_BUFFER] = "buffer",
+};
+
+void resource_manager_init(struct resource_manager *manager,
+                           VkPhysicalDevice physical_device, VkDevice device,
+                           const VkAllocationCallbacks *allocation_callbacks) {
+  manager->physical_device = physical_device;
+  manager->device = device;
+  manager->allocation_callbacks = allocation_callbacks;
+  for (uint32_t type = 0; type < RESOURCE_TYPE_COUNT; type++) {
+    struct resource_pool *pool = &manager->pools[type];
+    pool->free_list_head = RESOURCE_INVALID_INDEX;
+    pool->slot_count = 0;
+    pool->live_count = 0;
+  }
+  manager->retirement_count = 0;
+  manager->completed_value = 0;
+}
+
+static void destroy_object(struct resource_manager *manager,
+                           enum resource_type type, uint32_t index) {
+  switch (type) {
+  case RESOURCE_TYPE_PIPELINE:
+    vkDestroyPipeline(manager->device, manager->pipelines[index],
+                      manager->allocation_callbacks);
+    break;
+  case RESOURCE_TYPE_SAMPLER:
+    vkDestroySampler(manager->device, manager->samplers[index],
+                     manager->allocation_callbacks);
+    break;
+  case RESOURCE_TYPE_IMAGE_VIEW:
+    vkDestroyImageView(manager->device, manager->image_views[index],
+                       manager->allocation_callbacks);
+    break;
+  case RESOURCE_TYPE_IMAGE:
+    vkDestroyImage(manager->device, manager->images[index].image,
+                   manager->allocation_callbacks);
+    vkFreeMemory(manager->device, manager->images[index].memory,
+                 manager->allocation_callbacks);
+    break;
+  case RESOURCE_TYPE_BUFFER:
+    vkDestroyBuffer(manager->device, manager->buffers[index].buffer,
+                    manager->allocation_callbacks);
+    vkFreeMemory(manager->device, manager->buffers[index].memory,
+                 manager->allocation_callbacks);
+    break;
+  case RESOURCE_TYPE_COUNT:
+    assert(false);
+    break;
+  }
+}
+
+static void free_slot(struct resource_pool *pool, uint32_t index) {
+  pool->states[index] = RESOURCE_SLOT_FREE;
+  pool->next_free[index] = pool->free_list_head;
+  pool->free_list_head = index;
+}
+
+void resource_manager_deinit(struct resource_manager *manager) {
+  resource_manager_collect(manager, UINT64_MAX);
+  for (uint32_t type = 0; type < RESOURCE_TYPE_COUNT; type++) {
+    struct resource_pool *pool = &manager->pools[type];
+    for (uint32_t index = 0; index < pool->slot_count; index++) {
+      if (pool->states[index] == RESOURCE_SLOT_LIVE) {
+        destroy_object(manager, (enum resource_type)type, index);
+      }
+    }
+    if (pool->live_count > 0) {
+      LOG("Destroyed %u leftover %s resources", pool->live_count,
+          resource_type_names[type]);
+    }
+  }
+}
+
+// Reserves a slot; the caller fills in its object before calling
+// publish_slot().
+static bool allocate_slot(struct resource_manager *manager,
+                          enum resource_type type, uint32_t *out_index) {
+  struct resource_pool *pool = &manager->pools[type];
+  if (pool->free_list_head != RESOURCE_INVALID_INDEX) {
+    *out_index = pool->free_list_head;
+    pool->free_list_head = pool->next_free[*out_index];
+  } else if (pool->slot_count < RESOURCE_POOL_CAPACITY) {
+    *out_index = pool->slot_count++;
+    pool->generations[*out_index] = 1;
+  } else {
+    LOG("No %s slots left (%u in use)", resource_type_names[type],
+        RESOURCE_POOL_CAPACITY);
+    return false;
+  }
+  return true;
+}
+
+static struct resource_handle publish_slot(struct resource_manager *manager,
+                                           enum resource_type type,
+                                           uint32_t index) {
+  struct resource_pool *pool = &manager->pools[type];
+  pool->states[index] = RESOURCE_SLOT_LIVE;
+  pool->live_count++;
+  return (struct resource_handle){.index = index,
+                                  .generation = pool->generations[index]};
+}
+
+bool resource_manager_create_buffer(
+    struct resource_manager *manager, VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    const VkMemoryPropertyFlags *property_preferences,
+    uint32_t property_preference_count, struct resource_handle *out_handle) {
+  uint32_t index;
+  if (!allocate_slot(manager, RESOURCE_TYPE_BUFFER, &index)) {
+    return false;
+  }
+  struct resource_buffer *buffer = &manager->buffers[index];
+  if (!create_buffer(manager->physical_device, manager->device,
+                     manager->allocation_callbacks, size, usage,
+                     property_preferences, property_preference_count, 0,
+                     &buffer->buffer, &buffer->memory,
+                     &buffer->memory_properties)) {
+    free_slot(&manager->pools[RESOURCE_TYPE_BUFFER], index);
+    return false;
+  }
+  buffer->size = size;
+  *out_handle = publish_slot(manager, RESOURCE_TYPE_BUFFER, index);
+  return true;
+}
+
+bool resource_manager_create_image(struct resource_manager *manager,
+                                   const VkImageCreateInfo *create_info,
+                                   struct resource_handle *out_handle) {
+  uint32_t index;
+  if (!allocate_slot(manager, RESOURCE_TYPE_IMAGE, &index)) {
+    return false;
+  }
+  struct resource_image *image = &manager->images[index];
+  if (!create_image(manager->physical_device, manager->device,
+                    manager->allocation_callbacks, create_info, &image->image,
+                    &image->memory)) {
+    free_slot(&manager->pools[RESOURCE_TYPE_IMAGE], index);
+    return false;
+  }
+  image->format = create_info->format;
+  image->extent = create_info->extent;
+  *out_handle = publish_slot(manager, RESOURCE_TYPE_IMAGE, index);
+  return true;
+}
+
+bool resource_manager_create_image_view(
+    struct resource_manager *manager, const VkImageViewCreateInfo *create_info,
+    struct resource_handle *out_handle) {
+  uint32_t index;
+  if (!allocate_slot(manager, RESOURCE_TYPE_IMAGE_VIEW, &index)) {
+    return false;
+  }
+  VkResult result =
+      vkCreateImageView(manager->device, create_info,
+                        manager->allocation_callbacks,
+                        &manager->image_views[index]);
+  if (result != VK_SUCCESS) {
+    LOG("Couldn't create image view, VkResult=%d", result);
+    free_slot(&manager->pools[RESOURCE_TYPE_IMAGE_VIEW], index);
+    return false;
+  }
+  *out_handle = publish_slot(manager, RESOURCE_TYPE_IMAGE_VIEW, index);
+  return true;
+}
+
+bool resource_manager_create_sampler(struct resource_manager *manager,
+                                     const VkSamplerCreateInfo *create_info,
+                                     struct resource_handle *out_handle) {
+  uint32_t index;
+  if (!allocate_slot(manager, RESOURCE_TYPE_SAMPLER, &index)) {
+    return false;
+  }
+  VkResult result =
+      vkCreateSampler(manager->device, create_info,
+                      manager->allocation_callbacks, &manager->samplers[index]);
+  if (result != VK_SUCCESS) {
+    LOG("Couldn't create sampler, VkResult=%d", result);
+    free_slot(&manager->pools[RESOURCE_TYPE_SAMPLER], index);
+    return false;
+  }
+  *out_handle = publish_slot(manager, RESOURCE_TYPE_SAMPLER, index);
+  return true;
+}
+
+bool resource_manager_add_pipeline(struct resource_manager *manager,
+                                   VkPipeline pipeline,
+                                   struct resource_handle *out_handle) {
+  uint32_t index;
+  if (!allocate_slot(manager, RESOURCE_TYPE_PIPELINE, &index)) {
+    vkDestroyPipeline(manager->device, pipeline,
+                      manager->allocation_callbacks);
+    return false;
+  }
+  manager->pipelines[index] = pipeline;
+  *out_handle = publish_slot(manager, RESOURCE_TYPE_PIPELINE, index);
+  return true;
+}
+
+bool resource_manager_is_alive(const struct resource_manager *manager,
+                               enum resource_type type,
+                               struct resource_handle handle) {
+  assert(type < RESOURCE_TYPE_COUNT);
+  const struct resource_pool *pool = &manager->pools[type];
+  return handle.index < pool->slot_count &&
+         pool->states[handle.index] == RESOURCE_SLOT_LIVE &&
+         pool->generations[handle.index] == handle.generation;
+}
+
+const struct resource_buffer *
+resource_manager_buffer(const struct resource_manager *manager,
+                        struct resource_handle handle) {
+  return resource_manager_is_alive(manager, RESOURCE_TYPE_BUFFER, handle)
+             ? &manager->buffers[handle.index]
+             : NULL;
+}
+
+const struct resource_image *
+resource_manager_image(const struct resource_manager *manager,
+                       struct resource_handle handle) {
+  return resource_manager_is_alive(manager, RESOURCE_TYPE_IMAGE, handle)
+             ? &manager->images[handle.index]
+             : NULL;
+}
+
+VkImageView resource_manager_image_view(const struct resource_manager *manager,
+                                        struct resource_handle handle) {
+  return resource_manager_is_alive(manager, RESOURCE_TYPE_IMAGE_VIEW, handle)
+             ? manager->image_views[handle.index]
+             : VK_NULL_HANDLE;
+}
+
+VkSampler resource_manager_sampler(const struct resource_manager *manager,
+                                   struct resource_handle handle) {
+  return resource_manager_is_alive(manager, RESOURCE_TYPE_SAMPLER, handle)
+             ? manager->samplers[handle.index]
+             : VK_NULL_HANDLE;
+}
+
+VkPipeline resource_manager_pipeline(const struct resource_manager *manager,
+                                     struct resource_handle handle) {
+  return resource_manager_is_alive(manager, RESOURCE_TYPE_PIPELINE, handle)
+             ? manager->pipelines[handle.index]
+             : VK_NULL_HANDLE;
+}
+
+void resource_manager_destroy(struct resource_manager *manager,
+                              enum resource_type type,
+                              struct resource_handle handle,
+                              uint64_t retire_value) {
+  assert(resource_manager_is_alive(manager, type, handle));
+  struct resource_pool *pool = &manager->pools[type];
+  uint32_t index = handle.index;
+  pool->live_count--;
+  // Skips 0 on wrap around, which stays reserved for zeroed handles.
+  if (++pool->generations[index] == 0) {
+    pool->generations[index] = 1;
+  }
+
+  if (retire_value <= manager->completed_value) {
+    destroy_object(manager, type, index);
+    free_slot(pool, index);
+    return;
+  }
+  assert(manager->retirement_count <
+         RESOURCE_TYPE_COUNT * RESOURCE_POOL_CAPACITY);
+  pool->states[index] = RESOURCE_SLOT_RETIRING;
+  manager->retirements[manager->retirement_count++] =
+      (struct resource_retirement){
+          .retire_value = retire_value, .type = type, .index = index};
+}
+
+void resource_manager_collect(struct resource_manager *manager,
+                              uint64_t completed_value) {
+  if (completed_value > manager->completed_value) {
+    manager->completed_value = completed_value;
+  }
+  // Retirements are destroyed in the order they were queued in, so a view
+  // retired before its image also goes first.
+  uint32_t kept_count = 0;
+  for (uint32_t retirement_index = 0;
+       retirement_index < manager->retirement_count; retirement_index++) {
+    struct resource_retirement retirement =
+        manager->retirements[retirement_index];
+    if (retirement.retire_value > completed_value) {
+      manager->retirements[kept_count++] = retirement;
+      continue;
+    }
+    destroy_object(manager, retirement.type, retirement.index);
+    free_slot(&manager->pools[retirement.type], retirement.index);
+  }
+  manager->retirement_count = kept_count;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#define RESOURCE_POOL_CAPACITY 256
+#define RESOURCE_INVALID_INDEX UINT32_MAX
+
+enum resource_type {
+  // In the order leftovers are destroyed at deinit: users before what they
+  // use.
+  RESOURCE_TYPE_PIPELINE,
+  RESOURCE_TYPE_SAMPLER,
+  RESOURCE_TYPE_IMAGE_VIEW,
+  RESOURCE_TYPE_IMAGE,
+  RESOURCE_TYPE_BUFFER,
+  RESOURCE_TYPE_COUNT,
+};
+
+// Same scheme as scene_handle: a destroyed slot is reused with a bumped
+// generation, so stale handles are detected rather than aliased. Generation
+// 0 is never handed out, so a zeroed handle is never valid.
+struct resource_handle {
+  uint32_t index;
+  uint32_t generation;
+};
+
+struct resource_buffer {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  VkMemoryPropertyFlags memory_properties;
+};
+
+struct resource_image {
+  VkImage image;
+  VkDeviceMemory memory;
+  VkFormat format;
+  VkExtent3D extent;
+};
+
+enum resource_slot_state {
+  RESOURCE_SLOT_FREE,
+  RESOURCE_SLOT_LIVE,
+  // Destroyed by its owner, waiting for the GPU to be done with it.
+  RESOURCE_SLOT_RETIRING,
+};
+
+// Bookkeeping of one slot table. The objects themselves sit in the typed
+// arrays of struct resource_manager at the same index, so looking one up
+// touches a generation and the object and nothing else.
+struct resource_pool {
+  uint32_t generations[RESOURCE_POOL_CAPACITY];
+  uint8_t states[RESOURCE_POOL_CAPACITY];
+  // Free slots are chained through next_free.
+  uint32_t next_free[RESOURCE_POOL_CAPACITY];
+  uint32_t free_list_head;
+  uint32_t slot_count;
+  uint32_t live_count;
+};
+
+struct resource_retirement {
+  uint64_t retire_value;
+  enum resource_type type;
+  uint32_t index;
+};
+
+// Owns buffers, images, image views, samplers and pipelines, addressed by
+// generational handles. Destroying one invalidates its handle right away,
+// but the Vulkan object is only destroyed once the frame timeline reaches
+// the value passed along, i.e. once every frame that may still use it has
+// completed. Nothing here waits on the GPU.
+//
+// Timeline values count completed frames: frame n is done once the value
+// is n + 1, matching the renderer's frame timeline semaphore.
+struct resource_manager {
+  VkPhysicalDevice physical_device;
+  VkDevice device;
+  const VkAllocationCallbacks *allocation_callbacks;
+  struct resource_pool pools[RESOURCE_TYPE_COUNT];
+  struct resource_buffer buffers[RESOURCE_POOL_CAPACITY];
+  struct resource_image images[RESOURCE_POOL_CAPACITY];
+  VkImageView image_views[RESOURCE_POOL_CAPACITY];
+  VkSampler samplers[RESOURCE_POOL_CAPACITY];
+  VkPipeline pipelines[RESOURCE_POOL_CAPACITY];
+  // A slot retires at most once before it is freed, so this never fills up.
+  struct resource_retirement
+      retirements[RESOURCE_TYPE_COUNT * RESOURCE_POOL_CAPACITY];
+  uint32_t retirement_count;
+  uint64_t completed_value;
+};
+
+void resource_manager_init(struct resource_manager *manager,
+                           VkPhysicalDevice physical_device, VkDevice device,
+                           const VkAllocationCallbacks *allocation_callbacks);
+// The device must be idle. Destroys everything, retiring or not.
+void resource_manager_deinit(struct resource_manager *manager);
+
+// Creates a buffer with its own allocation, see create_buffer().
+bool resource_manager_create_buffer(
+    struct resource_manager *manager, VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    const VkMemoryPropertyFlags *property_preferences,
+    uint32_t property_preference_count, struct resource_handle *out_handle);
+// Creates an image backed by its own device local allocation.
+bool resource_manager_create_image(struct resource_manager *manager,
+                                   const VkImageCreateInfo *create_info,
+                                   struct resource_handle *out_handle);
+bool resource_manager_create_image_view(
+    struct resource_manager *manager, const VkImageViewCreateInfo *create_info,
+    struct resource_handle *out_handle);
+bool resource_manager_create_sampler(struct resource_manager *manager,
+                                     const VkSamplerCreateInfo *create_info,
+                                     struct resource_handle *out_handle);
+// Takes ownership of a pipeline created elsewhere. On failure the pipeline
+// is destroyed.
+bool resource_manager_add_pipeline(struct resource_manager *manager,
+                                   VkPipeline pipeline,
+                                   struct resource_handle *out_handle);
+
+bool resource_manager_is_alive(const struct resource_manager *manager,
+                               enum resource_type type,
+                               struct resource_handle handle);
+// NULL or VK_NULL_HANDLE for stale handles.
+const struct resource_buffer *
+resource_manager_buffer(const struct resource_manager *manager,
+                        struct resource_handle handle);
+const struct resource_image *
+resource_manager_image(const struct resource_manager *manager,
+                       struct resource_handle handle);
+VkImageView resource_manager_image_view(const struct resource_manager *manager,
+                                        struct resource_handle handle);
+VkSampler resource_manager_sampler(const struct resource_manager *manager,
+                                   struct resource_handle handle);
+VkPipeline resource_manager_pipeline(const struct resource_manager *manager,
+                                     struct resource_handle handle);
+
+// Invalidates the handle and destroys the object once the timeline reaches
+// retire_value, right away if it already has.
+void resource_manager_destroy(struct resource_manager *manager,
+                              enum resource_type type,
+                              struct resource_handle handle,
+                              uint64_t retire_value);
+// Destroys every retired object whose retire value is at most
+// completed_value and frees its slot. Call once the timeline has reached it.
+void resource_manager_collect(struct resource_manager *manager,
+                              uint64_t completed_value);
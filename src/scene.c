@@ -0,0 +1,432 @@
+#include "scene.h"
+
+#include "log.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum scene_state {
+  SCENE_STATE_ALIVE = 1u << 0,
+  SCENE_STATE_TRANSFORM_DIRTY = 1u << 1,
+  SCENE_STATE_UPDATED = 1u << 2,
+};
+
+static void *carve(char **cursor, size_t size) {
+  uintptr_t address = (uintptr_t)*cursor;
+  address = (address + HOST_ALLOCATOR_MIN_ALIGNMENT - 1) &
+            ~(uintptr_t)(HOST_ALLOCATOR_MIN_ALIGNMENT - 1);
+  *cursor = (char *)address + size;
+  return (void *)address;
+}
+
+// Lays the arrays out one after another starting at `base`. Called once with
+// a NULL base to measure and once more to assign the pointers.
+static size_t scene_layout(struct scene *scene, char *base) {
+  uint32_t capacity = scene->capacity;
+  char *cursor = base;
+  scene->generations = carve(&cursor, capacity * sizeof(uint32_t));
+  scene->states = carve(&cursor, capacity * sizeof(uint8_t));
+  scene->gpu_pending = carve(&cursor, capacity * sizeof(uint8_t));
+  scene->parents = carve(&cursor, capacity * sizeof(uint32_t));
+  scene->first_children = carve(&cursor, capacity * sizeof(uint32_t));
+  scene->next_siblings = carve(&cursor, capacity * sizeof(uint32_t));
+  scene->previous_siblings = carve(&cursor, capacity * sizeof(uint32_t));
+  scene->depths = carve(&cursor, capacity * sizeof(uint32_t));
+  scene->translations = carve(&cursor, capacity * sizeof(struct vec3));
+  scene->rotations = carve(&cursor, capacity * sizeof(struct quat));
+  scene->scales = carve(&cursor, capacity * sizeof(struct vec3));
+  scene->world_transforms = carve(&cursor, capacity * sizeof(struct mat4));
+  scene->local_bounds.center_x = carve(&cursor, capacity * sizeof(float));
+  scene->local_bounds.center_y = carve(&cursor, capacity * sizeof(float));
+  scene->local_bounds.center_z = carve(&cursor, capacity * sizeof(float));
+  scene->local_bounds.radius = carve(&cursor, capacity * sizeof(float));
+  scene->world_bounds.center_x = carve(&cursor, capacity * sizeof(float));
+  scene->world_bounds.center_y = carve(&cursor, capacity * sizeof(float));
+  scene->world_bounds.center_z = carve(&cursor, capacity * sizeof(float));
+  scene->world_bounds.radius = carve(&cursor, capacity * sizeof(float));
+  scene->mesh_ids = carve(&cursor, capacity * sizeof(uint32_t));
+  scene->material_ids = carve(&cursor, capacity * sizeof(uint32_t));
+  scene->flags = carve(&cursor, capacity * sizeof(uint32_t));
+  scene->transform_dirty_list = carve(&cursor, capacity * sizeof(uint32_t));
+  for (uint32_t copy_index = 0; copy_index < scene->gpu_copy_count;
+       copy_index++) {
+    scene->gpu_dirty_lists[copy_index] =
+        carve(&cursor, capacity * sizeof(uint32_t));
+  }
+  scene->sort_keys = carve(&cursor, capacity * sizeof(uint64_t));
+  scene->traversal_stack = carve(&cursor, capacity * sizeof(uint32_t));
+  return (size_t)((uintptr_t)cursor - (uintptr_t)base);
+}
+
+bool scene_init(struct scene *scene, struct host_allocator *allocator,
+                uint32_t capacity, uint32_t gpu_copy_count) {
+  assert(capacity > 0 && capacity < SCENE_INVALID_INDEX);
+  assert(gpu_copy_count > 0 && gpu_copy_count <= SCENE_MAX_GPU_COPIES);
+  *scene = (struct scene){.allocator = allocator,
+                          .capacity = capacity,
+                          .free_list_head = SCENE_INVALID_INDEX,
+                          .gpu_copy_count = gpu_copy_count};
+
+  size_t storage_size = scene_layout(scene, NULL);
+  scene->storage = host_allocator_alloc(allocator, storage_size,
+                                        VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+  if (!scene->storage) {
+    LOG("Couldn't allocate scene storage of %zu bytes", storage_size);
+    return false;
+  }
+  // The allocation is at least HOST_ALLOCATOR_MIN_ALIGNMENT aligned, so the
+  // second pass reproduces the measured layout exactly.
+  scene_layout(scene, scene->storage);
+  memset(scene->storage, 0, storage_size);
+  return true;
+}
+
+void scene_deinit(struct scene *scene) {
+  host_allocator_free(scene->allocator, scene->storage);
+  *scene = (struct scene){0};
+}
+
+bool scene_is_alive(const struct scene *scene, struct scene_handle handle) {
+  return handle.index < scene->slot_count &&
+         (scene->states[handle.index] & SCENE_STATE_ALIVE) &&
+         scene->generations[handle.index] == handle.generation;
+}
+
+static void mark_transform_dirty(struct scene *scene, uint32_t index) {
+  if (!(scene->states[index] & SCENE_STATE_TRANSFORM_DIRTY)) {
+    scene->states[index] |= SCENE_STATE_TRANSFORM_DIRTY;
+    scene->transform_dirty_list[scene->transform_dirty_count++] = index;
+  }
+}
+
+static void mark_gpu_dirty(struct scene *scene, uint32_t index) {
+  for (uint32_t copy_index = 0; copy_index < scene->gpu_copy_count;
+       copy_index++) {
+    uint8_t copy_bit = (uint8_t)(1u << copy_index);
+    if (!(scene->gpu_pending[index] & copy_bit)) {
+      scene->gpu_pending[index] |= copy_bit;
+      scene->gpu_dirty_lists[copy_index]
+                            [scene->gpu_dirty_counts[copy_index]++] = index;
+    }
+  }
+}
+
+static void set_subtree_depth(struct scene *scene, uint32_t root,
+                              uint32_t depth) {
+  scene->depths[root] = depth;
+  uint32_t stack_size = 0;
+  scene->traversal_stack[stack_size++] = root;
+  while (stack_size > 0) {
+    uint32_t index = scene->traversal_stack[--stack_size];
+    for (uint32_t child = scene->first_children[index];
+         child != SCENE_INVALID_INDEX; child = scene->next_siblings[child]) {
+      scene->depths[child] = scene->depths[index] + 1;
+      scene->traversal_stack[stack_size++] = child;
+    }
+  }
+}
+
+static void attach(struct scene *scene, uint32_t index, uint32_t parent) {
+  scene->parents[index] = parent;
+  scene->previous_siblings[index] = SCENE_INVALID_INDEX;
+  scene->next_siblings[index] = SCENE_INVALID_INDEX;
+  if (parent == SCENE_INVALID_INDEX) {
+    set_subtree_depth(scene, index, 0);
+    return;
+  }
+
+  uint32_t next = scene->first_children[parent];
+  scene->next_siblings[index] = next;
+  if (next != SCENE_INVALID_INDEX) {
+    scene->previous_siblings[next] = index;
+  }
+  scene->first_children[parent] = index;
+  set_subtree_depth(scene, index, scene->depths[parent] + 1);
+}
+
+static void detach(struct scene *scene, uint32_t index) {
+  uint32_t parent = scene->parents[index];
+  uint32_t previous = scene->previous_siblings[index];
+  uint32_t next = scene->next_siblings[index];
+  if (previous != SCENE_INVALID_INDEX) {
+    scene->next_siblings[previous] = next;
+  } else if (parent != SCENE_INVALID_INDEX) {
+    scene->first_children[parent] = next;
+  }
+  if (next != SCENE_INVALID_INDEX) {
+    scene->previous_siblings[next] = previous;
+  }
+  scene->parents[index] = SCENE_INVALID_INDEX;
+  scene->previous_siblings[index] = SCENE_INVALID_INDEX;
+  scene->next_siblings[index] = SCENE_INVALID_INDEX;
+}
+
+bool scene_create_node(struct scene *scene, const struct scene_handle *parent,
+                       struct scene_handle *out_handle) {
+  assert(!parent || scene_is_alive(scene, *parent));
+
+  uint32_t index;
+  if (scene->free_list_head != SCENE_INVALID_INDEX) {
+    index = scene->free_list_head;
+    scene->free_list_head = scene->next_siblings[index];
+  } else if (scene->slot_count < scene->capacity) {
+    index = scene->slot_count++;
+  } else {
+    LOG("Scene is full (%u nodes)", scene->capacity);
+    return false;
+  }
+
+  // A reused slot may still sit in the transform dirty list; keeping its bit
+  // stops it from being appended twice.
+  scene->states[index] = SCENE_STATE_ALIVE | (scene->states[index] &
+                                              SCENE_STATE_TRANSFORM_DIRTY);
+  scene->first_children[index] = SCENE_INVALID_INDEX;
+  scene->translations[index] = (struct vec3){0.0f, 0.0f, 0.0f};
+  scene->rotations[index] = quat_identity();
+  scene->scales[index] = (struct vec3){1.0f, 1.0f, 1.0f};
+  scene->local_bounds.center_x[index] = 0.0f;
+  scene->local_bounds.center_y[index] = 0.0f;
+  scene->local_bounds.center_z[index] = 0.0f;
+  scene->local_bounds.radius[index] = 0.0f;
+  scene->mesh_ids[index] = 0;
+  scene->material_ids[index] = 0;
+  scene->flags[index] = SCENE_FLAG_VISIBLE;
+  attach(scene, index, parent ? parent->index : SCENE_INVALID_INDEX);
+  mark_transform_dirty(scene, index);
+  scene->live_count++;
+
+  *out_handle = (struct scene_handle){.index = index,
+                                      .generation = scene->generations[index]};
+  return true;
+}
+
+void scene_destroy_node(struct scene *scene, struct scene_handle handle) {
+  assert(scene_is_alive(scene, handle));
+  detach(scene, handle.index);
+
+  uint32_t stack_size = 0;
+  scene->traversal_stack[stack_size++] = handle.index;
+  while (stack_size > 0) {
+    uint32_t index = scene->traversal_stack[--stack_size];
+    for (uint32_t child = scene->first_children[index];
+         child != SCENE_INVALID_INDEX; child = scene->next_siblings[child]) {
+      scene->traversal_stack[stack_size++] = child;
+    }
+
+    scene->states[index] &= SCENE_STATE_TRANSFORM_DIRTY;
+    scene->generations[index]++;
+    scene->flags[index] = 0;
+    scene->first_children[index] = SCENE_INVALID_INDEX;
+    scene->next_siblings[index] = scene->free_list_head;
+    scene->free_list_head = index;
+    scene->live_count--;
+    // Writes the cleared flags so the GPU stops drawing the slot.
+    mark_gpu_dirty(scene, index);
+  }
+}
+
+void scene_set_parent(struct scene *scene, struct scene_handle handle,
+                      const struct scene_handle *parent) {
+  assert(scene_is_alive(scene, handle));
+  assert(!parent || scene_is_alive(scene, *parent));
+#ifndef NDEBUG
+  if (parent) {
+    for (uint32_t ancestor = parent->index; ancestor != SCENE_INVALID_INDEX;
+         ancestor = scene->parents[ancestor]) {
+      assert(ancestor != handle.index && "cycle in scene hierarchy");
+    }
+  }
+#endif
+  detach(scene, handle.index);
+  attach(scene, handle.index, parent ? parent->index : SCENE_INVALID_INDEX);
+  mark_transform_dirty(scene, handle.index);
+}
+
+void scene_set_local_transform(struct scene *scene, struct scene_handle handle,
+                               struct vec3 translation, struct quat rotation,
+                               struct vec3 scale) {
+  assert(scene_is_alive(scene, handle));
+  scene->translations[handle.index] = translation;
+  scene->rotations[handle.index] = rotation;
+  scene->scales[handle.index] = scale;
+  mark_transform_dirty(scene, handle.index);
+}
+
+void scene_set_translation(struct scene *scene, struct scene_handle handle,
+                           struct vec3 translation) {
+  assert(scene_is_alive(scene, handle));
+  scene->translations[handle.index] = translation;
+  mark_transform_dirty(scene, handle.index);
+}
+
+void scene_set_rotation(struct scene *scene, struct scene_handle handle,
+                        struct quat rotation) {
+  assert(scene_is_alive(scene, handle));
+  scene->rotations[handle.index] = rotation;
+  mark_transform_dirty(scene, handle.index);
+}
+
+void scene_set_local_bounds(struct scene *scene, struct scene_handle handle,
+                            struct vec3 center, float radius) {
+  assert(scene_is_alive(scene, handle));
+  scene->local_bounds.center_x[handle.index] = center.x;
+  scene->local_bounds.center_y[handle.index] = center.y;
+  scene->local_bounds.center_z[handle.index] = center.z;
+  scene->local_bounds.radius[handle.index] = radius;
+  mark_transform_dirty(scene, handle.index);
+}
+
+void scene_set_mesh(struct scene *scene, struct scene_handle handle,
+                    uint32_t mesh_id, uint32_t material_id) {
+  assert(scene_is_alive(scene, handle));
+  scene->mesh_ids[handle.index] = mesh_id;
+  scene->material_ids[handle.index] = material_id;
+  mark_gpu_dirty(scene, handle.index);
+}
+
+void scene_set_flags(struct scene *scene, struct scene_handle handle,
+                     uint32_t flags) {
+  assert(scene_is_alive(scene, handle));
+  scene->flags[handle.index] = flags;
+  mark_gpu_dirty(scene, handle.index);
+}
+
+const struct mat4 *scene_world_transform(const struct scene *scene,
+                                         struct scene_handle handle) {
+  assert(scene_is_alive(scene, handle));
+  return &scene->world_transforms[handle.index];
+}
+
+static int compare_sort_keys(const void *a, const void *b) {
+  uint64_t key_a = *(const uint64_t *)a;
+  uint64_t key_b = *(const uint64_t *)b;
+  return (key_a > key_b) - (key_a < key_b);
+}
+
+static void update_node(struct scene *scene, uint32_t index) {
+  struct mat4 local =
+      mat4_from_trs(scene->translations[index], scene->rotations[index],
+                    scene->scales[index]);
+  uint32_t parent = scene->parents[index];
+  struct mat4 *world = &scene->world_transforms[index];
+  *world = parent == SCENE_INVALID_INDEX
+               ? local
+               : mat4_mul(&scene->world_transforms[parent], &local);
+
+  const float *m = world->m;
+  struct vec3 center = mat4_transform_point(
+      world, (struct vec3){scene->local_bounds.center_x[index],
+                           scene->local_bounds.center_y[index],
+                           scene->local_bounds.center_z[index]});
+  float scale0 = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+  float scale1 = m[4] * m[4] + m[5] * m[5] + m[6] * m[6];
+  float scale2 = m[8] * m[8] + m[9] * m[9] + m[10] * m[10];
+  float max_scale = fmaxf(scale0, fmaxf(scale1, scale2));
+  scene->world_bounds.center_x[index] = center.x;
+  scene->world_bounds.center_y[index] = center.y;
+  scene->world_bounds.center_z[index] = center.z;
+  scene->world_bounds.radius[index] =
+      scene->local_bounds.radius[index] * sqrtf(max_scale);
+}
+
+uint32_t scene_update(struct scene *scene) {
+  // Parents have to be final before their children are computed, so dirty
+  // nodes are visited shallowest first. A dirty node whose ancestor was also
+  // dirty has already been refreshed as part of that ancestor's subtree.
+  uint32_t key_count = 0;
+  for (uint32_t dirty_index = 0; dirty_index < scene->transform_dirty_count;
+       dirty_index++) {
+    uint32_t index = scene->transform_dirty_list[dirty_index];
+    scene->states[index] &= (uint8_t)~SCENE_STATE_TRANSFORM_DIRTY;
+    if (scene->states[index] & SCENE_STATE_ALIVE) {
+      scene->sort_keys[key_count++] =
+          (uint64_t)scene->depths[index] << 32 | index;
+    }
+  }
+  scene->transform_dirty_count = 0;
+  qsort(scene->sort_keys, key_count, sizeof(uint64_t), compare_sort_keys);
+
+  // The dirty list is drained, so it doubles as the list of updated nodes.
+  uint32_t *updated = scene->transform_dirty_list;
+  uint32_t updated_count = 0;
+  for (uint32_t key_index = 0; key_index < key_count; key_index++) {
+    uint32_t root = (uint32_t)scene->sort_keys[key_index];
+    if (scene->states[root] & SCENE_STATE_UPDATED) {
+      continue;
+    }
+
+    uint32_t stack_size = 0;
+    scene->traversal_stack[stack_size++] = root;
+    while (stack_size > 0) {
+      uint32_t index = scene->traversal_stack[--stack_size];
+      update_node(scene, index);
+      scene->states[index] |= SCENE_STATE_UPDATED;
+      updated[updated_count++] = index;
+      mark_gpu_dirty(scene, index);
+      for (uint32_t child = scene->first_children[index];
+           child != SCENE_INVALID_INDEX; child = scene->next_siblings[child]) {
+        scene->traversal_stack[stack_size++] = child;
+      }
+    }
+  }
+
+  for (uint32_t updated_index = 0; updated_index < updated_count;
+       updated_index++) {
+    scene->states[updated[updated_index]] &=
+        (uint8_t)~SCENE_STATE_UPDATED;
+  }
+  return updated_count;
+}
+
+bool scene_has_changes(const struct scene *scene, uint32_t copy_index) {
+  assert(copy_index < scene->gpu_copy_count);
+  return scene->transform_dirty_count > 0 ||
+         scene->gpu_dirty_counts[copy_index] > 0;
+}
+
+static struct scene_instance make_instance(const struct scene *scene,
+                                           uint32_t index) {
+  return (struct scene_instance){
+      .world = scene->world_transforms[index],
+      .bounds = {scene->world_bounds.center_x[index],
+                 scene->world_bounds.center_y[index],
+                 scene->world_bounds.center_z[index],
+                 scene->world_bounds.radius[index]},
+      .mesh_id = scene->mesh_ids[index],
+      .material_id = scene->material_ids[index],
+      .flags = scene->flags[index],
+      .generation = scene->generations[index]};
+}
+
+uint32_t scene_write_instances(struct scene *scene, uint32_t copy_index,
+                               struct scene_instance *instances,
+                               uint32_t *out_first, uint32_t *out_end) {
+  assert(copy_index < scene->gpu_copy_count);
+  uint8_t copy_bit = (uint8_t)(1u << copy_index);
+  uint32_t *dirty_list = scene->gpu_dirty_lists[copy_index];
+  uint32_t dirty_count = scene->gpu_dirty_counts[copy_index];
+  uint32_t first = UINT32_MAX;
+  uint32_t end = 0;
+
+  for (uint32_t dirty_index = 0; dirty_index < dirty_count; dirty_index++) {
+    uint32_t index = dirty_list[dirty_index];
+    instances[index] = make_instance(scene, index);
+    scene->gpu_pending[index] &= (uint8_t)~copy_bit;
+    first = index < first ? index : first;
+    end = index + 1 > end ? index + 1 : end;
+  }
+  scene->gpu_dirty_counts[copy_index] = 0;
+
+  *out_first = dirty_count > 0 ? first : 0;
+  *out_end = end;
+  return dirty_count;
+}
+
+void scene_read_instances(const struct scene *scene, uint32_t first,
+                          uint32_t count, struct scene_instance *out) {
+  assert(first <= scene->slot_count && count <= scene->slot_count - first);
+  for (uint32_t offset = 0; offset < count; offset++) {
+    out[offset] = make_instance(scene, first + offset);
+  }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "cull.h"
+#include "host_allocator.h"
+#include "math3d.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Upper bound on the number of GPU copies of the instance data, one per frame
+// in flight.
+#define SCENE_MAX_GPU_COPIES 4
+#define SCENE_INVALID_INDEX UINT32_MAX
+
+enum scene_flags {
+  SCENE_FLAG_VISIBLE = 1u << 0,
+};
+
+// Stays valid until the node is destroyed. A destroyed slot is reused with a
+// bumped generation, so stale handles are detected rather than aliased.
+struct scene_handle {
+  uint32_t index;
+  uint32_t generation;
+};
+
+// One entry of the GPU instance buffer, laid out for std430. Instances are
+// indexed by handle index, so the GPU index of a node never changes.
+struct scene_instance {
+  struct mat4 world;
+  // World space bounding sphere: xyz center, w radius.
+  struct vec4 bounds;
+  uint32_t mesh_id;
+  uint32_t material_id;
+  uint32_t flags;
+  uint32_t generation;
+};
+
+// Nodes live in structure-of-arrays slots indexed by handle index. Every
+// array holds `capacity` entries and comes from a single allocation.
+//
+// Two kinds of dirty state are tracked, each as a per-slot bit plus a list of
+// the set bits, so that work is proportional to the number of changes:
+// - transform_dirty_list: local transforms changed since the last
+//   scene_update().
+// - gpu_dirty_lists[copy]: instances whose data hasn't been written to GPU
+//   copy `copy` yet.
+struct scene {
+  struct host_allocator *allocator;
+  void *storage;
+  uint32_t capacity;
+  // One past the highest slot ever used. Instance buffers only need to be
+  // drawn up to here.
+  uint32_t slot_count;
+  uint32_t live_count;
+  uint32_t free_list_head;
+  uint32_t gpu_copy_count;
+
+  uint32_t *generations;
+  uint8_t *states;
+  uint8_t *gpu_pending;
+
+  // Hierarchy, as intrusive child lists.
+  uint32_t *parents;
+  uint32_t *first_children;
+  uint32_t *next_siblings;
+  uint32_t *previous_siblings;
+  uint32_t *depths;
+
+  // Local transform components.
+  struct vec3 *translations;
+  struct quat *rotations;
+  struct vec3 *scales;
+
+  struct mat4 *world_transforms;
+  struct sphere_soa local_bounds;
+  struct sphere_soa world_bounds;
+
+  uint32_t *mesh_ids;
+  uint32_t *material_ids;
+  uint32_t *flags;
+
+  uint32_t *transform_dirty_list;
+  uint32_t transform_dirty_count;
+  uint32_t *gpu_dirty_lists[SCENE_MAX_GPU_COPIES];
+  uint32_t gpu_dirty_counts[SCENE_MAX_GPU_COPIES];
+
+  // Scratch space for scene_update().
+  uint64_t *sort_keys;
+  uint32_t *traversal_stack;
+};
+
+bool scene_init(struct scene *scene, struct host_allocator *allocator,
+                uint32_t capacity, uint32_t gpu_copy_count);
+void scene_deinit(struct scene *scene);
+
+// Creates a visible node with an identity transform, attached to `parent`
+// unless parent is NULL.
+bool scene_create_node(struct scene *scene, const struct scene_handle *parent,
+                       struct scene_handle *out_handle);
+// Destroys the node together with its whole subtree.
+void scene_destroy_node(struct scene *scene, struct scene_handle handle);
+bool scene_is_alive(const struct scene *scene, struct scene_handle handle);
+
+// Reattaches the node; parent NULL makes it a root. The node keeps its local
+// transform, so its world transform follows the new parent.
+void scene_set_parent(struct scene *scene, struct scene_handle handle,
+                      const struct scene_handle *parent);
+void scene_set_local_transform(struct scene *scene, struct scene_handle handle,
+                               struct vec3 translation, struct quat rotation,
+                               struct vec3 scale);
+void scene_set_translation(struct scene *scene, struct scene_handle handle,
+                           struct vec3 translation);
+void scene_set_rotation(struct scene *scene, struct scene_handle handle,
+                        struct quat rotation);
+void scene_set_local_bounds(struct scene *scene, struct scene_handle handle,
+                            struct vec3 center, float radius);
+void scene_set_mesh(struct scene *scene, struct scene_handle handle,
+                    uint32_t mesh_id, uint32_t material_id);
+void scene_set_flags(struct scene *scene, struct scene_handle handle,
+                     uint32_t flags);
+
+const struct mat4 *scene_world_transform(const struct scene *scene,
+                                         struct scene_handle handle);
+
+// Recomputes world transforms and bounds of every node whose local transform
+// changed, and of their descendants. Returns how many nodes were updated.
+uint32_t scene_update(struct scene *scene);
+// Whether anything changed that copy `copy_index` hasn't been written yet,
+// including local transforms that scene_update() hasn't picked up.
+bool scene_has_changes(const struct scene *scene, uint32_t copy_index);
+
+// Writes every instance that changed since this copy was last written into
+// `instances`, a mapped array of `capacity` entries, and clears that copy's
+// dirty list. [*out_first, *out_end) spans the written instances, for
+// flushing non-coherent memory; it is empty when nothing was written.
+uint32_t scene_write_instances(struct scene *scene, uint32_t copy_index,
+                               struct scene_instance *instances,
+                               uint32_t *out_first, uint32_t *out_end);
+// Fills out[0, count) with instances [first, first + count) as
+// scene_write_instances() writes them, without touching any dirty state.
+// Once a copy has been written, that is what it holds.
+void scene_read_instances(const struct scene *scene, uint32_t first,
+                          uint32_t count, struct scene_instance *out);
@@ -0,0 +1,102 @@
+#include "shader_variant.h"
+
+#include "log.h"
+#include "vulkan_utils.h"
+#include <assert.h>
+#include <stdio.h>
+
+#define SHADER_VARIANT_MAX_PATH 128
+
+// File names and the permutations each source is built with must match
+// shader_variants in shaders/meson.build.
+static const struct {
+  const char *name;
+  uint32_t permutations;
+} shader_sources[SHADER_SOURCE_COUNT] = {
+    [SHADER_SOURCE_TRIANGLE_VERT] = {"triangle.vert",
+                                     SHADER_PERMUTATION_MULTIVIEW},
+    [SHADER_SOURCE_TRIANGLE_FRAG] = {"triangle.frag", 0},
+    [SHADER_SOURCE_HIZ_REDUCE_COMP] = {"hiz_reduce.comp", 0},
+    [SHADER_SOURCE_CULL_COMP] = {"cull.comp", 0},
+    [SHADER_SOURCE_POST_BLOOM_DOWN_COMP] = {"post_bloom_down.comp",
+                                            SHADER_PERMUTATION_SUBGROUPS},
+    [SHADER_SOURCE_POST_BLOOM_UP_COMP] = {"post_bloom_up.comp", 0},
+    [SHADER_SOURCE_POST_RESOLVE_COMP] = {"post_resolve.comp",
+                                         SHADER_PERMUTATION_SWAPCHAIN_OUTPUT},
+    [SHADER_SOURCE_SPRITE_VERT] = {"sprite.vert", 0},
+    [SHADER_SOURCE_SPRITE_FRAG] = {"sprite.frag", 0},
+};
+
+// In bit order, appended to the file name for every bit set.
+static const char *permutation_names[] = {"multiview", "subgroups",
+                                          "swapchain_output"};
+
+shader_variant_key shader_variant_key_make(enum shader_source source,
+                                           uint32_t permutations) {
+  assert(source < SHADER_SOURCE_COUNT);
+  assert((permutations & ~shader_sources[source].permutations) == 0);
+  return (uint32_t)source | permutations << 8;
+}
+
+static void variant_path(shader_variant_key key, char *path, size_t size) {
+  enum shader_source source = key & 0xff;
+  uint32_t permutations = key >> 8;
+  int length = snprintf(path, size, "shaders/%s", shader_sources[source].name);
+  for (uint32_t bit = 0;
+       bit < sizeof(permutation_names) / sizeof(const char *); bit++) {
+    if (permutations & (1u << bit)) {
+      length += snprintf(path + length, size - length, ".%s",
+                         permutation_names[bit]);
+    }
+  }
+  snprintf(path + length, size - length, ".spv");
+}
+
+VkShaderModule
+shader_variant_create_module(VkDevice device,
+                             const VkAllocationCallbacks *allocation_callbacks,
+                             struct host_allocator *host_allocator,
+                             shader_variant_key key) {
+  char path[SHADER_VARIANT_MAX_PATH];
+  variant_path(key, path, sizeof(path));
+  size_t code_size;
+  char *code = load_shader_from_file(host_allocator, path, &code_size);
+  if (!code) {
+    LOG("Couldn't load %s", path);
+    return VK_NULL_HANDLE;
+  }
+  VkShaderModule shader_module =
+      create_shader_module(device, allocation_callbacks, code, code_size);
+  host_allocator_free(host_allocator, code);
+  return shader_module;
+}
+
+void shader_specialization_set(struct shader_specialization *specialization,
+                               uint32_t constant_id, uint32_t value) {
+  for (uint32_t index = 0; index < specialization->count; index++) {
+    if (specialization->entries[index].constantID == constant_id) {
+      specialization->data[index] = value;
+      return;
+    }
+  }
+  assert(specialization->count < SHADER_MAX_SPECIALIZATION_CONSTANTS);
+  uint32_t index = specialization->count++;
+  specialization->entries[index] = (VkSpecializationMapEntry){
+      .constantID = constant_id,
+      .offset = index * sizeof(uint32_t),
+      .size = sizeof(uint32_t)};
+  specialization->data[index] = value;
+}
+
+const VkSpecializationInfo *
+shader_specialization_info(struct shader_specialization *specialization) {
+  if (specialization->count == 0) {
+    return NULL;
+  }
+  specialization->info = (VkSpecializationInfo){
+      .mapEntryCount = specialization->count,
+      .pMapEntries = specialization->entries,
+      .dataSize = specialization->count * sizeof(uint32_t),
+      .pData = specialization->data};
+  return &specialization->info;
+}
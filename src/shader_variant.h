@@ -0,0 +1,71 @@
+#pragma once
+
+#include "host_allocator.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#define SHADER_MAX_SPECIALIZATION_CONSTANTS 8
+
+// Every GLSL source in shaders/.
+enum shader_source {
+  SHADER_SOURCE_TRIANGLE_VERT,
+  SHADER_SOURCE_TRIANGLE_FRAG,
+  SHADER_SOURCE_HIZ_REDUCE_COMP,
+  SHADER_SOURCE_CULL_COMP,
+  SHADER_SOURCE_POST_BLOOM_DOWN_COMP,
+  SHADER_SOURCE_POST_BLOOM_UP_COMP,
+  SHADER_SOURCE_POST_RESOLVE_COMP,
+  SHADER_SOURCE_SPRITE_VERT,
+  SHADER_SOURCE_SPRITE_FRAG,
+  SHADER_SOURCE_COUNT,
+};
+
+// Preprocessor permutations. Each combination a source supports is compiled
+// by the build (shaders/meson.build) into its own SPIR-V file, so these are
+// for differences in interface or structure that a specialization constant
+// can't express. Everything else is a specialization constant, which costs
+// no extra files.
+enum shader_permutation {
+  // triangle.vert: one camera per multiview layer, drawing every live
+  // instance instead of the culled list.
+  SHADER_PERMUTATION_MULTIVIEW = 1u << 0,
+  // post_bloom_down.comp: reduces with subgroup arithmetic. Built for
+  // Vulkan 1.1, so only for devices with device_features.subgroup_arithmetic.
+  SHADER_PERMUTATION_SUBGROUPS = 1u << 1,
+  // post_resolve.comp: the output image has no format qualifier, so it can
+  // be a swapchain image of any storage format. Needs
+  // device_features.storage_image_write_without_format.
+  SHADER_PERMUTATION_SWAPCHAIN_OUTPUT = 1u << 2,
+};
+
+// Source in the low byte and permutation bits above it, so a variant is one
+// integer that can be compared, hashed or logged.
+typedef uint32_t shader_variant_key;
+
+shader_variant_key shader_variant_key_make(enum shader_source source,
+                                           uint32_t permutations);
+
+// Creates a module from the SPIR-V the build generated for key. Returns
+// VK_NULL_HANDLE if the variant wasn't built or can't be loaded.
+VkShaderModule
+shader_variant_create_module(VkDevice device,
+                             const VkAllocationCallbacks *allocation_callbacks,
+                             struct host_allocator *host_allocator,
+                             shader_variant_key key);
+
+// Values for the shaders' constant_id declarations. All constants here are
+// 32 bits: uint, int, float and bool, which Vulkan reads as a VkBool32.
+struct shader_specialization {
+  uint32_t count;
+  VkSpecializationMapEntry entries[SHADER_MAX_SPECIALIZATION_CONSTANTS];
+  uint32_t data[SHADER_MAX_SPECIALIZATION_CONSTANTS];
+  VkSpecializationInfo info;
+};
+
+void shader_specialization_set(struct shader_specialization *specialization,
+                               uint32_t constant_id, uint32_t value);
+// Points into specialization, which must outlive the pipeline creation.
+// NULL when nothing is set, leaving every constant at its default.
+const VkSpecializationInfo *
+shader_specialization_info(struct shader_specialization *specialization);
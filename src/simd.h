@@ -0,0 +1,198 @@
+#pragma once
+
+// Thin 4-wide float abstraction so math and culling kernels are written once
+// and compiled to SSE on x86, NEON on ARM and plain C everywhere else. Define
+// SIMD_FORCE_SCALAR (meson -Dsimd=false) to force the scalar path.
+
+#include <math.h>
+#include <stdint.h>
+
+#if !defined(SIMD_FORCE_SCALAR) &&                                             \
+    (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#define SIMD_SSE 1
+#include <immintrin.h>
+#elif !defined(SIMD_FORCE_SCALAR) &&                                           \
+    (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#else
+#define SIMD_SCALAR 1
+#endif
+
+#if defined(SIMD_SSE) && (defined(__GNUC__) || defined(__clang__)) &&         \
+    (defined(__x86_64__) || defined(__i386__))
+// AVX2 kernels are compiled with target attributes and picked at runtime, so
+// the binary still runs on SSE-only machines.
+#define SIMD_AVX2_DISPATCH 1
+#endif
+
+#if defined(SIMD_SSE)
+typedef __m128 f32x4;
+typedef __m128 m32x4;
+
+static inline f32x4 f32x4_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void f32x4_store(float *p, f32x4 v) { _mm_storeu_ps(p, v); }
+static inline f32x4 f32x4_splat(float s) { return _mm_set1_ps(s); }
+static inline f32x4 f32x4_set(float x, float y, float z, float w) {
+  return _mm_setr_ps(x, y, z, w);
+}
+static inline f32x4 f32x4_add(f32x4 a, f32x4 b) { return _mm_add_ps(a, b); }
+static inline f32x4 f32x4_sub(f32x4 a, f32x4 b) { return _mm_sub_ps(a, b); }
+static inline f32x4 f32x4_mul(f32x4 a, f32x4 b) { return _mm_mul_ps(a, b); }
+static inline f32x4 f32x4_madd(f32x4 a, f32x4 b, f32x4 c) {
+  return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+static inline f32x4 f32x4_max(f32x4 a, f32x4 b) { return _mm_max_ps(a, b); }
+static inline f32x4 f32x4_min(f32x4 a, f32x4 b) { return _mm_min_ps(a, b); }
+static inline f32x4 f32x4_abs(f32x4 a) {
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+}
+static inline f32x4 f32x4_sqrt(f32x4 a) { return _mm_sqrt_ps(a); }
+static inline m32x4 f32x4_cmpge(f32x4 a, f32x4 b) {
+  return _mm_cmpge_ps(a, b);
+}
+static inline m32x4 m32x4_and(m32x4 a, m32x4 b) { return _mm_and_ps(a, b); }
+static inline m32x4 m32x4_all(void) {
+  return _mm_castsi128_ps(_mm_set1_epi32(-1));
+}
+static inline uint32_t m32x4_bits(m32x4 m) {
+  return (uint32_t)_mm_movemask_ps(m);
+}
+static inline void f32x4_transpose(f32x4 *r0, f32x4 *r1, f32x4 *r2,
+                                   f32x4 *r3) {
+  _MM_TRANSPOSE4_PS(*r0, *r1, *r2, *r3);
+}
+
+#elif defined(SIMD_NEON)
+typedef float32x4_t f32x4;
+typedef uint32x4_t m32x4;
+
+static inline f32x4 f32x4_load(const float *p) { return vld1q_f32(p); }
+static inline void f32x4_store(float *p, f32x4 v) { vst1q_f32(p, v); }
+static inline f32x4 f32x4_splat(float s) { return vdupq_n_f32(s); }
+static inline f32x4 f32x4_set(float x, float y, float z, float w) {
+  const float values[4] = {x, y, z, w};
+  return vld1q_f32(values);
+}
+static inline f32x4 f32x4_add(f32x4 a, f32x4 b) { return vaddq_f32(a, b); }
+static inline f32x4 f32x4_sub(f32x4 a, f32x4 b) { return vsubq_f32(a, b); }
+static inline f32x4 f32x4_mul(f32x4 a, f32x4 b) { return vmulq_f32(a, b); }
+static inline f32x4 f32x4_madd(f32x4 a, f32x4 b, f32x4 c) {
+  return vmlaq_f32(c, a, b);
+}
+static inline f32x4 f32x4_max(f32x4 a, f32x4 b) { return vmaxq_f32(a, b); }
+static inline f32x4 f32x4_min(f32x4 a, f32x4 b) { return vminq_f32(a, b); }
+static inline f32x4 f32x4_abs(f32x4 a) { return vabsq_f32(a); }
+static inline f32x4 f32x4_sqrt(f32x4 a) {
+#if defined(__aarch64__)
+  return vsqrtq_f32(a);
+#else
+  float values[4];
+  vst1q_f32(values, a);
+  for (int lane = 0; lane < 4; lane++) {
+    values[lane] = sqrtf(values[lane]);
+  }
+  return vld1q_f32(values);
+#endif
+}
+static inline m32x4 f32x4_cmpge(f32x4 a, f32x4 b) { return vcgeq_f32(a, b); }
+static inline m32x4 m32x4_and(m32x4 a, m32x4 b) { return vandq_u32(a, b); }
+static inline m32x4 m32x4_all(void) { return vdupq_n_u32(0xffffffffu); }
+static inline uint32_t m32x4_bits(m32x4 m) {
+  static const uint32_t lane_bits[4] = {1, 2, 4, 8};
+  uint32x4_t bits = vandq_u32(m, vld1q_u32(lane_bits));
+  uint32x2_t sum = vadd_u32(vget_low_u32(bits), vget_high_u32(bits));
+  return vget_lane_u32(vpadd_u32(sum, sum), 0);
+}
+static inline void f32x4_transpose(f32x4 *r0, f32x4 *r1, f32x4 *r2,
+                                   f32x4 *r3) {
+  float32x4x2_t t01 = vtrnq_f32(*r0, *r1);
+  float32x4x2_t t23 = vtrnq_f32(*r2, *r3);
+  *r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+  *r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+  *r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+  *r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+
+#else
+typedef struct {
+  float v[4];
+} f32x4;
+typedef struct {
+  uint32_t v[4];
+} m32x4;
+
+static inline f32x4 f32x4_load(const float *p) {
+  return (f32x4){{p[0], p[1], p[2], p[3]}};
+}
+static inline void f32x4_store(float *p, f32x4 v) {
+  for (int lane = 0; lane < 4; lane++) {
+    p[lane] = v.v[lane];
+  }
+}
+static inline f32x4 f32x4_splat(float s) { return (f32x4){{s, s, s, s}}; }
+static inline f32x4 f32x4_set(float x, float y, float z, float w) {
+  return (f32x4){{x, y, z, w}};
+}
+#define SIMD_SCALAR_BINARY_OP(name, expression)                                \
+  static inline f32x4 name(f32x4 a, f32x4 b) {                                 \
+    f32x4 r;                                                                   \
+    for (int lane = 0; lane < 4; lane++) {                                     \
+      float x = a.v[lane];                                                     \
+      float y = b.v[lane];                                                     \
+      r.v[lane] = (expression);                                                \
+    }                                                                          \
+    return r;                                                                  \
+  }
+SIMD_SCALAR_BINARY_OP(f32x4_add, x + y)
+SIMD_SCALAR_BINARY_OP(f32x4_sub, x - y)
+SIMD_SCALAR_BINARY_OP(f32x4_mul, (x * y))
+SIMD_SCALAR_BINARY_OP(f32x4_max, x > y ? x : y)
+SIMD_SCALAR_BINARY_OP(f32x4_min, x < y ? x : y)
+#undef SIMD_SCALAR_BINARY_OP
+static inline f32x4 f32x4_madd(f32x4 a, f32x4 b, f32x4 c) {
+  return f32x4_add(f32x4_mul(a, b), c);
+}
+static inline f32x4 f32x4_abs(f32x4 a) {
+  for (int lane = 0; lane < 4; lane++) {
+    a.v[lane] = a.v[lane] < 0.0f ? -a.v[lane] : a.v[lane];
+  }
+  return a;
+}
+static inline f32x4 f32x4_sqrt(f32x4 a) {
+  for (int lane = 0; lane < 4; lane++) {
+    a.v[lane] = sqrtf(a.v[lane]);
+  }
+  return a;
+}
+static inline m32x4 f32x4_cmpge(f32x4 a, f32x4 b) {
+  m32x4 m;
+  for (int lane = 0; lane < 4; lane++) {
+    m.v[lane] = a.v[lane] >= b.v[lane] ? 0xffffffffu : 0u;
+  }
+  return m;
+}
+static inline m32x4 m32x4_and(m32x4 a, m32x4 b) {
+  for (int lane = 0; lane < 4; lane++) {
+    a.v[lane] &= b.v[lane];
+  }
+  return a;
+}
+static inline m32x4 m32x4_all(void) {
+  return (m32x4){{0xffffffffu, 0xffffffffu, 0xffffffffu, 0xffffffffu}};
+}
+static inline uint32_t m32x4_bits(m32x4 m) {
+  return (m.v[0] & 1u) | (m.v[1] & 2u) | (m.v[2] & 4u) | (m.v[3] & 8u);
+}
+static inline void f32x4_transpose(f32x4 *r0, f32x4 *r1, f32x4 *r2,
+                                   f32x4 *r3) {
+  f32x4 *rows[4] = {r0, r1, r2, r3};
+  for (int row = 0; row < 4; row++) {
+    for (int column = row + 1; column < 4; column++) {
+      float value = rows[row]->v[column];
+      rows[row]->v[column] = rows[column]->v[row];
+      rows[column]->v[row] = value;
+    }
+  }
+}
+#endif
@@ -0,0 +1,920 @@
+#include "sprite_batch.h"
+
+#include "log.h"
+#include "shader_variant.h"
+#include "telemetry.h"
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+// Sort key, most significant first: z, blend mode, clip rect, texture. A
+// draw covers a run of equal low KEY_Z_SHIFT bits.
+#define KEY_Z_SHIFT 16
+#define KEY_BLEND_SHIFT 14
+#define KEY_CLIP_SHIFT 8
+#define KEY_STATE_MASK 0xffffu
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1u << RADIX_BITS)
+
+static_assert(SPRITE_BLEND_COUNT <= 1u << (KEY_Z_SHIFT - KEY_BLEND_SHIFT),
+              "blend modes must fit their key bits");
+static_assert(SPRITE_BATCH_MAX_CLIP_RECTS <=
+                  1u << (KEY_BLEND_SHIFT - KEY_CLIP_SHIFT),
+              "clip rects must fit their key bits");
+static_assert(SPRITE_BATCH_MAX_TEXTURES <= 1u << KEY_CLIP_SHIFT,
+              "textures must fit their key bits");
+
+struct sprite_push_constants {
+  float pixel_to_clip[2];
+};
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static VkDeviceSize align_down(VkDeviceSize value, VkDeviceSize alignment) {
+  return value & ~(alignment - 1);
+}
+
+static uint32_t sprite_key(const struct sprite *sprite) {
+  // Biased so that negative z sorts first.
+  uint32_t z = (uint32_t)((int32_t)sprite->z + 32768);
+  return z << KEY_Z_SHIFT | (uint32_t)sprite->blend << KEY_BLEND_SHIFT |
+         sprite->clip_rect << KEY_CLIP_SHIFT | sprite->texture;
+}
+
+// Stable LSD radix sort of entries by their upper 32 bits, so equal keys
+// keep push order. Passes over a byte that every key shares are skipped,
+// which is most of them for a frame with a few z values and textures.
+static uint64_t *sort_entries(uint64_t *entries, uint64_t *scratch,
+                              uint32_t count) {
+  bool sorted = true;
+  for (uint32_t index = 1; index < count && sorted; index++) {
+    sorted = entries[index - 1] >> 32 <= entries[index] >> 32;
+  }
+  if (sorted) {
+    return entries;
+  }
+
+  for (uint32_t shift = 32; shift < 64; shift += RADIX_BITS) {
+    uint32_t offsets[RADIX_BUCKETS] = {0};
+    for (uint32_t index = 0; index < count; index++) {
+      offsets[(entries[index] >> shift) & (RADIX_BUCKETS - 1)]++;
+    }
+    if (offsets[(entries[0] >> shift) & (RADIX_BUCKETS - 1)] == count) {
+      continue;
+    }
+    uint32_t offset = 0;
+    for (uint32_t bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+      uint32_t bucket_count = offsets[bucket];
+      offsets[bucket] = offset;
+      offset += bucket_count;
+    }
+    for (uint32_t index = 0; index < count; index++) {
+      uint64_t entry = entries[index];
+      scratch[offsets[(entry >> shift) & (RADIX_BUCKETS - 1)]++] = entry;
+    }
+    uint64_t *swap = entries;
+    entries = scratch;
+    scratch = swap;
+  }
+  return entries;
+}
+
+static uint32_t entry_state(uint64_t entry) {
+  return (uint32_t)(entry >> 32) & KEY_STATE_MASK;
+}
+
+// One past the last of the sorted entries from `first` on that share its
+// state. The run may span several z values: drawn in one go, its sprites
+// still come out in sorted order.
+static uint32_t run_end(const uint64_t *entries, uint32_t first,
+                        uint32_t count) {
+  uint32_t state = entry_state(entries[first]);
+  uint32_t end = first + 1;
+  while (end < count && entry_state(entries[end]) == state) {
+    end++;
+  }
+  return end;
+}
+
+static bool create_render_pass(struct sprite_batch *batch,
+                               VkFormat output_format) {
+  struct resource_manager *resources = batch->resources;
+  // Whatever wrote the output image before, the late pass, the upscale,
+  // the post-processing chain or the thumbnail copy, is done before the
+  // sprites blend over it.
+  return vkCreateRenderPass(
+             resources->device,
+             &(const VkRenderPassCreateInfo){
+                 .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+                 .attachmentCount = 1,
+                 .pAttachments =
+                     &(const VkAttachmentDescription){
+                         .format = output_format,
+                         .samples = VK_SAMPLE_COUNT_1_BIT,
+                         .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
+                         .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                         .initialLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                         .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR},
+                 .subpassCount = 1,
+                 .pSubpasses =
+                     &(const VkSubpassDescription){
+                         .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+                         .colorAttachmentCount = 1,
+                         .pColorAttachments =
+                             &(const VkAttachmentReference){
+                                 .attachment = 0,
+                                 .layout =
+                                     VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}},
+                 .dependencyCount = 1,
+                 .pDependencies =
+                     &(const VkSubpassDependency){
+                         .srcSubpass = VK_SUBPASS_EXTERNAL,
+                         .dstSubpass = 0,
+                         .srcStageMask =
+                             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         .srcAccessMask =
+                             VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                             VK_ACCESS_SHADER_WRITE_BIT |
+                             VK_ACCESS_TRANSFER_WRITE_BIT,
+                         .dstStageMask =
+                             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         .dstAccessMask =
+                             VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                             VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT}},
+             resources->allocation_callbacks,
+             &batch->render_pass) == VK_SUCCESS;
+}
+
+static void destroy_framebuffers(struct sprite_batch *batch) {
+  struct resource_manager *resources = batch->resources;
+  for (uint32_t index = 0; index < batch->framebuffer_count; index++) {
+    vkDestroyFramebuffer(resources->device, batch->framebuffers[index],
+                         resources->allocation_callbacks);
+  }
+}
+
+static bool create_framebuffers(struct sprite_batch *batch,
+                                const VkImageView *output_views,
+                                uint32_t output_image_count) {
+  struct resource_manager *resources = batch->resources;
+  for (; batch->framebuffer_count < output_image_count;
+       batch->framebuffer_count++) {
+    if (vkCreateFramebuffer(
+            resources->device,
+            &(const VkFramebufferCreateInfo){
+                .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+                .renderPass = batch->render_pass,
+                .attachmentCount = 1,
+                .pAttachments = &output_views[batch->framebuffer_count],
+                .width = batch->extent.width,
+                .height = batch->extent.height,
+                .layers = 1},
+            resources->allocation_callbacks,
+            &batch->framebuffers[batch->framebuffer_count]) != VK_SUCCESS) {
+      destroy_framebuffers(batch);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool create_layouts(struct sprite_batch *batch) {
+  struct resource_manager *resources = batch->resources;
+  if (vkCreateDescriptorSetLayout(
+          resources->device,
+          &(const VkDescriptorSetLayoutCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+              .bindingCount = 1,
+              .pBindings =
+                  &(const VkDescriptorSetLayoutBinding){
+                      .binding = 0,
+                      .descriptorType =
+                          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                      .descriptorCount = 1,
+                      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT}},
+          resources->allocation_callbacks,
+          &batch->set_layout) != VK_SUCCESS) {
+    return false;
+  }
+
+  if (vkCreatePipelineLayout(
+          resources->device,
+          &(const VkPipelineLayoutCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+              .setLayoutCount = 1,
+              .pSetLayouts = &batch->set_layout,
+              .pushConstantRangeCount = 1,
+              .pPushConstantRanges =
+                  &(const VkPushConstantRange){
+                      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+                      .size = sizeof(struct sprite_push_constants)}},
+          resources->allocation_callbacks,
+          &batch->pipeline_layout) != VK_SUCCESS) {
+    vkDestroyDescriptorSetLayout(resources->device, batch->set_layout,
+                                 resources->allocation_callbacks);
+    return false;
+  }
+  return true;
+}
+
+static void destroy_layouts(struct sprite_batch *batch) {
+  struct resource_manager *resources = batch->resources;
+  vkDestroyPipelineLayout(resources->device, batch->pipeline_layout,
+                          resources->allocation_callbacks);
+  vkDestroyDescriptorSetLayout(resources->device, batch->set_layout,
+                               resources->allocation_callbacks);
+}
+
+// One pipeline per blend mode; everything else is shared.
+static bool create_pipelines(struct sprite_batch *batch,
+                             struct host_allocator *host_allocator) {
+  struct resource_manager *resources = batch->resources;
+  shader_variant_key shader_keys[] = {
+      shader_variant_key_make(SHADER_SOURCE_SPRITE_VERT, 0),
+      shader_variant_key_make(SHADER_SOURCE_SPRITE_FRAG, 0)};
+  static const VkShaderStageFlagBits shader_stages[] = {
+      VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT};
+  VkPipelineShaderStageCreateInfo stage_infos[2] = {0};
+  uint32_t stage_index = 0;
+  bool created = false;
+  for (; stage_index < 2; stage_index++) {
+    VkShaderModule shader_module = shader_variant_create_module(
+        resources->device, resources->allocation_callbacks, host_allocator,
+        shader_keys[stage_index]);
+    if (!shader_module) {
+      goto destroy_shader_modules;
+    }
+    stage_infos[stage_index] = (VkPipelineShaderStageCreateInfo){
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = shader_stages[stage_index],
+        .module = shader_module,
+        .pName = "main"};
+  }
+
+  VkVertexInputAttributeDescription attributes[] = {
+      {.location = 0,
+       .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+       .offset = offsetof(struct sprite_instance, rect)},
+      {.location = 1,
+       .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+       .offset = offsetof(struct sprite_instance, uv_rect)},
+      {.location = 2,
+       .format = VK_FORMAT_R8G8B8A8_UNORM,
+       .offset = offsetof(struct sprite_instance, color)}};
+  VkPipelineVertexInputStateCreateInfo vertex_input_info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+      .vertexBindingDescriptionCount = 1,
+      .pVertexBindingDescriptions =
+          &(const VkVertexInputBindingDescription){
+              .binding = 0,
+              .stride = sizeof(struct sprite_instance),
+              .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE},
+      .vertexAttributeDescriptionCount =
+          sizeof(attributes) / sizeof(attributes[0]),
+      .pVertexAttributeDescriptions = attributes};
+  VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+      .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP};
+  VkPipelineViewportStateCreateInfo viewport_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+      .viewportCount = 1,
+      .scissorCount = 1};
+  VkPipelineRasterizationStateCreateInfo rasterizer = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+      .polygonMode = VK_POLYGON_MODE_FILL,
+      .cullMode = VK_CULL_MODE_NONE,
+      .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+      .lineWidth = 1.0f};
+  VkPipelineMultisampleStateCreateInfo multisampling = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+      .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+      .minSampleShading = 1.0f};
+  // The scissor is the clip rect of each draw.
+  VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT,
+                                     VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamic_state = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+      .dynamicStateCount = sizeof(dynamic_states) / sizeof(VkDynamicState),
+      .pDynamicStates = dynamic_states};
+
+  VkPipelineColorBlendAttachmentState blend_attachments[SPRITE_BLEND_COUNT] =
+      {[SPRITE_BLEND_ALPHA] = {.blendEnable = VK_TRUE,
+                               .srcColorBlendFactor =
+                                   VK_BLEND_FACTOR_SRC_ALPHA,
+                               .dstColorBlendFactor =
+                                   VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+                               .colorBlendOp = VK_BLEND_OP_ADD,
+                               .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+                               .dstAlphaBlendFactor =
+                                   VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+                               .alphaBlendOp = VK_BLEND_OP_ADD},
+       [SPRITE_BLEND_ADDITIVE] = {.blendEnable = VK_TRUE,
+                                  .srcColorBlendFactor =
+                                      VK_BLEND_FACTOR_SRC_ALPHA,
+                                  .dstColorBlendFactor = VK_BLEND_FACTOR_ONE,
+                                  .colorBlendOp = VK_BLEND_OP_ADD,
+                                  .srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+                                  .dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+                                  .alphaBlendOp = VK_BLEND_OP_ADD}};
+  uint32_t blend = 0;
+  for (; blend < SPRITE_BLEND_COUNT; blend++) {
+    blend_attachments[blend].colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    VkPipelineColorBlendStateCreateInfo color_blending = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &blend_attachments[blend]};
+    VkPipeline pipeline;
+    if (vkCreateGraphicsPipelines(
+            resources->device, VK_NULL_HANDLE, 1,
+            &(const VkGraphicsPipelineCreateInfo){
+                .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+                .stageCount = 2,
+                .pStages = stage_infos,
+                .pVertexInputState = &vertex_input_info,
+                .pInputAssemblyState = &input_assembly,
+                .pViewportState = &viewport_state,
+                .pRasterizationState = &rasterizer,
+                .pMultisampleState = &multisampling,
+                .pColorBlendState = &color_blending,
+                .pDynamicState = &dynamic_state,
+                .layout = batch->pipeline_layout,
+                .renderPass = batch->render_pass,
+                .subpass = 0},
+            resources->allocation_callbacks, &pipeline) != VK_SUCCESS) {
+      goto destroy_shader_modules;
+    }
+    telemetry_count(TELEMETRY_COUNTER_PIPELINE_COMPILES, 1);
+    if (!resource_manager_add_pipeline(resources, pipeline,
+                                       &batch->pipelines[blend])) {
+      goto destroy_shader_modules;
+    }
+  }
+  created = true;
+
+destroy_shader_modules:
+  while (stage_index-- > 0) {
+    vkDestroyShaderModule(resources->device, stage_infos[stage_index].module,
+                          resources->allocation_callbacks);
+  }
+  return created;
+}
+
+static bool create_instance_buffer(struct sprite_batch *batch) {
+  struct resource_manager *resources = batch->resources;
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(resources->physical_device, &properties);
+  batch->non_coherent_atom_size = properties.limits.nonCoherentAtomSize;
+  // Regions start on an atom, so flushing one never touches another.
+  batch->region_size =
+      align_up(batch->capacity * sizeof(struct sprite_instance),
+               batch->non_coherent_atom_size);
+
+  // Written once per frame in sorted order and read once by the vertex
+  // input, so device local memory is only worth it if the host can map it.
+  static const VkMemoryPropertyFlags property_preferences[] = {
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+  if (!resource_manager_create_buffer(
+          resources, batch->region_size * batch->region_count,
+          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, property_preferences,
+          sizeof(property_preferences) / sizeof(VkMemoryPropertyFlags),
+          &batch->instance_buffer)) {
+    return false;
+  }
+  const struct resource_buffer *buffer =
+      resource_manager_buffer(resources, batch->instance_buffer);
+  batch->coherent =
+      buffer->memory_properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  void *mapped;
+  if (vkMapMemory(resources->device, buffer->memory, 0, VK_WHOLE_SIZE, 0,
+                  &mapped) != VK_SUCCESS) {
+    LOG("Couldn't map sprite instance buffer memory");
+    resource_manager_destroy(resources, RESOURCE_TYPE_BUFFER,
+                             batch->instance_buffer, 0);
+    return false;
+  }
+  batch->mapped = mapped;
+  return true;
+}
+
+static bool create_descriptor_pool(struct sprite_batch *batch) {
+  struct resource_manager *resources = batch->resources;
+  if (!resource_manager_create_sampler(
+          resources,
+          &(const VkSamplerCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+              .magFilter = VK_FILTER_LINEAR,
+              .minFilter = VK_FILTER_LINEAR,
+              .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+              .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+              .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+              .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE},
+          &batch->sampler)) {
+    return false;
+  }
+  if (vkCreateDescriptorPool(
+          resources->device,
+          &(const VkDescriptorPoolCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+              .maxSets = SPRITE_BATCH_MAX_TEXTURES,
+              .poolSizeCount = 1,
+              .pPoolSizes =
+                  &(const VkDescriptorPoolSize){
+                      .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                      .descriptorCount = SPRITE_BATCH_MAX_TEXTURES}},
+          resources->allocation_callbacks,
+          &batch->descriptor_pool) != VK_SUCCESS) {
+    resource_manager_destroy(resources, RESOURCE_TYPE_SAMPLER, batch->sampler,
+                             0);
+    return false;
+  }
+  return true;
+}
+
+static void destroy_textures(struct sprite_batch *batch,
+                             uint64_t retire_value) {
+  struct resource_manager *resources = batch->resources;
+  for (uint32_t upload = 0; upload < batch->upload_count; upload++) {
+    resource_manager_destroy(resources, RESOURCE_TYPE_BUFFER,
+                             batch->uploads[upload].staging_buffer,
+                             retire_value);
+  }
+  for (uint32_t texture = 0; texture < batch->texture_count; texture++) {
+    if (resource_manager_is_alive(resources, RESOURCE_TYPE_IMAGE,
+                                  batch->texture_images[texture])) {
+      resource_manager_destroy(resources, RESOURCE_TYPE_IMAGE_VIEW,
+                               batch->texture_views[texture], retire_value);
+      resource_manager_destroy(resources, RESOURCE_TYPE_IMAGE,
+                               batch->texture_images[texture], retire_value);
+    }
+  }
+}
+
+static void destroy_pipelines(struct sprite_batch *batch,
+                              uint64_t retire_value) {
+  for (uint32_t blend = 0; blend < SPRITE_BLEND_COUNT; blend++) {
+    if (resource_manager_is_alive(batch->resources, RESOURCE_TYPE_PIPELINE,
+                                  batch->pipelines[blend])) {
+      resource_manager_destroy(batch->resources, RESOURCE_TYPE_PIPELINE,
+                               batch->pipelines[blend], retire_value);
+    }
+  }
+}
+
+bool sprite_batch_init(struct sprite_batch *batch,
+                       struct resource_manager *resources,
+                       struct host_allocator *host_allocator,
+                       const VkImageView *output_views,
+                       uint32_t output_image_count, VkFormat output_format,
+                       VkExtent2D output_extent, uint32_t capacity,
+                       uint32_t region_count) {
+  assert(output_image_count <= SPRITE_BATCH_MAX_OUTPUT_IMAGES);
+  assert(capacity > 0 && region_count > 0);
+  *batch = (struct sprite_batch){.resources = resources,
+                                 .capacity = capacity,
+                                 .region_count = region_count,
+                                 .extent = output_extent};
+
+  // One host allocation: the sort entries and their scratch copy, then the
+  // instances.
+  size_t entries_size = (size_t)capacity * sizeof(uint64_t);
+  batch->entries = host_allocator_alloc(
+      host_allocator,
+      2 * entries_size + (size_t)capacity * sizeof(struct sprite_instance),
+      VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+  if (!batch->entries) {
+    LOG("Couldn't allocate room for %u sprites", capacity);
+    goto err;
+  }
+  batch->sort_scratch = batch->entries + capacity;
+  batch->instances =
+      (struct sprite_instance *)(batch->sort_scratch + capacity);
+
+  if (!create_instance_buffer(batch)) {
+    LOG("Couldn't create sprite instance buffer");
+    goto free_host_memory;
+  }
+
+  if (!create_render_pass(batch, output_format)) {
+    LOG("Couldn't create sprite render pass");
+    goto destroy_instance_buffer;
+  }
+
+  if (!create_framebuffers(batch, output_views, output_image_count)) {
+    LOG("Couldn't create sprite framebuffers");
+    goto destroy_render_pass;
+  }
+
+  if (!create_layouts(batch)) {
+    LOG("Couldn't create sprite pipeline layout");
+    goto destroy_framebuffers;
+  }
+
+  if (!create_pipelines(batch, host_allocator)) {
+    LOG("Couldn't create sprite pipelines");
+    goto destroy_pipelines;
+  }
+
+  if (!create_descriptor_pool(batch)) {
+    LOG("Couldn't create sprite descriptor pool");
+    goto destroy_pipelines;
+  }
+
+  static const uint32_t white = 0xffffffffu;
+  uint32_t white_texture;
+  if (!sprite_batch_create_texture(batch, 1, 1, &white, &white_texture)) {
+    LOG("Couldn't create white sprite texture");
+    goto destroy_textures;
+  }
+  assert(white_texture == SPRITE_BATCH_WHITE_TEXTURE);
+
+  sprite_batch_begin(batch);
+  return true;
+destroy_textures:
+  // Nothing has used them yet.
+  destroy_textures(batch, 0);
+  vkDestroyDescriptorPool(resources->device, batch->descriptor_pool,
+                          resources->allocation_callbacks);
+  resource_manager_destroy(resources, RESOURCE_TYPE_SAMPLER, batch->sampler,
+                           0);
+destroy_pipelines:
+  destroy_pipelines(batch, 0);
+  destroy_layouts(batch);
+destroy_framebuffers:
+  destroy_framebuffers(batch);
+destroy_render_pass:
+  vkDestroyRenderPass(resources->device, batch->render_pass,
+                      resources->allocation_callbacks);
+destroy_instance_buffer:
+  vkUnmapMemory(
+      resources->device,
+      resource_manager_buffer(resources, batch->instance_buffer)->memory);
+  resource_manager_destroy(resources, RESOURCE_TYPE_BUFFER,
+                           batch->instance_buffer, 0);
+free_host_memory:
+  host_allocator_free(host_allocator, batch->entries);
+err:
+  return false;
+}
+
+void sprite_batch_deinit(struct sprite_batch *batch,
+                         struct host_allocator *host_allocator,
+                         uint64_t retire_value) {
+  struct resource_manager *resources = batch->resources;
+  destroy_textures(batch, retire_value);
+  vkDestroyDescriptorPool(resources->device, batch->descriptor_pool,
+                          resources->allocation_callbacks);
+  resource_manager_destroy(resources, RESOURCE_TYPE_SAMPLER, batch->sampler,
+                           retire_value);
+  destroy_pipelines(batch, retire_value);
+  destroy_layouts(batch);
+  destroy_framebuffers(batch);
+  vkDestroyRenderPass(resources->device, batch->render_pass,
+                      resources->allocation_callbacks);
+  vkUnmapMemory(
+      resources->device,
+      resource_manager_buffer(resources, batch->instance_buffer)->memory);
+  resource_manager_destroy(resources, RESOURCE_TYPE_BUFFER,
+                           batch->instance_buffer, retire_value);
+  host_allocator_free(host_allocator, batch->entries);
+  *batch = (struct sprite_batch){0};
+}
+
+static bool add_texture_set(struct sprite_batch *batch, VkImageView view) {
+  struct resource_manager *resources = batch->resources;
+  VkDescriptorSet *set = &batch->texture_sets[batch->texture_count];
+  if (vkAllocateDescriptorSets(
+          resources->device,
+          &(const VkDescriptorSetAllocateInfo){
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+              .descriptorPool = batch->descriptor_pool,
+              .descriptorSetCount = 1,
+              .pSetLayouts = &batch->set_layout},
+          set) != VK_SUCCESS) {
+    return false;
+  }
+  vkUpdateDescriptorSets(
+      resources->device, 1,
+      &(const VkWriteDescriptorSet){
+          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+          .dstSet = *set,
+          .dstBinding = 0,
+          .descriptorCount = 1,
+          .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          .pImageInfo =
+              &(const VkDescriptorImageInfo){
+                  .sampler =
+                      resource_manager_sampler(resources, batch->sampler),
+                  .imageView = view,
+                  .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}},
+      0, NULL);
+  return true;
+}
+
+bool sprite_batch_add_texture(struct sprite_batch *batch, VkImageView view,
+                              uint32_t *out_texture) {
+  if (batch->texture_count == SPRITE_BATCH_MAX_TEXTURES) {
+    LOG("Sprite batch is out of textures");
+    return false;
+  }
+  if (!add_texture_set(batch, view)) {
+    return false;
+  }
+  batch->texture_images[batch->texture_count] = (struct resource_handle){0};
+  batch->texture_views[batch->texture_count] = (struct resource_handle){0};
+  *out_texture = batch->texture_count++;
+  return true;
+}
+
+bool sprite_batch_create_texture(struct sprite_batch *batch, uint32_t width,
+                                 uint32_t height, const uint32_t *pixels,
+                                 uint32_t *out_texture) {
+  struct resource_manager *resources = batch->resources;
+  if (batch->texture_count == SPRITE_BATCH_MAX_TEXTURES ||
+      batch->upload_count == SPRITE_BATCH_MAX_PENDING_UPLOADS) {
+    LOG("Sprite batch is out of textures or pending uploads");
+    goto err;
+  }
+  uint32_t texture = batch->texture_count;
+  struct sprite_upload *upload = &batch->uploads[batch->upload_count];
+  *upload = (struct sprite_upload){.extent = {width, height}};
+
+  VkDeviceSize size = (VkDeviceSize)width * height * sizeof(uint32_t);
+  static const VkMemoryPropertyFlags staging_preferences[] = {
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+  if (!resource_manager_create_buffer(
+          resources, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+          staging_preferences,
+          sizeof(staging_preferences) / sizeof(VkMemoryPropertyFlags),
+          &upload->staging_buffer)) {
+    goto err;
+  }
+  VkDeviceMemory staging_memory =
+      resource_manager_buffer(resources, upload->staging_buffer)->memory;
+  void *mapped;
+  if (vkMapMemory(resources->device, staging_memory, 0, VK_WHOLE_SIZE, 0,
+                  &mapped) != VK_SUCCESS) {
+    goto destroy_staging_buffer;
+  }
+  memcpy(mapped, pixels, size);
+  vkUnmapMemory(resources->device, staging_memory);
+
+  if (!resource_manager_create_image(
+          resources,
+          &(const VkImageCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+              .imageType = VK_IMAGE_TYPE_2D,
+              .format = VK_FORMAT_R8G8B8A8_SRGB,
+              .extent = {width, height, 1},
+              .mipLevels = 1,
+              .arrayLayers = 1,
+              .samples = VK_SAMPLE_COUNT_1_BIT,
+              .tiling = VK_IMAGE_TILING_OPTIMAL,
+              .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                       VK_IMAGE_USAGE_SAMPLED_BIT,
+              .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+              .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED},
+          &upload->image)) {
+    goto destroy_staging_buffer;
+  }
+  batch->texture_images[texture] = upload->image;
+
+  if (!resource_manager_create_image_view(
+          resources,
+          &(const VkImageViewCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+              .image = resource_manager_image(resources, upload->image)->image,
+              .viewType = VK_IMAGE_VIEW_TYPE_2D,
+              .format = VK_FORMAT_R8G8B8A8_SRGB,
+              .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                   .levelCount = 1,
+                                   .layerCount = 1}},
+          &batch->texture_views[texture])) {
+    goto destroy_image;
+  }
+
+  if (!add_texture_set(batch, resource_manager_image_view(
+                                  resources, batch->texture_views[texture]))) {
+    goto destroy_image_view;
+  }
+
+  batch->upload_count++;
+  *out_texture = batch->texture_count++;
+  return true;
+destroy_image_view:
+  resource_manager_destroy(resources, RESOURCE_TYPE_IMAGE_VIEW,
+                           batch->texture_views[texture], 0);
+destroy_image:
+  resource_manager_destroy(resources, RESOURCE_TYPE_IMAGE, upload->image, 0);
+destroy_staging_buffer:
+  resource_manager_destroy(resources, RESOURCE_TYPE_BUFFER,
+                           upload->staging_buffer, 0);
+err:
+  return false;
+}
+
+void sprite_batch_begin(struct sprite_batch *batch) {
+  batch->sprite_count = 0;
+  batch->clip_rects[SPRITE_BATCH_NO_CLIP] =
+      (VkRect2D){.extent = batch->extent};
+  batch->clip_rect_count = 1;
+}
+
+bool sprite_batch_add_clip_rect(struct sprite_batch *batch, VkRect2D rect,
+                                uint32_t *out_clip_rect) {
+  if (batch->clip_rect_count == SPRITE_BATCH_MAX_CLIP_RECTS) {
+    return false;
+  }
+  batch->clip_rects[batch->clip_rect_count] = rect;
+  *out_clip_rect = batch->clip_rect_count++;
+  return true;
+}
+
+bool sprite_batch_push(struct sprite_batch *batch,
+                       const struct sprite *sprite) {
+  assert(sprite->texture < batch->texture_count);
+  assert(sprite->clip_rect < batch->clip_rect_count);
+  assert(sprite->blend < SPRITE_BLEND_COUNT);
+  if (batch->sprite_count == batch->capacity) {
+    return false;
+  }
+  uint32_t index = batch->sprite_count++;
+  batch->instances[index] = (struct sprite_instance){
+      .rect = {sprite->x, sprite->y, sprite->width, sprite->height},
+      .uv_rect = {sprite->u0, sprite->v0, sprite->u1, sprite->v1},
+      .color = sprite->color};
+  batch->entries[index] = (uint64_t)sprite_key(sprite) << 32 | index;
+  return true;
+}
+
+static void cmd_upload_textures(struct sprite_batch *batch,
+                                VkCommandBuffer command_buffer,
+                                uint64_t retire_value) {
+  struct resource_manager *resources = batch->resources;
+  VkImageSubresourceRange color_range = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .levelCount = 1,
+      .layerCount = 1};
+  for (uint32_t index = 0; index < batch->upload_count; index++) {
+    struct sprite_upload *upload = &batch->uploads[index];
+    VkImage image = resource_manager_image(resources, upload->image)->image;
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+        &(const VkImageMemoryBarrier){
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = image,
+            .subresourceRange = color_range});
+    vkCmdCopyBufferToImage(
+        command_buffer,
+        resource_manager_buffer(resources, upload->staging_buffer)->buffer,
+        image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+        &(const VkBufferImageCopy){
+            .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                 .layerCount = 1},
+            .imageExtent = {upload->extent.width, upload->extent.height, 1}});
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
+        &(const VkImageMemoryBarrier){
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = image,
+            .subresourceRange = color_range});
+    resource_manager_destroy(resources, RESOURCE_TYPE_BUFFER,
+                             upload->staging_buffer, retire_value);
+  }
+  batch->upload_count = 0;
+}
+
+// Copies the sprites into the region in sorted order; the mapped memory
+// may be write-combined, so it is only ever written front to back.
+static bool write_instances(struct sprite_batch *batch,
+                            const uint64_t *entries,
+                            VkDeviceSize region_start) {
+  struct sprite_instance *region =
+      (struct sprite_instance *)(batch->mapped + region_start);
+  for (uint32_t index = 0; index < batch->sprite_count; index++) {
+    region[index] = batch->instances[(uint32_t)entries[index]];
+  }
+  if (batch->coherent) {
+    return true;
+  }
+  VkDeviceSize size = align_up(
+      batch->sprite_count * sizeof(struct sprite_instance),
+      batch->non_coherent_atom_size);
+  return vkFlushMappedMemoryRanges(
+             batch->resources->device, 1,
+             &(const VkMappedMemoryRange){
+                 .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                 .memory = resource_manager_buffer(batch->resources,
+                                                   batch->instance_buffer)
+                               ->memory,
+                 .offset = align_down(region_start,
+                                      batch->non_coherent_atom_size),
+                 .size = size}) == VK_SUCCESS;
+}
+
+bool sprite_batch_cmd_draw(struct sprite_batch *batch,
+                           VkCommandBuffer command_buffer,
+                           uint32_t frame_index, uint32_t image_index,
+                           uint64_t retire_value) {
+  assert(image_index < batch->framebuffer_count);
+  struct resource_manager *resources = batch->resources;
+  cmd_upload_textures(batch, command_buffer, retire_value);
+  batch->drawn_sprite_count = batch->sprite_count;
+  batch->draw_count = 0;
+  if (batch->sprite_count == 0) {
+    return true;
+  }
+
+  VkDeviceSize region_start =
+      (frame_index % batch->region_count) * batch->region_size;
+  const uint64_t *entries = sort_entries(batch->entries, batch->sort_scratch,
+                                         batch->sprite_count);
+  if (!write_instances(batch, entries, region_start)) {
+    return false;
+  }
+
+  vkCmdBeginRenderPass(
+      command_buffer,
+      &(const VkRenderPassBeginInfo){
+          .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+          .renderPass = batch->render_pass,
+          .framebuffer = batch->framebuffers[image_index],
+          .renderArea = {.extent = batch->extent}},
+      VK_SUBPASS_CONTENTS_INLINE);
+  vkCmdBindVertexBuffers(
+      command_buffer, 0, 1,
+      &resource_manager_buffer(resources, batch->instance_buffer)->buffer,
+      &region_start);
+  vkCmdSetViewport(command_buffer, 0, 1,
+                   &(const VkViewport){.width = (float)batch->extent.width,
+                                       .height = (float)batch->extent.height,
+                                       .maxDepth = 1.0f});
+  vkCmdPushConstants(
+      command_buffer, batch->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+      sizeof(struct sprite_push_constants),
+      &(const struct sprite_push_constants){
+          .pixel_to_clip = {2.0f / (float)batch->extent.width,
+                            2.0f / (float)batch->extent.height}});
+
+  // Only what changes between two runs is bound again.
+  uint32_t bound_blend = SPRITE_BLEND_COUNT;
+  uint32_t bound_clip_rect = SPRITE_BATCH_MAX_CLIP_RECTS;
+  uint32_t bound_texture = SPRITE_BATCH_MAX_TEXTURES;
+  uint32_t first = 0;
+  while (first < batch->sprite_count) {
+    uint32_t state = entry_state(entries[first]);
+    uint32_t end = run_end(entries, first, batch->sprite_count);
+
+    uint32_t blend = state >> KEY_BLEND_SHIFT;
+    uint32_t clip_rect =
+        (state >> KEY_CLIP_SHIFT) & (SPRITE_BATCH_MAX_CLIP_RECTS - 1);
+    uint32_t texture = state & ((1u << KEY_CLIP_SHIFT) - 1);
+    if (blend != bound_blend) {
+      vkCmdBindPipeline(
+          command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+          resource_manager_pipeline(resources, batch->pipelines[blend]));
+      bound_blend = blend;
+    }
+    if (clip_rect != bound_clip_rect) {
+      vkCmdSetScissor(command_buffer, 0, 1, &batch->clip_rects[clip_rect]);
+      bound_clip_rect = clip_rect;
+    }
+    if (texture != bound_texture) {
+      vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              batch->pipeline_layout, 0, 1,
+                              &batch->texture_sets[texture], 0, NULL);
+      bound_texture = texture;
+    }
+    vkCmdDraw(command_buffer, 4, end - first, 0, first);
+    batch->draw_count++;
+    first = end;
+  }
+  vkCmdEndRenderPass(command_buffer);
+  return true;
+}
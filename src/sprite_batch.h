@@ -0,0 +1,156 @@
+#pragma once
+
+#include "host_allocator.h"
+#include "resource_manager.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#define SPRITE_BATCH_MAX_TEXTURES 64
+#define SPRITE_BATCH_MAX_CLIP_RECTS 64
+#define SPRITE_BATCH_MAX_OUTPUT_IMAGES 32
+// Textures created since the last sprite_batch_cmd_draw(), whose pixels
+// are still waiting to be copied.
+#define SPRITE_BATCH_MAX_PENDING_UPLOADS 8
+// A single opaque white texel, for untextured quads.
+#define SPRITE_BATCH_WHITE_TEXTURE 0
+// The whole output.
+#define SPRITE_BATCH_NO_CLIP 0
+
+enum sprite_blend {
+  // Straight alpha: color * alpha + destination * (1 - alpha).
+  SPRITE_BLEND_ALPHA,
+  SPRITE_BLEND_ADDITIVE,
+  SPRITE_BLEND_COUNT,
+};
+
+struct sprite {
+  // Top left corner and size in output pixels, y down.
+  float x;
+  float y;
+  float width;
+  float height;
+  // Texture coordinates of the top left and bottom right corners.
+  float u0;
+  float v0;
+  float u1;
+  float v1;
+  // Multiplies the texture. 8 bit RGBA, red in the lowest byte.
+  uint32_t color;
+  uint32_t texture;
+  uint32_t clip_rect;
+  enum sprite_blend blend;
+  // Lower z is drawn first. Within one z, sprites that share texture, clip
+  // rect and blend mode keep the order they were pushed in; groups that
+  // don't are drawn in an unspecified order.
+  int16_t z;
+};
+
+// Mirrors the instance attributes of shaders/sprite.vert.
+struct sprite_instance {
+  float rect[4];
+  float uv_rect[4];
+  uint32_t color;
+};
+
+struct sprite_upload {
+  struct resource_handle staging_buffer;
+  struct resource_handle image;
+  VkExtent2D extent;
+};
+
+// Draws 2D quads over the output images, e.g. UI and overlays. Pushed
+// sprites are sorted by z, then blend mode, clip rect and texture; each run
+// that shares the last three becomes one instanced draw of a 4 vertex
+// strip, whatever its z range. The instances are written in sorted order
+// into a persistently mapped buffer with a region per frame in flight, so
+// the only vertex data is one 36 byte instance per quad.
+struct sprite_batch {
+  struct resource_manager *resources;
+  uint32_t capacity;
+  uint32_t region_count;
+  VkExtent2D extent;
+
+  // Sprites pushed this frame, in push order, and their sort entries: the
+  // sort key in the upper 32 bits, the index into instances in the lower.
+  struct sprite_instance *instances;
+  uint64_t *entries;
+  uint64_t *sort_scratch;
+  uint32_t sprite_count;
+  VkRect2D clip_rects[SPRITE_BATCH_MAX_CLIP_RECTS];
+  uint32_t clip_rect_count;
+
+  struct resource_handle instance_buffer;
+  char *mapped;
+  VkDeviceSize region_size;
+  VkDeviceSize non_coherent_atom_size;
+  bool coherent;
+
+  VkRenderPass render_pass;
+  VkFramebuffer framebuffers[SPRITE_BATCH_MAX_OUTPUT_IMAGES];
+  uint32_t framebuffer_count;
+  VkDescriptorSetLayout set_layout;
+  VkPipelineLayout pipeline_layout;
+  struct resource_handle pipelines[SPRITE_BLEND_COUNT];
+  struct resource_handle sampler;
+  VkDescriptorPool descriptor_pool;
+
+  // Images created by sprite_batch_create_texture() are owned here; those
+  // registered with sprite_batch_add_texture() have zeroed handles.
+  struct resource_handle texture_images[SPRITE_BATCH_MAX_TEXTURES];
+  struct resource_handle texture_views[SPRITE_BATCH_MAX_TEXTURES];
+  VkDescriptorSet texture_sets[SPRITE_BATCH_MAX_TEXTURES];
+  uint32_t texture_count;
+  struct sprite_upload uploads[SPRITE_BATCH_MAX_PENDING_UPLOADS];
+  uint32_t upload_count;
+
+  // What the last sprite_batch_cmd_draw() drew, for stats.
+  uint32_t drawn_sprite_count;
+  uint32_t draw_count;
+};
+
+// Draws onto output_views, images of output_format and output_extent that
+// are in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR whenever the batch draws. Room for
+// capacity sprites per frame, in region_count frames in flight.
+bool sprite_batch_init(struct sprite_batch *batch,
+                       struct resource_manager *resources,
+                       struct host_allocator *host_allocator,
+                       const VkImageView *output_views,
+                       uint32_t output_image_count, VkFormat output_format,
+                       VkExtent2D output_extent, uint32_t capacity,
+                       uint32_t region_count);
+// Call once the device is done with the batch. What the resource manager
+// owns is handed back to it with retire_value.
+void sprite_batch_deinit(struct sprite_batch *batch,
+                         struct host_allocator *host_allocator,
+                         uint64_t retire_value);
+
+// Creates an R8G8B8A8_SRGB texture from width * height pixels, red in the
+// lowest byte. The pixels are copied right away and reach the image in the
+// next sprite_batch_cmd_draw().
+bool sprite_batch_create_texture(struct sprite_batch *batch, uint32_t width,
+                                 uint32_t height, const uint32_t *pixels,
+                                 uint32_t *out_texture);
+// Registers a view the caller keeps alive, which must be in
+// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL whenever the batch draws.
+bool sprite_batch_add_texture(struct sprite_batch *batch, VkImageView view,
+                              uint32_t *out_texture);
+
+// Drops the sprites and clip rects of the previous frame.
+void sprite_batch_begin(struct sprite_batch *batch);
+// Sprites with this clip rect are only drawn inside it.
+bool sprite_batch_add_clip_rect(struct sprite_batch *batch, VkRect2D rect,
+                                uint32_t *out_clip_rect);
+// Fails once capacity sprites have been pushed this frame.
+bool sprite_batch_push(struct sprite_batch *batch,
+                       const struct sprite *sprite);
+
+// Sorts the sprites, writes them into frame_index's region and draws them
+// onto output image image_index, after copying the pixels of new textures.
+// Call once the frame that last used that region has completed, outside of
+// a render pass. Staging memory is handed back with retire_value, the
+// value the frame timeline reaches once this frame is done.
+bool sprite_batch_cmd_draw(struct sprite_batch *batch,
+                           VkCommandBuffer command_buffer,
+                           uint32_t frame_index, uint32_t image_index,
+                           uint64_t retire_value);
@@ -0,0 +1,319 @@
+#ifndef _WIN32
+// For sockets, poll() and pipe() under strict ISO C.
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "telemetry.h"
+
+#include "log.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TELEMETRY_HAS_UNIX_SOCKETS
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+static _Atomic uint64_t counters[TELEMETRY_COUNTER_COUNT];
+static _Atomic uint64_t histograms[TELEMETRY_HISTOGRAM_COUNT]
+                                  [TELEMETRY_HISTOGRAM_BUCKET_COUNT];
+static _Atomic uint32_t swapchain_width;
+static _Atomic uint32_t swapchain_height;
+static _Atomic uint32_t swapchain_format;
+static _Atomic uint32_t swapchain_present_mode;
+static _Atomic uint32_t swapchain_image_count;
+
+void telemetry_count(enum telemetry_counter counter, uint64_t amount) {
+  assert(counter < TELEMETRY_COUNTER_COUNT);
+  atomic_fetch_add_explicit(&counters[counter], amount, memory_order_relaxed);
+}
+
+void telemetry_record_time(enum telemetry_histogram histogram,
+                           uint64_t microseconds) {
+  assert(histogram < TELEMETRY_HISTOGRAM_COUNT);
+  uint32_t bucket = 0;
+  while (bucket + 1 < TELEMETRY_HISTOGRAM_BUCKET_COUNT &&
+         microseconds >= (UINT64_C(2) << bucket)) {
+    bucket++;
+  }
+  atomic_fetch_add_explicit(&histograms[histogram][bucket], 1,
+                            memory_order_relaxed);
+}
+
+void telemetry_set_swapchain(VkExtent2D extent, VkFormat format,
+                             VkPresentModeKHR present_mode,
+                             uint32_t image_count) {
+  atomic_store_explicit(&swapchain_width, extent.width, memory_order_relaxed);
+  atomic_store_explicit(&swapchain_height, extent.height,
+                        memory_order_relaxed);
+  atomic_store_explicit(&swapchain_format, (uint32_t)format,
+                        memory_order_relaxed);
+  atomic_store_explicit(&swapchain_present_mode, (uint32_t)present_mode,
+                        memory_order_relaxed);
+  atomic_store_explicit(&swapchain_image_count, image_count,
+                        memory_order_relaxed);
+}
+
+#ifdef TELEMETRY_HAS_UNIX_SOCKETS
+
+static const char *counter_names[TELEMETRY_COUNTER_COUNT] = {
+    [TELEMETRY_COUNTER_FRAMES] = "frames",
+    [TELEMETRY_COUNTER_QUEUE_SUBMITS] = "queue_submits",
+    [TELEMETRY_COUNTER_PRESENTS] = "presents",
+    [TELEMETRY_COUNTER_PIPELINE_COMPILES] = "pipeline_compiles",
+    [TELEMETRY_COUNTER_SWAPCHAIN_OUT_OF_DATE] = "swapchain_out_of_date"};
+
+static const char *histogram_names[TELEMETRY_HISTOGRAM_COUNT] = {
+    [TELEMETRY_HISTOGRAM_CPU_FRAME_TIME] = "cpu_frame_time_us",
+    [TELEMETRY_HISTOGRAM_GPU_FRAME_TIME] = "gpu_frame_time_us"};
+
+struct json_writer {
+  char *data;
+  size_t size;
+  size_t length;
+  bool ok;
+};
+
+static void json_append(struct json_writer *writer, const char *format, ...) {
+  if (!writer->ok) {
+    return;
+  }
+  va_list arguments;
+  va_start(arguments, format);
+  int written = vsnprintf(writer->data + writer->length,
+                          writer->size - writer->length, format, arguments);
+  va_end(arguments);
+  if (written < 0 || (size_t)written >= writer->size - writer->length) {
+    writer->ok = false;
+    return;
+  }
+  writer->length += (size_t)written;
+}
+
+static size_t write_snapshot(struct telemetry_server *server) {
+  struct json_writer writer = {.data = server->snapshot,
+                               .size = sizeof(server->snapshot),
+                               .ok = true};
+  json_append(&writer, "{");
+  for (uint32_t counter = 0; counter < TELEMETRY_COUNTER_COUNT; counter++) {
+    json_append(&writer, "\"%s\":%llu,", counter_names[counter],
+                (unsigned long long)atomic_load_explicit(
+                    &counters[counter], memory_order_relaxed));
+  }
+
+  for (uint32_t histogram = 0; histogram < TELEMETRY_HISTOGRAM_COUNT;
+       histogram++) {
+    json_append(&writer, "\"%s\":[", histogram_names[histogram]);
+    for (uint32_t bucket = 0; bucket < TELEMETRY_HISTOGRAM_BUCKET_COUNT;
+         bucket++) {
+      json_append(&writer, "%s%llu", bucket == 0 ? "" : ",",
+                  (unsigned long long)atomic_load_explicit(
+                      &histograms[histogram][bucket], memory_order_relaxed));
+    }
+    json_append(&writer, "],");
+  }
+
+  json_append(
+      &writer,
+      "\"swapchain\":{\"width\":%u,\"height\":%u,\"format\":%u,"
+      "\"present_mode\":%u,\"image_count\":%u},",
+      atomic_load_explicit(&swapchain_width, memory_order_relaxed),
+      atomic_load_explicit(&swapchain_height, memory_order_relaxed),
+      atomic_load_explicit(&swapchain_format, memory_order_relaxed),
+      atomic_load_explicit(&swapchain_present_mode, memory_order_relaxed),
+      atomic_load_explicit(&swapchain_image_count, memory_order_relaxed));
+
+  // Physical device queries need no external synchronization, so this is
+  // safe next to the render thread.
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT};
+  VkPhysicalDeviceMemoryProperties2 properties = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+      .pNext = &budget};
+  if (server->memory_budget) {
+    vkGetPhysicalDeviceMemoryProperties2(server->physical_device, &properties);
+  } else {
+    vkGetPhysicalDeviceMemoryProperties(server->physical_device,
+                                        &properties.memoryProperties);
+  }
+  json_append(&writer, "\"memory_heaps\":[");
+  const VkPhysicalDeviceMemoryProperties *memory =
+      &properties.memoryProperties;
+  for (uint32_t heap = 0; heap < memory->memoryHeapCount; heap++) {
+    json_append(&writer, "%s{\"size\":%llu,\"device_local\":%s",
+                heap == 0 ? "" : ",",
+                (unsigned long long)memory->memoryHeaps[heap].size,
+                memory->memoryHeaps[heap].flags &
+                        VK_MEMORY_HEAP_DEVICE_LOCAL_BIT
+                    ? "true"
+                    : "false");
+    if (server->memory_budget) {
+      json_append(&writer, ",\"usage\":%llu,\"budget\":%llu",
+                  (unsigned long long)budget.heapUsage[heap],
+                  (unsigned long long)budget.heapBudget[heap]);
+    }
+    json_append(&writer, "}");
+  }
+  json_append(&writer, "]}\n");
+
+  if (!writer.ok) {
+    LOG("Telemetry snapshot doesn't fit in %d bytes",
+        TELEMETRY_SNAPSHOT_SIZE);
+    return 0;
+  }
+  return writer.length;
+}
+
+static void send_snapshot(struct telemetry_server *server, int client_fd) {
+  size_t length = write_snapshot(server);
+  size_t sent = 0;
+  while (sent < length) {
+    ssize_t result = send(client_fd, server->snapshot + sent, length - sent,
+                          MSG_NOSIGNAL);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      return;
+    }
+    sent += (size_t)result;
+  }
+}
+
+static int telemetry_server_main(void *data) {
+  struct telemetry_server *server = data;
+  while (true) {
+    struct pollfd fds[] = {{.fd = server->listen_fd, .events = POLLIN},
+                           {.fd = server->wake_fds[0], .events = POLLIN}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG("Telemetry poll failed: %s", strerror(errno));
+      return 1;
+    }
+    if (fds[1].revents != 0) {
+      return 0;
+    }
+    if ((fds[0].revents & POLLIN) == 0) {
+      continue;
+    }
+
+    int client_fd = accept(server->listen_fd, NULL, NULL);
+    if (client_fd < 0) {
+      continue;
+    }
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(client_fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    send_snapshot(server, client_fd);
+    close(client_fd);
+  }
+}
+
+bool telemetry_server_start(struct telemetry_server *server, const char *path,
+                            VkPhysicalDevice physical_device,
+                            bool memory_budget) {
+  *server = (struct telemetry_server){.listen_fd = -1,
+                                      .wake_fds = {-1, -1},
+                                      .physical_device = physical_device,
+                                      .memory_budget = memory_budget};
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path) ||
+      strlen(path) >= sizeof(server->path)) {
+    LOG("Telemetry socket path is too long: %s", path);
+    goto err;
+  }
+  strcpy(address.sun_path, path);
+  strcpy(server->path, path);
+
+  server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server->listen_fd < 0) {
+    LOG("Couldn't create telemetry socket: %s", strerror(errno));
+    goto err;
+  }
+  // A socket file left behind by an earlier run would fail the bind. Only
+  // ever remove a socket, never whatever else a mistyped path names.
+  struct stat existing;
+  if (lstat(path, &existing) == 0) {
+    if (!S_ISSOCK(existing.st_mode)) {
+      LOG("Not replacing %s with the telemetry socket, it isn't a socket",
+          path);
+      goto close_listen_fd;
+    }
+    unlink(path);
+  } else if (errno != ENOENT) {
+    LOG("Couldn't check %s: %s", path, strerror(errno));
+    goto close_listen_fd;
+  }
+  if (bind(server->listen_fd, (const struct sockaddr *)&address,
+           sizeof(address)) != 0 ||
+      listen(server->listen_fd, 4) != 0) {
+    LOG("Couldn't listen on %s: %s", path, strerror(errno));
+    goto close_listen_fd;
+  }
+
+  if (pipe(server->wake_fds) != 0) {
+    LOG("Couldn't create telemetry wake pipe: %s", strerror(errno));
+    goto unlink_path;
+  }
+
+  server->thread =
+      SDL_CreateThread(telemetry_server_main, "telemetry", server);
+  if (!server->thread) {
+    LOG("Couldn't start telemetry thread: %s", SDL_GetError());
+    goto close_wake_fds;
+  }
+  LOG("Serving telemetry on %s", path);
+  return true;
+
+close_wake_fds:
+  close(server->wake_fds[0]);
+  close(server->wake_fds[1]);
+unlink_path:
+  unlink(path);
+close_listen_fd:
+  close(server->listen_fd);
+err:
+  return false;
+}
+
+void telemetry_server_stop(struct telemetry_server *server) {
+  char byte = 0;
+  while (write(server->wake_fds[1], &byte, 1) < 0 && errno == EINTR) {
+  }
+  SDL_WaitThread(server->thread, NULL);
+  close(server->wake_fds[0]);
+  close(server->wake_fds[1]);
+  close(server->listen_fd);
+  unlink(server->path);
+}
+
+#else
+
+bool telemetry_server_start(struct telemetry_server *server, const char *path,
+                            VkPhysicalDevice physical_device,
+                            bool memory_budget) {
+  (void)server;
+  (void)path;
+  (void)physical_device;
+  (void)memory_budget;
+  LOG("Telemetry needs Unix domain sockets, which aren't available here");
+  return false;
+}
+
+void telemetry_server_stop(struct telemetry_server *server) { (void)server; }
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Frame times are bucketed by powers of two of microseconds: bucket 0 holds
+// everything below 2us, bucket n > 0 holds [2^n, 2^(n+1)) and the last one
+// also takes everything slower (~0.5s and up).
+#define TELEMETRY_HISTOGRAM_BUCKET_COUNT 20
+#define TELEMETRY_MAX_PATH 108
+#define TELEMETRY_SNAPSHOT_SIZE 8192
+
+enum telemetry_counter {
+  TELEMETRY_COUNTER_FRAMES,
+  TELEMETRY_COUNTER_QUEUE_SUBMITS,
+  TELEMETRY_COUNTER_PRESENTS,
+  TELEMETRY_COUNTER_PIPELINE_COMPILES,
+  TELEMETRY_COUNTER_SWAPCHAIN_OUT_OF_DATE,
+  TELEMETRY_COUNTER_COUNT,
+};
+
+enum telemetry_histogram {
+  TELEMETRY_HISTOGRAM_CPU_FRAME_TIME,
+  TELEMETRY_HISTOGRAM_GPU_FRAME_TIME,
+  TELEMETRY_HISTOGRAM_COUNT,
+};
+
+// Recording is process wide and lock-free: relaxed atomic adds and stores
+// that any thread may do at any time, whether or not a server is running.
+void telemetry_count(enum telemetry_counter counter, uint64_t amount);
+void telemetry_record_time(enum telemetry_histogram histogram,
+                           uint64_t microseconds);
+// Each field is published on its own, so a snapshot taken while the
+// swapchain is being recreated may mix old and new values.
+void telemetry_set_swapchain(VkExtent2D extent, VkFormat format,
+                             VkPresentModeKHR present_mode,
+                             uint32_t image_count);
+
+// Serves one JSON snapshot of everything recorded to each client that
+// connects to a Unix domain socket at path, then closes the connection.
+// The server thread sleeps in poll() until a client or stop arrives, so an
+// endpoint nobody reads costs nothing but the counters.
+struct telemetry_server {
+  char path[TELEMETRY_MAX_PATH];
+  int listen_fd;
+  // Written by stop to wake the server thread.
+  int wake_fds[2];
+  SDL_Thread *thread;
+  // Device memory per heap is sampled when a snapshot is written. Usage and
+  // budget need VK_EXT_memory_budget and a Vulkan 1.1 instance.
+  VkPhysicalDevice physical_device;
+  bool memory_budget;
+  char snapshot[TELEMETRY_SNAPSHOT_SIZE];
+};
+
+// Returns false, with nothing left to stop, where Unix domain sockets aren't
+// available or the socket can't be created.
+bool telemetry_server_start(struct telemetry_server *server, const char *path,
+                            VkPhysicalDevice physical_device,
+                            bool memory_budget);
+void telemetry_server_stop(struct telemetry_server *server);
@@ -0,0 +1,167 @@
+#include "uniform_ring.h"
+
+#include "log.h"
+#include "vulkan_utils.h"
+#include <assert.h>
+#include <string.h>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static VkDeviceSize align_down(VkDeviceSize value, VkDeviceSize alignment) {
+  return value & ~(alignment - 1);
+}
+
+bool uniform_ring_init(struct uniform_ring *ring,
+                       VkPhysicalDevice physical_device, VkDevice device,
+                       const VkAllocationCallbacks *allocation_callbacks,
+                       VkDeviceSize region_size, uint32_t region_count,
+                       bool use_device_address) {
+  assert(region_count > 0);
+  *ring = (struct uniform_ring){0};
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+  if (properties.limits.minStorageBufferOffsetAlignment > alignment) {
+    alignment = properties.limits.minStorageBufferOffsetAlignment;
+  }
+  ring->alignment = alignment;
+  ring->non_coherent_atom_size = properties.limits.nonCoherentAtomSize;
+
+  // Keeping regions atom aligned lets every flush be rounded outwards without
+  // touching the neighbouring region that the GPU may still be reading.
+  VkDeviceSize region_alignment = alignment > ring->non_coherent_atom_size
+                                      ? alignment
+                                      : ring->non_coherent_atom_size;
+  ring->region_size = align_up(region_size, region_alignment);
+  ring->region_count = region_count;
+
+  VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  if (use_device_address) {
+    usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  }
+
+  // Prefer device local host-visible memory (resizable BAR / UMA) so shader
+  // reads don't cross the bus, and coherent memory so flushes can be skipped.
+  static const VkMemoryPropertyFlags property_preferences[] = {
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+  VkMemoryPropertyFlags memory_properties;
+  if (!create_buffer(physical_device, device, allocation_callbacks,
+                     ring->region_size * region_count, usage,
+                     property_preferences,
+                     sizeof(property_preferences) /
+                         sizeof(VkMemoryPropertyFlags),
+                     use_device_address ? VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT
+                                        : 0,
+                     &ring->buffer, &ring->memory, &memory_properties)) {
+    goto err;
+  }
+  ring->coherent = memory_properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  void *mapped;
+  if (vkMapMemory(device, ring->memory, 0, VK_WHOLE_SIZE, 0, &mapped) !=
+      VK_SUCCESS) {
+    LOG("Couldn't map uniform ring memory");
+    goto destroy_buffer;
+  }
+  ring->mapped = mapped;
+
+  if (use_device_address) {
+    ring->device_address = vkGetBufferDeviceAddress(
+        device, &(const VkBufferDeviceAddressInfo){
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                    .buffer = ring->buffer});
+  }
+
+  return true;
+destroy_buffer:
+  vkDestroyBuffer(device, ring->buffer, allocation_callbacks);
+  vkFreeMemory(device, ring->memory, allocation_callbacks);
+err:
+  return false;
+}
+
+void uniform_ring_deinit(struct uniform_ring *ring, VkDevice device,
+                         const VkAllocationCallbacks *allocation_callbacks) {
+  vkUnmapMemory(device, ring->memory);
+  vkDestroyBuffer(device, ring->buffer, allocation_callbacks);
+  vkFreeMemory(device, ring->memory, allocation_callbacks);
+  *ring = (struct uniform_ring){0};
+}
+
+void uniform_ring_begin_frame(struct uniform_ring *ring, uint32_t frame_index) {
+  ring->current_region = frame_index % ring->region_count;
+  ring->offset = 0;
+  ring->flushed_offset = 0;
+  ring->overflowed = false;
+}
+
+bool uniform_ring_alloc(struct uniform_ring *ring, VkDeviceSize size,
+                        struct uniform_ring_allocation *out_allocation) {
+  VkDeviceSize offset = align_up(ring->offset, ring->alignment);
+  if (offset + size > ring->region_size) {
+    if (!ring->overflowed) {
+      LOG("Uniform ring region of %llu bytes exhausted",
+          (unsigned long long)ring->region_size);
+      ring->overflowed = true;
+    }
+    return false;
+  }
+  ring->offset = offset + size;
+
+  VkDeviceSize buffer_offset =
+      ring->current_region * ring->region_size + offset;
+  out_allocation->data = ring->mapped + buffer_offset;
+  out_allocation->dynamic_offset = (uint32_t)buffer_offset;
+  out_allocation->device_address =
+      ring->device_address ? ring->device_address + buffer_offset : 0;
+  return true;
+}
+
+bool uniform_ring_push(struct uniform_ring *ring, const void *data,
+                       VkDeviceSize size, uint32_t *out_dynamic_offset) {
+  struct uniform_ring_allocation allocation;
+  if (!uniform_ring_alloc(ring, size, &allocation)) {
+    return false;
+  }
+  memcpy(allocation.data, data, size);
+  *out_dynamic_offset = allocation.dynamic_offset;
+  return true;
+}
+
+bool uniform_ring_flush(struct uniform_ring *ring, VkDevice device) {
+  if (ring->coherent || ring->offset == ring->flushed_offset) {
+    ring->flushed_offset = ring->offset;
+    return true;
+  }
+
+  VkDeviceSize region_start = ring->current_region * ring->region_size;
+  VkDeviceSize start = align_down(region_start + ring->flushed_offset,
+                                  ring->non_coherent_atom_size);
+  VkDeviceSize end = align_up(region_start + ring->offset,
+                              ring->non_coherent_atom_size);
+  ring->flushed_offset = ring->offset;
+
+  return vkFlushMappedMemoryRanges(
+             device, 1,
+             &(const VkMappedMemoryRange){
+                 .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                 .memory = ring->memory,
+                 .offset = start,
+                 .size = end - start}) == VK_SUCCESS;
+}
+
+VkDescriptorBufferInfo
+uniform_ring_descriptor_info(const struct uniform_ring *ring,
+                             VkDeviceSize range) {
+  return (VkDescriptorBufferInfo){
+      .buffer = ring->buffer, .offset = 0, .range = range};
+}
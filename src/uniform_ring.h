@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Linear allocator over one persistently mapped host-visible buffer that is
+// split into one region per frame in flight. A region is only rewound by
+// uniform_ring_begin_frame(), which the caller must invoke after the fence of
+// the frame that last used that region has signaled.
+struct uniform_ring {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  char *mapped;
+  VkDeviceSize region_size;
+  VkDeviceSize alignment;
+  VkDeviceSize non_coherent_atom_size;
+  VkDeviceAddress device_address;
+  uint32_t region_count;
+  uint32_t current_region;
+  VkDeviceSize offset;
+  VkDeviceSize flushed_offset;
+  bool coherent;
+  bool overflowed;
+};
+
+struct uniform_ring_allocation {
+  void *data;
+  // Offset from the start of the buffer, usable as a dynamic uniform/storage
+  // buffer offset against a descriptor that points at offset 0.
+  uint32_t dynamic_offset;
+  // Zero unless the ring was created with use_device_address.
+  VkDeviceAddress device_address;
+};
+
+bool uniform_ring_init(struct uniform_ring *ring,
+                       VkPhysicalDevice physical_device, VkDevice device,
+                       const VkAllocationCallbacks *allocation_callbacks,
+                       VkDeviceSize region_size, uint32_t region_count,
+                       bool use_device_address);
+void uniform_ring_deinit(struct uniform_ring *ring, VkDevice device,
+                         const VkAllocationCallbacks *allocation_callbacks);
+
+void uniform_ring_begin_frame(struct uniform_ring *ring, uint32_t frame_index);
+
+// Hands out an aligned sub-range of the current region. Fails once the region
+// is exhausted; nothing is ever reallocated mid-frame.
+bool uniform_ring_alloc(struct uniform_ring *ring, VkDeviceSize size,
+                        struct uniform_ring_allocation *out_allocation);
+bool uniform_ring_push(struct uniform_ring *ring, const void *data,
+                       VkDeviceSize size, uint32_t *out_dynamic_offset);
+
+// Makes everything written since the last flush visible to the device. A
+// no-op on host-coherent memory. Call before submitting the frame.
+bool uniform_ring_flush(struct uniform_ring *ring, VkDevice device);
+
+// Descriptor info for a UNIFORM_BUFFER_DYNAMIC or STORAGE_BUFFER_DYNAMIC
+// binding that reads `range` bytes at each dynamic offset.
+VkDescriptorBufferInfo
+uniform_ring_descriptor_info(const struct uniform_ring *ring,
+                             VkDeviceSize range);
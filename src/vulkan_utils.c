@@ -0,0 +1,211 @@
+#include "vulkan_utils.h"
+
+#include "log.h"
+#include <stdio.h>
+
+bool find_memory_type_index(VkPhysicalDevice physical_device,
+                            uint32_t memory_type_bits,
+                            VkMemoryPropertyFlags required_properties,
+                            uint32_t *out_memory_type_index) {
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+  for (uint32_t memory_type_index = 0;
+       memory_type_index < memory_properties.memoryTypeCount;
+       memory_type_index++) {
+    VkMemoryPropertyFlags property_flags =
+        memory_properties.memoryTypes[memory_type_index].propertyFlags;
+    if ((memory_type_bits & (1u << memory_type_index)) &&
+        (property_flags & required_properties) == required_properties) {
+      *out_memory_type_index = memory_type_index;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool create_buffer(VkPhysicalDevice physical_device, VkDevice device,
+                   const VkAllocationCallbacks *allocation_callbacks,
+                   VkDeviceSize size, VkBufferUsageFlags usage,
+                   const VkMemoryPropertyFlags *property_preferences,
+                   uint32_t property_preference_count,
+                   VkFlags memory_allocate_flags, VkBuffer *out_buffer,
+                   VkDeviceMemory *out_memory,
+                   VkMemoryPropertyFlags *out_memory_properties) {
+  VkBuffer buffer;
+  if (vkCreateBuffer(device,
+                     &(const VkBufferCreateInfo){
+                         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                         .size = size,
+                         .usage = usage,
+                         .sharingMode = VK_SHARING_MODE_EXCLUSIVE},
+                     allocation_callbacks, &buffer) != VK_SUCCESS) {
+    LOG("Couldn't create buffer of %llu bytes", (unsigned long long)size);
+    goto err;
+  }
+
+  VkMemoryRequirements memory_requirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memory_requirements);
+
+  uint32_t memory_type_index = 0;
+  uint32_t preference_index = 0;
+  for (; preference_index < property_preference_count; preference_index++) {
+    if (find_memory_type_index(physical_device,
+                               memory_requirements.memoryTypeBits,
+                               property_preferences[preference_index],
+                               &memory_type_index)) {
+      break;
+    }
+  }
+  if (preference_index == property_preference_count) {
+    LOG("No memory type suitable for buffer");
+    goto destroy_buffer;
+  }
+
+  VkMemoryAllocateFlagsInfo allocate_flags_info = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+      .flags = memory_allocate_flags};
+  VkDeviceMemory memory;
+  if (vkAllocateMemory(device,
+                       &(const VkMemoryAllocateInfo){
+                           .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                           .pNext = memory_allocate_flags
+                                        ? &allocate_flags_info
+                                        : NULL,
+                           .allocationSize = memory_requirements.size,
+                           .memoryTypeIndex = memory_type_index},
+                       allocation_callbacks, &memory) != VK_SUCCESS) {
+    LOG("Couldn't allocate %llu bytes of buffer memory",
+        (unsigned long long)memory_requirements.size);
+    goto destroy_buffer;
+  }
+
+  if (vkBindBufferMemory(device, buffer, memory, 0) != VK_SUCCESS) {
+    goto free_memory;
+  }
+
+  *out_buffer = buffer;
+  *out_memory = memory;
+  if (out_memory_properties) {
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+    *out_memory_properties =
+        memory_properties.memoryTypes[memory_type_index].propertyFlags;
+  }
+  return true;
+free_memory:
+  vkFreeMemory(device, memory, allocation_callbacks);
+destroy_buffer:
+  vkDestroyBuffer(device, buffer, allocation_callbacks);
+err:
+  return false;
+}
+
+bool create_image(VkPhysicalDevice physical_device, VkDevice device,
+                  const VkAllocationCallbacks *allocation_callbacks,
+                  const VkImageCreateInfo *create_info, VkImage *out_image,
+                  VkDeviceMemory *out_memory) {
+  VkImage image;
+  if (vkCreateImage(device, create_info, allocation_callbacks, &image) !=
+      VK_SUCCESS) {
+    LOG("Couldn't create %ux%u image", create_info->extent.width,
+        create_info->extent.height);
+    goto err;
+  }
+
+  VkMemoryRequirements memory_requirements;
+  vkGetImageMemoryRequirements(device, image, &memory_requirements);
+  uint32_t memory_type_index;
+  if (!find_memory_type_index(physical_device,
+                              memory_requirements.memoryTypeBits,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                              &memory_type_index)) {
+    LOG("No memory type suitable for image");
+    goto destroy_image;
+  }
+
+  VkDeviceMemory memory;
+  if (vkAllocateMemory(device,
+                       &(const VkMemoryAllocateInfo){
+                           .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                           .allocationSize = memory_requirements.size,
+                           .memoryTypeIndex = memory_type_index},
+                       allocation_callbacks, &memory) != VK_SUCCESS) {
+    LOG("Couldn't allocate %llu bytes of image memory",
+        (unsigned long long)memory_requirements.size);
+    goto destroy_image;
+  }
+
+  if (vkBindImageMemory(device, image, memory, 0) != VK_SUCCESS) {
+    goto free_memory;
+  }
+
+  *out_image = image;
+  *out_memory = memory;
+  return true;
+free_memory:
+  vkFreeMemory(device, memory, allocation_callbacks);
+destroy_image:
+  vkDestroyImage(device, image, allocation_callbacks);
+err:
+  return false;
+}
+
+char *load_shader_from_file(struct host_allocator *allocator, const char *path,
+                            size_t *out_size) {
+  FILE *file_handle = fopen(path, "rb");
+  if (!file_handle) {
+    goto err;
+  }
+
+  if (fseek(file_handle, 0, SEEK_END) < 0) {
+    goto close_file;
+  }
+
+  long file_size = ftell(file_handle);
+  if (file_size < 0) {
+    goto close_file;
+  }
+  rewind(file_handle);
+  char *shader_file_content = host_allocator_alloc(
+      allocator, file_size, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+  if (!shader_file_content) {
+    goto close_file;
+  }
+  if (fread(shader_file_content, file_size, 1, file_handle) != 1) {
+    goto free_shader_file_content;
+  }
+
+  if (fclose(file_handle) != 0) {
+    goto err;
+  }
+
+  *out_size = file_size;
+  return shader_file_content;
+free_shader_file_content:
+  host_allocator_free(allocator, shader_file_content);
+close_file:
+  fclose(file_handle);
+err:
+  return NULL;
+}
+
+VkShaderModule
+create_shader_module(VkDevice device,
+                     const VkAllocationCallbacks *allocation_callbacks,
+                     char *code, size_t code_size) {
+  VkShaderModule shader_module;
+  if (vkCreateShaderModule(
+          device,
+          &(const VkShaderModuleCreateInfo){
+              .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+              .codeSize = code_size,
+              .pCode = (const uint32_t *)code,
+          },
+          allocation_callbacks, &shader_module) != VK_SUCCESS) {
+    return NULL;
+  }
+
+  return shader_module;
+}
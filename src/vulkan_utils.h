@@ -0,0 +1,40 @@
+#pragma once
+
+#include "host_allocator.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+bool find_memory_type_index(VkPhysicalDevice physical_device,
+                            uint32_t memory_type_bits,
+                            VkMemoryPropertyFlags required_properties,
+                            uint32_t *out_memory_type_index);
+
+// Creates a buffer with its own dedicated allocation. Every entry of
+// property_preferences is tried in order until one has a matching memory type.
+// memory_allocate_flags is forwarded through VkMemoryAllocateFlagsInfo when
+// non-zero (e.g. VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT).
+bool create_buffer(VkPhysicalDevice physical_device, VkDevice device,
+                   const VkAllocationCallbacks *allocation_callbacks,
+                   VkDeviceSize size, VkBufferUsageFlags usage,
+                   const VkMemoryPropertyFlags *property_preferences,
+                   uint32_t property_preference_count,
+                   VkFlags memory_allocate_flags, VkBuffer *out_buffer,
+                   VkDeviceMemory *out_memory,
+                   VkMemoryPropertyFlags *out_memory_properties);
+
+// Creates an image backed by its own device local allocation.
+bool create_image(VkPhysicalDevice physical_device, VkDevice device,
+                  const VkAllocationCallbacks *allocation_callbacks,
+                  const VkImageCreateInfo *create_info, VkImage *out_image,
+                  VkDeviceMemory *out_memory);
+
+// Returns the file contents, to be released with host_allocator_free(), or
+// NULL on failure.
+char *load_shader_from_file(struct host_allocator *allocator, const char *path,
+                            size_t *out_size);
+VkShaderModule
+create_shader_module(VkDevice device,
+                     const VkAllocationCallbacks *allocation_callbacks,
+                     char *code, size_t code_size);
@@ -0,0 +1,237 @@
+// Writes command streams and reads them back, including files that are cut
+// short, recorded with another instance layout or carry oversized records.
+#include "command_stream.h"
+
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PATH "command_stream_test.bin"
+#define INSTANCE_SIZE 32
+#define SCENE_CAPACITY 256
+#define FILE_HEADER_SIZE 16
+#define RECORD_HEADER_SIZE 8
+#define RECORD_COUNT 4
+
+static struct host_allocator allocator;
+
+static const struct command_stream_config config = {
+    .width = 640,
+    .height = 480,
+    .color_format = 44,
+    .scene_capacity = SCENE_CAPACITY,
+    .instance_size = INSTANCE_SIZE};
+
+static unsigned char instances[SCENE_CAPACITY * INSTANCE_SIZE];
+
+// Writes the config, one frame holding a full upload, and the end of a second
+// frame. Fills record_ends with the file offset after each record.
+static void write_stream(long record_ends[RECORD_COUNT]) {
+  for (size_t byte = 0; byte < sizeof(instances); byte++) {
+    instances[byte] = (unsigned char)(byte * 7 + 3);
+  }
+
+  struct command_stream_writer writer;
+  bool ok = command_stream_writer_open(&writer, PATH, &config);
+  CHECK(ok);
+  if (!ok) {
+    return;
+  }
+  record_ends[0] = ftell(writer.file);
+  command_stream_write(&writer, COMMAND_STREAM_RECORD_FRAME_BEGIN,
+                       &(struct command_stream_frame){
+                           .frame_number = 42,
+                           .render_width = 320,
+                           .render_height = 240,
+                           .instance_count = SCENE_CAPACITY},
+                       sizeof(struct command_stream_frame), NULL, 0);
+  record_ends[1] = ftell(writer.file);
+  command_stream_write(&writer, COMMAND_STREAM_RECORD_INSTANCE_UPLOAD,
+                       &(struct command_stream_instance_upload){
+                           .first = 0, .count = SCENE_CAPACITY},
+                       sizeof(struct command_stream_instance_upload),
+                       instances, sizeof(instances));
+  record_ends[2] = ftell(writer.file);
+  command_stream_write(&writer, COMMAND_STREAM_RECORD_FRAME_END, NULL, 0, NULL,
+                       0);
+  record_ends[3] = ftell(writer.file);
+  CHECK(command_stream_writer_close(&writer));
+}
+
+static enum command_stream_read_result
+read_record(struct command_stream_reader *reader,
+            enum command_stream_record_type expected_type,
+            uint32_t expected_size) {
+  enum command_stream_record_type type;
+  uint32_t size;
+  enum command_stream_read_result result =
+      command_stream_read(reader, &type, &size);
+  if (result == COMMAND_STREAM_READ_RECORD) {
+    CHECK(type == expected_type);
+    CHECK(size == expected_size);
+  }
+  return result;
+}
+
+static void test_round_trip(void) {
+  long record_ends[RECORD_COUNT];
+  write_stream(record_ends);
+  CHECK(record_ends[0] ==
+        FILE_HEADER_SIZE + RECORD_HEADER_SIZE +
+            (long)sizeof(struct command_stream_config));
+
+  struct command_stream_reader reader;
+  if (!command_stream_reader_open(&reader, &allocator, PATH, INSTANCE_SIZE)) {
+    CHECK(!"reader_open failed");
+    return;
+  }
+  CHECK(memcmp(&reader.config, &config, sizeof(config)) == 0);
+
+  CHECK(read_record(&reader, COMMAND_STREAM_RECORD_FRAME_BEGIN,
+                    sizeof(struct command_stream_frame)) ==
+        COMMAND_STREAM_READ_RECORD);
+  struct command_stream_frame frame;
+  memcpy(&frame, reader.payload, sizeof(frame));
+  CHECK(frame.frame_number == 42);
+  CHECK(frame.render_width == 320 && frame.render_height == 240);
+  CHECK(frame.instance_count == SCENE_CAPACITY);
+
+  struct command_stream_instance_upload upload;
+  CHECK(read_record(&reader, COMMAND_STREAM_RECORD_INSTANCE_UPLOAD,
+                    sizeof(upload) + sizeof(instances)) ==
+        COMMAND_STREAM_READ_RECORD);
+  memcpy(&upload, reader.payload, sizeof(upload));
+  CHECK(upload.first == 0 && upload.count == SCENE_CAPACITY);
+  CHECK(memcmp((const char *)reader.payload + sizeof(upload), instances,
+               sizeof(instances)) == 0);
+  CHECK((uintptr_t)reader.payload % 16 == 0);
+
+  CHECK(read_record(&reader, COMMAND_STREAM_RECORD_FRAME_END, 0) ==
+        COMMAND_STREAM_READ_RECORD);
+  CHECK(read_record(&reader, 0, 0) == COMMAND_STREAM_READ_END);
+  command_stream_reader_close(&reader);
+}
+
+static void test_wrong_instance_size(void) {
+  long record_ends[RECORD_COUNT];
+  write_stream(record_ends);
+  struct command_stream_reader reader;
+  CHECK(!command_stream_reader_open(&reader, &allocator, PATH,
+                                    INSTANCE_SIZE + 16));
+  CHECK(reader.file == NULL && reader.payload == NULL);
+}
+
+static void check_cut(const unsigned char *bytes, long cut,
+                      const long record_ends[RECORD_COUNT]) {
+  FILE *file = fopen(PATH, "wb");
+  CHECK(file != NULL);
+  if (file == NULL) {
+    return;
+  }
+  CHECK(cut == 0 || fwrite(bytes, (size_t)cut, 1, file) == 1);
+  fclose(file);
+
+  struct command_stream_reader reader;
+  bool opened =
+      command_stream_reader_open(&reader, &allocator, PATH, INSTANCE_SIZE);
+  CHECK(opened == (cut >= record_ends[0]));
+  if (!opened) {
+    return;
+  }
+  int complete_records = 1;
+  enum command_stream_record_type type;
+  uint32_t size;
+  enum command_stream_read_result result;
+  while ((result = command_stream_read(&reader, &type, &size)) ==
+         COMMAND_STREAM_READ_RECORD) {
+    complete_records++;
+  }
+  bool between_records = false;
+  for (int record = 0; record < RECORD_COUNT; record++) {
+    if (cut == record_ends[record]) {
+      between_records = true;
+      CHECK(complete_records == record + 1);
+    }
+  }
+  if (result != (between_records ? COMMAND_STREAM_READ_END
+                                 : COMMAND_STREAM_READ_ERROR)) {
+    fprintf(stderr, "Cut at %ld read as %s\n", cut,
+            result == COMMAND_STREAM_READ_END ? "the end" : "an error");
+    test_failure_count++;
+  }
+  command_stream_reader_close(&reader);
+}
+
+// Cuts the file inside and next to every file and record header. A cut
+// between records reads as a shorter stream; any other cut has to be
+// reported, not read as the end.
+static void test_truncated(void) {
+  long record_ends[RECORD_COUNT];
+  write_stream(record_ends);
+  long file_size = record_ends[RECORD_COUNT - 1];
+  unsigned char *bytes = malloc((size_t)file_size);
+  FILE *file = fopen(PATH, "rb");
+  CHECK(file != NULL && bytes != NULL);
+  if (file == NULL || bytes == NULL) {
+    free(bytes);
+    return;
+  }
+  CHECK(fread(bytes, (size_t)file_size, 1, file) == 1);
+  fclose(file);
+
+  check_cut(bytes, 0, record_ends);
+  check_cut(bytes, FILE_HEADER_SIZE / 2, record_ends);
+  check_cut(bytes, FILE_HEADER_SIZE, record_ends);
+  for (int record = 0; record < RECORD_COUNT; record++) {
+    long start = record > 0 ? record_ends[record - 1] : FILE_HEADER_SIZE;
+    long cuts[] = {start + 1, start + RECORD_HEADER_SIZE - 1,
+                   start + RECORD_HEADER_SIZE, start + RECORD_HEADER_SIZE + 1,
+                   record_ends[record] - 1, record_ends[record]};
+    for (size_t cut = 0; cut < sizeof(cuts) / sizeof(cuts[0]); cut++) {
+      if (cuts[cut] >= start && cuts[cut] <= record_ends[record]) {
+        check_cut(bytes, cuts[cut], record_ends);
+      }
+    }
+  }
+  free(bytes);
+}
+
+static void test_oversized_record(uint32_t claimed_size) {
+  struct command_stream_writer writer;
+  if (!command_stream_writer_open(&writer, PATH, &config)) {
+    CHECK(!"writer_open failed");
+    return;
+  }
+  // Only the record header is written; the reader has to refuse before it
+  // allocates or reads the payload.
+  uint32_t record_header[2] = {COMMAND_STREAM_RECORD_DRAW_UNIFORMS,
+                               claimed_size};
+  CHECK(fwrite(record_header, sizeof(record_header), 1, writer.file) == 1);
+  CHECK(command_stream_writer_close(&writer));
+
+  struct command_stream_reader reader;
+  if (!command_stream_reader_open(&reader, &allocator, PATH, INSTANCE_SIZE)) {
+    CHECK(!"reader_open failed");
+    return;
+  }
+  CHECK(read_record(&reader, 0, 0) == COMMAND_STREAM_READ_ERROR);
+  CHECK(reader.payload_capacity < claimed_size);
+  command_stream_reader_close(&reader);
+}
+
+int main(void) {
+  if (!host_allocator_init(&allocator)) {
+    fprintf(stderr, "Couldn't initialize the host allocator\n");
+    return 1;
+  }
+  test_round_trip();
+  test_wrong_instance_size();
+  test_truncated();
+  // One byte more than a full upload, and a size no allocation could meet.
+  test_oversized_record(sizeof(struct command_stream_instance_upload) +
+                        sizeof(instances) + 1);
+  test_oversized_record(UINT32_MAX);
+  remove(PATH);
+  host_allocator_deinit(&allocator);
+  return test_result();
+}
@@ -0,0 +1,309 @@
+// Checks the SIMD culling kernels against the scalar per-object path.
+// cull.c is included whole so that every kernel the build has can be called
+// directly, not only the one the dispatch picks on this machine.
+#include "cull.c"
+
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_COUNT 4099
+// Random objects this close to a plane may land on either side of it,
+// depending on the order a kernel adds things up in.
+#define AMBIGUOUS_DISTANCE 1e-3f
+
+typedef uint32_t (*cull_spheres_fn)(const struct frustum *,
+                                    const struct sphere_soa *, uint32_t,
+                                    uint32_t *);
+typedef uint32_t (*cull_aabbs_fn)(const struct frustum *,
+                                  const struct aabb_soa *, uint32_t,
+                                  uint32_t *);
+
+struct kernel {
+  const char *name;
+  cull_spheres_fn spheres;
+  cull_aabbs_fn aabbs;
+};
+
+static struct kernel kernels[3];
+static uint32_t kernel_count;
+
+static void find_kernels(void) {
+  kernels[kernel_count++] =
+      (struct kernel){"x4", cull_spheres_x4, cull_aabbs_x4};
+#if defined(SIMD_AVX2_DISPATCH)
+  if (cpu_supports_avx2()) {
+    kernels[kernel_count++] =
+        (struct kernel){"avx2", cull_spheres_avx2, cull_aabbs_avx2};
+  } else {
+    fprintf(stderr, "No AVX2 on this CPU, skipping the AVX2 kernels\n");
+  }
+#endif
+  kernels[kernel_count++] =
+      (struct kernel){"dispatch", cull_spheres, cull_aabbs};
+}
+
+static float sphere_margin(const struct frustum *frustum,
+                           const struct sphere_soa *spheres, uint32_t index) {
+  float margin = INFINITY;
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    const struct vec4 *plane = &frustum->planes[plane_index];
+    float distance = plane->x * spheres->center_x[index] +
+                     plane->y * spheres->center_y[index] +
+                     plane->z * spheres->center_z[index] + plane->w +
+                     spheres->radius[index];
+    margin = fminf(margin, fabsf(distance));
+  }
+  return margin;
+}
+
+static float aabb_margin(const struct frustum *frustum,
+                         const struct aabb_soa *aabbs, uint32_t index) {
+  float margin = INFINITY;
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    const struct vec4 *plane = &frustum->planes[plane_index];
+    float distance = plane->x * aabbs->center_x[index] +
+                     plane->y * aabbs->center_y[index] +
+                     plane->z * aabbs->center_z[index] + plane->w +
+                     fabsf(plane->x) * aabbs->extent_x[index] +
+                     fabsf(plane->y) * aabbs->extent_y[index] +
+                     fabsf(plane->z) * aabbs->extent_z[index];
+    margin = fminf(margin, fabsf(distance));
+  }
+  return margin;
+}
+
+// Checks that indices lists exactly the objects in expected, in increasing
+// order. Objects flagged in ambiguous may be missing or present.
+static void check_visible(const char *kernel, const char *test,
+                          const uint32_t *indices, uint32_t visible_count,
+                          const bool *expected, const bool *ambiguous,
+                          uint32_t count) {
+  static bool actual[MAX_COUNT];
+  memset(actual, 0, sizeof(actual));
+  CHECK(visible_count <= count);
+  for (uint32_t visible = 0; visible < visible_count && visible < count;
+       visible++) {
+    CHECK(indices[visible] < count);
+    CHECK(visible == 0 || indices[visible] > indices[visible - 1]);
+    if (indices[visible] < count) {
+      actual[indices[visible]] = true;
+    }
+  }
+  for (uint32_t index = 0; index < count; index++) {
+    if (actual[index] != expected[index] && !ambiguous[index]) {
+      fprintf(stderr, "%s kernel, %s, count %u: object %u is %s\n", kernel,
+              test, count, index, actual[index] ? "visible" : "culled");
+      test_failure_count++;
+    }
+  }
+}
+
+struct sphere_data {
+  float x[MAX_COUNT], y[MAX_COUNT], z[MAX_COUNT], radius[MAX_COUNT];
+};
+
+struct aabb_data {
+  float x[MAX_COUNT], y[MAX_COUNT], z[MAX_COUNT];
+  float ex[MAX_COUNT], ey[MAX_COUNT], ez[MAX_COUNT];
+};
+
+static struct sphere_data sphere_data;
+static struct aabb_data aabb_data;
+static bool expected[MAX_COUNT];
+static bool ambiguous[MAX_COUNT];
+static uint32_t indices[MAX_COUNT];
+
+static const struct sphere_soa spheres = {sphere_data.x, sphere_data.y,
+                                          sphere_data.z, sphere_data.radius};
+static const struct aabb_soa aabbs = {aabb_data.x,  aabb_data.y,
+                                      aabb_data.z,  aabb_data.ex,
+                                      aabb_data.ey, aabb_data.ez};
+
+// Counts around every multiple of the 4 and 8 wide kernels.
+static const uint32_t counts[] = {0,  1,  2,  3,  4,  5,   7,    8,
+                                  9,  11, 12, 13, 15, 16,  17,   31,
+                                  33, 63, 64, 65, 1000, 1003, 4096, 4099};
+
+static void run_kernels(const struct frustum *frustum, const char *test,
+                        uint32_t count, bool aabb) {
+  for (uint32_t kernel = 0; kernel < kernel_count; kernel++) {
+    memset(indices, 0xff, sizeof(indices));
+    uint32_t visible_count =
+        aabb ? kernels[kernel].aabbs(frustum, &aabbs, count, indices)
+             : kernels[kernel].spheres(frustum, &spheres, count, indices);
+    check_visible(kernels[kernel].name, test, indices, visible_count,
+                  expected, ambiguous, count);
+  }
+}
+
+static struct frustum perspective_frustum(void) {
+  struct mat4 projection =
+      mat4_perspective(1.0f, 16.0f / 9.0f, 0.1f, 100.0f);
+  struct mat4 view =
+      mat4_look_at((struct vec3){3.0f, 4.0f, 10.0f}, (struct vec3){0},
+                   (struct vec3){0.0f, 1.0f, 0.0f});
+  struct mat4 view_projection = mat4_mul(&projection, &view);
+  return frustum_from_matrix(&view_projection);
+}
+
+static void test_random_spheres(void) {
+  struct frustum frustum = perspective_frustum();
+  uint32_t state = 0x2545f491u;
+  for (uint32_t index = 0; index < MAX_COUNT; index++) {
+    sphere_data.x[index] = test_random(&state, -60.0f, 60.0f);
+    sphere_data.y[index] = test_random(&state, -60.0f, 60.0f);
+    sphere_data.z[index] = test_random(&state, -120.0f, 20.0f);
+    sphere_data.radius[index] = test_random(&state, 0.0f, 8.0f);
+    expected[index] = sphere_visible_scalar(&frustum, &spheres, index);
+    ambiguous[index] =
+        sphere_margin(&frustum, &spheres, index) < AMBIGUOUS_DISTANCE;
+  }
+  for (size_t count = 0; count < sizeof(counts) / sizeof(counts[0]);
+       count++) {
+    run_kernels(&frustum, "random spheres", counts[count], false);
+  }
+}
+
+static void test_random_aabbs(void) {
+  struct frustum frustum = perspective_frustum();
+  uint32_t state = 0x7f4a7c15u;
+  for (uint32_t index = 0; index < MAX_COUNT; index++) {
+    aabb_data.x[index] = test_random(&state, -60.0f, 60.0f);
+    aabb_data.y[index] = test_random(&state, -60.0f, 60.0f);
+    aabb_data.z[index] = test_random(&state, -120.0f, 20.0f);
+    aabb_data.ex[index] = test_random(&state, 0.0f, 6.0f);
+    aabb_data.ey[index] = test_random(&state, 0.0f, 6.0f);
+    aabb_data.ez[index] = test_random(&state, 0.0f, 6.0f);
+    expected[index] = aabb_visible_scalar(&frustum, &aabbs, index);
+    ambiguous[index] =
+        aabb_margin(&frustum, &aabbs, index) < AMBIGUOUS_DISTANCE;
+  }
+  for (size_t count = 0; count < sizeof(counts) / sizeof(counts[0]);
+       count++) {
+    run_kernels(&frustum, "random boxes", counts[count], true);
+  }
+}
+
+// The box x, y in [-8, 8], z in [-16, 0]. Its planes are axis aligned with
+// small integer offsets, so every distance below is exact in any order of
+// operations and touching really is touching.
+static struct frustum box_frustum(void) {
+  struct mat4 projection =
+      mat4_orthographic(-8.0f, 8.0f, -8.0f, 8.0f, 0.0f, 16.0f);
+  return frustum_from_matrix(&projection);
+}
+
+// Objects just inside, touching and just outside each plane in turn, from
+// the outside. Touching counts as visible.
+static void test_boundary(bool aabb) {
+  struct frustum frustum = box_frustum();
+  static const float steps[] = {-0.5f, -0.25f, 0.0f, 0.25f, 0.5f};
+  const uint32_t step_count = sizeof(steps) / sizeof(steps[0]);
+  uint32_t count = 0;
+  for (int plane_index = 0; plane_index < 6; plane_index++) {
+    const struct vec4 *plane = &frustum.planes[plane_index];
+    for (uint32_t step = 0; step < step_count; step++, count++) {
+      // Start at the box center, where the plane is 8 away, and move
+      // outwards until the object's nearest point is steps[step] past it.
+      float size = 1.0f + (float)(count % 3);
+      float offset = 8.0f + size + steps[step];
+      float x = -plane->x * offset;
+      float y = -plane->y * offset;
+      float z = -8.0f - plane->z * offset;
+      sphere_data.x[count] = aabb_data.x[count] = x;
+      sphere_data.y[count] = aabb_data.y[count] = y;
+      sphere_data.z[count] = aabb_data.z[count] = z;
+      sphere_data.radius[count] = size;
+      aabb_data.ex[count] = aabb_data.ey[count] = aabb_data.ez[count] = size;
+      expected[count] = steps[step] <= 0.0f;
+      ambiguous[count] = false;
+      CHECK(expected[count] ==
+            (aabb ? aabb_visible_scalar(&frustum, &aabbs, count)
+                  : sphere_visible_scalar(&frustum, &spheres, count)));
+    }
+  }
+  // Every prefix, so the boundary objects land in every lane and in the
+  // scalar tails.
+  for (uint32_t prefix = 0; prefix <= count; prefix++) {
+    run_kernels(&frustum, aabb ? "boundary boxes" : "boundary spheres",
+                prefix, aabb);
+  }
+}
+
+static void check_near_relative(float actual, float expected) {
+  CHECK_NEAR(actual, expected, 1e-5f * fmaxf(1.0f, fabsf(expected)));
+}
+
+static void test_transforms(void) {
+  static struct mat4 transforms[MAX_COUNT];
+  static struct sphere_data world_spheres_data;
+  static struct aabb_data world_aabbs_data;
+  static struct sphere_data sphere_expected;
+  static struct aabb_data aabb_expected;
+  struct sphere_soa world_spheres = {
+      world_spheres_data.x, world_spheres_data.y, world_spheres_data.z,
+      world_spheres_data.radius};
+  struct aabb_soa world_aabbs = {world_aabbs_data.x,  world_aabbs_data.y,
+                                 world_aabbs_data.z,  world_aabbs_data.ex,
+                                 world_aabbs_data.ey, world_aabbs_data.ez};
+  uint32_t state = 0x51ed270bu;
+  const uint32_t count = 1003;
+  for (uint32_t index = 0; index < count; index++) {
+    struct vec3 axis = {test_random(&state, -1.0f, 1.0f),
+                        test_random(&state, -1.0f, 1.0f),
+                        test_random(&state, -1.0f, 1.0f)};
+    transforms[index] = mat4_from_trs(
+        (struct vec3){test_random(&state, -10.0f, 10.0f),
+                      test_random(&state, -10.0f, 10.0f),
+                      test_random(&state, -10.0f, 10.0f)},
+        quat_from_axis_angle(axis, test_random(&state, -3.0f, 3.0f)),
+        (struct vec3){test_random(&state, 0.5f, 2.0f),
+                      test_random(&state, 0.5f, 2.0f),
+                      test_random(&state, 0.5f, 2.0f)});
+    sphere_data.x[index] = aabb_data.x[index] = test_random(&state, -5, 5);
+    sphere_data.y[index] = aabb_data.y[index] = test_random(&state, -5, 5);
+    sphere_data.z[index] = aabb_data.z[index] = test_random(&state, -5, 5);
+    sphere_data.radius[index] = test_random(&state, 0.0f, 3.0f);
+    aabb_data.ex[index] = test_random(&state, 0.0f, 3.0f);
+    aabb_data.ey[index] = test_random(&state, 0.0f, 3.0f);
+    aabb_data.ez[index] = test_random(&state, 0.0f, 3.0f);
+  }
+
+  cull_transform_spheres(transforms, &spheres, &world_spheres, count);
+  cull_transform_aabbs(transforms, &aabbs, &world_aabbs, count);
+  for (uint32_t index = 0; index < count; index++) {
+    struct sphere_soa sphere_out = {sphere_expected.x, sphere_expected.y,
+                                    sphere_expected.z, sphere_expected.radius};
+    transform_sphere_scalar(&transforms[index], &spheres, &sphere_out, index);
+    check_near_relative(world_spheres.center_x[index],
+                        sphere_out.center_x[index]);
+    check_near_relative(world_spheres.center_y[index],
+                        sphere_out.center_y[index]);
+    check_near_relative(world_spheres.center_z[index],
+                        sphere_out.center_z[index]);
+    check_near_relative(world_spheres.radius[index],
+                        sphere_out.radius[index]);
+
+    struct aabb_soa aabb_out = {aabb_expected.x,  aabb_expected.y,
+                                aabb_expected.z,  aabb_expected.ex,
+                                aabb_expected.ey, aabb_expected.ez};
+    transform_aabb_scalar(&transforms[index], &aabbs, &aabb_out, index);
+    check_near_relative(world_aabbs.center_x[index], aabb_out.center_x[index]);
+    check_near_relative(world_aabbs.center_y[index], aabb_out.center_y[index]);
+    check_near_relative(world_aabbs.center_z[index], aabb_out.center_z[index]);
+    check_near_relative(world_aabbs.extent_x[index], aabb_out.extent_x[index]);
+    check_near_relative(world_aabbs.extent_y[index], aabb_out.extent_y[index]);
+    check_near_relative(world_aabbs.extent_z[index], aabb_out.extent_z[index]);
+  }
+}
+
+int main(void) {
+  find_kernels();
+  test_random_spheres();
+  test_random_aabbs();
+  test_boundary(false);
+  test_boundary(true);
+  test_transforms();
+  return test_result();
+}
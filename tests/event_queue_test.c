@@ -0,0 +1,99 @@
+// Checks that events come out in the order they went in, across the wrap of
+// the slots and of the indices, and that a full queue drops and counts.
+#include "event_queue.h"
+
+#include "test.h"
+
+static struct render_event make_event(uint32_t number) {
+  // The event carries its number in both fields, so order is checkable.
+  return (struct render_event){
+      .type = (enum render_event_type)(number % 5),
+      .capture_encoding = (enum frame_capture_encoding)(number / 5)};
+}
+
+static bool is_event(const struct render_event *event, uint32_t number) {
+  struct render_event expected = make_event(number);
+  return event->type == expected.type &&
+         event->capture_encoding == expected.capture_encoding;
+}
+
+// Pushes and pops in uneven batches, starting from `start` on both indices.
+static void test_order(uint32_t start) {
+  struct event_queue queue;
+  if (!event_queue_init(&queue)) {
+    CHECK(!"event_queue_init failed");
+    return;
+  }
+  atomic_store(&queue.head, start);
+  atomic_store(&queue.tail, start);
+
+  struct render_event event;
+  CHECK(!event_queue_pop(&queue, &event));
+  uint32_t pushed = 0;
+  uint32_t popped = 0;
+  for (uint32_t batch = 1; pushed < 4 * EVENT_QUEUE_CAPACITY; batch++) {
+    for (uint32_t push = 0; push < batch % 37 + 1; push++) {
+      struct render_event next = make_event(pushed);
+      CHECK(event_queue_push(&queue, &next));
+      pushed++;
+    }
+    for (uint32_t pop = 0; pop < batch % 31 + 1 && popped < pushed; pop++) {
+      CHECK(event_queue_pop(&queue, &event));
+      CHECK(is_event(&event, popped));
+      popped++;
+    }
+  }
+  while (event_queue_pop(&queue, &event)) {
+    CHECK(is_event(&event, popped));
+    popped++;
+  }
+  CHECK(popped == pushed);
+  CHECK(queue.dropped_count == 0);
+  event_queue_deinit(&queue);
+}
+
+static void test_full(void) {
+  struct event_queue queue;
+  if (!event_queue_init(&queue)) {
+    CHECK(!"event_queue_init failed");
+    return;
+  }
+
+  for (uint32_t number = 0; number < EVENT_QUEUE_CAPACITY; number++) {
+    struct render_event event = make_event(number);
+    CHECK(event_queue_push(&queue, &event));
+  }
+  // A full queue keeps what it has and counts what it turns away.
+  struct render_event extra = make_event(EVENT_QUEUE_CAPACITY);
+  CHECK(!event_queue_push(&queue, &extra));
+  CHECK(!event_queue_push(&queue, &extra));
+  CHECK(queue.dropped_count == 2);
+
+  // One pop makes room for exactly one push.
+  struct render_event event;
+  CHECK(event_queue_pop(&queue, &event));
+  CHECK(is_event(&event, 0));
+  CHECK(event_queue_push(&queue, &extra));
+  CHECK(!event_queue_push(&queue, &extra));
+  CHECK(queue.dropped_count == 3);
+
+  // Closing doesn't lose what is still queued.
+  event_queue_close(&queue);
+  CHECK(event_queue_is_closed(&queue));
+  uint32_t popped = 1;
+  while (event_queue_pop(&queue, &event)) {
+    CHECK(is_event(&event, popped));
+    popped++;
+  }
+  CHECK(popped == EVENT_QUEUE_CAPACITY + 1);
+  event_queue_wait(&queue, 0);
+  event_queue_deinit(&queue);
+}
+
+int main(void) {
+  test_order(0);
+  // The indices only ever increase, so they have to survive wrapping.
+  test_order(UINT32_MAX - EVENT_QUEUE_CAPACITY / 2);
+  test_full();
+  return test_result();
+}
@@ -0,0 +1,157 @@
+#include "math3d.h"
+
+#include "test.h"
+
+#define TOLERANCE 1e-4f
+
+static void check_mat4_near(const struct mat4 *actual,
+                            const struct mat4 *expected, float tolerance) {
+  for (int index = 0; index < 16; index++) {
+    CHECK_NEAR(actual->m[index], expected->m[index], tolerance);
+  }
+}
+
+static void check_vec3_near(struct vec3 actual, struct vec3 expected) {
+  CHECK_NEAR(actual.x, expected.x, TOLERANCE);
+  CHECK_NEAR(actual.y, expected.y, TOLERANCE);
+  CHECK_NEAR(actual.z, expected.z, TOLERANCE);
+}
+
+static struct vec3 random_vec3(uint32_t *state, float min, float max) {
+  return (struct vec3){test_random(state, min, max),
+                       test_random(state, min, max),
+                       test_random(state, min, max)};
+}
+
+static struct quat random_rotation(uint32_t *state) {
+  return quat_from_axis_angle(random_vec3(state, -1.0f, 1.0f),
+                              test_random(state, -3.14159265f, 3.14159265f));
+}
+
+static struct mat4 random_trs(uint32_t *state) {
+  return mat4_from_trs(random_vec3(state, -10.0f, 10.0f),
+                       random_rotation(state),
+                       random_vec3(state, 0.25f, 4.0f));
+}
+
+static void test_mat4_identities(void) {
+  uint32_t state = 0x12345678u;
+  struct mat4 identity = mat4_identity();
+  for (int iteration = 0; iteration < 64; iteration++) {
+    struct mat4 m = random_trs(&state);
+
+    struct mat4 left = mat4_mul(&identity, &m);
+    struct mat4 right = mat4_mul(&m, &identity);
+    check_mat4_near(&left, &m, 0.0f);
+    check_mat4_near(&right, &m, 0.0f);
+
+    struct mat4 transposed = mat4_transpose(&m);
+    CHECK(transposed.m[1] == m.m[4] && transposed.m[12] == m.m[3]);
+    struct mat4 twice = mat4_transpose(&transposed);
+    check_mat4_near(&twice, &m, 0.0f);
+
+    struct mat4 inverse;
+    CHECK(mat4_inverse(&m, &inverse));
+    struct mat4 product = mat4_mul(&inverse, &m);
+    check_mat4_near(&product, &identity, TOLERANCE);
+    product = mat4_mul(&m, &inverse);
+    check_mat4_near(&product, &identity, TOLERANCE);
+
+    // mat4_mul_vec4 against the definition.
+    struct vec4 v = {test_random(&state, -5.0f, 5.0f),
+                     test_random(&state, -5.0f, 5.0f),
+                     test_random(&state, -5.0f, 5.0f), 1.0f};
+    struct vec4 r = mat4_mul_vec4(&m, v);
+    const float *e = m.m;
+    CHECK_NEAR(r.x, e[0] * v.x + e[4] * v.y + e[8] * v.z + e[12] * v.w,
+               TOLERANCE);
+    CHECK_NEAR(r.y, e[1] * v.x + e[5] * v.y + e[9] * v.z + e[13] * v.w,
+               TOLERANCE);
+    CHECK_NEAR(r.z, e[2] * v.x + e[6] * v.y + e[10] * v.z + e[14] * v.w,
+               TOLERANCE);
+    CHECK_NEAR(r.w, e[3] * v.x + e[7] * v.y + e[11] * v.z + e[15] * v.w,
+               TOLERANCE);
+  }
+
+  struct mat4 singular = mat4_scale((struct vec3){1.0f, 0.0f, 1.0f});
+  struct mat4 untouched = identity;
+  CHECK(!mat4_inverse(&singular, &untouched));
+  check_mat4_near(&untouched, &identity, 0.0f);
+}
+
+static void test_trs(void) {
+  uint32_t state = 0x9e3779b9u;
+  for (int iteration = 0; iteration < 64; iteration++) {
+    struct vec3 translation = random_vec3(&state, -10.0f, 10.0f);
+    struct quat rotation = random_rotation(&state);
+    struct vec3 scale = random_vec3(&state, 0.25f, 4.0f);
+    struct mat4 trs = mat4_from_trs(translation, rotation, scale);
+
+    struct mat4 t = mat4_translation(translation);
+    struct mat4 r = mat4_from_quat(rotation);
+    struct mat4 s = mat4_scale(scale);
+    struct mat4 rs = mat4_mul(&r, &s);
+    struct mat4 composed = mat4_mul(&t, &rs);
+    check_mat4_near(&trs, &composed, TOLERANCE);
+
+    struct vec3 point = random_vec3(&state, -5.0f, 5.0f);
+    struct vec3 expected = vec3_add(
+        quat_rotate(rotation,
+                    (struct vec3){point.x * scale.x, point.y * scale.y,
+                                  point.z * scale.z}),
+        translation);
+    check_vec3_near(mat4_transform_point(&trs, point), expected);
+  }
+}
+
+static void test_quat_identities(void) {
+  struct vec3 x_axis = {1.0f, 0.0f, 0.0f};
+  struct vec3 z_axis = {0.0f, 0.0f, 1.0f};
+  struct quat quarter_turn = quat_from_axis_angle(z_axis, 1.57079633f);
+  check_vec3_near(quat_rotate(quarter_turn, x_axis),
+                  (struct vec3){0.0f, 1.0f, 0.0f});
+  check_vec3_near(quat_rotate(quat_identity(), x_axis), x_axis);
+
+  uint32_t state = 0xdeadbeefu;
+  for (int iteration = 0; iteration < 64; iteration++) {
+    struct quat a = random_rotation(&state);
+    struct quat b = random_rotation(&state);
+    struct vec3 v = random_vec3(&state, -5.0f, 5.0f);
+
+    struct quat unchanged = quat_mul(a, quat_identity());
+    CHECK_NEAR(unchanged.x, a.x, 0.0f);
+    CHECK_NEAR(unchanged.w, a.w, 0.0f);
+    unchanged = quat_mul(quat_identity(), a);
+    CHECK_NEAR(unchanged.y, a.y, 0.0f);
+    CHECK_NEAR(unchanged.z, a.z, 0.0f);
+
+    // a * b rotates by b first, then by a.
+    check_vec3_near(quat_rotate(quat_mul(a, b), v),
+                    quat_rotate(a, quat_rotate(b, v)));
+    // The conjugate undoes the rotation.
+    struct quat conjugate = {-a.x, -a.y, -a.z, a.w};
+    check_vec3_near(quat_rotate(conjugate, quat_rotate(a, v)), v);
+    // Rotations keep lengths.
+    CHECK_NEAR(vec3_length(quat_rotate(a, v)), vec3_length(v), TOLERANCE);
+
+    struct mat4 matrix = mat4_from_quat(a);
+    check_vec3_near(mat4_transform_point(&matrix, v), quat_rotate(a, v));
+
+    struct quat normalized = quat_normalize(
+        (struct quat){a.x * 3.0f, a.y * 3.0f, a.z * 3.0f, a.w * 3.0f});
+    CHECK_NEAR(normalized.x, a.x, TOLERANCE);
+    CHECK_NEAR(normalized.w, a.w, TOLERANCE);
+
+    check_vec3_near(quat_rotate(quat_nlerp(a, b, 0.0f), v),
+                    quat_rotate(a, v));
+    check_vec3_near(quat_rotate(quat_nlerp(a, b, 1.0f), v),
+                    quat_rotate(b, v));
+  }
+}
+
+int main(void) {
+  test_mat4_identities();
+  test_trs();
+  test_quat_identities();
+  return test_result();
+}
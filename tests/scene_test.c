@@ -0,0 +1,170 @@
+// Checks handle generations, slot reuse and the dirty lists that decide which
+// instances get written to each GPU copy.
+#include "scene.h"
+
+#include "test.h"
+#include <string.h>
+
+#define CAPACITY 8
+#define COPY_COUNT 2
+
+static struct host_allocator allocator;
+static struct scene_instance instances[CAPACITY];
+
+static void init_scene(struct scene *scene) {
+  bool ok = scene_init(scene, &allocator, CAPACITY, COPY_COUNT);
+  CHECK(ok);
+}
+
+static struct scene_handle create(struct scene *scene,
+                                  const struct scene_handle *parent) {
+  struct scene_handle handle = {0};
+  bool ok = scene_create_node(scene, parent, &handle);
+  CHECK(ok);
+  return handle;
+}
+
+static uint32_t write_copy(struct scene *scene, uint32_t copy, uint32_t *first,
+                           uint32_t *end) {
+  return scene_write_instances(scene, copy, instances, first, end);
+}
+
+static void test_generations(void) {
+  struct scene scene;
+  init_scene(&scene);
+
+  struct scene_handle first = create(&scene, NULL);
+  CHECK(scene_is_alive(&scene, first));
+  scene_destroy_node(&scene, first);
+  CHECK(!scene_is_alive(&scene, first));
+  CHECK(scene.live_count == 0);
+
+  // The slot comes back with a new generation, so the old handle stays dead.
+  struct scene_handle second = create(&scene, NULL);
+  CHECK(second.index == first.index);
+  CHECK(second.generation == first.generation + 1);
+  CHECK(scene_is_alive(&scene, second));
+  CHECK(!scene_is_alive(&scene, first));
+  CHECK(scene.slot_count == 1);
+
+  struct scene_handle out_of_range = {CAPACITY, 0};
+  CHECK(!scene_is_alive(&scene, out_of_range));
+  scene_deinit(&scene);
+}
+
+static void test_slot_reuse(void) {
+  struct scene scene;
+  init_scene(&scene);
+
+  struct scene_handle root = create(&scene, NULL);
+  struct scene_handle child = create(&scene, &root);
+  struct scene_handle grandchild = create(&scene, &child);
+  struct scene_handle other = create(&scene, NULL);
+  CHECK(scene.slot_count == 4);
+
+  // Destroying the root takes its subtree with it.
+  scene_destroy_node(&scene, root);
+  CHECK(!scene_is_alive(&scene, root));
+  CHECK(!scene_is_alive(&scene, child));
+  CHECK(!scene_is_alive(&scene, grandchild));
+  CHECK(scene_is_alive(&scene, other));
+  CHECK(scene.live_count == 1);
+
+  // Freed slots are handed out again before any new one.
+  bool reused[CAPACITY] = {false};
+  for (int node = 0; node < 3; node++) {
+    struct scene_handle handle = create(&scene, NULL);
+    CHECK(handle.index < 3);
+    CHECK(handle.generation == 1);
+    if (handle.index < CAPACITY) {
+      CHECK(!reused[handle.index]);
+      reused[handle.index] = true;
+    }
+  }
+  CHECK(scene.slot_count == 4);
+  CHECK(scene.live_count == 4);
+
+  while (scene.live_count < CAPACITY) {
+    create(&scene, NULL);
+  }
+  CHECK(scene.slot_count == CAPACITY);
+  struct scene_handle full;
+  CHECK(!scene_create_node(&scene, NULL, &full));
+  scene_deinit(&scene);
+}
+
+static void test_dirty_lists(void) {
+  struct scene scene;
+  init_scene(&scene);
+  uint32_t first;
+  uint32_t end;
+
+  struct scene_handle nodes[4];
+  for (int node = 0; node < 4; node++) {
+    nodes[node] = create(&scene, node > 0 ? &nodes[0] : NULL);
+  }
+  CHECK(scene_has_changes(&scene, 0));
+  CHECK(scene_update(&scene) == 4);
+
+  CHECK(write_copy(&scene, 0, &first, &end) == 4);
+  CHECK(first == 0 && end == 4);
+  CHECK(!scene_has_changes(&scene, 0));
+  // Every copy keeps its own list.
+  CHECK(scene_has_changes(&scene, 1));
+  CHECK(write_copy(&scene, 1, &first, &end) == 4);
+  CHECK(write_copy(&scene, 0, &first, &end) == 0);
+  CHECK(first == 0 && end == 0);
+
+  // A node shows up once however often it changes.
+  scene_set_translation(&scene, nodes[2], (struct vec3){1.0f, 0.0f, 0.0f});
+  scene_set_translation(&scene, nodes[2], (struct vec3){2.0f, 0.0f, 0.0f});
+  CHECK(scene_has_changes(&scene, 0));
+  CHECK(scene_update(&scene) == 1);
+  CHECK(write_copy(&scene, 0, &first, &end) == 1);
+  CHECK(first == nodes[2].index && end == nodes[2].index + 1);
+  CHECK_NEAR(instances[nodes[2].index].world.m[12], 2.0f, 1e-6f);
+
+  // Moving the parent refreshes its children too.
+  scene_set_translation(&scene, nodes[0], (struct vec3){0.0f, 5.0f, 0.0f});
+  CHECK(scene_update(&scene) == 4);
+  CHECK(write_copy(&scene, 0, &first, &end) == 4);
+  CHECK_NEAR(instances[nodes[2].index].world.m[12], 2.0f, 1e-6f);
+  CHECK_NEAR(instances[nodes[2].index].world.m[13], 5.0f, 1e-6f);
+
+  // Mesh and flag changes skip the transform update.
+  scene_set_mesh(&scene, nodes[3], 7, 9);
+  scene_set_flags(&scene, nodes[1], 0);
+  CHECK(scene_update(&scene) == 0);
+  CHECK(write_copy(&scene, 0, &first, &end) == 2);
+  CHECK(first == nodes[1].index && end == nodes[3].index + 1);
+  CHECK(instances[nodes[3].index].mesh_id == 7);
+  CHECK(instances[nodes[3].index].material_id == 9);
+  CHECK(instances[nodes[1].index].flags == 0);
+
+  // A destroyed node is written once more with its flags cleared, so the GPU
+  // stops drawing it.
+  scene_destroy_node(&scene, nodes[3]);
+  CHECK(write_copy(&scene, 0, &first, &end) == 1);
+  CHECK(first == nodes[3].index && end == nodes[3].index + 1);
+  CHECK(instances[nodes[3].index].flags == 0);
+  CHECK(instances[nodes[3].index].generation == nodes[3].generation + 1);
+
+  // Copy 1 collected everything since it was written.
+  CHECK(write_copy(&scene, 1, &first, &end) == 4);
+  struct scene_instance read[4];
+  scene_read_instances(&scene, 0, 4, read);
+  CHECK(memcmp(read, instances, sizeof(read)) == 0);
+  scene_deinit(&scene);
+}
+
+int main(void) {
+  if (!host_allocator_init(&allocator)) {
+    fprintf(stderr, "Couldn't initialize the host allocator\n");
+    return 1;
+  }
+  test_generations();
+  test_slot_reuse();
+  test_dirty_lists();
+  host_allocator_deinit(&allocator);
+  return test_result();
+}
@@ -0,0 +1,168 @@
+// Checks the sprite sort against a plain stable sort and the split of the
+// sorted sprites into draws. sprite_batch.c is included whole to reach its
+// static helpers.
+#include "sprite_batch.c"
+
+#include "test.h"
+
+#define MAX_COUNT 2000
+
+static uint64_t entries[MAX_COUNT];
+static uint64_t scratch[MAX_COUNT];
+static uint64_t expected[MAX_COUNT];
+
+static uint64_t make_entry(int16_t z, enum sprite_blend blend,
+                           uint32_t clip_rect, uint32_t texture,
+                           uint32_t index) {
+  struct sprite sprite = {
+      .z = z, .blend = blend, .clip_rect = clip_rect, .texture = texture};
+  return (uint64_t)sprite_key(&sprite) << 32 | index;
+}
+
+// Insertion sort on the key alone, stable by construction.
+static void reference_sort(const uint64_t *input, uint64_t *output,
+                           uint32_t count) {
+  for (uint32_t index = 0; index < count; index++) {
+    uint64_t entry = input[index];
+    uint32_t position = index;
+    while (position > 0 && output[position - 1] >> 32 > entry >> 32) {
+      output[position] = output[position - 1];
+      position--;
+    }
+    output[position] = entry;
+  }
+}
+
+// Sorts entries[0, count), which may leave entries itself scrambled, and
+// returns the sorted array.
+static const uint64_t *check_sort(const char *test, uint32_t count) {
+  reference_sort(entries, expected, count);
+  const uint64_t *sorted = sort_entries(entries, scratch, count);
+  for (uint32_t index = 0; index < count; index++) {
+    if (sorted[index] != expected[index]) {
+      fprintf(stderr, "%s: entry %u is %016llx, expected %016llx\n", test,
+              index, (unsigned long long)sorted[index],
+              (unsigned long long)expected[index]);
+      test_failure_count++;
+      break;
+    }
+  }
+  return sorted;
+}
+
+static void test_ties(void) {
+  // Pushed out of z order; each z holds sprites with equal state that must
+  // keep their push order, and z -1 has to come before z 0.
+  uint32_t count = 0;
+  for (uint32_t round = 0; round < 3; round++) {
+    entries[count] = make_entry(1, SPRITE_BLEND_ALPHA, 0, 2, count);
+    count++;
+    entries[count] = make_entry(-1, SPRITE_BLEND_ADDITIVE, 0, 2, count);
+    count++;
+    entries[count] = make_entry(0, SPRITE_BLEND_ALPHA, 0, 2, count);
+    count++;
+    entries[count] = make_entry(1, SPRITE_BLEND_ALPHA, 0, 5, count);
+    count++;
+  }
+  const uint64_t *sorted = check_sort("ties", count);
+  uint32_t expected_order[] = {1, 5, 9, 2, 6, 10, 0, 4, 8, 3, 7, 11};
+  for (uint32_t index = 0; index < count; index++) {
+    CHECK((uint32_t)sorted[index] == expected_order[index]);
+  }
+}
+
+static void test_sorted_input(void) {
+  uint32_t count = 0;
+  for (int16_t z = -3; z <= 3; z++) {
+    for (uint32_t texture = 0; texture < 4; texture++) {
+      entries[count] = make_entry(z, SPRITE_BLEND_ALPHA, 1, texture, count);
+      count++;
+    }
+  }
+  // Already in order: handed back as is, without touching the scratch.
+  CHECK(sort_entries(entries, scratch, count) == entries);
+  check_sort("sorted", count);
+  CHECK(sort_entries(entries, scratch, 1) == entries);
+}
+
+static void test_random_keys(uint32_t z_range, uint32_t texture_count) {
+  uint32_t state = 0x12345678u + z_range * 31 + texture_count;
+  for (uint32_t index = 0; index < MAX_COUNT; index++) {
+    int16_t z = (int16_t)test_random(&state, -(float)z_range, (float)z_range);
+    uint32_t texture =
+        (uint32_t)test_random(&state, 0.0f, (float)texture_count);
+    uint32_t clip_rect = (uint32_t)test_random(&state, 0.0f, 3.0f);
+    enum sprite_blend blend =
+        (enum sprite_blend)test_random(&state, 0.0f, SPRITE_BLEND_COUNT);
+    entries[index] = make_entry(z, blend, clip_rect, texture, index);
+  }
+  check_sort("random", MAX_COUNT);
+}
+
+// Splits count sorted entries into runs and checks each run is as long as
+// it can be.
+static uint32_t count_runs(const uint64_t *sorted, uint32_t count) {
+  uint32_t run_count = 0;
+  uint32_t first = 0;
+  while (first < count) {
+    uint32_t end = run_end(sorted, first, count);
+    CHECK(end > first && end <= count);
+    for (uint32_t index = first; index < end; index++) {
+      CHECK(entry_state(sorted[index]) == entry_state(sorted[first]));
+    }
+    CHECK(end == count ||
+          entry_state(sorted[end]) != entry_state(sorted[first]));
+    run_count++;
+    first = end;
+  }
+  return run_count;
+}
+
+static void test_runs(void) {
+  // One state across several z values is still a single draw.
+  uint32_t count = 0;
+  for (int16_t z = 0; z < 4; z++) {
+    entries[count] = make_entry(z, SPRITE_BLEND_ALPHA, 0, 3, count);
+    count++;
+  }
+  CHECK(count_runs(sort_entries(entries, scratch, count), count) == 1);
+
+  // Each change of blend mode, clip rect or texture starts a new one, even
+  // within one z.
+  count = 0;
+  entries[count] = make_entry(0, SPRITE_BLEND_ALPHA, 0, 3, count);
+  count++;
+  entries[count] = make_entry(0, SPRITE_BLEND_ALPHA, 0, 3, count);
+  count++;
+  entries[count] = make_entry(0, SPRITE_BLEND_ALPHA, 0, 4, count);
+  count++;
+  entries[count] = make_entry(0, SPRITE_BLEND_ALPHA, 1, 4, count);
+  count++;
+  entries[count] = make_entry(0, SPRITE_BLEND_ADDITIVE, 1, 4, count);
+  count++;
+  entries[count] = make_entry(1, SPRITE_BLEND_ALPHA, 0, 3, count);
+  count++;
+  const uint64_t *sorted = sort_entries(entries, scratch, count);
+  CHECK(count_runs(sorted, count) == 5);
+  CHECK(run_end(sorted, 0, count) == 2);
+
+  // Every z holds both textures, so each z splits into two draws.
+  uint32_t state = 0xcafef00du;
+  for (uint32_t index = 0; index < MAX_COUNT; index++) {
+    int16_t z = (int16_t)test_random(&state, 0.0f, 3.0f);
+    uint32_t texture = (uint32_t)test_random(&state, 0.0f, 2.0f);
+    entries[index] = make_entry(z, SPRITE_BLEND_ALPHA, 0, texture, index);
+  }
+  sorted = sort_entries(entries, scratch, MAX_COUNT);
+  CHECK(count_runs(sorted, MAX_COUNT) == 6);
+}
+
+int main(void) {
+  test_ties();
+  test_sorted_input();
+  test_random_keys(2, 3);
+  test_random_keys(300, SPRITE_BATCH_MAX_TEXTURES);
+  test_random_keys(32767, SPRITE_BATCH_MAX_TEXTURES);
+  test_runs();
+  return test_result();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// Just enough of a harness for meson's test(): every failed CHECK prints
+// where it failed, and test_result() turns the count into the exit code.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+static int test_failure_count;
+
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,         \
+              #condition);                                                     \
+      test_failure_count++;                                                    \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_NEAR(actual, expected, tolerance)                                \
+  do {                                                                         \
+    float check_actual = (actual);                                             \
+    float check_expected = (expected);                                         \
+    if (!(fabsf(check_actual - check_expected) <= (tolerance))) {              \
+      fprintf(stderr, "%s:%d: %s is %g, expected %g\n", __FILE__, __LINE__,    \
+              #actual, (double)check_actual, (double)check_expected);          \
+      test_failure_count++;                                                    \
+    }                                                                          \
+  } while (0)
+
+static inline int test_result(void) {
+  if (test_failure_count > 0) {
+    fprintf(stderr, "%d checks failed\n", test_failure_count);
+    return 1;
+  }
+  return 0;
+}
+
+// xorshift32, so every run sees the same inputs.
+static inline float test_random(uint32_t *state, float min, float max) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return min + (max - min) * (float)(x >> 8) * (1.0f / 16777216.0f);
+}
@@ -0,0 +1,90 @@
+// Prints the JSON snapshots served by the renderer's telemetry socket, see
+// src/telemetry.h. Start the renderer with VKGUIDE_TELEMETRY_SOCKET=<path>,
+// then run:
+//   vkguide-telemetry <path> [interval_ms]
+// Without an interval a single snapshot is printed.
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+static bool print_snapshot(const char *path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path is too long: %s\n", path);
+    return false;
+  }
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Couldn't create socket: %s\n", strerror(errno));
+    return false;
+  }
+  if (connect(fd, (const struct sockaddr *)&address, sizeof(address)) != 0) {
+    fprintf(stderr, "Couldn't connect to %s: %s\n", path, strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  // The server sends one snapshot and closes the connection.
+  char buffer[4096];
+  bool ok = true;
+  while (true) {
+    ssize_t received = read(fd, buffer, sizeof(buffer));
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received < 0) {
+      fprintf(stderr, "Couldn't read snapshot: %s\n", strerror(errno));
+      ok = false;
+      break;
+    }
+    if (received == 0) {
+      break;
+    }
+    fwrite(buffer, 1, (size_t)received, stdout);
+  }
+  fflush(stdout);
+  close(fd);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s <socket path> [interval_ms]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  long interval_ms = 0;
+  if (argc == 3) {
+    char *end;
+    errno = 0;
+    interval_ms = strtol(argv[2], &end, 10);
+    if (end == argv[2] || *end != '\0' || errno != 0 || interval_ms <= 0) {
+      fprintf(stderr, "Interval must be a positive number of milliseconds, "
+                      "got %s\n",
+              argv[2]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  while (true) {
+    if (!print_snapshot(argv[1])) {
+      return EXIT_FAILURE;
+    }
+    if (interval_ms == 0) {
+      return EXIT_SUCCESS;
+    }
+    struct timespec delay = {.tv_sec = interval_ms / 1000,
+                             .tv_nsec = (interval_ms % 1000) * 1000000};
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+    }
+  }
+}